@@ -1,533 +1,8888 @@
-#include <stdio.h>
-#include <string.h>
-#include <dirent.h>
-#include <gtk/gtk.h>
-#include <pthread.h>
-#include <stdlib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-
-#define MAX_FILES 10
-#define MAX_FILENAME_LENGTH 256
-#define BUFFER_SIZE 8192
-#define MAX_PATH_LENGTH 1024
-
-char *SOURCE_DIR;
-char *DEST_DIR;
-struct FileInfo
-{
-    int index;
-    char filename[MAX_FILENAME_LENGTH];
-    int isSelected;
-    GtkWidget *checkbox;
-};
-
-struct FileInfo fileInfos1[MAX_FILES];
-struct FileInfo fileInfos2[MAX_FILES];
-struct FileInfo selectedFiles[MAX_FILES];
-int numSelectedFiles = 0;
-
-GtkWidget *main_grid; // Main grid for the main window
-GtkWidget *window;    // Main window
-
-// Function declarations
-void on_back_button_clicked(GtkWidget *button, gpointer data);
-gboolean on_window_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data);
-void on_checkbox_selected(GtkWidget *checkbox, gpointer data);
-void *transfer_thread(void *arg);
-void readDirectory(const char *dirname, struct FileInfo *fileInfos);
-void updateDirectoryViews();
-void on_button_clicked(GtkWidget *button, gpointer data);
-void on_folder_button_clicked(GtkWidget *button, gpointer data);
-
-// Function to handle the "delete-event" signal for the window
-gboolean on_window_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data)
-{
-    gtk_main_quit(); // Quit the GTK main loop when the window is closed
-    return TRUE;     // Prevent the default destroy signal handler from executing
-}
-
-// Callback function to handle checkbox state change
-void on_checkbox_selected(GtkWidget *checkbox, gpointer data)
-{
-    struct FileInfo *fileInfo = (struct FileInfo *)g_object_get_data(G_OBJECT(checkbox), "file_info");
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(checkbox)))
-        fileInfo->isSelected = 1; // Select
-    else
-        fileInfo->isSelected = 0; // Deselect
-}
-
-void *transfer_thread(void *arg)
-{
-    struct FileInfo *file_info = (struct FileInfo *)arg;
-    char *filename = file_info->filename;
-    pid_t pid;
-    char fifo_name[MAX_PATH_LENGTH];
-    snprintf(fifo_name, sizeof(fifo_name), "fifo_%s", filename);
-    if (mkfifo(fifo_name, 0666) == -1)
-    {
-        perror("Error creating FIFO pipe");
-        pthread_exit(NULL);
-    }
-
-    pid = fork();
-
-    if (pid == -1)
-    {
-        perror("fork");
-        exit(EXIT_FAILURE);
-    }
-    else if (pid == 0)
-    {
-        // Sender process
-        FILE *file_ptr;
-        char full_file_path[MAX_PATH_LENGTH];
-        snprintf(full_file_path, sizeof(full_file_path), "%s/%s", SOURCE_DIR, filename);
-        file_ptr = fopen(full_file_path, "rb");
-        if (file_ptr == NULL)
-        {
-            perror("Error opening file");
-            pthread_exit(NULL);
-        }
-        unsigned char buffer[BUFFER_SIZE];
-        int res = open(fifo_name, O_WRONLY);
-        if (res == -1)
-        {
-            perror("Error opening named pipe for writing");
-            fclose(file_ptr);
-            pthread_exit(NULL);
-        }
-        while (1)
-        {
-            size_t bytes_read = fread(buffer, 1, BUFFER_SIZE, file_ptr);
-            if (bytes_read == 0)
-            {
-                if (feof(file_ptr))
-                {
-                    // EOF reached
-                    close(res);
-                    fclose(file_ptr);
-                }
-                else
-                {
-                    perror("Error reading file");
-                    pthread_exit(NULL);
-                }
-                break;
-            }
-
-            ssize_t bytes_written = write(res, buffer, bytes_read);
-            if (bytes_written != bytes_read)
-            {
-                perror("Error writing to named pipe");
-                break; // Exit the loop if write operation fails
-            }
-        }
-    }
-    else
-    {
-        // Receiver process
-        char full_file_path_dest[MAX_PATH_LENGTH];
-        snprintf(full_file_path_dest, sizeof(full_file_path_dest), "%s/%s", DEST_DIR, filename);
-
-        // Check if file already exists and rename if necessary
-        int file_number = 0;
-        char final_file_path[MAX_PATH_LENGTH];
-        char *dot = strrchr(filename, '.');
-        if (dot)
-        {
-            // Separate the base name and extension
-            size_t basename_length = dot - filename;
-            char basename[MAX_FILENAME_LENGTH];
-            strncpy(basename, filename, basename_length);
-            basename[basename_length] = '\0';
-
-            char extension[MAX_FILENAME_LENGTH];
-            strcpy(extension, dot);
-
-            // Construct the initial full path
-            snprintf(final_file_path, sizeof(final_file_path), "%s/%s%s", DEST_DIR, basename, extension);
-
-            // Increment the file number if the file already exists
-            while (access(final_file_path, F_OK) == 0)
-            {
-                file_number++;
-                snprintf(final_file_path, sizeof(final_file_path), "%s/%s(%d)%s", DEST_DIR, basename, file_number, extension);
-            }
-        }
-        else
-        {
-            // No extension found, just use the base name
-            strcpy(final_file_path, full_file_path_dest);
-            while (access(final_file_path, F_OK) == 0)
-            {
-                file_number++;
-                snprintf(final_file_path, sizeof(final_file_path), "%s/%s(%d)", DEST_DIR, filename, file_number);
-            }
-        }
-
-        FILE *dest_file = fopen(final_file_path, "wb");
-        unsigned char buffer[BUFFER_SIZE];
-        int res = open(fifo_name, O_RDONLY);
-        if (dest_file == NULL)
-        {
-            perror("Error creating/opening received file");
-            close(res);
-            pthread_exit(NULL);
-        }
-
-        if (res == -1)
-        {
-            perror("Error opening named pipe for reading");
-            fclose(dest_file);
-            pthread_exit(NULL);
-        }
-
-        while (1)
-        {
-            size_t bytes_read = read(res, buffer, BUFFER_SIZE);
-            if (bytes_read <= 0)
-            {
-                break;
-            }
-            ssize_t bytes_written = fwrite(buffer, 1, bytes_read, dest_file);
-
-            if (bytes_written != bytes_read)
-            {
-                perror("Error writing to file");
-                break;
-            }
-        }
-
-        // Close file pointer and named pipe
-        close(res);
-        fclose(dest_file);
-        if (unlink(fifo_name) == -1)
-        {
-            perror("Error removing FIFO pipe");
-        }
-
-        // Log receiver process completion
-        printf("Receiver process for file %s completed.\n", filename);
-
-        // Untick the checkbox on successful file transfer
-        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(file_info->checkbox), FALSE);
-    }
-    pthread_exit(NULL);
-}
-
-// Function to read the contents of a directory and populate fileInfos array
-void readDirectory(const char *dirname, struct FileInfo *fileInfos)
-{
-    DIR *dir = opendir(dirname);
-    if (dir != NULL)
-    {
-        struct dirent *ent;
-        int counter = 0;
-        while ((ent = readdir(dir)) != NULL && counter < MAX_FILES)
-        {
-            if (ent->d_name[0] != '.')
-            {
-                fileInfos[counter].index = counter;
-                strcpy(fileInfos[counter].filename, ent->d_name);
-                fileInfos[counter].isSelected = 0;
-                fileInfos[counter].checkbox = NULL;
-                counter++;
-            }
-        }
-        closedir(dir);
-    }
-    else
-    {
-        perror("Error opening directory");
-    }
-}
-
-// Function to update the directory views
-void updateDirectoryViews()
-{
-    readDirectory("./Folder1", fileInfos1);
-    readDirectory("./Folder2", fileInfos2);
-}
-
-// Callback function to handle button click for transferring files
-void on_button_clicked(GtkWidget *button, gpointer data)
-{
-    // Reset numSelectedFiles
-    numSelectedFiles = 0;
-
-    if (strcmp(gtk_widget_get_name(button), "Folder1") == 0)
-    {
-        SOURCE_DIR = "./Folder1";
-        DEST_DIR = "./Folder2";
-    }
-    else
-    {
-        SOURCE_DIR = "./Folder2";
-        DEST_DIR = "./Folder1";
-    }
-
-    // Iterate through fileInfos arrays and copy selected files to selectedFiles array
-    struct FileInfo *fileInfos = (strcmp(gtk_widget_get_name(button), "Folder1") == 0) ? fileInfos1 : fileInfos2;
-    for (int i = 0; i < MAX_FILES; i++)
-    {
-        if (fileInfos[i].isSelected == 1)
-        {
-            selectedFiles[numSelectedFiles++] = fileInfos[i];
-        }
-    }
-
-    // Print selected files on the terminal
-    printf("Selected Files:\n");
-    for (int i = 0; i < numSelectedFiles; i++)
-    {
-        printf("%s\n", selectedFiles[i].filename);
-    }
-
-    // Start transfer threads for selected files
-    pthread_t threads[MAX_FILES];
-    int transfer_success = 1;
-    for (int i = 0; i < numSelectedFiles; i++)
-    {
-        if (pthread_create(&threads[i], NULL, transfer_thread, (void *)&selectedFiles[i]) != 0)
-        {
-            transfer_success = 0;
-        }
-    }
-
-    // Wait for all transfer threads to complete
-    for (int i = 0; i < numSelectedFiles; i++)
-    {
-        if (pthread_join(threads[i], NULL) != 0)
-        {
-            transfer_success = 0;
-        }
-    }
-
-    // Update the directory views
-    updateDirectoryViews();
-
-    // Show success or failure message
-    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window),
-                                               GTK_DIALOG_DESTROY_WITH_PARENT,
-                                               transfer_success ? GTK_MESSAGE_INFO : GTK_MESSAGE_ERROR,
-                                               GTK_BUTTONS_OK,
-                                               transfer_success ? "File(s) transferred successfully" : "File transfer failed");
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
-}
-
-// Callback function to handle button click to select folder
-void on_folder_button_clicked(GtkWidget *button, gpointer data)
-{
-    const char *folder = gtk_widget_get_name(button);
-    if (strcmp(folder, "Folder1") == 0)
-    {
-        SOURCE_DIR = "./Folder1";
-        DEST_DIR = "./Folder2";
-    }
-    else
-    {
-        SOURCE_DIR = "./Folder2";
-        DEST_DIR = "./Folder1";
-    }
-
-    struct FileInfo *fileInfos = (strcmp(folder, "Folder1") == 0) ? fileInfos1 : fileInfos2;
-    readDirectory(SOURCE_DIR, fileInfos);
-
-    // Clear main grid
-    GList *children, *iter;
-    children = gtk_container_get_children(GTK_CONTAINER(main_grid));
-    for (iter = children; iter != NULL; iter = g_list_next(iter))
-    {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-
-    // Create a box for holding folder contents and checkboxes
-    GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
-    gtk_grid_attach(GTK_GRID(main_grid), vbox, 0, 0, 2, 1);
-
-    // Display folder contents
-    for (int i = 0; i < MAX_FILES; i++)
-    {
-        if (fileInfos[i].index != -1)
-        {
-            GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
-            gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
-
-            GtkWidget *checkbox = gtk_check_button_new_with_label(fileInfos[i].filename);
-            fileInfos[i].checkbox = checkbox;                                  // Store the checkbox widget
-            g_object_set_data(G_OBJECT(checkbox), "file_info", &fileInfos[i]); // Attach file info to the checkbox
-            g_signal_connect(checkbox, "toggled", G_CALLBACK(on_checkbox_selected), NULL);
-            gtk_box_pack_start(GTK_BOX(hbox), checkbox, FALSE, FALSE, 0);
-        }
-    }
-
-    // Create a button to add selected files
-    GtkWidget *add_button = gtk_button_new_with_label("Add Selected Files");
-    gtk_widget_set_name(add_button, folder);
-    g_signal_connect(add_button, "clicked", G_CALLBACK(on_button_clicked), NULL);
-    gtk_box_pack_start(GTK_BOX(vbox), add_button, FALSE, FALSE, 0);
-
-    // Create a back button to return to the main menu
-    GtkWidget *back_button = gtk_button_new_with_label("Back");
-    g_signal_connect(back_button, "clicked", G_CALLBACK(on_back_button_clicked), NULL);
-    gtk_box_pack_start(GTK_BOX(vbox), back_button, FALSE, FALSE, 0);
-
-    gtk_widget_show_all(main_grid);
-}
-
-void on_description_button_clicked(GtkWidget *button, gpointer data) {
-    // Create a new window for project description
-    GtkWidget *description_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-    gtk_window_set_title(GTK_WINDOW(description_window), "Project Description");
-    gtk_window_set_default_size(GTK_WINDOW(description_window), 800, 600); // Set a larger default size for better readability
-
-    // Create a scrolled window to contain the text view
-    GtkWidget *scrolled_window = gtk_scrolled_window_new(NULL, NULL);
-    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_window),
-                                   GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
-    gtk_container_add(GTK_CONTAINER(description_window), scrolled_window);
-
-    // Create a text view widget to display the project description
-    GtkWidget *text_view = gtk_text_view_new();
-    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(text_view), GTK_WRAP_WORD_CHAR);
-    gtk_container_add(GTK_CONTAINER(scrolled_window), text_view);
-
-    // Create a text buffer and set the text for the text view
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    const char *description_text = "In this project, the system is designed to facilitate efficient file transfer between a sender and a receiver. The senders role involves interfacing with a graphical user interface (GUI) to select and process multiple video files. These files are segmented and dispatched through individual threads over shared pipes, ensuring that each files end is properly signaled to the receiver. Once a file is completely transferred, the corresponding pipe is closed. On the other side, the receiver is tasked with opening and assembling the incoming segments into new video files. It must detect the end-of-file (EOF) marker to conclude each transfer, after which it terminates the associated thread and closes the file and pipe. Throughout this process, the GUI serves as a dashboard, displaying successful transfers or reporting any errors encountered. This dual-process system streamlines the transfer of video content, ensuring that multiple files can be handled concurrently and efficiently.";
-    gtk_text_buffer_set_text(buffer, description_text, -1);
-
-    // Set the background color and styling using CSS
-    GtkCssProvider *provider = gtk_css_provider_new();
-    gtk_css_provider_load_from_data(provider,
-                                    "textview { background-color: #333333; color: #ffffff; font-family: 'Arial'; font-size: 28px; }", // Dark gray background color, white text, increased font size
-                                    -1,
-                                    NULL);
-
-    GtkStyleContext *context = gtk_widget_get_style_context(text_view);
-    gtk_style_context_add_provider(context, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-
-    // Show all widgets in the description window
-    gtk_widget_show_all(description_window);
-}
-
-
-
-
-void on_back_button_clicked(GtkWidget *button, gpointer data)
-{
-    // Clear main grid
-    GList *children, *iter;
-    children = gtk_container_get_children(GTK_CONTAINER(main_grid));
-    for (iter = children; iter != NULL; iter = g_list_next(iter))
-    {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-
-    // Recreate the main menu layout
-    // Create a heading label
-    // Create a heading label with custom CSS styling
-	GtkWidget *heading_label = gtk_label_new(NULL);
-	gtk_label_set_markup(GTK_LABEL(heading_label), "<span font_desc='30' foreground='#FFFFFF'>OS Project By Hira Sardar and Sarmad Sultan</span>");
-	gtk_grid_attach(GTK_GRID(main_grid), heading_label, 0, 0, 2, 1);
-
-    // Create buttons for Folder1 and Folder2
-    GtkWidget *button1 = gtk_button_new_with_label("Folder1");
-    gtk_widget_set_name(button1, "Folder1");
-    g_signal_connect(button1, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
-    gtk_grid_attach(GTK_GRID(main_grid), button1, 0, 1, 1, 1);
-
-    GtkWidget *button2 = gtk_button_new_with_label("Folder2");
-    gtk_widget_set_name(button2, "Folder2");
-    g_signal_connect(button2, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
-    gtk_grid_attach(GTK_GRID(main_grid), button2, 1, 1, 1, 1);
-    
-    GtkWidget *button3 = gtk_button_new_with_label("Description");
-    gtk_widget_set_name(button2, "Description");
-    g_signal_connect(button2, "clicked", G_CALLBACK(on_description_button_clicked), NULL);
-    gtk_grid_attach(GTK_GRID(main_grid), button3, 2, 1, 1, 1);
-    
-    // Load CSS provider and apply styles to the window
-    GtkCssProvider *provider = gtk_css_provider_new();
-    gtk_css_provider_load_from_data(provider,
-                                    "window { background-color: #800020; }", // Vine red background color
-                                    -1,
-                                    NULL);
-
-    // Apply the CSS provider to the window's style context
-    GtkStyleContext *context = gtk_widget_get_style_context(window);
-    gtk_style_context_add_provider(context, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-
-    gtk_widget_show_all(window);
-}
-
-int main(int argc, char *argv[])
-{
-    // Initialize GTK
-gtk_init(&argc, &argv);
-
-// Create the main window
-window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-gtk_window_set_title(GTK_WINDOW(window), "File Transfer Program");
-gtk_window_set_default_size(GTK_WINDOW(window), 600, 500);
-g_signal_connect(window, "delete-event", G_CALLBACK(on_window_delete_event), NULL);
-
-// Create a main grid
-main_grid = gtk_grid_new();
-gtk_grid_set_column_homogeneous(GTK_GRID(main_grid), TRUE);
-gtk_grid_set_row_homogeneous(GTK_GRID(main_grid), TRUE);
-gtk_container_add(GTK_CONTAINER(window), main_grid);
-
-// Create a heading label
-GtkWidget *heading_label = gtk_label_new(NULL);
-gtk_label_set_markup(GTK_LABEL(heading_label), "<span font_desc='38' foreground='#FFFFFF'>End Semester Project By Hira Sardar and Sarmad Sultan!!</span>");
-gtk_grid_attach(GTK_GRID(main_grid), heading_label, 0, 0, 2, 1);
-
-// Create a choice label
-GtkWidget *choice_label = gtk_label_new(NULL);
-gtk_label_set_markup(GTK_LABEL(choice_label), "<span font_desc='30' foreground='#FFFFFF'>Choose the source folder to move files or click 'Description' to read details!!</span>");
-gtk_grid_attach(GTK_GRID(main_grid), choice_label, 0, 1, 2, 1);
-
-// Create buttons for Folder1 and Folder2
-GtkWidget *button1 = gtk_button_new_with_label("Folder1");
-gtk_widget_set_name(button1, "Folder1");
-g_signal_connect(button1, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
-gtk_grid_attach(GTK_GRID(main_grid), button1, 0, 2, 1, 1);
-
-GtkWidget *button2 = gtk_button_new_with_label("Folder2");
-gtk_widget_set_name(button2, "Folder2");
-g_signal_connect(button2, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
-gtk_grid_attach(GTK_GRID(main_grid), button2, 1, 2, 1, 1);
-
-GtkWidget *button3 = gtk_button_new_with_label("Description");
-gtk_widget_set_name(button3, "Description");
-g_signal_connect(button3, "clicked", G_CALLBACK(on_description_button_clicked), NULL);
-gtk_grid_attach(GTK_GRID(main_grid), button3, 2, 2, 1, 1);
-
-// Load CSS provider and apply styles to the window
-GtkCssProvider *provider = gtk_css_provider_new();
-gtk_css_provider_load_from_data(provider,
-                                "window { background-color: #800020; }", // Vine red background color
-                                -1,
-                                NULL);
-
-// Apply the CSS provider to the window's style context
-GtkStyleContext *context = gtk_widget_get_style_context(window);
-gtk_style_context_add_provider(context, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-
-// Show all widgets in the main window
-gtk_widget_show_all(window);
-
-// Start the GTK main loop
-gtk_main();
-
-return 0;
-
-}
-
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <gtk/gtk.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <endian.h>
+#include <linux/errqueue.h>
+#include <stdarg.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#define MAX_FILENAME_LENGTH 256
+#define BUFFER_SIZE 8192 // Default block size of the buffered copy loop, see --buffer-size
+#define MAX_PATH_LENGTH 1024
+#define MAX_BUFFER_SIZE (64 * 1024 * 1024)
+#define ADAPTIVE_BLOCK_START (64 * 1024) // --buffer-size=auto: first block size, then the last one used
+#define ADAPTIVE_BLOCK_MIN (16 * 1024)
+#define ADAPTIVE_BLOCK_MAX (4 * 1024 * 1024)
+#define ADAPTIVE_BLOCK_TARGET_NS 2000000LL // Aim for blocks that take about this long to move
+#define ADAPTIVE_WINDOW_NS 20000000LL      // Throughput is measured over windows this long
+#define ADAPTIVE_WINDOW_BLOCKS 4           // and at least this many blocks
+#define ADAPTIVE_PIPE_SIZE (4 * 1024 * 1024) // FIFO capacity asked for with F_SETPIPE_SZ
+#define BUFFER_POOL_CLASSES 27 // Power of two size classes up to MAX_BUFFER_SIZE
+#define BUFFER_POOL_MAX_FREE 16 // Idle buffers kept per class
+#define BUFFER_ALIGNMENT 4096
+#define DIRECT_IO_ALIGNMENT 4096 // O_DIRECT offsets and lengths are multiples of this
+#define CACHE_WINDOW_BYTES (8LL * 1024 * 1024) // --cache-mode: pages are released in windows this big
+#define BENCH_PROBE_BLOCK_SIZE (64 * 1024)
+#define BENCH_PROBE_MAX_SAMPLES 100000
+#define MAX_CLI_FILES 4096
+#define PROGRESS_REFRESH_MS 250
+#define INOTIFY_BUFFER_SIZE (64 * 1024)
+#define DIRECTORY_WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define BENCH_MAX_VALUES 16
+#define BENCH_FILL_BLOCK_SIZE (1024 * 1024)
+
+// How the program was started
+#define RUN_MODE_GUI 0
+#define RUN_MODE_CLI 1   // --cli: transfer the files named on the command line
+#define RUN_MODE_BENCH 2 // --bench: measure the transfer engine on synthetic files
+#define RUN_MODE_SERVE 3 // --serve: receive files sent over TCP by --remote senders
+#define SPLICE_CHUNK_SIZE (1024 * 1024) // Default bytes moved per splice() call
+#define SHM_BLOCK_SIZE (1024 * 1024)    // Default bytes read into the shm ring per read()
+#define VERIFY_BLOCK_SIZE (256 * 1024)  // Default block size of the buffered loop under --verify, which replaces splice()
+#define CHUNK_COPY_BUFFER_SIZE (1024 * 1024)
+#define KERNEL_COPY_BLOCK_SIZE (8 * 1024 * 1024) // copy_file_range() calls are this big, for progress
+#define DEFAULT_LARGE_FILE_THRESHOLD (256LL * 1024 * 1024)
+#define DEFAULT_CHUNK_SIZE (64LL * 1024 * 1024)
+#define SHM_RING_SIZE (16 * 1024 * 1024)
+#define URING_QUEUE_DEPTH 128
+#define URING_NUM_BUFFERS 32
+#define URING_BUFFER_SIZE (512 * 1024)
+#define JOURNAL_NAME ".transfer_journal"
+#define CRC32C_POLY 0x82F63B78 // Castagnoli polynomial, bit-reflected
+#define CRC32C_LONG_BLOCK 8192 // Block sizes of the three interleaved hardware CRC streams
+#define CRC32C_SHORT_BLOCK 256
+#define CRC32C_FOLD_MIN 1024 // Calls this long fold 256-byte blocks with VPCLMULQDQ where the CPU has it
+#define JOURNAL_CHECKPOINT_BYTES (64LL * 1024 * 1024) // Smaller files are simply copied again
+#define NAME_ALLOCATOR_BUCKETS 64 // Initial hash table size, a power of two
+#define CONTENT_INDEX_NAME ".transfer_index"
+#define COMPARE_BLOCK_SIZE (1024 * 1024) // Read size when two files are compared byte for byte
+#define DEDUP_RESCAN_INTERVAL_NS (2LL * 1000000000) // Folder changes seen sooner wait for the next lookup
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Transfer modes for moving data between the files and the FIFO
+#define TRANSFER_MODE_BUFFERED 0 // read()/write() through a user space buffer
+#define TRANSFER_MODE_SPLICE 1   // zero-copy splice() file->pipe->file
+
+// Transfer engines
+#define TRANSFER_ENGINE_FIFO 0  // sender/receiver thread pairs connected by a FIFO
+#define TRANSFER_ENGINE_URING 1 // one io_uring driving reads and writes for all files
+
+// Transports between the sender and receiver threads of the FIFO engine
+#define TRANSFER_TRANSPORT_FIFO 0 // named pipe per file
+#define TRANSFER_TRANSPORT_SHM 1  // lock-free ring in memfd shared memory
+
+// Scheduling classes of the pool queue, served in this order
+#define PRIORITY_URGENT 0 // flagged by the user
+#define PRIORITY_SMALL 1  // smaller than --small-file-threshold
+#define PRIORITY_BULK 2
+#define NUM_PRIORITIES 3
+#define DEFAULT_SMALL_FILE_THRESHOLD (16LL * 1024 * 1024)
+#define PRIORITY_MAX_BYPASS 8 // Waiting bulk jobs get a turn after this many small ones
+#define THROTTLE_BURST_NS 100000000LL // Idle time a bandwidth cap lets a transfer catch up on
+
+// Containers --playable writes so that they can be played while they arrive
+#define VIDEO_FORMAT_NONE 0
+#define VIDEO_FORMAT_MP4 1 // ISO base media: ftyp, moov (the index) and mdat (the media) boxes
+#define VIDEO_FORMAT_TS 2  // MPEG transport stream: fixed-size packets starting with 0x47
+#define TS_PACKET_SIZE 188
+#define M2TS_PACKET_SIZE 192 // Blu-ray/AVCHD streams: a 4-byte timestamp before every packet
+#define TS_SYNC_BYTE 0x47
+#define MP4_MAX_BOXES 4096 // Top-level boxes looked at before giving up on a file
+#define MP4_MAX_MOOV_SIZE (64 * 1024 * 1024) // Larger indexes are not moved to the front
+#define PLAYABLE_HEAD_SIZE (1024 * 1024) // Stream bytes written before the file is shown under its name
+
+// Network transfers (--remote and --serve)
+#define NET_MAGIC 0x46545632 // "FTV2", starts every request and reply
+#define NET_SEND_BLOCK (4 * 1024 * 1024) // sendfile()/send() calls are this big, for progress and bandwidth caps
+#define NET_RECEIVE_BUFFER_SIZE (1024 * 1024)
+#define NET_MAX_IN_FLIGHT 64 // Requests a connection sends ahead of their replies
+#define NET_LISTEN_BACKLOG 64
+#define NET_MAX_CONNECTIONS 64        // Senders served at once; further ones are turned away
+#define NET_MAX_FILE_SIZE (1LL << 40) // Largest file a request may announce
+
+// Requests of the network protocol; each is followed by the file name and its data
+#define NET_REQUEST_FILE 1   // A whole file
+#define NET_REQUEST_CHUNK 2  // One byte range of a large file, written in place
+#define NET_REQUEST_COMMIT 3 // Every chunk arrived: give the file its name
+#define NET_REQUEST_ABORT 4  // A chunk failed: drop the partial file
+
+// Event trace of the transfer pipeline (--trace and SIGUSR1)
+#define TRACE_RING_EVENTS 32768 // Events kept per thread, a power of two; older ones are overwritten
+#define TRACE_DETAIL_LENGTH 64  // Bytes of the file name kept with an event
+#define TRACE_MAX_THREADS 1024  // Thread names kept for the dump
+#define TRACE_DEFAULT_PATH "transfer_trace.%d.json" // Where SIGUSR1 dumps without --trace, by process id
+
+// Kinds of trace events, the categories of the dumped trace
+#define TRACE_STAGE 0 // A job, or a step of one such as hashing or placing the file
+#define TRACE_IO 1    // One read, write, splice, sendfile, ... call
+#define TRACE_WAIT 2  // Blocked on the other half, the job queue or a bandwidth cap
+
+// Page cache policies for the files being copied
+#define CACHE_MODE_NORMAL 0 // leave it to the kernel
+#define CACHE_MODE_STREAM 1 // drop pages behind the copy, with write-behind on the destination
+#define CACHE_MODE_DIRECT 2 // like stream, but the receiver writes with O_DIRECT
+
+// Codecs of the compression stage of the network path (--compress with --remote)
+#define CODEC_NONE 0
+#define CODEC_LZ4 1  // fast, modest ratio
+#define CODEC_ZSTD 2 // slower, better ratio
+#define COMPRESS_BLOCK_SIZE (1024 * 1024) // Blocks are compressed independently, so in parallel
+#define COMPRESS_MAX_THREADS 16
+#define COMPRESS_SLOTS_PER_THREAD 2
+#define COMPRESS_PROBE_SAMPLES 4 // Blocks sampled from files of unknown type
+#define COMPRESS_PROBE_BLOCK_SIZE (64 * 1024)
+#define COMPRESS_PROBE_PERCENT 90 // Samples must shrink to this share of their size
+// Extensions of formats that are already entropy coded, and of raw ones, between spaces
+#define COMPRESS_SKIP_EXTENSIONS " mp4 m4v mkv webm ts m2ts mts wmv flv 3gp jpg jpeg png gif webp heic mp3 aac m4a ogg opus flac zip gz bz2 xz zst lz4 7z rar "
+#define COMPRESS_RAW_EXTENSIONS " yuv y4m raw rgb nv12 pcm wav bmp tif tiff dpx txt log csv json xml "
+
+// States of a compression slot
+#define COMPRESS_SLOT_FREE 0
+#define COMPRESS_SLOT_FILLED 1 // Read from the source, waiting for a helper thread
+#define COMPRESS_SLOT_PACKED 2 // Compressed, waiting to be written to the connection
+
+// Shared memory ring states
+#define RING_OPEN 0
+#define RING_EOF 1     // The producer sent everything
+#define RING_ERROR 2   // The producer failed
+#define RING_ABORTED 3 // The consumer gave up
+
+char *SOURCE_DIR;
+char *DEST_DIR;
+struct FileInfo
+{
+    int index;
+    char filename[MAX_FILENAME_LENGTH];
+    int isSelected;
+    int urgent;               // Flagged by the user to go ahead of everything else
+    GtkTreeRowReference *row; // Row of the file in the folder view, NULL outside the GUI
+};
+
+// Columns of the folder view's list store
+#define FILE_COLUMN_SELECTED 0
+#define FILE_COLUMN_NAME 1
+#define FILE_COLUMN_SIZE 2
+#define FILE_COLUMN_PROGRESS 3 // 0-100
+#define FILE_COLUMN_STATUS 4   // Text drawn on the progress bar
+#define FILE_COLUMN_URGENT 5
+#define FILE_NUM_COLUMNS 6
+
+// A regular file of a folder, with the attributes cached from fstatat()
+struct FileEntry
+{
+    char filename[MAX_FILENAME_LENGTH];
+    long long size;
+    long long mtime_ns;
+};
+
+// Sorted listing of a folder, loaded once and then kept current from inotify events
+// so that showing or refreshing a large folder never rescans it
+struct DirectoryIndex
+{
+    const char *path;
+    struct FileEntry *entries; // Sorted by filename
+    int count;
+    int capacity;
+    int watch; // inotify watch descriptor, -1 when not watched
+};
+
+// Progress states
+#define PROGRESS_QUEUED 0
+#define PROGRESS_RUNNING 1
+#define PROGRESS_DONE 2
+#define PROGRESS_FAILED 3
+
+// Live counters of one file transfer. The copy loops update the atomics; the
+// progress monitor thread turns them into a rate, which the GUI and the metrics
+// snapshot read. Records live in a registry guarded by progress_lock.
+struct TransferProgress
+{
+    char filename[MAX_FILENAME_LENGTH];
+    char source_dir[MAX_PATH_LENGTH];
+    char dest_dir[MAX_PATH_LENGTH];
+    long long total_bytes;
+    _Atomic long long bytes_done;
+    _Atomic long long wait_pipe_ns; // Receiver blocked waiting for the sender (FIFO or ring)
+    _Atomic long long wait_disk_ns; // Receiver blocked in disk reads/writes
+    _Atomic long long wait_cap_ns;  // Held back to stay under a bandwidth cap
+    _Atomic long long start_ns;
+    _Atomic int state;
+    struct TransferBatch *batch; // Whose bandwidth cap the copy is charged to
+    long long sample_bytes; // Monitor thread only, under progress_lock
+    long long sample_ns;
+    double rate; // Smoothed bytes per second
+    GtkTreeRowReference *row; // GUI thread only; owned by the job's FileInfo
+    struct TransferProgress *prev;
+    struct TransferProgress *next;
+};
+
+// Kinds of jobs the worker pool runs
+#define JOB_TYPE_FILE 0  // Transfer a whole file
+#define JOB_TYPE_CHUNK 1 // Copy one byte range of a large file
+#define JOB_TYPE_COMMIT 2 // --remote: have the daemon name a large file once its chunks arrived
+
+// A single file queued for transfer; it carries its own copy of the folders
+// so that SOURCE_DIR/DEST_DIR can change while it waits in the queue
+struct TransferJob
+{
+    int type;
+    int priority; // PRIORITY_*, chunk jobs inherit their file's
+    struct FileInfo file;
+    char source_dir[MAX_PATH_LENGTH];
+    char dest_dir[MAX_PATH_LENGTH];
+    struct TransferBatch *batch;
+    struct timespec queued_time; // When the job entered the queue
+    long long bytes_done;        // Bytes the receiver wrote and the time it took
+    double seconds;
+    struct TransferProgress *progress;
+    struct ChunkedCopy *copy; // Chunk jobs only: the large file being copied
+    long long offset;         // Chunk jobs only: byte range to copy
+    long long length;
+    struct JournalEntry *journal;    // Checkpoint record of the file, NULL when it cannot be resumed
+    uint32_t send_checksum;          // --verify: CRC32C of what the sender read and the receiver wrote
+    uint32_t receive_checksum;
+    int checksum_mismatch;
+    long long resume_offset;         // Bytes of temp_path kept from an earlier attempt
+    size_t send_block_size;          // Block sizes the copy loops ended with, for the log
+    size_t receive_block_size;
+    const char *send_mode;           // Loops that finished the copy on each side ("splice" or "buffered")
+    const char *receive_mode;
+    int pipe_size;                   // FIFO capacity, 0 when it was left at the default
+    char temp_path[MAX_PATH_LENGTH]; // The file is written here and renamed once complete
+    char final_path[MAX_PATH_LENGTH]; // Where the complete file ended up
+    uint64_t content_hash;            // --dedup: XXH64 of the source, valid when content_hashed
+    int content_hashed;
+    int content_changed;              // --dedup: the copy's bytes differ from the source, so it is not indexed
+    int codec;                        // --compress: CODEC_* the file is sent to the daemon with
+    int in_kernel;                    // Folder sync on one filesystem: copied with copy_file_range()
+    long long wire_bytes;             // Bytes the compression stage put on the connection
+    long long pack_ns;                // CPU time spent compressing the file
+    uint64_t remote_id;               // --remote: id of the file on the wire, shared by its chunks
+    long long started_ns;             // --remote: when the first byte was sent
+    struct TransferJob *next;
+};
+
+// Block size of one copy loop; with --buffer-size=auto it follows the measured
+// throughput so that each block takes about ADAPTIVE_BLOCK_TARGET_NS to move
+struct BlockSizer
+{
+    size_t size;
+    long long window_start_ns;
+    long long window_bytes;
+    int window_blocks;
+};
+
+// Page cache bookkeeping of one file being read or written sequentially under
+// --cache-mode. Pages are released one window behind the copy: a reader drops
+// [start, flushing) once it is past flushing, a writer first waits for their writeback
+struct CacheWindow
+{
+    int fd;
+    int writing;
+    int direct;             // O_DIRECT is on, so there is nothing to release
+    long long start;        // First byte still in the page cache
+    long long flushing;     // End of the window being written back or read
+    long long position;     // End of the bytes copied so far
+};
+
+// --bench-hot-set: a stand-in for another service on the host, reading random
+// blocks of its working set while a benchmark run copies files
+struct BenchProbe
+{
+    int fd;
+    long long size;
+    _Atomic int stop;
+    double *latencies; // Milliseconds per read
+    int num_latencies;
+    long long peak_dirty_kb; // Highest Dirty in /proc/meminfo seen during the run
+    pthread_t thread;
+};
+
+// Checkpoint of one partially received file. committed bytes at the start of the
+// temporary file, plus any chunks marked in done_chunks, are known to be on disk.
+struct JournalEntry
+{
+    char filename[MAX_FILENAME_LENGTH];
+    long long source_size; // Source identity; a changed source is copied from scratch
+    long long source_mtime_ns;
+    long long committed;
+    long long written;          // Bytes written so far by a sequential copy, owner only
+    long long chunk_size;       // Chunked copies: chunk size of done_chunks, 0 when unused
+    unsigned char *done_chunks; // Bitmap of finished chunks
+    int active;                 // A job is writing the file right now
+    int saved;                  // The entry is in the journal file on disk
+    struct TransferJournal *journal;
+    struct JournalEntry *next;
+};
+
+// Checkpoints of the files being received into one destination folder,
+// persisted as JOURNAL_NAME in that folder
+struct TransferJournal
+{
+    char dest_dir[MAX_PATH_LENGTH];
+    struct JournalEntry *entries;
+    struct TransferJournal *next;
+};
+
+// Next free copy number of one "name.ext" in a destination folder
+struct NameSlot
+{
+    char key[MAX_FILENAME_LENGTH + 1]; // "name/.ext"
+    int next_number;                   // 0: the name itself is free, N: "name(N).ext" is
+    struct NameSlot *next;
+};
+
+// Names taken in one destination folder, hashed by key
+struct NameAllocator
+{
+    char dir[MAX_PATH_LENGTH];
+    struct NameSlot **buckets;
+    size_t num_buckets; // Power of two
+    size_t count;
+    int stale; // Rescanned on next use; set when a batch starts
+    struct NameAllocator *next;
+};
+
+// Size, mtime and content hash of one file, as last seen by --dedup
+struct ContentEntry
+{
+    char filename[MAX_FILENAME_LENGTH];
+    long long size;
+    long long mtime_ns;
+    uint64_t hash; // XXH64 of the contents, valid when hashed
+    int hashed;
+    int seen; // Found by the current scan
+    struct ContentEntry *next;
+};
+
+// Content hashes of the files in one folder, persisted as CONTENT_INDEX_NAME in it
+// when it is a destination
+struct ContentIndex
+{
+    char dir[MAX_PATH_LENGTH];
+    struct ContentEntry *entries;
+    long long dir_mtime_ns; // Folder mtime at the last scan
+    long long scan_ns;
+    int dirty;       // Changed since it was last saved
+    int destination; // Saved in the folder; source folders are only indexed in memory
+    struct ContentIndex *next;
+};
+
+// State shared by the chunk jobs of one large file
+struct ChunkedCopy
+{
+    struct TransferJob *file_job; // Finished once every chunk is done
+    int src_fd;
+    int dest_fd;
+    long long size;
+    pthread_mutex_t lock;
+    int chunks_left;
+    int failed;
+    struct timespec start_time;
+    uint64_t remote_id; // --remote: the chunks go to the daemon and dest_fd is unused
+};
+
+// One block of a file going through the compression stage
+struct CompressSlot
+{
+    unsigned char *data;   // COMPRESS_BLOCK_SIZE bytes read from the source
+    unsigned char *packed; // codec_bound(COMPRESS_BLOCK_SIZE) bytes
+    size_t length;
+    size_t packed_length; // 0: the block did not shrink and is sent as it is
+    int state;            // COMPRESS_SLOT_*
+};
+
+// Compression stage of one worker's connection. The worker reads blocks into the
+// slots, the helper threads compress them in parallel and the worker sends them to
+// the daemon in the order they were read. Blocks are numbered from 0 over the life of
+// the stage and block n lives in slots[n % num_slots]
+struct Compressor
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct CompressSlot slots[COMPRESS_MAX_THREADS * COMPRESS_SLOTS_PER_THREAD];
+    int num_slots;
+    pthread_t threads[COMPRESS_MAX_THREADS];
+    int num_threads;
+    int codec;              // Of the file being sent
+    long long filled;       // Blocks read so far
+    long long taken;        // Blocks handed to a helper thread
+    long long packed_count; // Blocks compressed
+    long long pack_ns;      // Helper CPU time spent on the file being sent
+    int shutdown;
+};
+
+// Header the compression stage puts on the connection in front of each block
+struct CompressFrame
+{
+    uint32_t length;        // Bytes of the source block
+    uint32_t packed_length; // Bytes that follow; 0 when length bytes follow uncompressed
+};
+
+// Bandwidth cap state, kept as the time at which the bytes granted so far will
+// have been sent at the cap (a virtual scheduling clock), so a grant is one update
+struct TokenBucket
+{
+    pthread_mutex_t lock;
+    long long next_free_ns;
+    long long generation; // rate_limit_generation the clock was started under
+};
+
+// Group of jobs started together by one click on "Add Selected Files"
+struct TransferBatch
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;    // Jobs queued or running, plus one while the batch is still being filled
+    int total;      // Jobs added to the batch
+    int failed;     // Jobs that finished with an error
+    int notify_gui; // Report file and batch completion to the GTK main loop
+    char failed_files[MAX_PATH_LENGTH];
+    double *latencies; // Optional: seconds from queueing to completion of each file
+    int num_latencies;
+    struct TokenBucket bucket; // Enforces batch_rate_limit
+    int sync;                  // Folder sync: changed destination files are replaced, not added as copies
+};
+
+// Counts of one folder sync
+struct SyncStats
+{
+    int folders;
+    int files; // Regular files in the source tree
+    int added; // Queued because the destination has no copy
+    int changed; // Queued because the copy differs in size or mtime
+    int unchanged;
+    long long bytes; // Size of the queued files
+    dev_t dest_dev;  // Destination root, skipped when it lies inside the source
+    ino_t dest_ino;
+};
+
+// Folder sync started from the GUI, handed to sync_thread()
+struct SyncRequest
+{
+    struct TransferBatch *batch;
+    char source_dir[MAX_PATH_LENGTH];
+    char dest_dir[MAX_PATH_LENGTH];
+};
+
+// Result of one job, handed from a worker to the GTK main loop
+struct FileResult
+{
+    GtkTreeRowReference *row;
+    struct TransferProgress *progress;
+    int success;
+    int checksum_mismatch;
+};
+
+// Single-producer/single-consumer byte ring living in shared memory.
+// Positions only grow; the producer owns write_pos and the consumer read_pos,
+// so neither side needs a lock. A side only makes a futex syscall when the
+// ring is full or empty and the other side has announced it is sleeping.
+struct ShmRing
+{
+    _Atomic unsigned long long write_pos __attribute__((aligned(64)));
+    _Atomic unsigned long long read_pos __attribute__((aligned(64)));
+    _Atomic int data_seq __attribute__((aligned(64))); // Futex word bumped when data is produced
+    _Atomic int space_seq;                             // Futex word bumped when data is consumed
+    _Atomic int producer_waiting;
+    _Atomic int consumer_waiting;
+    _Atomic int state;
+    size_t capacity;
+    unsigned char data[] __attribute__((aligned(64)));
+};
+
+// Header of a network request, in network byte order
+struct NetRequest
+{
+    uint32_t magic;
+    uint32_t type;        // NET_REQUEST_*
+    uint64_t id;          // Picked by the sender; the chunks of a file share it
+    uint64_t offset;      // NET_REQUEST_CHUNK: where the data goes in the file
+    uint64_t length;      // Bytes of data following the name
+    uint64_t file_size;   // Size of the whole file
+    uint64_t mtime_ns;    // Modification time of the source, given to the placed file
+    uint32_t name_length; // Bytes of file name following the header
+    uint32_t codec;       // CODEC_*: the data is length bytes of the file as CompressFrame blocks
+};
+
+// Reply to one request; the daemon answers the requests of a connection in order
+struct NetReply
+{
+    uint32_t magic;
+    int32_t status; // 0, or the errno the daemon failed with
+    uint64_t id;
+};
+
+// Connection of a worker to the daemon. The worker sends requests without waiting
+// for their replies; a reader thread matches the replies to the jobs in flight
+struct NetConnection
+{
+    int fd;
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct TransferJob *head; // Jobs in flight, oldest first
+    struct TransferJob *tail;
+    int in_flight;
+    struct TransferJob *sending; // Job whose request the worker is writing; the worker finishes it
+    int sending_replied;         // The reply to it came before the worker was done, with this status
+    int sending_status;
+    int broken;               // No more requests; the reader fails the jobs in flight and exits
+    int closed;               // The reader has exited
+    int zerocopy;             // SO_ZEROCOPY was accepted
+    uint32_t zerocopy_sent;   // MSG_ZEROCOPY sends, and those the kernel reported done with
+    uint32_t zerocopy_done;
+    int zerocopy_copied;      // The kernel copied the data after all, as it does on loopback
+};
+
+// Partial file the daemon is receiving in chunks. The chunks may arrive over several
+// connections; once the last of them closes, a file not yet committed is removed
+struct NetPartial
+{
+    uint64_t serial; // Tells the files apart when a later sender reuses an id
+    uint64_t id;
+    char filename[MAX_FILENAME_LENGTH];
+    int connections; // Open connections that sent chunks of the file
+    struct NetPartial *next;
+};
+
+// Partial files one daemon connection sent chunks of, by serial
+struct NetPartialList
+{
+    uint64_t *serials;
+    int count;
+    int capacity;
+};
+
+// One event of the trace, padded to two cache lines
+struct TraceEvent
+{
+    _Atomic unsigned long long seq; // 2n+1 while the ring's nth event is written here, 2n+2 once it is complete
+    const char *name;               // A string literal
+    long long start_ns;
+    long long duration_ns;
+    long long bytes; // -1 when the event moved no data
+    int tid;
+    int kind; // TRACE_*
+    char detail[TRACE_DETAIL_LENGTH];
+} __attribute__((aligned(128)));
+
+// Events recorded by one thread. Only that thread writes them, so recording takes
+// no lock; a dump copies each event and skips those whose sequence number changed
+struct TraceRing
+{
+    _Atomic unsigned long long head; // Events ever recorded
+    _Atomic int in_use;              // Owned by a running thread; a new thread reuses a released ring
+    struct TraceRing *next;          // Every ring, newest first
+    struct TraceEvent events[TRACE_RING_EVENTS];
+};
+
+// A worker is a receiver thread paired with a long-lived sender thread
+struct TransferWorker
+{
+    int id;
+    pthread_t receiver;
+    pthread_t sender;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct TransferJob *send_job; // Job handed to the sender thread, NULL when idle
+    char fifo_name[MAX_PATH_LENGTH];
+    struct ShmRing *send_ring; // Ring for the handed job, NULL when it goes through fifo_name
+    struct ShmRing *ring;      // Worker's shared memory ring, created on first use
+    struct Compressor *compressor; // --remote: compression stage of the connection, created on first use
+    struct NetConnection *connection; // --remote: connection to the daemon, opened on first use
+    int send_result;
+    int send_done;
+    int shutdown;
+};
+
+// Fixed-size pool of workers fed by one FIFO queue of jobs per priority class
+struct TransferPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    struct TransferJob *head[NUM_PRIORITIES];
+    struct TransferJob *tail[NUM_PRIORITIES];
+    int bypassed; // Small jobs run in a row while bulk jobs were waiting
+    struct TransferWorker *workers;
+    int num_workers;
+    int shutdown;
+};
+
+#ifdef HAVE_LIBURING
+// One registered buffer and the request currently using it; a block is read
+// into the buffer and then written out of it at the same offset
+struct UringOp
+{
+    struct UringFile *file;
+    int buf_index;
+    int is_write;
+    int is_sync; // The checkpoint fdatasync of file, which has no buffer
+    long long offset;
+    unsigned int length;
+    unsigned int done; // Bytes of this request already completed (short reads/writes)
+};
+
+// A file being copied by the io_uring engine
+struct UringFile
+{
+    struct TransferJob *job;
+    int src_fd;
+    int dest_fd;
+    long long size;
+    long long next_offset; // Next byte to issue a read for
+    int in_flight;         // Reads, writes and syncs outstanding for this file
+    int failed;
+    int syncing;            // sync_op is in flight
+    struct UringOp sync_op; // Checkpoint fdatasync of dest_fd, for the bytes below sync_op.offset
+    long long throttle_until_ns;   // No reads are issued before this, to stay under the bandwidth caps
+    long long throttle_since_ns;   // When the hold began, for the progress counters
+    long long throttle_generation; // rate_limit_generation of the hold; a cap change ends it
+    struct timespec start_time;
+    struct UringFile *next;
+};
+
+struct UringEngine
+{
+    struct io_uring ring;
+    pthread_t thread;
+    int wake_fd; // eventfd used to interrupt the wait when jobs arrive
+    int registered;
+    unsigned char *buffers;
+    struct UringOp ops[URING_NUM_BUFFERS];
+    struct UringOp *free_ops[URING_NUM_BUFFERS];
+    int num_free_ops;
+    struct UringFile *files; // Files being copied, owned by the engine thread
+    pthread_mutex_t lock;    // Protects incoming and shutdown
+    struct TransferJob *incoming;
+    int shutdown;
+};
+#endif
+
+struct DirectoryIndex folder_indexes[2] = {{"./Folder1", NULL, 0, 0, -1}, {"./Folder2", NULL, 0, 0, -1}};
+int inotify_fd = -1;
+struct DirectoryIndex *shown_index = NULL; // Folder currently on screen and its list store
+GtkListStore *shown_store = NULL;
+int transfer_mode = TRANSFER_MODE_SPLICE;
+int num_transfer_workers = 0; // 0 means one worker per online CPU
+struct TransferPool transfer_pool;
+long long large_file_threshold = DEFAULT_LARGE_FILE_THRESHOLD; // Files this big are copied in parallel chunks
+int large_file_threshold_set = 0;                              // --large-file-threshold was given
+_Atomic long long chunked_files = 0;                           // Files copied in parallel chunks
+long long chunk_size = DEFAULT_CHUNK_SIZE;
+int transfer_engine = TRANSFER_ENGINE_FIFO;
+int transfer_transport = TRANSFER_TRANSPORT_FIFO;
+size_t transfer_buffer_size = 0; // --buffer-size for every copy loop; 0 leaves each loop its own default
+int cache_mode = CACHE_MODE_NORMAL;
+long long small_file_threshold = DEFAULT_SMALL_FILE_THRESHOLD; // Smaller files are scheduled first
+
+// Bandwidth caps in bytes per second, 0 for none; they may change at any time
+_Atomic long long total_rate_limit = 0; // All transfers together
+_Atomic long long batch_rate_limit = 0; // Each batch on its own
+struct TokenBucket total_bucket = {PTHREAD_MUTEX_INITIALIZER, 0, 0};
+_Atomic long long rate_limit_generation = 0; // Bumped whenever a cap changes
+pthread_mutex_t rate_limit_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t rate_limit_changed = PTHREAD_COND_INITIALIZER; // Wakes transfer_throttle() on a cap change
+char *control_path = NULL; // --control: file the limits are re-read from while running
+long long control_mtime_ns = 0;
+int adaptive_buffers = 0;                  // --buffer-size=auto: size blocks and FIFOs by throughput
+_Atomic size_t adaptive_block_hint = 0;    // Block size the last file ended with
+_Atomic int pipe_size_limit = ADAPTIVE_PIPE_SIZE; // Largest FIFO capacity F_SETPIPE_SZ granted
+
+// Idle page-aligned copy buffers by power of two size class, guarded by buffer_pool_lock;
+// each idle buffer stores the next one in its first bytes
+pthread_mutex_t buffer_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+void *buffer_pool_free[BUFFER_POOL_CLASSES];
+int buffer_pool_count[BUFFER_POOL_CLASSES];
+
+// Number of read/write/splice/futex/io_uring syscalls issued by the copy loops, for the benchmark
+_Atomic long long io_syscall_count = 0;
+#define COUNT_IO_SYSCALL() atomic_fetch_add_explicit(&io_syscall_count, 1, memory_order_relaxed)
+int quiet_transfers = 0; // Suppress the per-file completion lines
+
+// --verify: CRC32C each file on both sides of the FIFO or ring and compare
+int verify_transfers = 0;
+uint32_t crc32c_table[8][256];
+uint32_t crc32c_long_shift[4][256]; // Append CRC32C_LONG_BLOCK zero bytes to a CRC
+uint32_t crc32c_short_shift[4][256];
+uint64_t crc32c_fold_constants[5][2]; // Move 128 bits 2048, 512, 384, 256 or 128 bits further, see crc32c_fold_pair()
+uint32_t crc32c_software(uint32_t crc, const unsigned char *data, size_t length);
+uint32_t (*crc32c_update)(uint32_t crc, const unsigned char *data, size_t length) = crc32c_software;
+_Atomic long long checksum_ns = 0; // Time spent checksumming, for the overhead report
+
+// Checkpoint journals of the destination folders, all guarded by journal_lock
+pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+struct TransferJournal *journals = NULL;
+_Atomic int temp_file_counter = 0;
+
+// Destination name allocators, guarded by name_lock
+pthread_mutex_t name_lock = PTHREAD_MUTEX_INITIALIZER;
+struct NameAllocator *name_allocators = NULL;
+
+// --dedup: link files whose contents are already in the destination instead of copying them
+int dedup_transfers = 0;
+pthread_mutex_t content_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t content_save_lock = PTHREAD_MUTEX_INITIALIZER; // Held while index files are written, without content_lock
+struct ContentIndex *content_indexes = NULL;
+
+// --sync: mirror --from into --to, copying only new and changed files
+int sync_mode = 0;
+_Atomic long long sync_identical = 0; // Files whose changed mtime hid identical contents
+
+// How finely each destination filesystem stores mtimes, found by mtime_granularity()
+#define MTIME_GRANULARITY_SLOTS 16
+pthread_mutex_t mtime_granularity_lock = PTHREAD_MUTEX_INITIALIZER;
+dev_t mtime_granularity_dev[MTIME_GRANULARITY_SLOTS];
+long long mtime_granularity_ns[MTIME_GRANULARITY_SLOTS];
+int mtime_granularity_count = 0;
+
+// --playable: write MP4 and MPEG-TS files so that players can open them while they arrive
+int playable_transfers = 0;
+_Atomic long long playable_files = 0;     // Files shown under their name before they were complete
+_Atomic long long playable_moved_moov = 0; // MP4 files whose index was moved in front of the media
+_Atomic long long playable_head_ns = 0;   // Time it took until they could be opened, summed
+
+// --compress: compression stage of the network path
+int compress_codec = CODEC_NONE; // Codec of the files compress_choose() picks
+int compress_level = 0;          // zstd level or lz4 acceleration, 0 for the codec's default
+int compress_threads = 0;        // Helper threads per sender, 0 to share the CPUs among the workers
+_Atomic long long compress_files = 0; // Files sent compressed
+_Atomic long long compress_raw_bytes = 0; // Their size before and after the stage
+_Atomic long long compress_wire_bytes = 0;
+_Atomic long long compress_pack_ns = 0; // CPU time of the helper threads
+
+// --remote: send to a receiving daemon over TCP instead of into a local folder
+char *remote_address = NULL; // HOST:PORT
+struct addrinfo *remote_addrinfo = NULL;
+int net_zerocopy = 0; // --zerocopy: send with MSG_ZEROCOPY instead of sendfile()
+_Atomic uint64_t net_next_id = 0;
+_Atomic int net_zerocopy_copied = 0; // Connections whose MSG_ZEROCOPY sends were copied anyway
+char *serve_address = NULL; // --serve: [HOST:]PORT the daemon listens on
+_Atomic int net_connection_count = 0; // --serve: connections being served
+struct NetPartial *net_partials = NULL; // --serve: files being received in chunks
+uint64_t net_partial_serial = 0;
+pthread_mutex_t net_partial_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --trace: every thread records timed events into its own ring while trace_enabled is
+// set; they are dumped as Chrome trace JSON at exit and on SIGUSR1
+_Atomic int trace_enabled = 0;
+char *trace_path = NULL;
+char trace_default_path[MAX_PATH_LENGTH];
+long long trace_epoch_ns = 0; // Event times are dumped relative to when tracing started
+_Atomic(struct TraceRing *) trace_rings = NULL;
+pthread_key_t trace_ring_key; // Releases the ring of a thread when it exits
+__thread struct TraceRing *trace_ring = NULL;
+__thread int trace_tid = 0;
+__thread const char *trace_stage_name = NULL; // Job the thread is running, recorded when it ends
+__thread long long trace_stage_start = 0;
+__thread char trace_stage_detail[TRACE_DETAIL_LENGTH];
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the thread names and dumps
+int trace_thread_ids[TRACE_MAX_THREADS];
+char trace_thread_names[TRACE_MAX_THREADS][32];
+int num_trace_threads = 0;
+// Tracing costs a relaxed load and a branch per call site while it is off
+#define TRACE_START() (atomic_load_explicit(&trace_enabled, memory_order_relaxed) ? now_ns() : 0)
+#define TRACE_END(start, kind, name, bytes)                    \
+    do                                                         \
+    {                                                          \
+        if (start)                                             \
+            trace_event((kind), (name), (start), (bytes), NULL); \
+    } while (0)
+
+// Progress registry and metrics export
+pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+struct TransferProgress *progress_list = NULL;
+_Atomic long long files_completed = 0;
+_Atomic long long files_failed = 0;
+_Atomic long long bytes_completed = 0;
+char *metrics_path = NULL; // --metrics: JSON snapshot file
+int metrics_interval_ms = 1000;
+pthread_t progress_monitor;
+int progress_monitor_running = 0;
+_Atomic int progress_monitor_stop = 0;
+
+// Headless mode settings
+int run_mode = RUN_MODE_GUI;
+char *cli_source_dir = NULL;
+char *cli_dest_dir = NULL;
+char *cli_files[MAX_CLI_FILES];
+int cli_urgent[MAX_CLI_FILES]; // --urgent: these files jump the queue
+int num_cli_files = 0;
+char *bench_dir = "./bench_data";
+char *bench_sizes = "1,16,256";      // MB
+char *bench_buffers = "8,64,1024,4096"; // KB
+char *bench_workers = "1,2,4,8";
+int bench_files_per_size = 8;
+int bench_hot_set_mb = 0; // --bench-hot-set: size of the working set of the concurrent probe
+char *bench_output = NULL; // JSON lines go to stdout when not set
+#ifdef HAVE_LIBURING
+struct UringEngine uring_engine;
+#endif
+
+GtkWidget *main_grid; // Main grid for the main window
+GtkWidget *window;    // Main window
+
+// Function declarations
+void on_back_button_clicked(GtkWidget *button, gpointer data);
+gboolean on_window_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data);
+void on_file_toggled(GtkCellRendererToggle *renderer, gchar *path, gpointer data);
+void on_urgent_toggled(GtkCellRendererToggle *renderer, gchar *path, gpointer data);
+void on_rate_limit_changed(GtkSpinButton *spin_button, gpointer data);
+long long now_ns();
+long long thread_cpu_ns();
+int format_path(char *path, size_t size, const char *format, ...) __attribute__((format(printf, 3, 4)));
+struct TransferProgress *progress_register(const struct TransferJob *job);
+void progress_unregister(struct TransferProgress *progress);
+void progress_start(struct TransferProgress *progress);
+void progress_add(struct TransferProgress *progress, long long bytes, long long pipe_ns, long long disk_ns);
+long long token_bucket_reserve(struct TokenBucket *bucket, long long rate, long long bytes);
+void rate_limit_set(_Atomic long long *limit, long long rate);
+long long transfer_throttle_delay(struct TransferProgress *progress, long long bytes);
+void transfer_throttle(struct TransferProgress *progress, long long bytes);
+void progress_add_cap_wait(struct TransferProgress *progress, long long cap_ns);
+void control_file_poll();
+void progress_sample_locked(long long now);
+double progress_eta(const struct TransferProgress *progress);
+void json_write_string(FILE *file, const char *s);
+void write_metrics_snapshot();
+void *progress_monitor_thread(void *arg);
+void progress_monitor_start();
+void progress_monitor_stop_and_join();
+int trace_thread_id();
+void trace_thread_name(const char *format, ...);
+struct TraceRing *trace_ring_get();
+void trace_ring_release(void *ring);
+void trace_event(int kind, const char *name, long long start_ns, long long bytes, const char *detail);
+void trace_stage_begin(const char *name, const char *detail);
+void trace_stage_end();
+int trace_dump(const char *path);
+void trace_enable();
+void *trace_signal_thread(void *arg);
+void trace_signals_start();
+void trace_finish();
+gboolean on_progress_timer(gpointer data);
+double elapsed_seconds(const struct timespec *start);
+void crc32c_init();
+uint32_t gf2_matrix_times(const uint32_t *matrix, uint32_t vector);
+void gf2_matrix_square(uint32_t *square, const uint32_t *matrix);
+void crc32c_zeros_table(uint32_t table[4][256], size_t length);
+uint32_t crc32c_shift(uint32_t table[4][256], uint32_t crc);
+void crc32c_fold_pair(uint64_t pair[2], int bits);
+#if defined(__x86_64__)
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t length);
+__m512i crc32c_fold_512(__m512i x, __m512i constants, __m512i next);
+__m128i crc32c_fold_128(__m128i x, const uint64_t constants[2]);
+uint32_t crc32c_vpclmul(uint32_t crc, const unsigned char *data, size_t length);
+#endif
+void checksum_add(uint32_t *checksum, const void *data, size_t length);
+int buffer_pool_class(size_t size);
+void *buffer_pool_get(size_t size);
+void buffer_pool_put(void *buffer, size_t size);
+void block_sizer_start(struct BlockSizer *sizer, size_t default_size);
+void block_sizer_default(struct BlockSizer *sizer, size_t default_size);
+void block_sizer_update(struct BlockSizer *sizer, long long bytes);
+size_t block_sizer_finish(struct BlockSizer *sizer);
+int grow_pipe(int fd);
+void cache_window_start(struct CacheWindow *window, int fd, long long offset, int writing);
+void cache_window_try_direct(struct CacheWindow *window);
+void cache_window_end_direct(struct CacheWindow *window);
+void cache_window_advance(struct CacheWindow *window, long long bytes);
+void cache_window_finish(struct CacheWindow *window);
+long long buffered_copy(int in_fd, int out_fd, struct TransferProgress *progress, struct JournalEntry *journal, uint32_t *checksum,
+                        struct BlockSizer *sizer, struct CacheWindow *cache);
+long long splice_copy(int in_fd, int out_fd, int *unsupported, struct TransferProgress *progress, struct JournalEntry *journal,
+                      struct BlockSizer *sizer, struct CacheWindow *cache);
+long long copy_fd(int in_fd, int out_fd, struct TransferProgress *progress, struct JournalEntry *journal, uint32_t *checksum,
+                  struct BlockSizer *sizer, struct CacheWindow *cache, const char **mode);
+size_t name_key_hash(const char *key);
+void name_key(const char *filename, int base_length, char *key, size_t key_size);
+int name_copy_number(const char *filename, int *base_length, int *stem_length);
+struct NameSlot *name_allocator_slot_locked(struct NameAllocator *names, const char *key, int create);
+void name_allocator_note_locked(struct NameAllocator *names, const char *filename);
+void name_allocator_scan_locked(struct NameAllocator *names);
+struct NameAllocator *name_allocator_for_locked(const char *dest_dir);
+void name_allocators_invalidate();
+int place_destination_file(const char *dest_dir, const char *filename, const char *temp_path, char *final_file_path);
+struct TransferJournal *journal_for_locked(const char *dest_dir);
+void journal_load(struct TransferJournal *journal);
+void journal_save_locked(struct TransferJournal *journal);
+void journal_free_entry_locked(struct JournalEntry *entry);
+int journal_begin(struct TransferJob *job, const struct stat *source);
+void journal_checkpoint(struct JournalEntry *entry, int fd, long long offset);
+void journal_commit(struct JournalEntry *entry, long long offset);
+void journal_discard(struct JournalEntry *entry);
+void journal_add(struct JournalEntry *entry, int fd, long long bytes);
+void journal_prepare_chunks(struct JournalEntry *entry, long long size, long long chunk_bytes);
+int journal_chunk_is_done(struct JournalEntry *entry, long long offset, long long length);
+void journal_chunk_done(struct JournalEntry *entry, int fd, long long offset, long long length);
+int journal_finish(struct TransferJob *job, int result);
+int open_temp_file(struct TransferJob *job, long long keep_bytes);
+uint64_t rotl64(uint64_t value, int bits);
+uint64_t xxh64_round(uint64_t acc, uint64_t input);
+uint64_t xxh64_merge_round(uint64_t hash, uint64_t acc);
+uint64_t xxh64(const unsigned char *data, size_t length, uint64_t seed);
+int hash_file(const char *dir, const char *filename, long long size, uint64_t *hash);
+struct ContentIndex *content_index_for_locked(const char *dir, int destination);
+void content_index_load(struct ContentIndex *index);
+void content_index_scan_locked(struct ContentIndex *index);
+struct ContentEntry *content_index_find_locked(struct ContentIndex *index, const char *filename);
+void content_index_set_locked(struct ContentIndex *index, const char *filename, long long size, long long mtime_ns, uint64_t hash);
+void content_index_save_all();
+int content_hash(const char *dir, int destination, const char *filename, long long size, long long mtime_ns, uint64_t *hash);
+int files_identical(const char *path_a, const char *path_b, long long size);
+int content_size_known(const char *dest_dir, long long size);
+int content_find_match(const char *dest_dir, const char *source_path, long long size, uint64_t hash, char *match_name);
+int dedup_link(struct TransferJob *job, const char *existing_name, const struct stat *source, char *final_file_path, const char **how);
+int dedup_try(struct TransferJob *job, const struct stat *source);
+void dedup_record(struct TransferJob *job);
+int send_file(struct TransferJob *job, const char *fifo_name);
+int receive_file(struct TransferJob *job, const char *fifo_name);
+ssize_t read_full(int fd, void *buffer, size_t length);
+int write_full(int fd, const void *buffer, size_t length);
+const char *codec_name(int codec);
+size_t codec_bound(size_t length);
+int codec_available(int codec);
+size_t codec_compress(int codec, void *context, const unsigned char *data, size_t length, unsigned char *packed,
+                      size_t capacity, int level);
+int codec_decompress(int codec, void *context, const unsigned char *packed, size_t packed_length, unsigned char *data,
+                     size_t length);
+int compress_select(const char *name);
+int compress_choose(struct TransferJob *job, long long size);
+void *compress_thread(void *arg);
+struct Compressor *compressor_create();
+void compressor_destroy(struct Compressor *compressor);
+int compress_send(struct TransferJob *job, struct Compressor *compressor, int src_fd, int out_fd, long long length,
+                  struct TransferProgress *progress);
+long long compress_receive(int codec, int in_fd, int out_fd, long long length, int *status, long long *unpack_ns);
+void futex_wait(_Atomic int *addr, int value);
+void futex_wake(_Atomic int *addr);
+struct ShmRing *shm_ring_create(size_t capacity);
+void shm_ring_destroy(struct ShmRing *ring);
+void shm_ring_reset(struct ShmRing *ring);
+size_t shm_ring_wait_space(struct ShmRing *ring);
+void shm_ring_produce(struct ShmRing *ring, size_t count);
+size_t shm_ring_wait_data(struct ShmRing *ring);
+void shm_ring_consume(struct ShmRing *ring, size_t count);
+void shm_ring_close(struct ShmRing *ring, int state);
+int send_file_shm(struct TransferJob *job, struct ShmRing *ring);
+int receive_file_shm(struct TransferJob *job, struct ShmRing *ring);
+int transfer_file(struct TransferWorker *worker, struct TransferJob *job);
+int copy_range(int src_fd, int dest_fd, long long offset, long long length, struct TransferProgress *progress, int in_kernel);
+long long kernel_copy(int src_fd, int dest_fd, long long offset, long long length, struct TransferProgress *progress,
+                      struct JournalEntry *journal, int *unsupported);
+int kernel_copy_file(struct TransferJob *job, long long size);
+uint32_t load_be32(const unsigned char *p);
+uint64_t load_be64(const unsigned char *p);
+void store_be32(unsigned char *p, uint32_t value);
+void store_be64(unsigned char *p, uint64_t value);
+int video_probe(int fd, long long size, int *packet_size);
+int mp4_find_boxes(int fd, long long size, long long *moov_offset, long long *moov_size, long long *mdat_offset);
+int mp4_patch_offsets(unsigned char *data, long long length, long long from, long long to, long long shift);
+int segment_copy(int src_fd, long long src_offset, int dest_fd, long long dest_offset, long long length, int unit,
+                 struct TransferProgress *progress);
+int playable_copy_file(struct TransferJob *job, const struct stat *source);
+int sync_directories(struct TransferBatch *batch, const char *source_dir, const char *dest_dir, struct SyncStats *stats);
+int sync_try(struct TransferJob *job, const struct stat *source);
+long long mtime_granularity(const char *dir);
+int mtimes_match(const struct stat *source, const struct stat *dest, const char *dest_dir);
+void sync_record(struct TransferJob *job);
+void *sync_thread(void *arg);
+int start_chunked_copy(struct TransferJob *job, long long size);
+void chunk_finished(struct ChunkedCopy *copy, int result);
+int pwrite_full(int fd, const void *buffer, size_t length, long long offset);
+int net_resolve(const char *address, int passive, struct addrinfo **result);
+struct NetConnection *net_connect();
+void net_connection_close(struct NetConnection *connection);
+struct NetConnection *net_connection_for(struct TransferWorker *worker);
+void *net_reader_thread(void *arg);
+void net_complete(struct TransferJob *job, int status);
+int net_zerocopy_reap(struct NetConnection *connection, int wait);
+int net_send_zerocopy(struct NetConnection *connection, int src_fd, long long offset, long long length,
+                      struct TransferProgress *progress);
+int net_send_data(struct NetConnection *connection, int src_fd, long long offset, long long length,
+                  struct TransferProgress *progress);
+void net_send_request(struct TransferWorker *worker, struct TransferJob *job, int type, const char *filename, int src_fd,
+                      long long offset, long long length, long long file_size, long long mtime_ns);
+void net_send_file(struct TransferWorker *worker, struct TransferJob *job, const struct stat *source);
+void net_send_chunk(struct TransferWorker *worker, struct TransferJob *job);
+void net_send_commit(struct TransferWorker *worker, struct TransferJob *job);
+int net_serve_request(int fd, const struct NetRequest *request, const char *filename, unsigned char *buffer,
+                      struct NetPartialList *partials);
+void *net_serve_thread(void *arg);
+struct NetPartial *net_partial_find_locked(uint64_t id, const char *filename);
+int net_partial_attach(struct NetPartialList *partials, uint64_t id, const char *filename);
+void net_partial_finish(uint64_t id, const char *filename);
+void net_partial_release_all(struct NetPartialList *partials);
+int run_server();
+#ifdef HAVE_LIBURING
+int uring_engine_start();
+void uring_engine_stop();
+void uring_engine_submit(struct TransferJob *job);
+void uring_engine_open_file(struct UringEngine *engine, struct TransferJob *job);
+void uring_engine_close_file(struct UringEngine *engine, struct UringFile *file);
+int uring_engine_queue_op(struct UringEngine *engine, struct UringOp *op);
+void uring_engine_queue_sync(struct UringEngine *engine, struct UringFile *file, long long offset);
+long long uring_engine_fill(struct UringEngine *engine);
+void uring_engine_complete(struct UringEngine *engine, struct UringOp *op, int res);
+void uring_engine_wake(struct UringEngine *engine);
+void *uring_engine_thread(void *arg);
+#endif
+void *sender_thread(void *arg);
+void *transfer_thread(void *arg);
+void transfer_pool_start(int num_workers);
+void transfer_pool_stop();
+void transfer_pool_submit(struct TransferJob *job);
+void transfer_pool_submit_front(struct TransferJob *job);
+int transfer_pool_pick_locked();
+struct TransferJob *transfer_pool_next_job();
+struct TransferBatch *transfer_batch_new(int notify_gui);
+void transfer_batch_add(struct TransferBatch *batch, const struct FileInfo *file_info, const char *source_dir, const char *dest_dir);
+void transfer_batch_close(struct TransferBatch *batch);
+void transfer_batch_release(struct TransferBatch *batch);
+void transfer_job_finished(struct TransferJob *job, int result);
+int transfer_batch_wait(struct TransferBatch *batch);
+void transfer_batch_free(struct TransferBatch *batch);
+gboolean on_file_finished_idle(gpointer data);
+gboolean on_row_released_idle(gpointer data);
+gboolean on_batch_finished_idle(gpointer data);
+int compare_file_entries(const void *a, const void *b);
+int directory_index_find(const struct DirectoryIndex *index, const char *filename, int *found);
+int directory_index_stat(int dir_fd, const char *filename, struct FileEntry *entry);
+int directory_index_load(struct DirectoryIndex *index);
+void directory_index_refresh(struct DirectoryIndex *index, const char *filename);
+struct DirectoryIndex *directory_index_for(const char *path);
+void directory_watch_start();
+gboolean on_inotify_event(GIOChannel *channel, GIOCondition condition, gpointer data);
+void format_size(long long bytes, char *text, size_t size);
+void folder_store_set_entry(GtkListStore *store, GtkTreeIter *iter, const struct FileEntry *entry);
+void folder_store_fill(GtkListStore *store, const struct DirectoryIndex *index);
+void on_folder_view_destroyed(GtkWidget *widget, gpointer data);
+void folder_row_set_progress(GtkTreeRowReference *row, int percent, const char *text);
+void on_button_clicked(GtkWidget *button, gpointer data);
+void on_folder_button_clicked(GtkWidget *button, gpointer data);
+void on_sync_button_clicked(GtkWidget *button, gpointer data);
+void log_file_completed(const char *filename, long long bytes, double seconds, const char *how);
+void print_usage(const char *program);
+int default_worker_count();
+const char *transfer_engine_name();
+const char *transfer_transport_name();
+const char *transfer_mode_name();
+const char *cache_mode_name();
+long long meminfo_dirty_kb();
+void *bench_probe_thread(void *arg);
+double file_resident_percent(const char *path);
+int run_cli();
+int parse_number_list(const char *list, long long *values, int max_values);
+int create_bench_file(const char *path, long long size);
+void empty_directory(const char *dirname);
+int compare_doubles(const void *a, const void *b);
+int run_benchmark();
+void start_transfer_engine();
+void stop_transfer_engine();
+void parse_options(int argc, char *argv[]);
+
+// Function to handle the "delete-event" signal for the window
+gboolean on_window_delete_event(GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+    gtk_main_quit(); // Quit the GTK main loop when the window is closed
+    return TRUE;     // Prevent the default destroy signal handler from executing
+}
+
+// Callback function to handle a click on the checkbox column of the folder view
+void on_file_toggled(GtkCellRendererToggle *renderer, gchar *path, gpointer data)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(data);
+    GtkTreeIter iter;
+    gboolean selected;
+    if (!gtk_tree_model_get_iter_from_string(model, &iter, path))
+        return;
+    gtk_tree_model_get(model, &iter, FILE_COLUMN_SELECTED, &selected, -1);
+    gtk_list_store_set(GTK_LIST_STORE(model), &iter, FILE_COLUMN_SELECTED, !selected, -1);
+}
+
+// Callback function to flag a file as urgent; flagging it also ticks it
+void on_urgent_toggled(GtkCellRendererToggle *renderer, gchar *path, gpointer data)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(data);
+    GtkTreeIter iter;
+    gboolean urgent;
+    if (!gtk_tree_model_get_iter_from_string(model, &iter, path))
+        return;
+    gtk_tree_model_get(model, &iter, FILE_COLUMN_URGENT, &urgent, -1);
+    gtk_list_store_set(GTK_LIST_STORE(model), &iter, FILE_COLUMN_URGENT, !urgent, -1);
+    if (!urgent)
+        gtk_list_store_set(GTK_LIST_STORE(model), &iter, FILE_COLUMN_SELECTED, TRUE, -1);
+}
+
+// Callback function to apply a bandwidth cap from its spin button right away;
+// data points to total_rate_limit or batch_rate_limit
+void on_rate_limit_changed(GtkSpinButton *spin_button, gpointer data)
+{
+    rate_limit_set(data, (long long)(gtk_spin_button_get_value(spin_button) * 1024 * 1024));
+}
+
+// Function to read the monotonic clock in nanoseconds
+long long now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Function to read the CPU time used by the calling thread in nanoseconds
+long long thread_cpu_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Function to format a path into the size bytes at path. A truncated path could name
+// another file, so one that does not fit is an error rather than cut short
+// Returns 0 on success, -1 with errno set to ENAMETOOLONG if it does not fit
+int format_path(char *path, size_t size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(path, size, format, args);
+    va_end(args);
+    if (length < 0 || (size_t)length >= size)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+// Function to create the progress record of a queued job and add it to the registry
+// Returns NULL if it could not be allocated; the transfer then runs without progress
+struct TransferProgress *progress_register(const struct TransferJob *job)
+{
+    struct TransferProgress *progress = calloc(1, sizeof(struct TransferProgress));
+    if (progress == NULL)
+        return NULL;
+    snprintf(progress->filename, sizeof(progress->filename), "%s", job->file.filename);
+    snprintf(progress->source_dir, sizeof(progress->source_dir), "%s", job->source_dir);
+    snprintf(progress->dest_dir, sizeof(progress->dest_dir), "%s", job->dest_dir);
+
+    char full_file_path[MAX_PATH_LENGTH];
+    struct stat st;
+    progress->total_bytes = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir,
+                                        job->file.filename) == 0 && stat(full_file_path, &st) == 0
+                                ? st.st_size
+                                : 0;
+    progress->row = job->file.row;
+    progress->batch = job->batch;
+    atomic_store(&progress->state, PROGRESS_QUEUED);
+
+    pthread_mutex_lock(&progress_lock);
+    progress->next = progress_list;
+    if (progress_list)
+        progress_list->prev = progress;
+    progress_list = progress;
+    pthread_mutex_unlock(&progress_lock);
+    return progress;
+}
+
+// Function to remove a finished record from the registry and free it
+void progress_unregister(struct TransferProgress *progress)
+{
+    pthread_mutex_lock(&progress_lock);
+    if (progress->prev)
+        progress->prev->next = progress->next;
+    else
+        progress_list = progress->next;
+    if (progress->next)
+        progress->next->prev = progress->prev;
+    pthread_mutex_unlock(&progress_lock);
+    free(progress);
+}
+
+// Function to mark a job as started
+void progress_start(struct TransferProgress *progress)
+{
+    if (progress == NULL)
+        return;
+    atomic_store(&progress->start_ns, now_ns());
+    atomic_store(&progress->state, PROGRESS_RUNNING);
+}
+
+// Function to account bytes copied and time spent waiting on the pipe and on the disk
+// Called from the copy loops, so it only does relaxed atomic adds
+void progress_add(struct TransferProgress *progress, long long bytes, long long pipe_ns, long long disk_ns)
+{
+    if (progress == NULL)
+        return;
+    atomic_fetch_add_explicit(&progress->bytes_done, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&progress->wait_pipe_ns, pipe_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&progress->wait_disk_ns, disk_ns, memory_order_relaxed);
+}
+
+// Function to account time a copy was held back by a bandwidth cap
+void progress_add_cap_wait(struct TransferProgress *progress, long long cap_ns)
+{
+    if (progress == NULL)
+        return;
+    atomic_fetch_add_explicit(&progress->wait_cap_ns, cap_ns, memory_order_relaxed);
+}
+
+// Function to grant bytes at rate bytes per second from bucket
+// Returns how long the caller must wait before the grant is within the cap
+long long token_bucket_reserve(struct TokenBucket *bucket, long long rate, long long bytes)
+{
+    long long now = now_ns();
+    long long generation = atomic_load(&rate_limit_generation);
+    pthread_mutex_lock(&bucket->lock);
+    // Time left unused after a pause only counts up to THROTTLE_BURST_NS, and a
+    // backlog granted at an old cap is dropped rather than paid at the new one
+    if (bucket->next_free_ns < now - THROTTLE_BURST_NS || bucket->generation != generation)
+        bucket->next_free_ns = now - THROTTLE_BURST_NS;
+    bucket->generation = generation;
+    bucket->next_free_ns += (long long)(bytes * 1e9 / rate);
+    long long wait = bucket->next_free_ns - now;
+    pthread_mutex_unlock(&bucket->lock);
+    return wait;
+}
+
+// Function to change a bandwidth cap and cut short every wait made under the old one
+void rate_limit_set(_Atomic long long *limit, long long rate)
+{
+    atomic_store(limit, rate);
+    pthread_mutex_lock(&rate_limit_lock);
+    atomic_fetch_add(&rate_limit_generation, 1);
+    pthread_cond_broadcast(&rate_limit_changed);
+    pthread_mutex_unlock(&rate_limit_lock);
+#ifdef HAVE_LIBURING
+    if (transfer_engine == TRANSFER_ENGINE_URING)
+        uring_engine_wake(&uring_engine);
+#endif
+}
+
+// Function to charge bytes a receiver just wrote to the overall and its batch's
+// bandwidth cap. Returns how long it must hold off for them to fit under both
+long long transfer_throttle_delay(struct TransferProgress *progress, long long bytes)
+{
+    long long total_rate = atomic_load_explicit(&total_rate_limit, memory_order_relaxed);
+    long long batch_rate = atomic_load_explicit(&batch_rate_limit, memory_order_relaxed);
+    if (progress == NULL || bytes <= 0 || (total_rate == 0 && batch_rate == 0))
+        return 0;
+
+    long long wait = 0;
+    if (total_rate > 0)
+        wait = token_bucket_reserve(&total_bucket, total_rate, bytes);
+    if (batch_rate > 0 && progress->batch)
+    {
+        long long batch_wait = token_bucket_reserve(&progress->batch->bucket, batch_rate, bytes);
+        if (batch_wait > wait)
+            wait = batch_wait;
+    }
+    return wait;
+}
+
+// Function to hold a receiver that just wrote bytes until they fit under the
+// bandwidth caps. The sender is slowed by the full pipe or ring. A cap change
+// ends the wait early, so a raised cap takes effect at once
+void transfer_throttle(struct TransferProgress *progress, long long bytes)
+{
+    long long wait = transfer_throttle_delay(progress, bytes);
+    if (wait <= 0)
+        return;
+
+    long long t0 = now_ns();
+    long long trace_start = TRACE_START();
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait / 1000000000LL + (deadline.tv_nsec + wait % 1000000000LL) / 1000000000LL;
+    deadline.tv_nsec = (deadline.tv_nsec + wait % 1000000000LL) % 1000000000LL;
+    pthread_mutex_lock(&rate_limit_lock);
+    long long generation = atomic_load(&rate_limit_generation);
+    while (atomic_load(&rate_limit_generation) == generation &&
+           pthread_cond_timedwait(&rate_limit_changed, &rate_limit_lock, &deadline) != ETIMEDOUT)
+        ;
+    pthread_mutex_unlock(&rate_limit_lock);
+    TRACE_END(trace_start, TRACE_WAIT, "bandwidth cap", bytes);
+    progress_add_cap_wait(progress, now_ns() - t0);
+}
+
+// Function to re-read --control when it changed. Lines are "total_mbps N" and
+// "batch_mbps N"; 0 removes the cap
+void control_file_poll()
+{
+    struct stat st;
+    if (control_path == NULL || stat(control_path, &st) == -1 ||
+        st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec == control_mtime_ns)
+        return;
+    control_mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    FILE *file = fopen(control_path, "r");
+    if (file == NULL)
+        return;
+    char line[128];
+    double value;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "total_mbps %lf", &value) == 1 && value >= 0)
+            rate_limit_set(&total_rate_limit, (long long)(value * 1024 * 1024));
+        else if (sscanf(line, "batch_mbps %lf", &value) == 1 && value >= 0)
+            rate_limit_set(&batch_rate_limit, (long long)(value * 1024 * 1024));
+    }
+    fclose(file);
+    fprintf(stderr, "Bandwidth caps: total %.1f MB/s, per batch %.1f MB/s (0 = none)\n",
+            atomic_load(&total_rate_limit) / (1024.0 * 1024.0), atomic_load(&batch_rate_limit) / (1024.0 * 1024.0));
+}
+
+// Function to refresh the smoothed rate of every record; called with progress_lock held
+void progress_sample_locked(long long now)
+{
+    for (struct TransferProgress *progress = progress_list; progress; progress = progress->next)
+    {
+        long long bytes = atomic_load_explicit(&progress->bytes_done, memory_order_relaxed);
+        if (progress->sample_ns != 0 && now > progress->sample_ns)
+        {
+            double instant = (bytes - progress->sample_bytes) * 1e9 / (now - progress->sample_ns);
+            progress->rate = progress->rate == 0 ? instant : 0.5 * progress->rate + 0.5 * instant;
+        }
+        progress->sample_bytes = bytes;
+        progress->sample_ns = now;
+    }
+}
+
+// Function to estimate the seconds left for a record, or -1 when unknown
+double progress_eta(const struct TransferProgress *progress)
+{
+    long long left = progress->total_bytes - atomic_load_explicit(&progress->bytes_done, memory_order_relaxed);
+    if (left <= 0)
+        return 0;
+    return progress->rate > 0 ? left / progress->rate : -1;
+}
+
+// Function to write s as a JSON string literal
+void json_write_string(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+// Function to write a snapshot of all transfers to metrics_path
+// The snapshot is written to a temporary file and renamed, so readers never see a partial file
+void write_metrics_snapshot()
+{
+    char tmp_path[MAX_PATH_LENGTH];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics_path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        perror("Error writing metrics snapshot");
+        return;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    long long now = now_ns();
+    fprintf(file, "{\"timestamp\":%lld.%03ld,\"files_completed\":%lld,\"files_failed\":%lld,\"bytes_completed\":%lld,\"files\":[",
+            (long long)wall.tv_sec, wall.tv_nsec / 1000000, atomic_load(&files_completed),
+            atomic_load(&files_failed), atomic_load(&bytes_completed));
+
+    pthread_mutex_lock(&progress_lock);
+    for (struct TransferProgress *progress = progress_list; progress; progress = progress->next)
+    {
+        int state = atomic_load(&progress->state);
+        long long start = atomic_load(&progress->start_ns);
+        fprintf(file, "%s{\"file\":", progress == progress_list ? "" : ",");
+        json_write_string(file, progress->filename);
+        fprintf(file, ",\"source\":");
+        json_write_string(file, progress->source_dir);
+        fprintf(file, ",\"dest\":");
+        json_write_string(file, progress->dest_dir);
+        fprintf(file, ",\"state\":\"%s\",\"bytes\":%lld,\"total\":%lld,\"mb_per_s\":%.2f,\"eta_s\":%.1f,"
+                      "\"elapsed_s\":%.3f,\"wait_pipe_s\":%.3f,\"wait_disk_s\":%.3f,\"wait_cap_s\":%.3f}",
+                state == PROGRESS_QUEUED ? "queued" : state == PROGRESS_RUNNING ? "running" : state == PROGRESS_DONE ? "done" : "failed",
+                atomic_load(&progress->bytes_done), progress->total_bytes, progress->rate / (1024.0 * 1024.0),
+                progress_eta(progress), start ? (now - start) / 1e9 : 0.0,
+                atomic_load(&progress->wait_pipe_ns) / 1e9, atomic_load(&progress->wait_disk_ns) / 1e9,
+                atomic_load(&progress->wait_cap_ns) / 1e9);
+    }
+    pthread_mutex_unlock(&progress_lock);
+
+    fprintf(file, "]}\n");
+    if (fclose(file) == 0 && rename(tmp_path, metrics_path) == -1)
+        perror("Error publishing metrics snapshot");
+}
+
+// Progress monitor thread: updates the transfer rates and writes the metrics snapshot
+void *progress_monitor_thread(void *arg)
+{
+    trace_thread_name("progress monitor");
+    while (!atomic_load(&progress_monitor_stop))
+    {
+        pthread_mutex_lock(&progress_lock);
+        progress_sample_locked(now_ns());
+        pthread_mutex_unlock(&progress_lock);
+        if (metrics_path)
+            write_metrics_snapshot();
+        control_file_poll();
+
+        struct timespec interval = {metrics_interval_ms / 1000, (metrics_interval_ms % 1000) * 1000000L};
+        nanosleep(&interval, NULL);
+    }
+    if (metrics_path)
+        write_metrics_snapshot();
+    return NULL;
+}
+
+// Function to start the progress monitor thread
+void progress_monitor_start()
+{
+    atomic_store(&progress_monitor_stop, 0);
+    if (pthread_create(&progress_monitor, NULL, progress_monitor_thread, NULL) != 0)
+    {
+        perror("Error creating progress monitor thread");
+        return;
+    }
+    progress_monitor_running = 1;
+}
+
+// Function to stop the progress monitor thread, writing a final snapshot
+void progress_monitor_stop_and_join()
+{
+    if (!progress_monitor_running)
+        return;
+    atomic_store(&progress_monitor_stop, 1);
+    pthread_join(progress_monitor, NULL);
+    progress_monitor_running = 0;
+}
+
+// Function to return the kernel thread id of the calling thread, as shown in the trace
+int trace_thread_id()
+{
+    if (trace_tid == 0)
+        trace_tid = (int)syscall(SYS_gettid);
+    return trace_tid;
+}
+
+// Function to name the calling thread in the trace
+void trace_thread_name(const char *format, ...)
+{
+    int tid = trace_thread_id();
+    pthread_mutex_lock(&trace_lock);
+    int i = 0;
+    // Thread ids are reused, and so is their slot
+    while (i < num_trace_threads && trace_thread_ids[i] != tid)
+        i++;
+    if (i < TRACE_MAX_THREADS)
+    {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(trace_thread_names[i], sizeof(trace_thread_names[i]), format, args);
+        va_end(args);
+        trace_thread_ids[i] = tid;
+        if (i == num_trace_threads)
+            num_trace_threads++;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Function to return the event ring of the calling thread, taking over a released one
+// or allocating one the first time the thread records an event
+// Returns NULL if it could not be allocated
+struct TraceRing *trace_ring_get()
+{
+    if (trace_ring)
+        return trace_ring;
+
+    struct TraceRing *ring;
+    for (ring = atomic_load(&trace_rings); ring; ring = ring->next)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&ring->in_use, &expected, 1))
+            break;
+    }
+    if (ring == NULL)
+    {
+        // Events are only read below head, so they need no initialization
+        if ((ring = aligned_alloc(_Alignof(struct TraceRing), sizeof(struct TraceRing))) == NULL)
+        {
+            perror("Error allocating trace ring");
+            return NULL;
+        }
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->in_use, 1);
+        ring->next = atomic_load(&trace_rings);
+        while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring))
+            ;
+    }
+    pthread_setspecific(trace_ring_key, ring);
+    trace_ring = ring;
+    return ring;
+}
+
+// Function to hand the ring of an exiting thread to the next thread that records
+void trace_ring_release(void *ring)
+{
+    atomic_store(&((struct TraceRing *)ring)->in_use, 0);
+}
+
+// Function to record an event of the calling thread that started at start_ns and ends now
+// bytes is -1 and detail NULL when they do not apply
+void trace_event(int kind, const char *name, long long start_ns, long long bytes, const char *detail)
+{
+    long long end_ns = now_ns();
+    struct TraceRing *ring = trace_ring_get();
+    if (ring == NULL)
+        return;
+
+    unsigned long long n = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct TraceEvent *event = &ring->events[n & (TRACE_RING_EVENTS - 1)];
+    atomic_store_explicit(&event->seq, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->name = name;
+    event->start_ns = start_ns;
+    event->duration_ns = end_ns - start_ns;
+    event->bytes = bytes;
+    event->tid = trace_thread_id();
+    event->kind = kind;
+    size_t length = detail ? strnlen(detail, TRACE_DETAIL_LENGTH - 1) : 0;
+    memcpy(event->detail, detail ? detail : "", length);
+    event->detail[length] = '\0';
+    atomic_store_explicit(&event->seq, 2 * n + 2, memory_order_release);
+    atomic_store_explicit(&ring->head, n + 1, memory_order_release);
+}
+
+// Function to open the span of the job the calling thread starts on
+// It is recorded by trace_stage_end(), whichever way the job ends
+void trace_stage_begin(const char *name, const char *detail)
+{
+    trace_stage_name = name;
+    trace_stage_start = TRACE_START();
+    if (trace_stage_start)
+        snprintf(trace_stage_detail, sizeof(trace_stage_detail), "%.*s", (int)sizeof(trace_stage_detail) - 1, detail);
+}
+
+// Function to record the span of the job the calling thread ran, if any
+void trace_stage_end()
+{
+    if (trace_stage_start)
+        trace_event(TRACE_STAGE, trace_stage_name, trace_stage_start, -1, trace_stage_detail);
+    trace_stage_start = 0;
+}
+
+// Function to write the events in every thread's ring as Chrome trace JSON, which
+// chrome://tracing and Perfetto open. Threads keep recording while it runs
+// Returns the number of events written, or -1 on failure
+int trace_dump(const char *path)
+{
+    static const char *categories[] = {"stage", "io", "wait"};
+    char tmp_path[MAX_PATH_LENGTH];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    pthread_mutex_lock(&trace_lock);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        perror("Error writing trace");
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+
+    int pid = getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"file_transfer\"}}",
+            pid, pid);
+    for (int i = 0; i < num_trace_threads; i++)
+    {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid,
+                trace_thread_ids[i]);
+        json_write_string(file, trace_thread_names[i]);
+        fprintf(file, "}}");
+    }
+
+    int count = 0;
+    for (struct TraceRing *ring = atomic_load(&trace_rings); ring; ring = ring->next)
+    {
+        unsigned long long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (unsigned long long n = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0; n < head; n++)
+        {
+            // Copy the event, then make sure it was not overwritten meanwhile
+            struct TraceEvent *event = &ring->events[n & (TRACE_RING_EVENTS - 1)];
+            if (atomic_load_explicit(&event->seq, memory_order_acquire) != 2 * n + 2)
+                continue;
+            const char *name = event->name;
+            long long start_ns = event->start_ns;
+            long long duration_ns = event->duration_ns;
+            long long bytes = event->bytes;
+            int tid = event->tid;
+            int kind = event->kind;
+            char detail[TRACE_DETAIL_LENGTH];
+            memcpy(detail, event->detail, sizeof(detail));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&event->seq, memory_order_relaxed) != 2 * n + 2)
+                continue;
+            detail[sizeof(detail) - 1] = '\0';
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                    name, categories[kind], pid, tid, (start_ns - trace_epoch_ns) / 1e3, duration_ns / 1e3);
+            if (bytes >= 0)
+                fprintf(file, "\"bytes\":%lld%s", bytes, detail[0] ? "," : "");
+            if (detail[0])
+            {
+                fprintf(file, "\"file\":");
+                json_write_string(file, detail);
+            }
+            fprintf(file, "}}");
+            count++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0 || rename(tmp_path, path) == -1)
+    {
+        perror("Error publishing trace");
+        count = -1;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return count;
+}
+
+// Function to start recording events; they are dumped to trace_path, or to
+// trace_default_path when --trace was not given
+void trace_enable()
+{
+    if (trace_path == NULL)
+        trace_path = trace_default_path;
+    trace_epoch_ns = now_ns();
+    atomic_store(&trace_enabled, 1);
+}
+
+// Trace signal thread: the first SIGUSR1 starts tracing unless --trace did, each
+// one after that dumps the trace
+void *trace_signal_thread(void *arg)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    while (1)
+    {
+        int signal_number;
+        if (sigwait(&signals, &signal_number) != 0)
+            continue;
+        if (!atomic_load(&trace_enabled))
+        {
+            trace_enable();
+            printf("Tracing started; send SIGUSR1 again to write %s\n", trace_path);
+        }
+        else
+        {
+            int count = trace_dump(trace_path);
+            if (count >= 0)
+                printf("Wrote %d trace events to %s\n", count, trace_path);
+        }
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+// Function to hand SIGUSR1 to the trace signal thread
+// Called before any other thread is created, so that they all inherit the blocked signal
+void trace_signals_start()
+{
+    pthread_key_create(&trace_ring_key, trace_ring_release);
+    snprintf(trace_default_path, sizeof(trace_default_path), TRACE_DEFAULT_PATH, (int)getpid());
+    trace_thread_name("main");
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, trace_signal_thread, NULL) != 0)
+    {
+        perror("Error creating trace signal thread");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Function to write the trace on exit if tracing was started
+void trace_finish()
+{
+    if (!atomic_load(&trace_enabled))
+        return;
+    int count = trace_dump(trace_path);
+    if (count >= 0)
+        printf("Wrote %d trace events to %s\n", count, trace_path);
+}
+
+// Timer callback on the GUI thread that refreshes the progress bars
+gboolean on_progress_timer(gpointer data)
+{
+    pthread_mutex_lock(&progress_lock);
+    for (struct TransferProgress *progress = progress_list; progress; progress = progress->next)
+    {
+        if (progress->row == NULL || atomic_load(&progress->state) != PROGRESS_RUNNING)
+            continue;
+
+        long long bytes = atomic_load_explicit(&progress->bytes_done, memory_order_relaxed);
+        double fraction = progress->total_bytes > 0 ? (double)bytes / progress->total_bytes : 0.0;
+        double eta = progress_eta(progress);
+        char text[128];
+        if (eta >= 0)
+            snprintf(text, sizeof(text), "%.0f%%  %.1f MB/s  ETA %.0fs  (wait pipe %.1fs, disk %.1fs, cap %.1fs)",
+                     fraction * 100, progress->rate / (1024.0 * 1024.0), eta,
+                     atomic_load(&progress->wait_pipe_ns) / 1e9, atomic_load(&progress->wait_disk_ns) / 1e9,
+                     atomic_load(&progress->wait_cap_ns) / 1e9);
+        else
+            snprintf(text, sizeof(text), "%.0f%%", fraction * 100);
+        folder_row_set_progress(progress->row, fraction > 1 ? 100 : (int)(fraction * 100), text);
+    }
+    pthread_mutex_unlock(&progress_lock);
+    return G_SOURCE_CONTINUE;
+}
+
+// Function to update the progress column of a folder view row, if the row still exists
+void folder_row_set_progress(GtkTreeRowReference *row, int percent, const char *text)
+{
+    GtkTreePath *path = gtk_tree_row_reference_get_path(row);
+    if (path == NULL)
+        return;
+    GtkTreeModel *model = gtk_tree_row_reference_get_model(row);
+    GtkTreeIter iter;
+    if (gtk_tree_model_get_iter(model, &iter, path))
+    {
+        if (percent >= 0)
+            gtk_list_store_set(GTK_LIST_STORE(model), &iter, FILE_COLUMN_PROGRESS, percent, -1);
+        gtk_list_store_set(GTK_LIST_STORE(model), &iter, FILE_COLUMN_STATUS, text, -1);
+    }
+    gtk_tree_path_free(path);
+}
+
+// Function to return the number of seconds elapsed since start
+double elapsed_seconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Function to log a finished file with its throughput, unless per-file logging is off
+void log_file_completed(const char *filename, long long bytes, double seconds, const char *how)
+{
+    if (quiet_transfers)
+        return;
+    printf("Receiver for file %s completed: %lld bytes in %.3f s (%.2f MB/s, %s)\n",
+           filename, bytes, seconds, seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0.0, how);
+}
+
+// Function to multiply a 32x32 GF(2) matrix by a vector
+uint32_t gf2_matrix_times(const uint32_t *matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    while (vector)
+    {
+        if (vector & 1)
+            sum ^= *matrix;
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+// Function to square a 32x32 GF(2) matrix
+void gf2_matrix_square(uint32_t *square, const uint32_t *matrix)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+}
+
+// Function to build the table that appends length zero bytes (a power of two) to a CRC
+// It is used to join the CRCs of the interleaved streams into one
+void crc32c_zeros_table(uint32_t table[4][256], size_t length)
+{
+    uint32_t odd[32], even[32];
+    odd[0] = CRC32C_POLY; // Operator for one zero bit
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1U << (n - 1);
+    gf2_matrix_square(even, odd); // Two zero bits
+    gf2_matrix_square(odd, even); // Four zero bits
+    uint32_t *op = odd;
+    while (1)
+    {
+        // Each squaring doubles the number of zero bytes, starting from one
+        gf2_matrix_square(even, odd);
+        op = even;
+        if ((length >>= 1) == 0)
+            break;
+        gf2_matrix_square(odd, even);
+        op = odd;
+        if ((length >>= 1) == 0)
+            break;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        table[0][n] = gf2_matrix_times(op, n);
+        table[1][n] = gf2_matrix_times(op, n << 8);
+        table[2][n] = gf2_matrix_times(op, n << 16);
+        table[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+// Function to apply a zeros table to crc
+uint32_t crc32c_shift(uint32_t table[4][256], uint32_t crc)
+{
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+// Function to compute the carry-less multipliers that fold a bit-reflected 128-bit
+// value bits further along the message. The low half of the value holds the higher
+// powers of x, so it is multiplied by x^(bits + 64) and the high half by x^bits,
+// both reduced modulo the polynomial and taken one power lower because a
+// carry-less product of two reflected values comes out one bit short
+void crc32c_fold_pair(uint64_t pair[2], int bits)
+{
+    int powers[2] = {bits + 63, bits - 1};
+    for (int half = 0; half < 2; half++)
+    {
+        uint32_t value = 0x80000000U; // x^0, bit-reflected
+        for (int n = 0; n < powers[half]; n++)
+            value = (value >> 1) ^ (CRC32C_POLY & -(value & 1));
+        pair[half] = (uint64_t)value << 32;
+    }
+}
+
+// Function to build the slicing-by-8 tables of the software CRC32C and pick the
+// SSE4.2 instruction, or carry-less multiplies, when the CPU has them
+void crc32c_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        crc32c_table[0][i] = crc;
+    }
+    for (int slice = 1; slice < 8; slice++)
+    {
+        for (int i = 0; i < 256; i++)
+            crc32c_table[slice][i] = (crc32c_table[slice - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[slice - 1][i] & 0xFF];
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_zeros_table(crc32c_long_shift, CRC32C_LONG_BLOCK);
+        crc32c_zeros_table(crc32c_short_shift, CRC32C_SHORT_BLOCK);
+        crc32c_update = crc32c_sse42;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("vpclmulqdq") && __builtin_cpu_supports("pclmul"))
+    {
+        const int distances[5] = {2048, 512, 384, 256, 128};
+        for (int i = 0; i < 5; i++)
+            crc32c_fold_pair(crc32c_fold_constants[i], distances[i]);
+        crc32c_update = crc32c_vpclmul;
+    }
+#endif
+}
+
+// Function to extend crc over length bytes of data, eight bytes per step with table lookups
+uint32_t crc32c_software(uint32_t crc, const unsigned char *data, size_t length)
+{
+    while (length > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xFF];
+        length--;
+    }
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xFF] ^ crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^ crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Function to extend crc with the SSE4.2 crc32 instruction, eight bytes per instruction
+// The instruction has a latency of three cycles but can start every cycle, so large
+// inputs are hashed as three interleaved streams whose CRCs are joined afterwards
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t length)
+{
+    uint64_t crc64 = crc;
+    while (length > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *data++);
+        length--;
+    }
+
+    const size_t blocks[2] = {CRC32C_LONG_BLOCK, CRC32C_SHORT_BLOCK};
+    for (int b = 0; b < 2; b++)
+    {
+        size_t block = blocks[b];
+        while (length >= block * 3)
+        {
+            uint64_t crc1 = 0, crc2 = 0;
+            for (const unsigned char *end = data + block; data < end; data += 8)
+            {
+                uint64_t word0, word1, word2;
+                memcpy(&word0, data, 8);
+                memcpy(&word1, data + block, 8);
+                memcpy(&word2, data + block * 2, 8);
+                crc64 = __builtin_ia32_crc32di(crc64, word0);
+                crc1 = __builtin_ia32_crc32di(crc1, word1);
+                crc2 = __builtin_ia32_crc32di(crc2, word2);
+            }
+            uint32_t (*shift)[256] = b == 0 ? crc32c_long_shift : crc32c_short_shift;
+            crc64 = crc32c_shift(shift, (uint32_t)crc64) ^ (uint32_t)crc1;
+            crc64 = crc32c_shift(shift, (uint32_t)crc64) ^ (uint32_t)crc2;
+            data += block * 2;
+            length -= block * 3;
+        }
+    }
+
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+        crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *data++);
+    return (uint32_t)crc64;
+}
+#endif
+
+#if defined(__x86_64__)
+// Function to fold the four 128-bit lanes of x as far as constants say and add next
+__attribute__((target("avx512f,vpclmulqdq"))) __m512i crc32c_fold_512(__m512i x, __m512i constants, __m512i next)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, constants, 0x00),
+                                     _mm512_clmulepi64_epi128(x, constants, 0x11), next, 0x96); // a ^ b ^ c
+}
+
+// Function to fold one 128-bit value as far as constants say
+__attribute__((target("pclmul,sse4.1"))) __m128i crc32c_fold_128(__m128i x, const uint64_t constants[2])
+{
+    __m128i multipliers = _mm_set_epi64x((long long)constants[1], (long long)constants[0]);
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, multipliers, 0x00), _mm_clmulepi64_si128(x, multipliers, 0x11));
+}
+
+// Function to extend crc over length bytes of data with carry-less multiplies: four
+// 512-bit accumulators fold 256 bytes per step, about four times the rate of the
+// crc32 instruction. They are then folded into one 128-bit value, which crc32
+// reduces, and crc32c_sse42() takes the remaining bytes
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"))) uint32_t crc32c_vpclmul(uint32_t crc, const unsigned char *data, size_t length)
+{
+    if (length < CRC32C_FOLD_MIN)
+        return crc32c_sse42(crc, data, length);
+
+    // The CRC so far joins the message by being added to its first four bytes
+    __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(data), _mm512_maskz_set1_epi32(1, (int)crc));
+    __m512i x1 = _mm512_loadu_si512(data + 64);
+    __m512i x2 = _mm512_loadu_si512(data + 128);
+    __m512i x3 = _mm512_loadu_si512(data + 192);
+    data += 256;
+    length -= 256;
+    const uint64_t *k = crc32c_fold_constants[0];
+    __m512i fold_2048 = _mm512_broadcast_i32x4(_mm_set_epi64x((long long)k[1], (long long)k[0]));
+    while (length >= 256)
+    {
+        x0 = crc32c_fold_512(x0, fold_2048, _mm512_loadu_si512(data));
+        x1 = crc32c_fold_512(x1, fold_2048, _mm512_loadu_si512(data + 64));
+        x2 = crc32c_fold_512(x2, fold_2048, _mm512_loadu_si512(data + 128));
+        x3 = crc32c_fold_512(x3, fold_2048, _mm512_loadu_si512(data + 192));
+        data += 256;
+        length -= 256;
+    }
+
+    k = crc32c_fold_constants[1];
+    __m512i fold_512 = _mm512_broadcast_i32x4(_mm_set_epi64x((long long)k[1], (long long)k[0]));
+    x1 = crc32c_fold_512(x0, fold_512, x1);
+    x2 = crc32c_fold_512(x1, fold_512, x2);
+    x3 = crc32c_fold_512(x2, fold_512, x3);
+    __m128i value = _mm512_extracti32x4_epi32(x3, 3);
+    value = _mm_xor_si128(value, crc32c_fold_128(_mm512_extracti32x4_epi32(x3, 0), crc32c_fold_constants[2]));
+    value = _mm_xor_si128(value, crc32c_fold_128(_mm512_extracti32x4_epi32(x3, 1), crc32c_fold_constants[3]));
+    value = _mm_xor_si128(value, crc32c_fold_128(_mm512_extracti32x4_epi32(x3, 2), crc32c_fold_constants[4]));
+
+    uint64_t crc64 = __builtin_ia32_crc32di(0, (uint64_t)_mm_cvtsi128_si64(value));
+    crc64 = __builtin_ia32_crc32di(crc64, (uint64_t)_mm_extract_epi64(value, 1));
+
+    // GCC emits no vzeroupper before the tail call. Left dirty, the upper halves of the
+    // zmm registers slow down every later SSE instruction and every context switch
+    // has to save them: about 200 ns per call, and a quarter of the rate on 256 KB
+    _mm256_zeroupper();
+    return crc32c_sse42((uint32_t)crc64, data, length);
+}
+#endif
+
+// Function to add data that went through one side of a transfer to its running checksum
+// Only called in --verify mode; the time spent is kept for the throughput report
+void checksum_add(uint32_t *checksum, const void *data, size_t length)
+{
+    long long t0 = now_ns();
+    *checksum = crc32c_update(*checksum, data, length);
+    atomic_fetch_add_explicit(&checksum_ns, now_ns() - t0, memory_order_relaxed);
+}
+
+// Function to find the pool size class of a buffer of size bytes: the smallest
+// power of two that holds it, never below one page
+int buffer_pool_class(size_t size)
+{
+    int size_class = 12;
+    while (((size_t)1 << size_class) < size)
+        size_class++;
+    return size_class;
+}
+
+// Function to take a page-aligned buffer of at least size bytes from the pool,
+// allocating one when the pool has none. Returns NULL on failure
+void *buffer_pool_get(size_t size)
+{
+    int size_class = buffer_pool_class(size);
+    void *buffer = NULL;
+    if (size_class < BUFFER_POOL_CLASSES)
+    {
+        pthread_mutex_lock(&buffer_pool_lock);
+        if ((buffer = buffer_pool_free[size_class]) != NULL)
+        {
+            buffer_pool_free[size_class] = *(void **)buffer;
+            buffer_pool_count[size_class]--;
+        }
+        pthread_mutex_unlock(&buffer_pool_lock);
+    }
+    if (buffer == NULL && posix_memalign(&buffer, BUFFER_ALIGNMENT, (size_t)1 << size_class) != 0)
+    {
+        perror("Error allocating copy buffer");
+        return NULL;
+    }
+    return buffer;
+}
+
+// Function to give a buffer from buffer_pool_get() back for the next copy
+void buffer_pool_put(void *buffer, size_t size)
+{
+    int size_class = buffer_pool_class(size);
+    if (buffer == NULL)
+        return;
+    pthread_mutex_lock(&buffer_pool_lock);
+    if (size_class < BUFFER_POOL_CLASSES && buffer_pool_count[size_class] < BUFFER_POOL_MAX_FREE)
+    {
+        *(void **)buffer = buffer_pool_free[size_class];
+        buffer_pool_free[size_class] = buffer;
+        buffer_pool_count[size_class]++;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&buffer_pool_lock);
+    free(buffer);
+}
+
+// Function to pick the first block size of a copy loop
+// Adaptive loops start where the previous file ended, fixed ones use --buffer-size
+// or, when it was not given, default_size
+void block_sizer_start(struct BlockSizer *sizer, size_t default_size)
+{
+    sizer->size = transfer_buffer_size ? transfer_buffer_size : default_size;
+    if (!adaptive_buffers)
+        return;
+    size_t hint = atomic_load(&adaptive_block_hint);
+    if (hint)
+        sizer->size = hint;
+    if (sizer->size < ADAPTIVE_BLOCK_MIN)
+        sizer->size = ADAPTIVE_BLOCK_MIN;
+    if (sizer->size > ADAPTIVE_BLOCK_MAX)
+        sizer->size = ADAPTIVE_BLOCK_MAX;
+    sizer->window_start_ns = now_ns();
+    sizer->window_bytes = 0;
+    sizer->window_blocks = 0;
+}
+
+// Function to switch a fixed sizer to the default of the loop it is handed to next,
+// unless --buffer-size or --buffer-size=auto chose the size
+void block_sizer_default(struct BlockSizer *sizer, size_t default_size)
+{
+    if (!adaptive_buffers && transfer_buffer_size == 0)
+        sizer->size = default_size;
+}
+
+// Function to account for a block of bytes just moved and, once a window is over,
+// double or halve the block size towards what the measured rate moves in
+// ADAPTIVE_BLOCK_TARGET_NS. Short reads from a slow source shrink the blocks too
+void block_sizer_update(struct BlockSizer *sizer, long long bytes)
+{
+    if (!adaptive_buffers)
+        return;
+    sizer->window_bytes += bytes;
+    long long now = now_ns();
+    long long elapsed = now - sizer->window_start_ns;
+    if (++sizer->window_blocks < ADAPTIVE_WINDOW_BLOCKS || elapsed < ADAPTIVE_WINDOW_NS)
+        return;
+
+    double target = (double)sizer->window_bytes * ADAPTIVE_BLOCK_TARGET_NS / elapsed;
+    if (target >= 2.0 * sizer->size && sizer->size < ADAPTIVE_BLOCK_MAX)
+        sizer->size *= 2;
+    else if (target < sizer->size / 2.0 && sizer->size > ADAPTIVE_BLOCK_MIN)
+        sizer->size /= 2;
+    sizer->window_start_ns = now;
+    sizer->window_bytes = 0;
+    sizer->window_blocks = 0;
+}
+
+// Function to end a copy loop; the next file starts from the size it settled on
+// Returns that size for the log
+size_t block_sizer_finish(struct BlockSizer *sizer)
+{
+    if (adaptive_buffers)
+        atomic_store(&adaptive_block_hint, sizer->size);
+    return sizer->size;
+}
+
+// Function to raise the capacity of the pipe behind fd, halving the request until
+// the kernel grants it (unprivileged users are held to /proc/sys/fs/pipe-max-size)
+// Returns the capacity the pipe ended up with
+int grow_pipe(int fd)
+{
+    int size = atomic_load(&pipe_size_limit);
+    while (size >= ADAPTIVE_BLOCK_MIN)
+    {
+        int granted = fcntl(fd, F_SETPIPE_SZ, size);
+        if (granted != -1)
+        {
+            atomic_store(&pipe_size_limit, size);
+            return granted;
+        }
+        if (errno != EPERM)
+            break;
+        size /= 2;
+    }
+    return fcntl(fd, F_GETPIPE_SZ);
+}
+
+// Function to start tracking the file behind fd from offset under --cache-mode
+// writing tells whether the copy writes the file or reads it
+void cache_window_start(struct CacheWindow *window, int fd, long long offset, int writing)
+{
+    window->fd = fd;
+    window->writing = writing;
+    window->direct = 0;
+    window->start = window->flushing = window->position = offset;
+    if (cache_mode != CACHE_MODE_NORMAL && !writing)
+        posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+// Function to switch a destination file to O_DIRECT for --cache-mode=direct
+// Only an aligned starting offset qualifies; otherwise, or where the filesystem
+// refuses O_DIRECT, the file is streamed through the page cache instead
+void cache_window_try_direct(struct CacheWindow *window)
+{
+    if (cache_mode != CACHE_MODE_DIRECT || window->position % DIRECT_IO_ALIGNMENT != 0)
+        return;
+    int flags = fcntl(window->fd, F_GETFL);
+    if (flags != -1 && fcntl(window->fd, F_SETFL, flags | O_DIRECT) == 0)
+        window->direct = 1;
+}
+
+// Function to go back to cached writes, for a tail shorter than DIRECT_IO_ALIGNMENT
+// or a filesystem that turned out to reject O_DIRECT writes
+void cache_window_end_direct(struct CacheWindow *window)
+{
+    int flags = fcntl(window->fd, F_GETFL);
+    if (flags != -1)
+        fcntl(window->fd, F_SETFL, flags & ~O_DIRECT);
+    window->direct = 0;
+    window->start = window->flushing = window->position;
+}
+
+// Function to account for bytes just copied and, every CACHE_WINDOW_BYTES, release
+// the previous window from the page cache. A writer starts writeback of the new
+// window first and waits for the previous one, which bounds its dirty pages to
+// about two windows
+void cache_window_advance(struct CacheWindow *window, long long bytes)
+{
+    if (window == NULL || cache_mode == CACHE_MODE_NORMAL)
+        return;
+    window->position += bytes;
+    if (window->direct || window->position - window->flushing < CACHE_WINDOW_BYTES)
+        return;
+
+    if (window->writing)
+        sync_file_range(window->fd, window->flushing, window->position - window->flushing, SYNC_FILE_RANGE_WRITE);
+    if (window->flushing > window->start)
+    {
+        if (window->writing)
+            sync_file_range(window->fd, window->start, window->flushing - window->start,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(window->fd, window->start, window->flushing - window->start, POSIX_FADV_DONTNEED);
+        window->start = window->flushing;
+    }
+    window->flushing = window->position;
+}
+
+// Function to release whatever a finished copy still has in the page cache
+void cache_window_finish(struct CacheWindow *window)
+{
+    if (window == NULL || cache_mode == CACHE_MODE_NORMAL || window->position == window->start)
+        return;
+    if (window->writing)
+        sync_file_range(window->fd, window->start, window->position - window->start,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(window->fd, window->start, window->position - window->start, POSIX_FADV_DONTNEED);
+    window->start = window->flushing = window->position;
+}
+
+// Function to copy from in_fd to out_fd through a user space buffer
+// When progress is set (receiver side) the time blocked in read() is counted as
+// waiting on the pipe and the time in write() as waiting on the disk; journal
+// checkpoints the bytes written to out_fd and checksum, when set, is extended
+// over every block. sizer picks the size of each block and cache, when set,
+// releases the file's pages behind the copy. With O_DIRECT on, only whole
+// DIRECT_IO_ALIGNMENT blocks are written; the rest waits for the next read
+// Returns the number of bytes copied, or -1 on error
+long long buffered_copy(int in_fd, int out_fd, struct TransferProgress *progress, struct JournalEntry *journal, uint32_t *checksum,
+                        struct BlockSizer *sizer, struct CacheWindow *cache)
+{
+    size_t capacity = (adaptive_buffers ? ADAPTIVE_BLOCK_MAX : sizer->size) + DIRECT_IO_ALIGNMENT;
+    unsigned char *buffer = buffer_pool_get(capacity);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+    long long total = 0;
+    size_t pending = 0; // O_DIRECT only: bytes at the start of buffer not written yet
+    while (1)
+    {
+        long long t0 = progress ? now_ns() : 0;
+        long long trace_start = TRACE_START();
+        ssize_t bytes_read = read(in_fd, buffer + pending, sizer->size);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "read", bytes_read);
+        long long t1 = progress ? now_ns() : 0;
+        if (bytes_read == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            total = -1;
+            break;
+        }
+        if (bytes_read == 0 && pending == 0)
+        {
+            break; // EOF reached
+        }
+        if (checksum)
+            checksum_add(checksum, buffer + pending, bytes_read);
+
+        size_t length = pending + bytes_read;
+        size_t to_write = length;
+        if (cache && cache->direct)
+        {
+            to_write = length & ~(size_t)(DIRECT_IO_ALIGNMENT - 1);
+            if (bytes_read == 0)
+            {
+                // The unaligned tail goes through the page cache
+                cache_window_end_direct(cache);
+                to_write = length;
+            }
+        }
+        trace_start = TRACE_START();
+        ssize_t bytes_written = to_write ? write(out_fd, buffer, to_write) : 0;
+        COUNT_IO_SYSCALL();
+        if (bytes_written == -1 && errno == EINVAL && cache && cache->direct)
+        {
+            // The filesystem accepted the flag but not the writes
+            cache_window_end_direct(cache);
+            to_write = length;
+            bytes_written = write(out_fd, buffer, to_write);
+            COUNT_IO_SYSCALL();
+        }
+        TRACE_END(trace_start, TRACE_IO, "write", bytes_written);
+        if (bytes_written != (ssize_t)to_write)
+        {
+            total = -1;
+            break;
+        }
+        pending = length - to_write;
+        if (pending)
+            memmove(buffer, buffer + to_write, pending);
+        total += bytes_written;
+        if (progress)
+            progress_add(progress, bytes_written, t1 - t0, now_ns() - t1);
+        transfer_throttle(progress, bytes_written);
+        journal_add(journal, out_fd, bytes_written);
+        block_sizer_update(sizer, bytes_written);
+        cache_window_advance(cache, bytes_written);
+    }
+    buffer_pool_put(buffer, capacity);
+    return total;
+}
+
+// Function to move data from in_fd to out_fd inside the kernel with splice()
+// One of the two descriptors must be a pipe. Returns the number of bytes moved,
+// or -1 on error. *unsupported is set when splice() refuses these descriptors,
+// in which case the caller should finish the copy with buffered_copy()
+// When progress is set in_fd must be the pipe: the pipe side is made non-blocking
+// so time spent waiting for the sender (in poll()) is told apart from time spent
+// writing to the disk (in splice()). sizer picks how much each call may move
+// and cache, when set, releases the file's pages behind the copy
+long long splice_copy(int in_fd, int out_fd, int *unsupported, struct TransferProgress *progress, struct JournalEntry *journal,
+                      struct BlockSizer *sizer, struct CacheWindow *cache)
+{
+    long long total = 0;
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_MORE | (progress ? SPLICE_F_NONBLOCK : 0);
+    *unsupported = 0;
+    while (1)
+    {
+        long long t0 = progress ? now_ns() : 0;
+        long long trace_start = TRACE_START();
+        ssize_t moved = splice(in_fd, NULL, out_fd, NULL, sizer->size, flags);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "splice", moved);
+        if (moved == 0)
+        {
+            break; // EOF reached
+        }
+        if (moved == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && progress)
+            {
+                // The pipe is empty: wait for the sender
+                struct pollfd pfd = {in_fd, POLLIN, 0};
+                long long t1 = now_ns();
+                trace_start = TRACE_START();
+                poll(&pfd, 1, -1);
+                COUNT_IO_SYSCALL();
+                TRACE_END(trace_start, TRACE_WAIT, "wait for sender", -1);
+                progress_add(progress, 0, now_ns() - t1, 0);
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS)
+            {
+                *unsupported = 1;
+                break;
+            }
+            return -1;
+        }
+        total += moved;
+        if (progress)
+            progress_add(progress, moved, 0, now_ns() - t0);
+        transfer_throttle(progress, moved);
+        journal_add(journal, out_fd, moved);
+        block_sizer_update(sizer, moved);
+        cache_window_advance(cache, moved);
+    }
+    return total;
+}
+
+// Function to copy everything from in_fd to out_fd using the configured transfer mode
+// progress and journal are only passed on the receiver side, where in_fd is the pipe
+// A checksum needs the data in user space, and O_DIRECT needs aligned blocks,
+// so both always take the buffered loop. *mode is set to the loop that finished the copy
+// Returns the number of bytes copied, or -1 on error
+long long copy_fd(int in_fd, int out_fd, struct TransferProgress *progress, struct JournalEntry *journal, uint32_t *checksum,
+                  struct BlockSizer *sizer, struct CacheWindow *cache, const char **mode)
+{
+    long long total = 0;
+    if (transfer_mode == TRANSFER_MODE_SPLICE && checksum == NULL && !(cache && cache->direct))
+    {
+        int unsupported;
+        *mode = "splice";
+        block_sizer_default(sizer, SPLICE_CHUNK_SIZE);
+        total = splice_copy(in_fd, out_fd, &unsupported, progress, journal, sizer, cache);
+        if (total == -1 || !unsupported)
+        {
+            return total;
+        }
+    }
+
+    *mode = "buffered";
+    block_sizer_default(sizer, checksum ? VERIFY_BLOCK_SIZE : BUFFER_SIZE);
+    long long rest = buffered_copy(in_fd, out_fd, progress, journal, checksum, sizer, cache);
+    return rest == -1 ? -1 : total + rest;
+}
+
+// Function to hash a name allocator key (FNV-1a)
+size_t name_key_hash(const char *key)
+{
+    size_t hash = 14695981039346656037ULL;
+    for (; *key; key++)
+        hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+    return hash;
+}
+
+// Function to build the allocator key of filename: "base/ext", with the extension
+// taken from the last '.', as '/' cannot appear in a filename
+void name_key(const char *filename, int base_length, char *key, size_t key_size)
+{
+    const char *dot = strrchr(filename, '.');
+    snprintf(key, key_size, "%.*s/%s", base_length, filename, dot ? dot : "");
+}
+
+// Function to find the length of the base name of filename, and if it is numbered
+// copy "base(N).ext" of another name, the length of that name's base and N
+// Returns N, or 0 for names that are not numbered copies
+int name_copy_number(const char *filename, int *base_length, int *stem_length)
+{
+    const char *dot = strrchr(filename, '.');
+    *base_length = dot ? (int)(dot - filename) : (int)strlen(filename);
+    *stem_length = *base_length;
+
+    // N is a positive number without leading zeros, as this program writes it
+    const char *close = filename + *base_length - 1;
+    if (*base_length < 3 || *close != ')')
+        return 0;
+    const char *open = close - 1;
+    while (open > filename && *open >= '0' && *open <= '9')
+        open--;
+    if (*open != '(' || open + 1 == close || open[1] == '0' || close - open > 10)
+        return 0;
+    *stem_length = open - filename;
+    return atoi(open + 1);
+}
+
+// Function to find the slot of key, creating it if create is set
+// Called with name_lock held; returns NULL if it is missing or could not be allocated
+struct NameSlot *name_allocator_slot_locked(struct NameAllocator *names, const char *key, int create)
+{
+    size_t bucket = name_key_hash(key) & (names->num_buckets - 1);
+    for (struct NameSlot *slot = names->buckets[bucket]; slot; slot = slot->next)
+    {
+        if (strcmp(slot->key, key) == 0)
+            return slot;
+    }
+    if (!create)
+        return NULL;
+
+    // Keep chains short by doubling the table when it fills up
+    if (names->count >= names->num_buckets)
+    {
+        size_t num_buckets = names->num_buckets * 2;
+        struct NameSlot **buckets = calloc(num_buckets, sizeof(struct NameSlot *));
+        if (buckets)
+        {
+            for (size_t i = 0; i < names->num_buckets; i++)
+            {
+                struct NameSlot *slot = names->buckets[i];
+                while (slot)
+                {
+                    struct NameSlot *next = slot->next;
+                    size_t target = name_key_hash(slot->key) & (num_buckets - 1);
+                    slot->next = buckets[target];
+                    buckets[target] = slot;
+                    slot = next;
+                }
+            }
+            free(names->buckets);
+            names->buckets = buckets;
+            names->num_buckets = num_buckets;
+            bucket = name_key_hash(key) & (num_buckets - 1);
+        }
+    }
+
+    struct NameSlot *slot = calloc(1, sizeof(struct NameSlot));
+    if (slot == NULL)
+    {
+        perror("Error allocating name slot");
+        return NULL;
+    }
+    snprintf(slot->key, sizeof(slot->key), "%s", key);
+    slot->next = names->buckets[bucket];
+    names->buckets[bucket] = slot;
+    names->count++;
+    return slot;
+}
+
+// Function to note that filename is taken, so that later copies are numbered past it
+// Called with name_lock held
+void name_allocator_note_locked(struct NameAllocator *names, const char *filename)
+{
+    char key[MAX_FILENAME_LENGTH + 1];
+    int base_length, stem_length;
+    int number = name_copy_number(filename, &base_length, &stem_length);
+
+    // The name itself is taken ...
+    name_key(filename, base_length, key, sizeof(key));
+    struct NameSlot *slot = name_allocator_slot_locked(names, key, 1);
+    if (slot && slot->next_number == 0)
+        slot->next_number = 1;
+
+    // ... and "name(N).ext" also takes copy N of "name.ext"
+    if (number > 0)
+    {
+        name_key(filename, stem_length, key, sizeof(key));
+        if ((slot = name_allocator_slot_locked(names, key, 1)) != NULL && slot->next_number <= number)
+            slot->next_number = number + 1;
+    }
+}
+
+// Function to rebuild the allocator of a folder from one readdir() pass
+// Called with name_lock held
+void name_allocator_scan_locked(struct NameAllocator *names)
+{
+    for (size_t i = 0; i < names->num_buckets; i++)
+    {
+        while (names->buckets[i])
+        {
+            struct NameSlot *slot = names->buckets[i];
+            names->buckets[i] = slot->next;
+            free(slot);
+        }
+    }
+    names->count = 0;
+
+    DIR *dir = opendir(names->dir);
+    if (dir == NULL)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+            name_allocator_note_locked(names, ent->d_name);
+    }
+    closedir(dir);
+}
+
+// Function to get the name allocator of dest_dir, scanning the folder on first use
+// and again once per batch. Names others create in between are caught by the
+// EEXIST retry of place_destination_file(), so the folder's own .part, .tmp and
+// .dedup files never cause a rescan
+// Called with name_lock held; returns NULL if it could not be allocated
+struct NameAllocator *name_allocator_for_locked(const char *dest_dir)
+{
+    struct NameAllocator *names;
+    for (names = name_allocators; names; names = names->next)
+    {
+        if (strcmp(names->dir, dest_dir) == 0)
+            break;
+    }
+    if (names == NULL)
+    {
+        if ((names = calloc(1, sizeof(struct NameAllocator))) == NULL ||
+            (names->buckets = calloc(NAME_ALLOCATOR_BUCKETS, sizeof(struct NameSlot *))) == NULL)
+        {
+            perror("Error allocating name allocator");
+            free(names);
+            return NULL;
+        }
+        snprintf(names->dir, sizeof(names->dir), "%s", dest_dir);
+        names->num_buckets = NAME_ALLOCATOR_BUCKETS;
+        names->stale = 1;
+        names->next = name_allocators;
+        name_allocators = names;
+    }
+    if (names->stale)
+    {
+        name_allocator_scan_locked(names);
+        names->stale = 0;
+    }
+    return names;
+}
+
+// Function to have every name allocator rescan its folder on next use, so that
+// names freed since the last batch are handed out again
+void name_allocators_invalidate()
+{
+    pthread_mutex_lock(&name_lock);
+    for (struct NameAllocator *names = name_allocators; names; names = names->next)
+        names->stale = 1;
+    pthread_mutex_unlock(&name_lock);
+}
+
+// Function to move temp_path into dest_dir under filename, or under the next free
+// "name(N).ext" if it is taken. The allocator picks the name in constant time and
+// renameat2(RENAME_NOREPLACE) makes sure nothing that appeared meanwhile is overwritten
+// Returns 0 with final_file_path filled on success, -1 on failure
+int place_destination_file(const char *dest_dir, const char *filename, const char *temp_path, char *final_file_path)
+{
+    char key[MAX_FILENAME_LENGTH + 1];
+    const char *dot = strrchr(filename, '.');
+    int base_length = dot ? (int)(dot - filename) : (int)strlen(filename);
+    name_key(filename, base_length, key, sizeof(key));
+
+    int result;
+    struct NameSlot *slot;
+    do
+    {
+        // Reserve a number under the lock so that concurrent workers never pick the same name
+        pthread_mutex_lock(&name_lock);
+        struct NameAllocator *names = name_allocator_for_locked(dest_dir);
+        slot = names ? name_allocator_slot_locked(names, key, 1) : NULL;
+        int number = slot ? slot->next_number++ : 0;
+        pthread_mutex_unlock(&name_lock);
+
+        if (number == 0)
+            snprintf(final_file_path, MAX_PATH_LENGTH, "%s/%s", dest_dir, filename);
+        else
+            snprintf(final_file_path, MAX_PATH_LENGTH, "%s/%.*s(%d)%s", dest_dir, base_length, filename, number,
+                     dot ? dot : "");
+
+        // Only the rename itself is traced, not the wait for name_lock
+        long long trace_start = TRACE_START();
+        result = renameat2(AT_FDCWD, temp_path, AT_FDCWD, final_file_path, RENAME_NOREPLACE);
+        if (result == -1 && errno == EINVAL)
+        {
+            // The filesystem cannot rename without replacing; link() never replaces either
+            result = link(temp_path, final_file_path);
+            if (result == 0)
+                unlink(temp_path);
+        }
+        int rename_errno = errno;
+        TRACE_END(trace_start, TRACE_IO, "rename", -1);
+        errno = rename_errno;
+        // Taken by someone else since the folder was scanned: the next number is tried
+    } while (result == -1 && errno == EEXIST && slot != NULL);
+
+    // Record the name, which may have been reserved by another key's number
+    int saved_errno = errno;
+    pthread_mutex_lock(&name_lock);
+    for (struct NameAllocator *names = name_allocators; names && result == 0; names = names->next)
+    {
+        if (strcmp(names->dir, dest_dir) == 0)
+            name_allocator_note_locked(names, strrchr(final_file_path, '/') + 1);
+    }
+    pthread_mutex_unlock(&name_lock);
+    errno = saved_errno;
+    return result;
+}
+
+// Function to find the journal of dest_dir, loading it from disk on first use
+// Called with journal_lock held; returns NULL if it could not be allocated
+struct TransferJournal *journal_for_locked(const char *dest_dir)
+{
+    for (struct TransferJournal *journal = journals; journal; journal = journal->next)
+    {
+        if (strcmp(journal->dest_dir, dest_dir) == 0)
+            return journal;
+    }
+    struct TransferJournal *journal = calloc(1, sizeof(struct TransferJournal));
+    if (journal == NULL)
+    {
+        perror("Error allocating transfer journal");
+        return NULL;
+    }
+    snprintf(journal->dest_dir, sizeof(journal->dest_dir), "%s", dest_dir);
+    journal_load(journal);
+    journal->next = journals;
+    journals = journal;
+    return journal;
+}
+
+// Function to read the checkpoints left in a destination folder by earlier runs
+// Each line is "committed size mtime_ns chunk_size chunk_bitmap filename", where
+// chunk_bitmap is hex, or "-" when the file was copied sequentially
+void journal_load(struct TransferJournal *journal)
+{
+    char journal_path[MAX_PATH_LENGTH];
+    if (format_path(journal_path, sizeof(journal_path), "%s/%s", journal->dest_dir, JOURNAL_NAME) == -1)
+        return;
+    FILE *file = fopen(journal_path, "r");
+    if (file == NULL)
+        return;
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) > 0)
+    {
+        if (line[length - 1] == '\n')
+            line[--length] = '\0';
+        if (line[0] == '#')
+            continue;
+
+        struct JournalEntry *entry = calloc(1, sizeof(struct JournalEntry));
+        int consumed = 0;
+        if (entry == NULL ||
+            sscanf(line, "%lld %lld %lld %lld %n", &entry->committed, &entry->source_size,
+                   &entry->source_mtime_ns, &entry->chunk_size, &consumed) != 4 || consumed == 0)
+        {
+            fprintf(stderr, "Ignoring malformed line in %s\n", journal_path);
+            free(entry);
+            continue;
+        }
+        char *bitmap = line + consumed;
+        char *filename = strchr(bitmap, ' ');
+        if (filename == NULL || filename[1] == '\0' || strlen(filename + 1) >= sizeof(entry->filename))
+        {
+            fprintf(stderr, "Ignoring malformed line in %s\n", journal_path);
+            free(entry);
+            continue;
+        }
+        *filename++ = '\0';
+        strcpy(entry->filename, filename);
+
+        // Rebuild the chunk bitmap from its hex digits
+        if (entry->chunk_size > 0 && strcmp(bitmap, "-") != 0)
+        {
+            size_t num_bytes = strlen(bitmap) / 2;
+            entry->done_chunks = calloc(num_bytes + 1, 1);
+            for (size_t i = 0; entry->done_chunks && i < num_bytes; i++)
+            {
+                unsigned int value;
+                if (sscanf(bitmap + i * 2, "%2x", &value) == 1)
+                    entry->done_chunks[i] = value;
+            }
+        }
+        if (entry->done_chunks == NULL)
+            entry->chunk_size = 0;
+        entry->saved = 1;
+        entry->journal = journal;
+        entry->next = journal->entries;
+        journal->entries = entry;
+    }
+    free(line);
+    fclose(file);
+}
+
+// Function to write the saved checkpoints of a folder to its journal file
+// The file is written under a temporary name, synced and renamed, so a crash
+// leaves either the old or the new journal. Called with journal_lock held
+void journal_save_locked(struct TransferJournal *journal)
+{
+    char journal_path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH + 8];
+    if (format_path(journal_path, sizeof(journal_path), "%s/%s", journal->dest_dir, JOURNAL_NAME) == -1)
+    {
+        perror("Error saving transfer journal");
+        return;
+    }
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", journal_path);
+
+    int any = 0;
+    for (struct JournalEntry *entry = journal->entries; entry; entry = entry->next)
+        any |= entry->saved;
+    if (!any)
+    {
+        if (unlink(journal_path) == -1 && errno != ENOENT)
+            perror("Error removing transfer journal");
+        return;
+    }
+
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL)
+    {
+        perror("Error writing transfer journal");
+        return;
+    }
+    fprintf(file, "# committed size mtime_ns chunk_size chunk_bitmap filename\n");
+    for (struct JournalEntry *entry = journal->entries; entry; entry = entry->next)
+    {
+        if (!entry->saved)
+            continue;
+        fprintf(file, "%lld %lld %lld %lld ", entry->committed, entry->source_size,
+                entry->source_mtime_ns, entry->done_chunks ? entry->chunk_size : 0);
+        if (entry->done_chunks)
+        {
+            long long num_chunks = (entry->source_size + entry->chunk_size - 1) / entry->chunk_size;
+            for (long long i = 0; i < (num_chunks + 7) / 8; i++)
+                fprintf(file, "%02x", entry->done_chunks[i]);
+        }
+        else
+        {
+            fputc('-', file);
+        }
+        fprintf(file, " %s\n", entry->filename);
+    }
+    if (fflush(file) != 0 || fsync(fileno(file)) == -1)
+        perror("Error syncing transfer journal");
+    fclose(file);
+    if (rename(temp_path, journal_path) == -1)
+        perror("Error replacing transfer journal");
+}
+
+// Function to unlink an entry from its journal and free it; called with journal_lock held
+void journal_free_entry_locked(struct JournalEntry *entry)
+{
+    struct JournalEntry **link = &entry->journal->entries;
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    free(entry->done_chunks);
+    free(entry);
+}
+
+// Function to pick the temporary file of a job and find out how much of it an
+// earlier, interrupted attempt already committed. source is NULL if the source
+// could not be examined. Sets job->journal, job->resume_offset and job->temp_path
+// Returns 0 on success, -1 if the temporary file's path is too long
+int journal_begin(struct TransferJob *job, const struct stat *source)
+{
+    const char *filename = job->file.filename;
+    job->journal = NULL;
+    job->resume_offset = 0;
+    if (format_path(job->temp_path, sizeof(job->temp_path), "%s/.%s.part", job->dest_dir, filename) == -1)
+    {
+        perror("Error creating/opening received file");
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal_lock);
+    struct TransferJournal *journal = source && strchr(filename, '\n') == NULL ? journal_for_locked(job->dest_dir) : NULL;
+    struct JournalEntry *entry = NULL;
+    if (journal)
+    {
+        for (entry = journal->entries; entry; entry = entry->next)
+        {
+            if (strcmp(entry->filename, filename) == 0)
+                break;
+        }
+    }
+    if (journal == NULL || (entry && entry->active))
+    {
+        // The same file is already being received: write a private copy without a checkpoint
+        pthread_mutex_unlock(&journal_lock);
+        if (format_path(job->temp_path, sizeof(job->temp_path), "%s/.%s.%d.part", job->dest_dir, filename,
+                        atomic_fetch_add(&temp_file_counter, 1)) == -1)
+        {
+            perror("Error creating/opening received file");
+            return -1;
+        }
+        return 0;
+    }
+
+    long long mtime_ns = source->st_mtim.tv_sec * 1000000000LL + source->st_mtim.tv_nsec;
+    struct stat temp;
+    if (entry && (entry->source_size != source->st_size || entry->source_mtime_ns != mtime_ns ||
+                  stat(job->temp_path, &temp) == -1 || temp.st_size < entry->committed ||
+                  (entry->done_chunks && temp.st_size < source->st_size)))
+    {
+        // The source changed or the partial copy is gone: start over
+        entry->committed = 0;
+        entry->chunk_size = 0;
+        free(entry->done_chunks);
+        entry->done_chunks = NULL;
+    }
+    if (entry == NULL && (entry = calloc(1, sizeof(struct JournalEntry))) != NULL)
+    {
+        strcpy(entry->filename, filename);
+        entry->journal = journal;
+        entry->next = journal->entries;
+        journal->entries = entry;
+    }
+    if (entry)
+    {
+        entry->source_size = source->st_size;
+        entry->source_mtime_ns = mtime_ns;
+        entry->written = entry->committed;
+        entry->active = 1;
+        job->journal = entry;
+        job->resume_offset = entry->committed;
+    }
+    pthread_mutex_unlock(&journal_lock);
+
+    if (job->resume_offset > 0)
+    {
+        printf("Resuming file %s at byte %lld of %lld\n", filename, job->resume_offset, (long long)source->st_size);
+        progress_add(job->progress, job->resume_offset, 0, 0);
+    }
+    return 0;
+}
+
+// Function to record that the first offset bytes of the temporary file are written
+// The data is flushed to disk before the journal claims it
+void journal_checkpoint(struct JournalEntry *entry, int fd, long long offset)
+{
+    long long trace_start = TRACE_START();
+    if (fdatasync(fd) == -1)
+    {
+        perror("Error syncing received file");
+        TRACE_END(trace_start, TRACE_IO, "fdatasync", -1); // A failed sync can take the longest
+        return;
+    }
+    TRACE_END(trace_start, TRACE_IO, "fdatasync", -1);
+    journal_commit(entry, offset);
+}
+
+// Function to record that the first offset bytes of the temporary file, which
+// the caller has already flushed to disk, are written
+void journal_commit(struct JournalEntry *entry, long long offset)
+{
+    pthread_mutex_lock(&journal_lock);
+    if (offset > entry->committed)
+        entry->committed = offset;
+    entry->saved = 1;
+    journal_save_locked(entry->journal);
+    pthread_mutex_unlock(&journal_lock);
+}
+
+// Function to drop the checkpoints of a file whose partial copy cannot be trusted
+void journal_discard(struct JournalEntry *entry)
+{
+    if (entry == NULL)
+        return;
+    pthread_mutex_lock(&journal_lock);
+    if (entry->saved)
+    {
+        entry->saved = 0;
+        journal_save_locked(entry->journal);
+    }
+    pthread_mutex_unlock(&journal_lock);
+}
+
+// Function called by the sequential copy loops after writing bytes to fd
+// Only the owning receiver touches written, so the common case takes no lock
+void journal_add(struct JournalEntry *entry, int fd, long long bytes)
+{
+    if (entry == NULL)
+        return;
+    entry->written += bytes;
+    if (entry->written - entry->committed >= JOURNAL_CHECKPOINT_BYTES)
+        journal_checkpoint(entry, fd, entry->written);
+}
+
+// Function to make the chunk bitmap of entry match chunk_bytes before a chunked copy
+// Finished chunks of a different size are dropped; the committed prefix is kept
+void journal_prepare_chunks(struct JournalEntry *entry, long long size, long long chunk_bytes)
+{
+    if (entry == NULL)
+        return;
+    pthread_mutex_lock(&journal_lock);
+    if (entry->done_chunks == NULL || entry->chunk_size != chunk_bytes)
+    {
+        free(entry->done_chunks);
+        entry->chunk_size = chunk_bytes;
+        entry->done_chunks = calloc((size + chunk_bytes - 1) / chunk_bytes / 8 + 1, 1);
+        if (entry->done_chunks == NULL)
+            entry->chunk_size = 0;
+    }
+    pthread_mutex_unlock(&journal_lock);
+}
+
+// Function to tell whether an earlier attempt already copied the chunk at offset
+int journal_chunk_is_done(struct JournalEntry *entry, long long offset, long long length)
+{
+    if (entry == NULL)
+        return 0;
+    pthread_mutex_lock(&journal_lock);
+    long long index = entry->chunk_size ? offset / entry->chunk_size : 0;
+    int done = offset + length <= entry->committed ||
+               (entry->done_chunks && (entry->done_chunks[index / 8] & (1 << (index % 8))));
+    pthread_mutex_unlock(&journal_lock);
+    return done;
+}
+
+// Function to checkpoint a finished chunk, extending the committed prefix over
+// every finished chunk that now follows it
+void journal_chunk_done(struct JournalEntry *entry, int fd, long long offset, long long length)
+{
+    if (entry == NULL || entry->done_chunks == NULL)
+        return;
+    long long trace_start = TRACE_START();
+    if (fdatasync(fd) == -1)
+    {
+        perror("Error syncing received file");
+        TRACE_END(trace_start, TRACE_IO, "fdatasync", -1);
+        return;
+    }
+    TRACE_END(trace_start, TRACE_IO, "fdatasync", -1);
+    pthread_mutex_lock(&journal_lock);
+    long long index = offset / entry->chunk_size;
+    entry->done_chunks[index / 8] |= 1 << (index % 8);
+    while (entry->committed < entry->source_size)
+    {
+        index = entry->committed / entry->chunk_size;
+        if (!(entry->done_chunks[index / 8] & (1 << (index % 8))))
+            break;
+        entry->committed = (index + 1) * entry->chunk_size;
+    }
+    if (entry->committed > entry->source_size)
+        entry->committed = entry->source_size;
+    entry->saved = 1;
+    journal_save_locked(entry->journal);
+    pthread_mutex_unlock(&journal_lock);
+}
+
+// Function to end a job's use of its temporary file: a complete file is renamed
+// to its final name, a failed one is kept for a later attempt if it has checkpoints
+// Returns the job's result, -1 if the rename failed
+int journal_finish(struct TransferJob *job, int result)
+{
+    if (result == 0)
+    {
+        int placed;
+        if (job->batch->sync)
+        {
+            // A folder sync replaces the outdated copy in place
+            placed = format_path(job->final_path, sizeof(job->final_path), "%s/%s", job->dest_dir, job->file.filename);
+            if (placed == 0)
+                placed = rename(job->temp_path, job->final_path);
+        }
+        else
+        {
+            placed = place_destination_file(job->dest_dir, job->file.filename, job->temp_path, job->final_path);
+        }
+        if (placed == -1)
+        {
+            perror("Error renaming received file");
+            job->final_path[0] = '\0';
+            result = -1;
+        }
+    }
+
+    struct JournalEntry *entry = job->journal;
+    int keep = 0;
+    if (entry)
+    {
+        pthread_mutex_lock(&journal_lock);
+        entry->active = 0;
+        keep = result != 0 && entry->saved;
+        if (!keep)
+        {
+            int saved = entry->saved;
+            struct TransferJournal *journal = entry->journal;
+            journal_free_entry_locked(entry);
+            if (saved)
+                journal_save_locked(journal);
+        }
+        pthread_mutex_unlock(&journal_lock);
+        job->journal = NULL;
+    }
+
+    // Nothing worth resuming: do not leave the partial copy behind
+    if (result != 0 && !keep && unlink(job->temp_path) == -1 && errno != ENOENT)
+        perror("Error removing partial file");
+    return result;
+}
+
+// Function to open the temporary file of a job, keeping its first keep_bytes
+// Returns the descriptor, or -1 on error
+int open_temp_file(struct TransferJob *job, long long keep_bytes)
+{
+    int fd = open(job->temp_path, O_WRONLY | O_CREAT, 0666);
+    if (fd == -1)
+    {
+        perror("Error creating/opening received file");
+        return -1;
+    }
+    if (ftruncate(fd, keep_bytes) == -1 || lseek(fd, job->resume_offset, SEEK_SET) == -1)
+    {
+        perror("Error preparing received file");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to rotate a 64-bit value left
+uint64_t rotl64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Function to mix one 8-byte lane into an XXH64 accumulator
+uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+// Function to fold an accumulator into the XXH64 hash
+uint64_t xxh64_merge_round(uint64_t hash, uint64_t acc)
+{
+    hash ^= xxh64_round(0, acc);
+    return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// Function to compute the XXH64 hash of length bytes of data
+uint64_t xxh64(const unsigned char *data, size_t length, uint64_t seed)
+{
+    const unsigned char *end = data + length;
+    uint64_t hash;
+    uint64_t lane;
+    uint32_t half;
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2, v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed, v4 = seed - XXH_PRIME64_1;
+        do
+        {
+            memcpy(&lane, data, 8);
+            v1 = xxh64_round(v1, lane);
+            memcpy(&lane, data + 8, 8);
+            v2 = xxh64_round(v2, lane);
+            memcpy(&lane, data + 16, 8);
+            v3 = xxh64_round(v3, lane);
+            memcpy(&lane, data + 24, 8);
+            v4 = xxh64_round(v4, lane);
+            data += 32;
+        } while (data + 32 <= end);
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh64_merge_round(hash, v1);
+        hash = xxh64_merge_round(hash, v2);
+        hash = xxh64_merge_round(hash, v3);
+        hash = xxh64_merge_round(hash, v4);
+    }
+    else
+    {
+        hash = seed + XXH_PRIME64_5;
+    }
+    hash += length;
+
+    while (data + 8 <= end)
+    {
+        memcpy(&lane, data, 8);
+        hash ^= xxh64_round(0, lane);
+        hash = rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        data += 8;
+    }
+    if (data + 4 <= end)
+    {
+        memcpy(&half, data, 4);
+        hash ^= half * XXH_PRIME64_1;
+        hash = rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        data += 4;
+    }
+    while (data < end)
+    {
+        hash ^= *data++ * XXH_PRIME64_5;
+        hash = rotl64(hash, 11) * XXH_PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Function to hash the contents of dir/filename, which is expected to be size bytes
+// Returns 0 on success, -1 if the file could not be read or changed size
+int hash_file(const char *dir, const char *filename, long long size, uint64_t *hash)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    snprintf(full_file_path, sizeof(full_file_path), "%s/%s", dir, filename);
+    int fd = open(full_file_path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size != size)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    if (size == 0)
+    {
+        close(fd);
+        *hash = xxh64(NULL, 0, 0);
+        return 0;
+    }
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("Error mapping file for hashing");
+        return -1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    long long trace_start = TRACE_START();
+    *hash = xxh64(data, size, 0);
+    TRACE_END(trace_start, TRACE_STAGE, "hash", size);
+    munmap(data, size);
+    return 0;
+}
+
+// Function to find the content index of dir, loading and rescanning it as needed
+// destination marks it to be saved back into dir; a source folder is not written to
+// Called with content_lock held; returns NULL if it could not be allocated
+struct ContentIndex *content_index_for_locked(const char *dir, int destination)
+{
+    struct ContentIndex *index;
+    for (index = content_indexes; index; index = index->next)
+    {
+        if (strcmp(index->dir, dir) == 0)
+            break;
+    }
+    if (index == NULL)
+    {
+        if ((index = calloc(1, sizeof(struct ContentIndex))) == NULL)
+        {
+            perror("Error allocating content index");
+            return NULL;
+        }
+        snprintf(index->dir, sizeof(index->dir), "%s", dir);
+        content_index_load(index);
+        index->next = content_indexes;
+        content_indexes = index;
+    }
+    index->destination |= destination;
+
+    // Pick up files that other programs added, changed or removed
+    struct stat st;
+    long long now = now_ns();
+    if (stat(dir, &st) == 0 && st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec != index->dir_mtime_ns &&
+        now - index->scan_ns >= DEDUP_RESCAN_INTERVAL_NS)
+    {
+        index->dir_mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        index->scan_ns = now;
+        content_index_scan_locked(index);
+    }
+    return index;
+}
+
+// Function to read the hashes saved in a folder's index file
+// Each line is "size mtime_ns xxh64 filename"
+void content_index_load(struct ContentIndex *index)
+{
+    char index_path[MAX_PATH_LENGTH];
+    if (format_path(index_path, sizeof(index_path), "%s/%s", index->dir, CONTENT_INDEX_NAME) == -1)
+        return;
+    FILE *file = fopen(index_path, "r");
+    if (file == NULL)
+        return;
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) > 0)
+    {
+        if (line[length - 1] == '\n')
+            line[--length] = '\0';
+        struct ContentEntry *entry = calloc(1, sizeof(struct ContentEntry));
+        unsigned long long hash;
+        int consumed = 0;
+        if (entry == NULL || line[0] == '#' ||
+            sscanf(line, "%lld %lld %llx %n", &entry->size, &entry->mtime_ns, &hash, &consumed) != 3 ||
+            consumed == 0 || line[consumed] == '\0' || strlen(line + consumed) >= sizeof(entry->filename))
+        {
+            free(entry);
+            continue;
+        }
+        strcpy(entry->filename, line + consumed);
+        entry->hash = hash;
+        entry->hashed = 1;
+        entry->next = index->entries;
+        index->entries = entry;
+    }
+    free(line);
+    fclose(file);
+}
+
+// Function to bring the index in line with the folder with one readdir()/fstatat() pass
+// Hashes stay valid for files whose size and mtime did not change. Called with content_lock held
+void content_index_scan_locked(struct ContentIndex *index)
+{
+    DIR *dir = opendir(index->dir);
+    if (dir == NULL)
+        return;
+    for (struct ContentEntry *entry = index->entries; entry; entry = entry->next)
+        entry->seen = 0;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        struct FileEntry file;
+        if (directory_index_stat(dirfd(dir), ent->d_name, &file) == -1)
+            continue;
+        struct ContentEntry *entry = content_index_find_locked(index, file.filename);
+        if (entry == NULL)
+        {
+            if ((entry = calloc(1, sizeof(struct ContentEntry))) == NULL)
+                break;
+            strcpy(entry->filename, file.filename);
+            entry->next = index->entries;
+            index->entries = entry;
+        }
+        if (entry->size != file.size || entry->mtime_ns != file.mtime_ns)
+        {
+            entry->size = file.size;
+            entry->mtime_ns = file.mtime_ns;
+            entry->hashed = 0;
+            index->dirty = 1;
+        }
+        entry->seen = 1;
+    }
+    closedir(dir);
+
+    // Forget files that are gone
+    struct ContentEntry **link = &index->entries;
+    while (*link)
+    {
+        struct ContentEntry *entry = *link;
+        if (entry->seen)
+        {
+            link = &entry->next;
+            continue;
+        }
+        *link = entry->next;
+        free(entry);
+        index->dirty = 1;
+    }
+}
+
+// Function to look a file up by name; called with content_lock held
+struct ContentEntry *content_index_find_locked(struct ContentIndex *index, const char *filename)
+{
+    for (struct ContentEntry *entry = index->entries; entry; entry = entry->next)
+    {
+        if (strcmp(entry->filename, filename) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Function to record the size, mtime and hash of a file; called with content_lock held
+void content_index_set_locked(struct ContentIndex *index, const char *filename, long long size, long long mtime_ns, uint64_t hash)
+{
+    struct ContentEntry *entry = content_index_find_locked(index, filename);
+    if (entry == NULL)
+    {
+        if ((entry = calloc(1, sizeof(struct ContentEntry))) == NULL)
+            return;
+        strcpy(entry->filename, filename);
+        entry->next = index->entries;
+        index->entries = entry;
+    }
+    entry->size = size;
+    entry->mtime_ns = mtime_ns;
+    entry->hash = hash;
+    entry->hashed = 1;
+    index->dirty = 1;
+}
+
+// Function to write every changed destination index back to its folder, under a
+// temporary name that is synced and renamed so a crash never leaves a torn index.
+// Each index is copied out under content_lock and written without it
+void content_index_save_all()
+{
+    pthread_mutex_lock(&content_save_lock);
+    pthread_mutex_lock(&content_lock);
+    for (struct ContentIndex *index = content_indexes; index; index = index->next)
+    {
+        if (!index->dirty || !index->destination)
+            continue;
+        index->dirty = 0;
+
+        char *text = NULL;
+        size_t text_length = 0;
+        FILE *memory = open_memstream(&text, &text_length);
+        if (memory == NULL)
+        {
+            index->dirty = 1;
+            continue;
+        }
+        fprintf(memory, "# size mtime_ns xxh64 filename\n");
+        for (struct ContentEntry *entry = index->entries; entry; entry = entry->next)
+        {
+            if (entry->hashed && entry->size >= 0)
+                fprintf(memory, "%lld %lld %016llx %s\n", entry->size, entry->mtime_ns,
+                        (unsigned long long)entry->hash, entry->filename);
+        }
+        fclose(memory);
+        char index_path[MAX_PATH_LENGTH];
+        char temp_path[MAX_PATH_LENGTH + 8];
+        int have_path = format_path(index_path, sizeof(index_path), "%s/%s", index->dir, CONTENT_INDEX_NAME) == 0;
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", index_path);
+        pthread_mutex_unlock(&content_lock);
+
+        // Indexes are never freed, so index stays valid while the lock is released
+        int fd = have_path ? open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666) : -1;
+        int saved = fd != -1 && write_full(fd, text, text_length) == 0 && fsync(fd) == 0;
+        if (fd != -1 && close(fd) == -1)
+            saved = 0;
+        if (!saved || rename(temp_path, index_path) == -1)
+        {
+            perror("Error saving content index");
+            if (fd != -1)
+                unlink(temp_path);
+            saved = 0;
+        }
+        free(text);
+
+        pthread_mutex_lock(&content_lock);
+        if (!saved)
+            index->dirty = 1;
+    }
+    pthread_mutex_unlock(&content_lock);
+    pthread_mutex_unlock(&content_save_lock);
+}
+
+// Function to get the hash of dir/filename, reusing the index when its size and mtime match
+// destination tells whether dir is a destination folder, see content_index_for_locked()
+// Returns 0 on success, -1 if the file could not be hashed
+int content_hash(const char *dir, int destination, const char *filename, long long size, long long mtime_ns, uint64_t *hash)
+{
+    pthread_mutex_lock(&content_lock);
+    struct ContentIndex *index = content_index_for_locked(dir, destination);
+    struct ContentEntry *entry = index ? content_index_find_locked(index, filename) : NULL;
+    if (entry && entry->hashed && entry->size == size && entry->mtime_ns == mtime_ns)
+    {
+        *hash = entry->hash;
+        pthread_mutex_unlock(&content_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&content_lock);
+
+    // Hash without the lock; other workers keep going meanwhile
+    if (hash_file(dir, filename, size, hash) == -1)
+        return -1;
+    pthread_mutex_lock(&content_lock);
+    if ((index = content_index_for_locked(dir, destination)) != NULL)
+        content_index_set_locked(index, filename, size, mtime_ns, *hash);
+    pthread_mutex_unlock(&content_lock);
+    return 0;
+}
+
+// Function to compare two files of size bytes, so that equal hashes are never taken
+// on trust. Returns 1 if their contents are the same, 0 if not or on error
+int files_identical(const char *path_a, const char *path_b, long long size)
+{
+    int fd_a = open(path_a, O_RDONLY);
+    int fd_b = open(path_b, O_RDONLY);
+    unsigned char *block_a = buffer_pool_get(COMPARE_BLOCK_SIZE);
+    unsigned char *block_b = buffer_pool_get(COMPARE_BLOCK_SIZE);
+    struct stat st_a, st_b;
+    int identical = fd_a != -1 && fd_b != -1 && block_a && block_b && fstat(fd_a, &st_a) == 0 &&
+                    fstat(fd_b, &st_b) == 0 && st_a.st_size == size && st_b.st_size == size;
+    long long trace_start = TRACE_START();
+    for (long long offset = 0; identical && offset < size; offset += COMPARE_BLOCK_SIZE)
+    {
+        size_t want = size - offset < COMPARE_BLOCK_SIZE ? (size_t)(size - offset) : COMPARE_BLOCK_SIZE;
+        identical = read_full(fd_a, block_a, want) == (ssize_t)want && read_full(fd_b, block_b, want) == (ssize_t)want &&
+                    memcmp(block_a, block_b, want) == 0;
+    }
+    TRACE_END(trace_start, TRACE_STAGE, "compare", size);
+    buffer_pool_put(block_a, COMPARE_BLOCK_SIZE);
+    buffer_pool_put(block_b, COMPARE_BLOCK_SIZE);
+    if (fd_a != -1)
+        close(fd_a);
+    if (fd_b != -1)
+        close(fd_b);
+    return identical;
+}
+
+// Function to tell whether the index of dest_dir has a file of the given size
+// Returns 1 if it has, 0 if no file there can hold the same contents
+int content_size_known(const char *dest_dir, long long size)
+{
+    int known = 0;
+    pthread_mutex_lock(&content_lock);
+    struct ContentIndex *index = content_index_for_locked(dest_dir, 1);
+    for (struct ContentEntry *entry = index ? index->entries : NULL; entry && !known; entry = entry->next)
+        known = entry->size == size;
+    pthread_mutex_unlock(&content_lock);
+    return known;
+}
+
+// Function to find a file in dest_dir with the same contents as source_path, which
+// has the given size and hash. Candidates of the right size that were not hashed yet
+// are hashed, and one with the same hash is compared byte for byte
+// Returns 0 and fills match_name if one exists, -1 otherwise
+int content_find_match(const char *dest_dir, const char *source_path, long long size, uint64_t hash, char *match_name)
+{
+    while (1)
+    {
+        // Collect one unhashed candidate at a time so hashing runs without the lock
+        char candidate[MAX_FILENAME_LENGTH] = "";
+        long long mtime_ns = 0;
+        pthread_mutex_lock(&content_lock);
+        struct ContentIndex *index = content_index_for_locked(dest_dir, 1);
+        for (struct ContentEntry *entry = index ? index->entries : NULL; entry; entry = entry->next)
+        {
+            if (entry->size != size)
+                continue;
+            if (entry->hashed && entry->hash == hash)
+            {
+                // A hash collision is vanishingly rare; the file is then simply copied
+                strcpy(match_name, entry->filename);
+                pthread_mutex_unlock(&content_lock);
+                char match_path[MAX_PATH_LENGTH];
+                snprintf(match_path, sizeof(match_path), "%s/%s", dest_dir, match_name);
+                return files_identical(source_path, match_path, size) ? 0 : -1;
+            }
+            if (!entry->hashed && candidate[0] == '\0')
+            {
+                strcpy(candidate, entry->filename);
+                mtime_ns = entry->mtime_ns;
+            }
+        }
+        pthread_mutex_unlock(&content_lock);
+        if (candidate[0] == '\0')
+            return -1;
+
+        uint64_t candidate_hash;
+        if (content_hash(dest_dir, 1, candidate, size, mtime_ns, &candidate_hash) == -1)
+        {
+            // Unreadable; remember it so it is not tried again
+            pthread_mutex_lock(&content_lock);
+            if ((index = content_index_for_locked(dest_dir, 1)) != NULL)
+                content_index_set_locked(index, candidate, -1, mtime_ns, 0);
+            pthread_mutex_unlock(&content_lock);
+        }
+    }
+}
+
+// Function to create a new name in dest_dir for the contents of existing_name,
+// sharing its blocks with a reflink or, where the filesystem cannot, a hard link
+// Returns 0 on success with final_file_path filled and *how naming the method, -1 on failure
+int dedup_link(struct TransferJob *job, const char *existing_name, const struct stat *source,
+               char *final_file_path, const char **how)
+{
+    char existing_path[MAX_PATH_LENGTH];
+    char temp_path[MAX_PATH_LENGTH];
+    if (format_path(existing_path, sizeof(existing_path), "%s/%s", job->dest_dir, existing_name) == -1 ||
+        format_path(temp_path, sizeof(temp_path), "%s/.%s.%d.dedup", job->dest_dir, job->file.filename,
+                    atomic_fetch_add(&temp_file_counter, 1)) == -1)
+    {
+        perror("Error linking duplicate file");
+        return -1;
+    }
+
+    int src_fd = open(existing_path, O_RDONLY);
+    int dest_fd = src_fd == -1 ? -1 : open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (dest_fd != -1 && ioctl(dest_fd, FICLONE, src_fd) == 0)
+    {
+        // A reflink is an independent file, so it can carry the source's mtime
+        struct timespec times[2] = {source->st_atim, source->st_mtim};
+        futimens(dest_fd, times);
+        *how = "reflink";
+    }
+    else
+    {
+        if (dest_fd != -1)
+        {
+            close(dest_fd);
+            dest_fd = -1;
+            unlink(temp_path);
+        }
+        if (src_fd == -1 || link(existing_path, temp_path) == -1)
+        {
+            perror("Error linking duplicate file");
+            if (src_fd != -1)
+                close(src_fd);
+            return -1;
+        }
+        *how = "hard link";
+    }
+    if (dest_fd != -1)
+        close(dest_fd);
+    close(src_fd);
+
+    if (place_destination_file(job->dest_dir, job->file.filename, temp_path, final_file_path) == -1)
+    {
+        perror("Error renaming linked file");
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to settle a file job without copying when --dedup finds its contents
+// already in the destination. Returns 1 if the job is done, 0 if it must be copied
+int dedup_try(struct TransferJob *job, const struct stat *source)
+{
+    const char *filename = job->file.filename;
+    long long mtime_ns = source->st_mtim.tv_sec * 1000000000LL + source->st_mtim.tv_nsec;
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    // Same name, size and mtime: a previous run already delivered this file
+    char dest_path[MAX_PATH_LENGTH];
+    struct stat dest;
+    if (format_path(dest_path, sizeof(dest_path), "%s/%s", job->dest_dir, filename) == -1)
+        return 0; // The copy reports it
+    int have_dest = lstat(dest_path, &dest) == 0 && S_ISREG(dest.st_mode);
+    if (have_dest && dest.st_size == source->st_size && mtimes_match(source, &dest, job->dest_dir))
+    {
+        if (!quiet_transfers)
+            printf("Skipped file %s: unchanged in %s\n", filename, job->dest_dir);
+        progress_add(job->progress, source->st_size, 0, 0);
+        return 1;
+    }
+
+    // Hash the source only when some file in the destination could hold the same contents
+    char source_path[MAX_PATH_LENGTH];
+    if (!content_size_known(job->dest_dir, source->st_size) ||
+        format_path(source_path, sizeof(source_path), "%s/%s", job->source_dir, filename) == -1 ||
+        content_hash(job->source_dir, 0, filename, source->st_size, mtime_ns, &job->content_hash) == -1)
+        return 0;
+    job->content_hashed = 1;
+
+    // Same name and same contents: nothing to do either
+    uint64_t dest_hash;
+    if (have_dest && dest.st_size == source->st_size &&
+        content_hash(job->dest_dir, 1, filename, dest.st_size, dest.st_mtim.tv_sec * 1000000000LL + dest.st_mtim.tv_nsec,
+                     &dest_hash) == 0 &&
+        dest_hash == job->content_hash && files_identical(source_path, dest_path, source->st_size))
+    {
+        if (!quiet_transfers)
+            printf("Skipped file %s: identical contents already in %s\n", filename, job->dest_dir);
+        progress_add(job->progress, source->st_size, 0, 0);
+        return 1;
+    }
+
+    // The contents exist under another name: link to them instead of copying
+    char match_name[MAX_FILENAME_LENGTH];
+    char final_file_path[MAX_PATH_LENGTH];
+    const char *how;
+    if (source->st_size == 0 ||
+        content_find_match(job->dest_dir, source_path, source->st_size, job->content_hash, match_name) == -1 ||
+        dedup_link(job, match_name, source, final_file_path, &how) == -1)
+        return 0;
+
+    if (!quiet_transfers)
+        printf("Deduplicated file %s: %s to %s in %.3f ms\n", filename, how, match_name,
+               elapsed_seconds(&start_time) * 1000);
+    progress_add(job->progress, source->st_size, 0, 0);
+    struct stat st;
+    if (stat(final_file_path, &st) == 0)
+    {
+        pthread_mutex_lock(&content_lock);
+        struct ContentIndex *index = content_index_for_locked(job->dest_dir, 1);
+        if (index)
+            content_index_set_locked(index, strrchr(final_file_path, '/') + 1, st.st_size,
+                                     st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, job->content_hash);
+        pthread_mutex_unlock(&content_lock);
+    }
+    return 1;
+}
+
+// Function to index a file that --dedup had to copy, giving it the source's mtime
+// so that sending it again is recognised as unchanged. A copy whose source was not
+// hashed is indexed unhashed, and content_find_match() hashes it when needed
+void dedup_record(struct TransferJob *job)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    struct stat source;
+    if (job->content_changed || job->final_path[0] == '\0' ||
+        format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == -1 ||
+        stat(full_file_path, &source) == -1)
+        return;
+    struct timespec times[2] = {source.st_atim, source.st_mtim};
+    if (utimensat(AT_FDCWD, job->final_path, times, 0) == -1)
+    {
+        perror("Error setting modification time");
+        return;
+    }
+
+    pthread_mutex_lock(&content_lock);
+    struct ContentIndex *index = content_index_for_locked(job->dest_dir, 1);
+    if (index)
+    {
+        const char *name = strrchr(job->final_path, '/') + 1;
+        content_index_set_locked(index, name, source.st_size,
+                                 source.st_mtim.tv_sec * 1000000000LL + source.st_mtim.tv_nsec, job->content_hash);
+        struct ContentEntry *entry = content_index_find_locked(index, name);
+        if (entry && !job->content_hashed)
+            entry->hashed = 0;
+    }
+    pthread_mutex_unlock(&content_lock);
+}
+
+// Function to run the sender half of a transfer: copy the source file into the FIFO
+// Returns 0 on success, -1 on failure
+int send_file(struct TransferJob *job, const char *fifo_name)
+{
+    // Open the pipe first so the receiver is never left blocked in open()
+    long long trace_start = TRACE_START();
+    int res = open(fifo_name, O_WRONLY);
+    TRACE_END(trace_start, TRACE_WAIT, "open fifo", -1);
+    if (res == -1)
+    {
+        perror("Error opening named pipe for writing");
+        return -1;
+    }
+
+    char full_file_path[MAX_PATH_LENGTH];
+    int src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY) : -1;
+    if (src_fd == -1 || lseek(src_fd, job->resume_offset, SEEK_SET) == -1)
+    {
+        perror("Error opening file");
+        if (src_fd != -1)
+            close(src_fd);
+        close(res);
+        return -1;
+    }
+
+    // Fast sources fill a default 64 KB pipe long before the receiver drains it
+    if (adaptive_buffers)
+        job->pipe_size = grow_pipe(res);
+
+    // Move the file into the pipe, falling back to the buffered loop if splice is not supported
+    struct BlockSizer sizer;
+    struct CacheWindow cache;
+    block_sizer_start(&sizer, BUFFER_SIZE);
+    cache_window_start(&cache, src_fd, job->resume_offset, 0);
+    job->send_checksum = ~0U;
+    long long bytes_sent = copy_fd(src_fd, res, NULL, NULL, verify_transfers ? &job->send_checksum : NULL, &sizer, &cache,
+                                   &job->send_mode);
+    job->send_checksum = ~job->send_checksum;
+    job->send_block_size = block_sizer_finish(&sizer);
+    cache_window_finish(&cache);
+    if (bytes_sent == -1)
+    {
+        perror("Error writing to named pipe");
+    }
+    close(res);
+    close(src_fd);
+    return bytes_sent == -1 ? -1 : 0;
+}
+
+// Function to run the receiver half of a transfer: drain the FIFO into the destination file
+// Returns 0 on success, -1 on failure
+int receive_file(struct TransferJob *job, const char *fifo_name)
+{
+    long long trace_start = TRACE_START();
+    int res = open(fifo_name, O_RDONLY);
+    TRACE_END(trace_start, TRACE_WAIT, "open fifo", -1);
+    if (res == -1)
+    {
+        perror("Error opening named pipe for reading");
+        return -1;
+    }
+
+    // Append to what an earlier attempt left in the temporary file
+    int dest_fd = open_temp_file(job, job->resume_offset);
+    if (dest_fd == -1)
+    {
+        close(res); // The sender sees EPIPE and gives up
+        return -1;
+    }
+
+    // Drain the pipe into the destination file and time it
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    struct BlockSizer sizer;
+    struct CacheWindow cache;
+    block_sizer_start(&sizer, BUFFER_SIZE);
+    cache_window_start(&cache, dest_fd, job->resume_offset, 1);
+    job->receive_checksum = ~0U;
+    cache_window_try_direct(&cache);
+    long long bytes_received = copy_fd(res, dest_fd, job->progress, job->journal,
+                                       verify_transfers ? &job->receive_checksum : NULL, &sizer, &cache, &job->receive_mode);
+    job->receive_checksum = ~job->receive_checksum;
+    job->receive_block_size = block_sizer_finish(&sizer);
+    if (bytes_received != -1)
+        cache_window_finish(&cache);
+    double seconds = elapsed_seconds(&start_time);
+    if (bytes_received == -1)
+    {
+        perror("Error writing to file");
+    }
+
+    // Close destination file and named pipe
+    close(res);
+    close(dest_fd);
+
+    // Keep the byte count and time; they are logged once the sender has also succeeded
+    job->bytes_done = bytes_received;
+    job->seconds = seconds;
+    return bytes_received == -1 ? -1 : 0;
+}
+
+// Function to read up to length bytes, stopping early only at EOF
+// Returns the number of bytes read, or -1 on error
+ssize_t read_full(int fd, void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        long long trace_start = TRACE_START();
+        ssize_t bytes_read = read(fd, (unsigned char *)buffer + done, length - done);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "read", bytes_read);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read == -1)
+            return -1;
+        if (bytes_read == 0)
+            break; // EOF reached
+        done += bytes_read;
+    }
+    return done;
+}
+
+// Function to write all length bytes
+// Returns 0 on success, -1 on error
+int write_full(int fd, const void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        long long trace_start = TRACE_START();
+        ssize_t bytes_written = write(fd, (const unsigned char *)buffer + done, length - done);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "write", bytes_written);
+        if (bytes_written == -1 && errno == EINTR)
+            continue;
+        if (bytes_written == -1)
+            return -1;
+        done += bytes_written;
+    }
+    return 0;
+}
+
+// Function to write all length bytes at offset
+// Returns 0 on success, -1 on error
+int pwrite_full(int fd, const void *buffer, size_t length, long long offset)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        long long trace_start = TRACE_START();
+        ssize_t bytes_written = pwrite(fd, (const unsigned char *)buffer + done, length - done, offset + done);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "pwrite", bytes_written);
+        if (bytes_written == -1 && errno == EINTR)
+            continue;
+        if (bytes_written == -1)
+            return -1;
+        done += bytes_written;
+    }
+    return 0;
+}
+
+// Function to name a codec of the compression stage
+const char *codec_name(int codec)
+{
+    return codec == CODEC_ZSTD ? "zstd" : codec == CODEC_LZ4 ? "lz4" : "off";
+}
+
+// Function to tell whether this build can compress and decompress with codec
+int codec_available(int codec)
+{
+#ifdef HAVE_ZSTD
+    if (codec == CODEC_ZSTD)
+        return 1;
+#endif
+#ifdef HAVE_LZ4
+    if (codec == CODEC_LZ4)
+        return 1;
+#endif
+    return 0;
+}
+
+// Function to return the largest size a block of length bytes can be packed to
+// by any codec of this build
+size_t codec_bound(size_t length)
+{
+    size_t bound = length;
+#ifdef HAVE_ZSTD
+    if (ZSTD_compressBound(length) > bound)
+        bound = ZSTD_compressBound(length);
+#endif
+#ifdef HAVE_LZ4
+    if ((size_t)LZ4_compressBound((int)length) > bound)
+        bound = LZ4_compressBound((int)length);
+#endif
+    return bound;
+}
+
+// Function to compress one block into packed, which holds capacity bytes
+// context is the calling thread's ZSTD_CCtx, or NULL to use a temporary one
+// Returns the packed size, or 0 when the block did not shrink and is better sent as it is
+size_t codec_compress(int codec, void *context, const unsigned char *data, size_t length, unsigned char *packed,
+                      size_t capacity, int level)
+{
+    size_t packed_length = 0;
+#ifdef HAVE_ZSTD
+    if (codec == CODEC_ZSTD)
+    {
+        int zstd_level = level ? level : ZSTD_CLEVEL_DEFAULT;
+        packed_length = context ? ZSTD_compressCCtx(context, packed, capacity, data, length, zstd_level)
+                                : ZSTD_compress(packed, capacity, data, length, zstd_level);
+        if (ZSTD_isError(packed_length))
+            packed_length = 0;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (codec == CODEC_LZ4)
+    {
+        int result = LZ4_compress_fast((const char *)data, (char *)packed, (int)length, (int)capacity, level > 0 ? level : 1);
+        packed_length = result > 0 ? result : 0;
+    }
+#endif
+    return packed_length < length ? packed_length : 0;
+}
+
+// Function to unpack one block, which must come out as exactly length bytes
+// Returns 0 on success, -1 when the block is damaged
+int codec_decompress(int codec, void *context, const unsigned char *packed, size_t packed_length, unsigned char *data,
+                     size_t length)
+{
+#ifdef HAVE_ZSTD
+    if (codec == CODEC_ZSTD)
+    {
+        size_t result = context ? ZSTD_decompressDCtx(context, data, length, packed, packed_length)
+                                : ZSTD_decompress(data, length, packed, packed_length);
+        return !ZSTD_isError(result) && result == length ? 0 : -1;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (codec == CODEC_LZ4)
+        return LZ4_decompress_safe((const char *)packed, (char *)data, (int)packed_length, (int)length) == (int)length ? 0 : -1;
+#endif
+    return -1;
+}
+
+// Function to pick the codec named by --compress: zstd, lz4, auto (the best one
+// this build has) or off. A codec the build lacks leaves compression off
+// Returns 0 on success, -1 for an unknown name
+int compress_select(const char *name)
+{
+    if (strcmp(name, "off") == 0)
+    {
+        compress_codec = CODEC_NONE;
+        return 0;
+    }
+    if (strcmp(name, "auto") == 0)
+    {
+#if defined(HAVE_ZSTD)
+        compress_codec = CODEC_ZSTD;
+#elif defined(HAVE_LZ4)
+        compress_codec = CODEC_LZ4;
+#else
+        fprintf(stderr, "This build has no compression support (rebuild with -DHAVE_ZSTD -lzstd or -DHAVE_LZ4 -llz4); "
+                        "sending files uncompressed\n");
+        compress_codec = CODEC_NONE;
+#endif
+        return 0;
+    }
+    if (strcmp(name, "zstd") == 0)
+    {
+#ifdef HAVE_ZSTD
+        compress_codec = CODEC_ZSTD;
+#else
+        fprintf(stderr, "This build has no zstd support (rebuild with -DHAVE_ZSTD -lzstd); sending files uncompressed\n");
+#endif
+        return 0;
+    }
+    if (strcmp(name, "lz4") == 0)
+    {
+#ifdef HAVE_LZ4
+        compress_codec = CODEC_LZ4;
+#else
+        fprintf(stderr, "This build has no lz4 support (rebuild with -DHAVE_LZ4 -llz4); sending files uncompressed\n");
+#endif
+        return 0;
+    }
+    return -1;
+}
+
+// Function to decide whether a file goes through the compression stage. Formats
+// known to be compressed already are sent as they are and known raw formats are
+// compressed; anything else is compressed when a few blocks sampled across the
+// file shrink enough
+// Returns the codec to send the file with, CODEC_NONE to send it as it is
+int compress_choose(struct TransferJob *job, long long size)
+{
+    if (compress_codec == CODEC_NONE || size <= job->resume_offset)
+        return CODEC_NONE;
+
+    const char *dot = strrchr(job->file.filename, '.');
+    if (dot && dot[1] && strlen(dot) < 16)
+    {
+        char extension[20];
+        snprintf(extension, sizeof(extension), " %s ", dot + 1);
+        if (strcasestr(COMPRESS_SKIP_EXTENSIONS, extension))
+            return CODEC_NONE;
+        if (strcasestr(COMPRESS_RAW_EXTENSIONS, extension))
+            return compress_codec;
+    }
+
+    char full_file_path[MAX_PATH_LENGTH];
+    int fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY) : -1;
+    if (fd == -1)
+        return CODEC_NONE; // The sender reports it
+    size_t capacity = codec_bound(COMPRESS_PROBE_BLOCK_SIZE);
+    unsigned char *data = malloc(COMPRESS_PROBE_BLOCK_SIZE);
+    unsigned char *packed = malloc(capacity);
+    long long sampled = 0, packed_total = 0;
+    for (int i = 0; data && packed && i < COMPRESS_PROBE_SAMPLES; i++)
+    {
+        long long offset = size > COMPRESS_PROBE_BLOCK_SIZE ? (size - COMPRESS_PROBE_BLOCK_SIZE) / (COMPRESS_PROBE_SAMPLES - 1) * i : 0;
+        ssize_t length = pread(fd, data, COMPRESS_PROBE_BLOCK_SIZE, offset);
+        if (length <= 0)
+            break;
+        size_t packed_length = codec_compress(compress_codec, NULL, data, length, packed, capacity, compress_level);
+        sampled += length;
+        packed_total += packed_length ? packed_length : length;
+    }
+    free(data);
+    free(packed);
+    close(fd);
+    return sampled && packed_total * 100 <= sampled * COMPRESS_PROBE_PERCENT ? compress_codec : CODEC_NONE;
+}
+
+// Compression helper thread: compresses the blocks the sender has read, in order
+void *compress_thread(void *arg)
+{
+    struct Compressor *compressor = (struct Compressor *)arg;
+    trace_thread_name("compress helper");
+    void *context = NULL;
+#ifdef HAVE_ZSTD
+    context = ZSTD_createCCtx();
+#endif
+    size_t capacity = codec_bound(COMPRESS_BLOCK_SIZE);
+    pthread_mutex_lock(&compressor->lock);
+    while (1)
+    {
+        while (compressor->taken == compressor->filled && !compressor->shutdown)
+        {
+            pthread_cond_wait(&compressor->cond, &compressor->lock);
+        }
+        if (compressor->taken == compressor->filled)
+        {
+            break; // Shutdown requested
+        }
+        struct CompressSlot *slot = &compressor->slots[compressor->taken++ % compressor->num_slots];
+        int codec = compressor->codec;
+        pthread_mutex_unlock(&compressor->lock);
+
+        long long t0 = thread_cpu_ns();
+        long long trace_start = TRACE_START();
+        slot->packed_length = codec_compress(codec, context, slot->data, slot->length, slot->packed, capacity, compress_level);
+        TRACE_END(trace_start, TRACE_STAGE, "compress", slot->length);
+        long long spent = thread_cpu_ns() - t0;
+
+        pthread_mutex_lock(&compressor->lock);
+        slot->state = COMPRESS_SLOT_PACKED;
+        compressor->packed_count++;
+        compressor->pack_ns += spent;
+        pthread_cond_broadcast(&compressor->cond);
+    }
+    pthread_mutex_unlock(&compressor->lock);
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(context);
+#endif
+    return NULL;
+}
+
+// Function to create the compression stage of a sender and start its helper threads;
+// by default the online CPUs are shared among the workers
+// Returns NULL on failure
+struct Compressor *compressor_create()
+{
+    int num_threads = compress_threads > 0 ? compress_threads : default_worker_count() / num_transfer_workers;
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > COMPRESS_MAX_THREADS)
+        num_threads = COMPRESS_MAX_THREADS;
+
+    struct Compressor *compressor = calloc(1, sizeof(struct Compressor));
+    if (compressor == NULL)
+    {
+        perror("Error allocating compression stage");
+        return NULL;
+    }
+    pthread_mutex_init(&compressor->lock, NULL);
+    pthread_cond_init(&compressor->cond, NULL);
+    compressor->num_slots = num_threads * COMPRESS_SLOTS_PER_THREAD;
+    for (int i = 0; i < compressor->num_slots; i++)
+    {
+        compressor->slots[i].data = malloc(COMPRESS_BLOCK_SIZE);
+        compressor->slots[i].packed = malloc(codec_bound(COMPRESS_BLOCK_SIZE));
+        if (compressor->slots[i].data == NULL || compressor->slots[i].packed == NULL)
+        {
+            perror("Error allocating compression buffers");
+            compressor_destroy(compressor);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (pthread_create(&compressor->threads[i], NULL, compress_thread, compressor) != 0)
+        {
+            perror("Error creating compression thread");
+            break;
+        }
+        compressor->num_threads++;
+    }
+    if (compressor->num_threads == 0)
+    {
+        compressor_destroy(compressor);
+        return NULL;
+    }
+    return compressor;
+}
+
+// Function to stop the helper threads of a compression stage and free it
+void compressor_destroy(struct Compressor *compressor)
+{
+    pthread_mutex_lock(&compressor->lock);
+    compressor->shutdown = 1;
+    pthread_cond_broadcast(&compressor->cond);
+    pthread_mutex_unlock(&compressor->lock);
+    for (int i = 0; i < compressor->num_threads; i++)
+    {
+        pthread_join(compressor->threads[i], NULL);
+    }
+    for (int i = 0; i < compressor->num_slots; i++)
+    {
+        free(compressor->slots[i].data);
+        free(compressor->slots[i].packed);
+    }
+    pthread_mutex_destroy(&compressor->lock);
+    pthread_cond_destroy(&compressor->cond);
+    free(compressor);
+}
+
+// Function to send length bytes of src_fd, from its current position, to out_fd
+// through the compression stage, as a CompressFrame and its bytes per block.
+// Reading, compressing and sending overlap: the worker keeps every free slot
+// filled while the helpers compress. Progress and the bandwidth caps count the
+// bytes that go on the wire. Returns 0 on success, -1 on error
+int compress_send(struct TransferJob *job, struct Compressor *compressor, int src_fd, int out_fd, long long length,
+                  struct TransferProgress *progress)
+{
+    pthread_mutex_lock(&compressor->lock);
+    compressor->codec = job->codec;
+    compressor->pack_ns = 0;
+    long long next_read = compressor->filled;
+    long long next_write = compressor->filled;
+    pthread_mutex_unlock(&compressor->lock);
+
+    long long total = 0;
+    int failed = 0;
+    while (!failed)
+    {
+        while (total < length && next_read - next_write < compressor->num_slots)
+        {
+            struct CompressSlot *slot = &compressor->slots[next_read % compressor->num_slots];
+            size_t want = length - total < COMPRESS_BLOCK_SIZE ? (size_t)(length - total) : COMPRESS_BLOCK_SIZE;
+            ssize_t got = read_full(src_fd, slot->data, want);
+            if (got != (ssize_t)want)
+            {
+                if (got != -1)
+                    errno = EIO; // The file shrank under us
+                perror("Error reading file");
+                failed = 1;
+                break;
+            }
+            slot->length = want;
+            total += want;
+
+            pthread_mutex_lock(&compressor->lock);
+            slot->state = COMPRESS_SLOT_FILLED;
+            compressor->filled++;
+            pthread_cond_broadcast(&compressor->cond);
+            pthread_mutex_unlock(&compressor->lock);
+            next_read++;
+        }
+        if (failed || next_write == next_read)
+            break;
+
+        // Send the oldest block as soon as it is compressed
+        struct CompressSlot *slot = &compressor->slots[next_write % compressor->num_slots];
+        long long trace_start = TRACE_START();
+        pthread_mutex_lock(&compressor->lock);
+        while (slot->state != COMPRESS_SLOT_PACKED)
+        {
+            pthread_cond_wait(&compressor->cond, &compressor->lock);
+        }
+        pthread_mutex_unlock(&compressor->lock);
+        TRACE_END(trace_start, TRACE_WAIT, "wait for compressor", -1);
+        struct CompressFrame frame = {htonl((uint32_t)slot->length), htonl((uint32_t)slot->packed_length)};
+        size_t payload = slot->packed_length ? slot->packed_length : slot->length;
+        if (write_full(out_fd, &frame, sizeof(frame)) == -1 ||
+            write_full(out_fd, slot->packed_length ? slot->packed : slot->data, payload) == -1)
+        {
+            failed = 1;
+        }
+        job->wire_bytes += sizeof(frame) + payload;
+        progress_add(progress, slot->length, 0, 0);
+        transfer_throttle(progress, sizeof(frame) + payload);
+        slot->state = COMPRESS_SLOT_FREE;
+        next_write++;
+    }
+
+    // The helpers must be done with the slots before the next file reuses them
+    pthread_mutex_lock(&compressor->lock);
+    while (compressor->packed_count < compressor->filled)
+    {
+        pthread_cond_wait(&compressor->cond, &compressor->lock);
+    }
+    for (; next_write < next_read; next_write++)
+        compressor->slots[next_write % compressor->num_slots].state = COMPRESS_SLOT_FREE;
+    job->pack_ns = compressor->pack_ns;
+    pthread_mutex_unlock(&compressor->lock);
+    return failed ? -1 : 0;
+}
+
+// Function to receive the length bytes compress_send() puts on the connection in_fd,
+// unpack them and write them to out_fd. Blocks are still read when they cannot be
+// stored, so that the next request is found; *status is then set to the errno to
+// reply with. Returns the number of bytes received, or -1 if the stream broke
+long long compress_receive(int codec, int in_fd, int out_fd, long long length, int *status, long long *unpack_ns)
+{
+    size_t capacity = codec_bound(COMPRESS_BLOCK_SIZE);
+    unsigned char *data = buffer_pool_get(COMPRESS_BLOCK_SIZE);
+    unsigned char *packed = buffer_pool_get(capacity);
+    void *context = NULL;
+#ifdef HAVE_ZSTD
+    if (codec == CODEC_ZSTD)
+        context = ZSTD_createDCtx();
+#endif
+    if (data == NULL || packed == NULL)
+        *status = ENOMEM; // The blocks are still drained into whichever buffer exists
+    long long total = 0;
+    while (total != -1 && total < length)
+    {
+        struct CompressFrame frame;
+        if (read_full(in_fd, &frame, sizeof(frame)) != sizeof(frame))
+        {
+            total = -1;
+            break;
+        }
+        frame.length = ntohl(frame.length);
+        frame.packed_length = ntohl(frame.packed_length);
+        size_t payload = frame.packed_length ? frame.packed_length : frame.length;
+        unsigned char *target = frame.packed_length ? packed : data;
+        if (frame.length == 0 || frame.length > COMPRESS_BLOCK_SIZE || frame.length > length - total ||
+            frame.packed_length >= frame.length || target == NULL ||
+            read_full(in_fd, target, payload) != (ssize_t)payload)
+        {
+            fprintf(stderr, "Truncated or damaged compressed stream\n");
+            total = -1;
+            break;
+        }
+        if (frame.packed_length && *status == 0)
+        {
+            long long cpu0 = thread_cpu_ns();
+            long long trace_start = TRACE_START();
+            int unpacked = codec_decompress(codec, context, packed, frame.packed_length, data, frame.length);
+            TRACE_END(trace_start, TRACE_STAGE, "decompress", frame.length);
+            *unpack_ns += thread_cpu_ns() - cpu0;
+            if (unpacked == -1)
+            {
+                fprintf(stderr, "Damaged %s block\n", codec_name(codec));
+                *status = EIO;
+            }
+        }
+        if (*status == 0 && out_fd != -1 && pwrite_full(out_fd, data, frame.length, total) == -1)
+        {
+            *status = errno;
+            perror("Error writing to file");
+        }
+        total += frame.length;
+    }
+#ifdef HAVE_ZSTD
+    if (context)
+        ZSTD_freeDCtx(context);
+#endif
+    if (data)
+        buffer_pool_put(data, COMPRESS_BLOCK_SIZE);
+    if (packed)
+        buffer_pool_put(packed, capacity);
+    return total;
+}
+
+// Function to block while the futex word at addr still holds value
+void futex_wait(_Atomic int *addr, int value)
+{
+    long long trace_start = TRACE_START();
+    syscall(SYS_futex, (int *)addr, FUTEX_WAIT, value, NULL, NULL, 0);
+    COUNT_IO_SYSCALL();
+    TRACE_END(trace_start, TRACE_WAIT, "wait on ring", -1);
+}
+
+// Function to wake every thread blocked on the futex word at addr
+void futex_wake(_Atomic int *addr)
+{
+    syscall(SYS_futex, (int *)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    COUNT_IO_SYSCALL();
+}
+
+// Function to map a ring of capacity bytes (a power of two) in memfd-backed shared memory
+// Returns NULL on failure
+struct ShmRing *shm_ring_create(size_t capacity)
+{
+    int fd = memfd_create("transfer_ring", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        perror("Error creating shared memory ring");
+        return NULL;
+    }
+    size_t map_size = sizeof(struct ShmRing) + capacity;
+    if (ftruncate(fd, map_size) == -1)
+    {
+        perror("Error sizing shared memory ring");
+        close(fd);
+        return NULL;
+    }
+    struct ShmRing *ring = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the memory alive
+    if (ring == MAP_FAILED)
+    {
+        perror("Error mapping shared memory ring");
+        return NULL;
+    }
+    ring->capacity = capacity;
+    shm_ring_reset(ring);
+    return ring;
+}
+
+// Function to unmap a ring created by shm_ring_create()
+void shm_ring_destroy(struct ShmRing *ring)
+{
+    munmap(ring, sizeof(struct ShmRing) + ring->capacity);
+}
+
+// Function to empty a ring before it carries the next file
+void shm_ring_reset(struct ShmRing *ring)
+{
+    atomic_store(&ring->write_pos, 0);
+    atomic_store(&ring->read_pos, 0);
+    atomic_store(&ring->producer_waiting, 0);
+    atomic_store(&ring->consumer_waiting, 0);
+    atomic_store(&ring->state, RING_OPEN);
+}
+
+// Function to wait until the producer has room in the ring
+// Returns the number of contiguous free bytes, or 0 if the consumer gave up
+size_t shm_ring_wait_space(struct ShmRing *ring)
+{
+    unsigned long long write_pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    while (1)
+    {
+        int seq = atomic_load(&ring->space_seq);
+        unsigned long long used = write_pos - atomic_load(&ring->read_pos);
+        if (atomic_load(&ring->state) == RING_ABORTED)
+            return 0;
+        if (used < ring->capacity)
+        {
+            size_t index = write_pos & (ring->capacity - 1);
+            size_t free_bytes = ring->capacity - used;
+            return free_bytes < ring->capacity - index ? free_bytes : ring->capacity - index;
+        }
+
+        // Announce that we are about to sleep, then re-check before sleeping
+        atomic_store(&ring->producer_waiting, 1);
+        if (write_pos - atomic_load(&ring->read_pos) >= ring->capacity && atomic_load(&ring->state) != RING_ABORTED)
+            futex_wait(&ring->space_seq, seq);
+        atomic_store(&ring->producer_waiting, 0);
+    }
+}
+
+// Function to publish count bytes written at the producer position
+void shm_ring_produce(struct ShmRing *ring, size_t count)
+{
+    atomic_fetch_add_explicit(&ring->write_pos, count, memory_order_release);
+    atomic_fetch_add(&ring->data_seq, 1);
+    if (atomic_load(&ring->consumer_waiting))
+        futex_wake(&ring->data_seq);
+}
+
+// Function to wait until the consumer has data in the ring
+// Returns the number of contiguous readable bytes, or 0 once the producer has finished
+size_t shm_ring_wait_data(struct ShmRing *ring)
+{
+    unsigned long long read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    while (1)
+    {
+        int seq = atomic_load(&ring->data_seq);
+        unsigned long long available = atomic_load_explicit(&ring->write_pos, memory_order_acquire) - read_pos;
+        if (available > 0)
+        {
+            size_t index = read_pos & (ring->capacity - 1);
+            return available < ring->capacity - index ? available : ring->capacity - index;
+        }
+        if (atomic_load(&ring->state) != RING_OPEN)
+        {
+            // Data published just before the stream was closed is still delivered
+            if (atomic_load(&ring->write_pos) == read_pos)
+                return 0;
+            continue;
+        }
+
+        // Announce that we are about to sleep, then re-check before sleeping
+        atomic_store(&ring->consumer_waiting, 1);
+        if (atomic_load(&ring->write_pos) == read_pos && atomic_load(&ring->state) == RING_OPEN)
+            futex_wait(&ring->data_seq, seq);
+        atomic_store(&ring->consumer_waiting, 0);
+    }
+}
+
+// Function to release count bytes the consumer has finished with
+void shm_ring_consume(struct ShmRing *ring, size_t count)
+{
+    atomic_fetch_add_explicit(&ring->read_pos, count, memory_order_release);
+    atomic_fetch_add(&ring->space_seq, 1);
+    if (atomic_load(&ring->producer_waiting))
+        futex_wake(&ring->space_seq);
+}
+
+// Function to end the stream: RING_EOF or RING_ERROR from the producer, RING_ABORTED from the consumer
+void shm_ring_close(struct ShmRing *ring, int state)
+{
+    atomic_store(&ring->state, state);
+    atomic_fetch_add(&ring->data_seq, 1);
+    atomic_fetch_add(&ring->space_seq, 1);
+    futex_wake(&ring->data_seq);
+    futex_wake(&ring->space_seq);
+}
+
+// Function to run the sender half of a transfer over a shared memory ring
+// File data is read straight into the ring, so no intermediate buffer is involved
+// Returns 0 on success, -1 on failure
+int send_file_shm(struct TransferJob *job, struct ShmRing *ring)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    int src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY) : -1;
+    if (src_fd == -1 || lseek(src_fd, job->resume_offset, SEEK_SET) == -1)
+    {
+        perror("Error opening file");
+        if (src_fd != -1)
+            close(src_fd);
+        shm_ring_close(ring, RING_ERROR);
+        return -1;
+    }
+
+    int result = 0;
+    struct BlockSizer sizer;
+    struct CacheWindow cache;
+    block_sizer_start(&sizer, SHM_BLOCK_SIZE);
+    cache_window_start(&cache, src_fd, job->resume_offset, 0);
+    job->send_checksum = ~0U;
+    while (1)
+    {
+        size_t space = shm_ring_wait_space(ring);
+        if (space == 0)
+        {
+            result = -1; // The receiver gave up
+            break;
+        }
+        if (space > sizer.size)
+            space = sizer.size;
+
+        size_t index = atomic_load_explicit(&ring->write_pos, memory_order_relaxed) & (ring->capacity - 1);
+        long long trace_start = TRACE_START();
+        ssize_t bytes_read = read(src_fd, ring->data + index, space);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "read", bytes_read);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read == -1)
+        {
+            perror("Error reading file");
+            result = -1;
+            break;
+        }
+        if (bytes_read == 0)
+            break; // EOF reached
+        if (verify_transfers)
+            checksum_add(&job->send_checksum, ring->data + index, bytes_read);
+        shm_ring_produce(ring, bytes_read);
+        block_sizer_update(&sizer, bytes_read);
+        cache_window_advance(&cache, bytes_read);
+    }
+    job->send_checksum = ~job->send_checksum;
+    job->send_block_size = block_sizer_finish(&sizer);
+    cache_window_finish(&cache);
+    close(src_fd);
+    shm_ring_close(ring, result == 0 ? RING_EOF : RING_ERROR);
+    return result;
+}
+
+// Function to run the receiver half of a transfer over a shared memory ring
+// Returns 0 on success, -1 on failure
+int receive_file_shm(struct TransferJob *job, struct ShmRing *ring)
+{
+    // Append to what an earlier attempt left in the temporary file
+    int dest_fd = open_temp_file(job, job->resume_offset);
+    if (dest_fd == -1)
+    {
+        shm_ring_close(ring, RING_ABORTED);
+        return -1;
+    }
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    long long bytes_received = 0;
+    int result = 0;
+    size_t available;
+    struct CacheWindow cache; // Ring offsets are not aligned, so O_DIRECT is never used here
+    cache_window_start(&cache, dest_fd, job->resume_offset, 1);
+    job->receive_checksum = ~0U;
+    long long t0 = now_ns();
+    while (result == 0 && (available = shm_ring_wait_data(ring)) > 0)
+    {
+        long long t1 = now_ns();
+        size_t index = atomic_load_explicit(&ring->read_pos, memory_order_relaxed) & (ring->capacity - 1);
+        if (verify_transfers)
+            checksum_add(&job->receive_checksum, ring->data + index, available);
+        size_t done = 0;
+        while (done < available)
+        {
+            long long trace_start = TRACE_START();
+            ssize_t bytes_written = write(dest_fd, ring->data + index + done, available - done);
+            COUNT_IO_SYSCALL();
+            TRACE_END(trace_start, TRACE_IO, "write", bytes_written);
+            if (bytes_written == -1 && errno == EINTR)
+                continue;
+            if (bytes_written <= 0)
+            {
+                perror("Error writing to file");
+                shm_ring_close(ring, RING_ABORTED);
+                result = -1;
+                break;
+            }
+            done += bytes_written;
+        }
+        shm_ring_consume(ring, done);
+        bytes_received += done;
+        journal_add(job->journal, dest_fd, done);
+        cache_window_advance(&cache, done);
+        long long t2 = now_ns();
+        progress_add(job->progress, done, t1 - t0, t2 - t1);
+        transfer_throttle(job->progress, done);
+        t0 = now_ns();
+    }
+    if (result == 0)
+        cache_window_finish(&cache);
+    double seconds = elapsed_seconds(&start_time);
+    job->receive_checksum = ~job->receive_checksum;
+    if (close(dest_fd) == -1)
+        result = -1;
+    if (result == 0 && atomic_load(&ring->state) == RING_ERROR)
+        result = -1; // The sender failed part way through
+
+    // Keep the byte count and time; they are logged once the checksums are compared
+    job->bytes_done = bytes_received;
+    job->seconds = seconds;
+    return result;
+}
+
+// Function to transfer a single file with the worker's sender thread on the other end
+// of either a per-file FIFO or the worker's shared memory ring
+// Returns 0 on success, -1 on failure
+int transfer_file(struct TransferWorker *worker, struct TransferJob *job)
+{
+    char fifo_name[MAX_PATH_LENGTH];
+    struct ShmRing *ring = NULL;
+    if (transfer_transport == TRANSFER_TRANSPORT_SHM)
+    {
+        // The ring is created once per worker and reused for every file
+        if (worker->ring == NULL && (worker->ring = shm_ring_create(SHM_RING_SIZE)) == NULL)
+        {
+            return -1;
+        }
+        ring = worker->ring;
+        shm_ring_reset(ring);
+    }
+    else
+    {
+        snprintf(fifo_name, sizeof(fifo_name), "fifo_%d_%s", worker->id, job->file.filename);
+        // The name belongs to this worker; one left over by a killed run is stale
+        long long trace_start = TRACE_START();
+        if (mkfifo(fifo_name, 0666) == -1 && (errno != EEXIST || unlink(fifo_name) == -1 || mkfifo(fifo_name, 0666) == -1))
+        {
+            perror("Error creating FIFO pipe");
+            return -1;
+        }
+        TRACE_END(trace_start, TRACE_IO, "mkfifo", -1);
+    }
+
+    // Hand the job to the sender thread and act as the receiver ourselves
+    pthread_mutex_lock(&worker->lock);
+    if (ring == NULL)
+        strcpy(worker->fifo_name, fifo_name);
+    worker->send_ring = ring;
+    worker->send_job = job;
+    worker->send_done = 0;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+
+    int received = ring ? receive_file_shm(job, ring) : receive_file(job, fifo_name);
+
+    // Wait for the sender to finish with this job
+    pthread_mutex_lock(&worker->lock);
+    while (!worker->send_done)
+    {
+        pthread_cond_wait(&worker->cond, &worker->lock);
+    }
+    int sent = worker->send_result;
+    pthread_mutex_unlock(&worker->lock);
+
+    if (ring == NULL && unlink(fifo_name) == -1)
+    {
+        perror("Error removing FIFO pipe");
+    }
+
+    // Both sides checksummed the same bytes; a difference means the data was damaged
+    // on the way, so nothing written for this file can be trusted
+    int result = (sent == -1 || received == -1) ? -1 : 0;
+    if (result == 0 && verify_transfers && job->send_checksum != job->receive_checksum)
+    {
+        fprintf(stderr, "Checksum mismatch for file %s: sender crc32c %08x, receiver %08x\n",
+                job->file.filename, job->send_checksum, job->receive_checksum);
+        job->checksum_mismatch = 1;
+        journal_discard(job->journal);
+        result = -1;
+    }
+
+    // Publish the complete file, or keep the checkpointed part for a later attempt
+    result = journal_finish(job, result);
+    if (result == 0)
+    {
+        char how[160];
+        char mode[32];
+        int used;
+        if (ring)
+        {
+            snprintf(mode, sizeof(mode), "shm");
+        }
+        else if (strcmp(job->send_mode, job->receive_mode) == 0)
+        {
+            snprintf(mode, sizeof(mode), "%s", job->receive_mode);
+        }
+        else
+        {
+            snprintf(mode, sizeof(mode), "%s/%s", job->send_mode, job->receive_mode); // sender/receiver
+        }
+        if (verify_transfers)
+            used = snprintf(how, sizeof(how), "%s, crc32c %08x verified", mode, job->receive_checksum);
+        else
+            used = snprintf(how, sizeof(how), "%s", mode);
+        if (cache_mode != CACHE_MODE_NORMAL)
+            used += snprintf(how + used, sizeof(how) - used, ", cache %s", cache_mode_name());
+        if (adaptive_buffers && ring)
+            snprintf(how + used, sizeof(how) - used, ", blocks %zu KB", job->send_block_size / 1024);
+        else if (adaptive_buffers)
+            snprintf(how + used, sizeof(how) - used, ", blocks %zu/%zu KB, pipe %d KB", job->send_block_size / 1024,
+                     job->receive_block_size / 1024, job->pipe_size / 1024);
+        log_file_completed(job->file.filename, job->bytes_done, job->seconds, how);
+    }
+    return result;
+}
+
+// Function to copy length bytes at offset from src_fd to dest_fd with pread()/pwrite()
+// Both calls hit a disk, so all of their time is counted as waiting on the disk
+// in_kernel tries copy_file_range() first, for folder syncs within one filesystem
+// Returns 0 on success, -1 on failure
+int copy_range(int src_fd, int dest_fd, long long offset, long long length, struct TransferProgress *progress, int in_kernel)
+{
+    if (in_kernel)
+    {
+        int unsupported;
+        if (kernel_copy(src_fd, dest_fd, offset, length, progress, NULL, &unsupported) == -1)
+            return -1;
+        if (!unsupported)
+            return 0;
+    }
+
+    unsigned char *buffer = buffer_pool_get(CHUNK_COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+        return -1;
+
+    // Both descriptors are shared by every chunk of the file, so O_DIRECT, a
+    // per-descriptor flag, is left off and the pages are only released
+    struct CacheWindow src_cache, dest_cache;
+    cache_window_start(&src_cache, src_fd, offset, 0);
+    cache_window_start(&dest_cache, dest_fd, offset, 1);
+    int result = 0;
+    while (length > 0)
+    {
+        size_t want = length < CHUNK_COPY_BUFFER_SIZE ? (size_t)length : CHUNK_COPY_BUFFER_SIZE;
+        long long t0 = now_ns();
+        long long trace_start = TRACE_START();
+        ssize_t bytes_read = pread(src_fd, buffer, want, offset);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "pread", bytes_read);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0)
+        {
+            // The source shrank or could not be read
+            perror("Error reading file chunk");
+            result = -1;
+            break;
+        }
+
+        ssize_t done = 0;
+        while (done < bytes_read)
+        {
+            long long trace_start = TRACE_START();
+            ssize_t bytes_written = pwrite(dest_fd, buffer + done, bytes_read - done, offset + done);
+            COUNT_IO_SYSCALL();
+            TRACE_END(trace_start, TRACE_IO, "pwrite", bytes_written);
+            if (bytes_written == -1 && errno == EINTR)
+                continue;
+            if (bytes_written <= 0)
+            {
+                perror("Error writing file chunk");
+                result = -1;
+                break;
+            }
+            done += bytes_written;
+        }
+        if (result == -1)
+            break;
+        progress_add(progress, bytes_read, 0, now_ns() - t0);
+        transfer_throttle(progress, bytes_read);
+        cache_window_advance(&src_cache, bytes_read);
+        cache_window_advance(&dest_cache, bytes_read);
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+    buffer_pool_put(buffer, CHUNK_COPY_BUFFER_SIZE);
+    cache_window_finish(&src_cache);
+    if (result == 0)
+        cache_window_finish(&dest_cache);
+    return result;
+}
+
+// Function to copy length bytes at offset from src_fd to dest_fd inside the kernel with
+// copy_file_range(), which also lets filesystems share blocks or copy on the server.
+// Time in the call counts as waiting on the disk; journal, when set, checkpoints a
+// sequential copy. *unsupported is set, with nothing copied, when the filesystems
+// cannot do it, in which case the caller copies through user space instead
+// Returns the number of bytes copied, or -1 on error
+long long kernel_copy(int src_fd, int dest_fd, long long offset, long long length, struct TransferProgress *progress,
+                      struct JournalEntry *journal, int *unsupported)
+{
+    long long total = 0;
+    *unsupported = 0;
+    while (total < length)
+    {
+        loff_t in_offset = offset + total;
+        loff_t out_offset = offset + total;
+        size_t want = length - total < KERNEL_COPY_BLOCK_SIZE ? (size_t)(length - total) : KERNEL_COPY_BLOCK_SIZE;
+        long long t0 = now_ns();
+        long long trace_start = TRACE_START();
+        ssize_t copied = copy_file_range(src_fd, &in_offset, dest_fd, &out_offset, want, 0);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "copy_file_range", copied);
+        if (copied == -1 && errno == EINTR)
+            continue;
+        if (copied == -1 && total == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+        {
+            *unsupported = 1;
+            break;
+        }
+        if (copied <= 0)
+        {
+            // The source shrank or could not be copied
+            perror("Error copying file in the kernel");
+            return -1;
+        }
+        total += copied;
+        progress_add(progress, copied, 0, now_ns() - t0);
+        transfer_throttle(progress, copied);
+        journal_add(journal, dest_fd, copied);
+    }
+    return total;
+}
+
+// Function to copy a whole file of a folder sync with kernel_copy(), resuming
+// where an earlier attempt left off
+// Returns 0 on success, -1 on failure, 1 if the filesystems cannot copy in the
+// kernel and the file has to take the normal path
+int kernel_copy_file(struct TransferJob *job, long long size)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    int src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY) : -1;
+    if (src_fd == -1)
+    {
+        perror("Error opening file");
+        return -1;
+    }
+    int dest_fd = open_temp_file(job, job->resume_offset);
+    if (dest_fd == -1)
+    {
+        close(src_fd);
+        return -1;
+    }
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    int unsupported;
+    long long copied = kernel_copy(src_fd, dest_fd, job->resume_offset, size - job->resume_offset, job->progress,
+                                   job->journal, &unsupported);
+    close(src_fd);
+    close(dest_fd);
+    if (unsupported)
+        return 1;
+    job->bytes_done = copied;
+    job->seconds = elapsed_seconds(&start_time);
+    return copied == -1 ? -1 : 0;
+}
+
+// Functions to read and write big-endian integers, the byte order of MP4 boxes
+uint32_t load_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+uint64_t load_be64(const unsigned char *p)
+{
+    return (uint64_t)load_be32(p) << 32 | load_be32(p + 4);
+}
+
+void store_be32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+void store_be64(unsigned char *p, uint64_t value)
+{
+    store_be32(p, value >> 32);
+    store_be32(p + 4, (uint32_t)value);
+}
+
+// Function to recognise the container of a video by its first bytes rather than its
+// extension; *packet_size is set to the packet size of transport streams
+// Returns VIDEO_FORMAT_*
+int video_probe(int fd, long long size, int *packet_size)
+{
+    unsigned char head[3 * M2TS_PACKET_SIZE];
+    ssize_t length = pread(fd, head, sizeof(head), 0);
+    COUNT_IO_SYSCALL();
+    *packet_size = 1;
+    if (length >= 12 && memcmp(head + 4, "ftyp", 4) == 0)
+        return VIDEO_FORMAT_MP4;
+    if (length >= 3 * TS_PACKET_SIZE && size % TS_PACKET_SIZE == 0 && head[0] == TS_SYNC_BYTE &&
+        head[TS_PACKET_SIZE] == TS_SYNC_BYTE && head[2 * TS_PACKET_SIZE] == TS_SYNC_BYTE)
+    {
+        *packet_size = TS_PACKET_SIZE;
+        return VIDEO_FORMAT_TS;
+    }
+    if (length == sizeof(head) && size % M2TS_PACKET_SIZE == 0 && head[4] == TS_SYNC_BYTE &&
+        head[4 + M2TS_PACKET_SIZE] == TS_SYNC_BYTE && head[4 + 2 * M2TS_PACKET_SIZE] == TS_SYNC_BYTE)
+    {
+        *packet_size = M2TS_PACKET_SIZE;
+        return VIDEO_FORMAT_TS;
+    }
+    return VIDEO_FORMAT_NONE;
+}
+
+// Function to walk the top-level boxes of an MP4 file and find the index (moov)
+// and the first media box (mdat)
+// Returns 0 if both were found in a well-formed file, -1 otherwise
+int mp4_find_boxes(int fd, long long size, long long *moov_offset, long long *moov_size, long long *mdat_offset)
+{
+    *moov_offset = *mdat_offset = -1;
+    long long offset = 0;
+    for (int i = 0; i < MP4_MAX_BOXES && offset < size; i++)
+    {
+        unsigned char header[16];
+        if (size - offset < 8 || pread(fd, header, sizeof(header), offset) < 8)
+            return -1;
+        COUNT_IO_SYSCALL();
+        long long box_size = load_be32(header);
+        if (box_size == 1)
+        {
+            if (size - offset < 16)
+                return -1;
+            box_size = (long long)load_be64(header + 8); // 64-bit size follows the type
+        }
+        else if (box_size == 0)
+        {
+            box_size = size - offset; // The box runs to the end of the file
+        }
+        if (box_size < 8 || box_size > size - offset)
+            return -1;
+
+        if (memcmp(header + 4, "moov", 4) == 0 && *moov_offset == -1)
+        {
+            *moov_offset = offset;
+            *moov_size = box_size;
+        }
+        else if (memcmp(header + 4, "mdat", 4) == 0 && *mdat_offset == -1)
+        {
+            *mdat_offset = offset;
+        }
+        offset += box_size;
+    }
+    return offset == size && *moov_offset != -1 && *mdat_offset != -1 ? 0 : -1;
+}
+
+// Function to add shift to every chunk offset (stco/co64 entry) in the boxes at data
+// that points into the file range [from, to). The boxes leading to the sample tables
+// are descended into
+// Returns 0, or -1 if the boxes are malformed or a 32-bit offset would overflow
+int mp4_patch_offsets(unsigned char *data, long long length, long long from, long long to, long long shift)
+{
+    long long pos = 0;
+    while (pos + 8 <= length)
+    {
+        long long size = load_be32(data + pos);
+        int header = 8;
+        if (size == 1)
+        {
+            if (pos + 16 > length)
+                return -1;
+            size = (long long)load_be64(data + pos + 8);
+            header = 16;
+        }
+        else if (size == 0)
+        {
+            size = length - pos;
+        }
+        if (size < header || size > length - pos)
+            return -1;
+
+        const unsigned char *type = data + pos + 4;
+        unsigned char *body = data + pos + header;
+        long long body_length = size - header;
+        if (memcmp(type, "moov", 4) == 0 || memcmp(type, "trak", 4) == 0 || memcmp(type, "mdia", 4) == 0 ||
+            memcmp(type, "minf", 4) == 0 || memcmp(type, "stbl", 4) == 0)
+        {
+            if (mp4_patch_offsets(body, body_length, from, to, shift) == -1)
+                return -1;
+        }
+        else if (memcmp(type, "stco", 4) == 0 || memcmp(type, "co64", 4) == 0)
+        {
+            // Version and flags, the entry count, then the offsets
+            int wide = type[0] == 'c';
+            int entry_size = wide ? 8 : 4;
+            if (body_length < 8 || load_be32(body + 4) > (uint64_t)(body_length - 8) / entry_size)
+                return -1;
+            uint32_t count = load_be32(body + 4);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                unsigned char *entry = body + 8 + (size_t)i * entry_size;
+                long long offset = wide ? (long long)load_be64(entry) : load_be32(entry);
+                if (offset < from || offset >= to)
+                    continue;
+                offset += shift;
+                if (wide)
+                    store_be64(entry, offset);
+                else if (offset > UINT32_MAX)
+                    return -1;
+                else
+                    store_be32(entry, (uint32_t)offset);
+            }
+        }
+        pos += size;
+    }
+    return 0;
+}
+
+// Function to copy length bytes from src_offset in src_fd to dest_offset in dest_fd
+// front to back, in blocks that are a multiple of unit bytes, so that the growing
+// destination always ends on a whole transport stream packet
+// Returns 0 on success, -1 on failure
+int segment_copy(int src_fd, long long src_offset, int dest_fd, long long dest_offset, long long length, int unit,
+                 struct TransferProgress *progress)
+{
+    unsigned char *buffer = buffer_pool_get(CHUNK_COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+        return -1;
+    size_t block = CHUNK_COPY_BUFFER_SIZE / unit * unit;
+    struct CacheWindow src_cache, dest_cache;
+    cache_window_start(&src_cache, src_fd, src_offset, 0);
+    cache_window_start(&dest_cache, dest_fd, dest_offset, 1);
+    int result = 0;
+    long long done = 0;
+    while (done < length)
+    {
+        size_t want = length - done < (long long)block ? (size_t)(length - done) : block;
+        long long t0 = now_ns();
+        long long trace_start = TRACE_START();
+        ssize_t bytes_read = pread(src_fd, buffer, want, src_offset + done);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "pread", bytes_read);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read != (ssize_t)want)
+        {
+            // The source shrank or could not be read; a short read would also tear a packet
+            perror("Error reading file segment");
+            result = -1;
+            break;
+        }
+        if (pwrite_full(dest_fd, buffer, want, dest_offset + done) == -1)
+        {
+            perror("Error writing file segment");
+            result = -1;
+            break;
+        }
+        progress_add(progress, want, 0, now_ns() - t0);
+        transfer_throttle(progress, want);
+        cache_window_advance(&src_cache, want);
+        cache_window_advance(&dest_cache, want);
+        done += want;
+    }
+    buffer_pool_put(buffer, CHUNK_COPY_BUFFER_SIZE);
+    cache_window_finish(&src_cache);
+    if (result == 0)
+        cache_window_finish(&dest_cache);
+    return result;
+}
+
+// Function to copy an MP4 or MPEG-TS file so that a player can open the destination
+// while the rest is still arriving. The file is written front to back and shown under
+// its name as soon as its head is there: the index of an MP4 file, moved in front of
+// the media if it was recorded at the end, or the first packets of a transport stream
+// Returns 0 on success, -1 on failure, 1 if the file is not a video this can help with
+int playable_copy_file(struct TransferJob *job, const struct stat *source)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    int src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY) : -1;
+    if (src_fd == -1)
+        return 1; // Let the usual path report it
+
+    long long size = source->st_size;
+    int unit;
+    long long moov_offset = 0, moov_size = 0, mdat_offset = 0;
+    int format = video_probe(src_fd, size, &unit);
+    if (format == VIDEO_FORMAT_MP4 && mp4_find_boxes(src_fd, size, &moov_offset, &moov_size, &mdat_offset) == -1)
+        format = VIDEO_FORMAT_NONE;
+
+    // An index behind the media moves in front of it, so the chunk offsets
+    // pointing at the media it jumps over grow by its size
+    unsigned char *moov = NULL;
+    if (format == VIDEO_FORMAT_MP4 && moov_offset > mdat_offset)
+    {
+        if (moov_size > MP4_MAX_MOOV_SIZE || (moov = malloc(moov_size)) == NULL ||
+            pread(src_fd, moov, moov_size, moov_offset) != moov_size ||
+            mp4_patch_offsets(moov, moov_size, mdat_offset, moov_offset, moov_size) == -1)
+        {
+            free(moov);
+            moov = NULL;
+            format = VIDEO_FORMAT_NONE; // Too big, unreadable or beyond 32-bit offsets
+        }
+    }
+    if (format == VIDEO_FORMAT_NONE)
+    {
+        close(src_fd);
+        return 1;
+    }
+
+    // The file is not written in source order, so it gets a private temporary file
+    // without checkpoints
+    job->journal = NULL;
+    job->resume_offset = 0;
+    int dest_fd = format_path(job->temp_path, sizeof(job->temp_path), "%s/.%s.%d.part", job->dest_dir, job->file.filename,
+                              atomic_fetch_add(&temp_file_counter, 1)) == 0
+                      ? open(job->temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)
+                      : -1;
+    if (dest_fd == -1)
+    {
+        perror("Error creating/opening received file");
+        free(moov);
+        close(src_fd);
+        return -1;
+    }
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    long long head;
+    int result;
+    if (moov)
+    {
+        // Whatever precedes the media, then the patched index where the media started
+        result = segment_copy(src_fd, 0, dest_fd, 0, mdat_offset, 1, job->progress);
+        if (result == 0 && pwrite_full(dest_fd, moov, moov_size, mdat_offset) == -1)
+        {
+            perror("Error writing file segment");
+            result = -1;
+        }
+        if (result == 0)
+            progress_add(job->progress, moov_size, 0, 0);
+        head = mdat_offset + moov_size;
+    }
+    else
+    {
+        // Already in playing order: the head is the index, or the first packets of the stream
+        head = format == VIDEO_FORMAT_MP4 ? moov_offset + moov_size : PLAYABLE_HEAD_SIZE / unit * unit;
+        if (head > size)
+            head = size;
+        result = segment_copy(src_fd, 0, dest_fd, 0, head, unit, job->progress);
+    }
+
+    // Show the file under its final name; the rest is appended to it in place. A folder
+    // sync keeps the copy it replaces until the new one is complete, so a failure does
+    // not cost the old copy
+    int early = 1;
+    if (job->batch->sync)
+    {
+        char dest_path[MAX_PATH_LENGTH];
+        struct stat dest;
+        early = format_path(dest_path, sizeof(dest_path), "%s/%s", job->dest_dir, job->file.filename) == 0 &&
+                lstat(dest_path, &dest) == -1 && errno == ENOENT;
+    }
+    int placed = 0;
+    if (result == 0 && early)
+    {
+        result = journal_finish(job, 0);
+        placed = result == 0;
+    }
+    if (placed)
+    {
+        double head_seconds = elapsed_seconds(&start_time);
+        atomic_fetch_add(&playable_files, 1);
+        atomic_fetch_add(&playable_head_ns, (long long)(head_seconds * 1e9));
+        if (!quiet_transfers)
+            printf("Receiver for file %s is playable after %.3f s (%lld of %lld bytes)\n", job->file.filename,
+                   head_seconds, head, size);
+    }
+
+    if (result == 0 && moov)
+    {
+        // The media, now behind the index, then anything that followed the old index
+        result = segment_copy(src_fd, mdat_offset, dest_fd, head, moov_offset - mdat_offset, 1, job->progress);
+        if (result == 0)
+            result = segment_copy(src_fd, moov_offset + moov_size, dest_fd, moov_offset + moov_size,
+                                  size - moov_offset - moov_size, 1, job->progress);
+    }
+    else if (result == 0)
+    {
+        result = segment_copy(src_fd, head, dest_fd, head, size - head, unit, job->progress);
+    }
+    close(src_fd);
+    if (close(dest_fd) == -1 && result == 0)
+    {
+        perror("Error closing received file");
+        result = -1;
+    }
+    free(moov);
+
+    if (result != 0 && placed)
+    {
+        // Do not leave a truncated video behind under the real name
+        if (unlink(job->final_path) == -1)
+            perror("Error removing partial file");
+        job->final_path[0] = '\0';
+    }
+    else if (!placed)
+    {
+        result = journal_finish(job, result);
+    }
+    if (result == 0 && moov)
+    {
+        atomic_fetch_add(&playable_moved_moov, 1);
+        job->content_changed = 1; // The bytes differ from the source now
+    }
+    job->bytes_done = size;
+    job->seconds = elapsed_seconds(&start_time);
+    if (result == 0)
+        log_file_completed(job->file.filename, size, job->seconds,
+                           format == VIDEO_FORMAT_TS ? (unit == M2TS_PACKET_SIZE ? "playable, m2ts packets" : "playable, ts packets")
+                           : moov ? "playable, mp4 index moved to the front" : "playable, mp4");
+    return result;
+}
+
+// Function to queue on batch the files of the tree at source_dir that are missing
+// from dest_dir or differ from their copy there in size or mtime, creating dest_dir
+// and its subfolders as needed. Whether a copy of the same size really changed is
+// left to the worker (sync_try), so that the hashing runs in parallel
+// Returns 0 on success, -1 if part of the tree could not be read or created
+int sync_directories(struct TransferBatch *batch, const char *source_dir, const char *dest_dir, struct SyncStats *stats)
+{
+    if (mkdir(dest_dir, 0777) == -1 && errno != EEXIST)
+    {
+        perror("Error creating destination folder");
+        return -1;
+    }
+    struct stat dest_st;
+    if (stats->folders == 0 && stat(dest_dir, &dest_st) == 0)
+    {
+        // Remember the destination root so a destination inside the source is not mirrored into itself
+        stats->dest_dev = dest_st.st_dev;
+        stats->dest_ino = dest_st.st_ino;
+    }
+    DIR *dir = opendir(source_dir);
+    if (dir == NULL)
+    {
+        perror("Error opening source folder");
+        return -1;
+    }
+    stats->folders++;
+
+    int result = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        size_t length = strlen(name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, JOURNAL_NAME) == 0 ||
+            strcmp(name, CONTENT_INDEX_NAME) == 0 ||
+            (name[0] == '.' && length > 5 && strcmp(name + length - 5, ".part") == 0))
+            continue; // Bookkeeping and partial files of this program
+
+        struct stat source;
+        char source_path[MAX_PATH_LENGTH];
+        char dest_path[MAX_PATH_LENGTH];
+        if (fstatat(dirfd(dir), name, &source, AT_SYMLINK_NOFOLLOW) == -1)
+            continue; // Deleted meanwhile
+        if (snprintf(source_path, sizeof(source_path), "%s/%s", source_dir, name) >= (int)sizeof(source_path) ||
+            snprintf(dest_path, sizeof(dest_path), "%s/%s", dest_dir, name) >= (int)sizeof(dest_path) ||
+            length >= MAX_FILENAME_LENGTH)
+        {
+            fprintf(stderr, "Path too long, not synced: %s/%s\n", source_dir, name);
+            result = -1;
+            continue;
+        }
+
+        if (S_ISDIR(source.st_mode))
+        {
+            if (source.st_dev == stats->dest_dev && source.st_ino == stats->dest_ino)
+                continue;
+            if (sync_directories(batch, source_path, dest_path, stats) == -1)
+                result = -1;
+            continue;
+        }
+        if (!S_ISREG(source.st_mode))
+            continue; // Links, devices and sockets are not mirrored
+        stats->files++;
+
+        struct stat dest;
+        int have_dest = lstat(dest_path, &dest) == 0;
+        if (have_dest && !S_ISREG(dest.st_mode))
+        {
+            fprintf(stderr, "Not replacing %s: it is not a regular file\n", dest_path);
+            result = -1;
+            continue;
+        }
+        if (have_dest && dest.st_size == source.st_size && mtimes_match(&source, &dest, dest_dir))
+        {
+            stats->unchanged++;
+            continue;
+        }
+        if (have_dest)
+            stats->changed++;
+        else
+            stats->added++;
+        stats->bytes += source.st_size;
+
+        struct FileInfo file_info = {0};
+        file_info.index = stats->files;
+        snprintf(file_info.filename, sizeof(file_info.filename), "%s", name);
+        transfer_batch_add(batch, &file_info, source_dir, dest_dir);
+    }
+    closedir(dir);
+    return result;
+}
+
+// Function to find how finely the filesystem holding dir stores mtimes: 1 ns on
+// ext4 or XFS, 100 ns on NTFS, 10 ms on exFAT, 2 s on FAT. An mtime is set on a
+// probe file and read back, and the result is kept per device
+// Returns the granularity in nanoseconds, 1 if it could not be found out
+long long mtime_granularity(const char *dir)
+{
+    struct stat st;
+    if (stat(dir, &st) == -1)
+        return 1;
+    pthread_mutex_lock(&mtime_granularity_lock);
+    for (int i = 0; i < mtime_granularity_count; i++)
+    {
+        if (mtime_granularity_dev[i] == st.st_dev)
+        {
+            long long granularity = mtime_granularity_ns[i];
+            pthread_mutex_unlock(&mtime_granularity_lock);
+            return granularity;
+        }
+    }
+
+    // Named like a partial file, so a sync never mirrors it
+    char probe_path[MAX_PATH_LENGTH];
+    snprintf(probe_path, sizeof(probe_path), "%s/.mtime_probe.%d.part", dir, (int)getpid());
+    struct timespec times[2] = {{1000000001, 123456789}, {1000000001, 123456789}};
+    struct stat probe;
+    long long granularity = 1;
+    int fd = open(probe_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd != -1)
+    {
+        if (futimens(fd, times) == 0 && fstat(fd, &probe) == 0)
+        {
+            // The smallest step that explains how far the stored mtime moved
+            static const long long steps[] = {1, 100, 1000, 10000000LL, 1000000000LL, 2000000000LL};
+            long long moved = llabs(probe.st_mtim.tv_sec * 1000000000LL + probe.st_mtim.tv_nsec - 1000000001123456789LL);
+            for (int i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])); i++)
+            {
+                granularity = steps[i];
+                if (moved < granularity)
+                    break;
+            }
+        }
+        close(fd);
+        unlink(probe_path);
+    }
+    if (mtime_granularity_count < MTIME_GRANULARITY_SLOTS)
+    {
+        mtime_granularity_dev[mtime_granularity_count] = st.st_dev;
+        mtime_granularity_ns[mtime_granularity_count++] = granularity;
+    }
+    pthread_mutex_unlock(&mtime_granularity_lock);
+    return granularity;
+}
+
+// Function to tell whether the mtime of dest, a file in dest_dir, is the mtime of
+// source as far as the destination filesystem can store it
+int mtimes_match(const struct stat *source, const struct stat *dest, const char *dest_dir)
+{
+    long long source_ns = source->st_mtim.tv_sec * 1000000000LL + source->st_mtim.tv_nsec;
+    long long dest_ns = dest->st_mtim.tv_sec * 1000000000LL + dest->st_mtim.tv_nsec;
+    return source_ns == dest_ns || llabs(source_ns - dest_ns) < mtime_granularity(dest_dir);
+}
+
+// Function to settle a file job of a folder sync whose destination copy has the same
+// size but another mtime. Identical contents only need the source's mtime copied over,
+// so the next sync sees the file as unchanged without reading it again
+// Returns 1 if the job is done, 0 if the file must be copied
+int sync_try(struct TransferJob *job, const struct stat *source)
+{
+    char source_path[MAX_PATH_LENGTH];
+    char dest_path[MAX_PATH_LENGTH];
+    struct stat dest;
+    if (format_path(source_path, sizeof(source_path), "%s/%s", job->source_dir, job->file.filename) == -1 ||
+        format_path(dest_path, sizeof(dest_path), "%s/%s", job->dest_dir, job->file.filename) == -1 ||
+        stat(dest_path, &dest) == -1 || !S_ISREG(dest.st_mode) || dest.st_size != source->st_size ||
+        !files_identical(source_path, dest_path, source->st_size))
+        return 0;
+
+    struct timespec times[2] = {source->st_atim, source->st_mtim};
+    if (utimensat(AT_FDCWD, dest_path, times, 0) == -1)
+        perror("Error setting modification time");
+    if (!quiet_transfers)
+        printf("Skipped file %s: identical contents already in %s\n", job->file.filename, job->dest_dir);
+    atomic_fetch_add(&sync_identical, 1);
+    progress_add(job->progress, source->st_size, 0, 0);
+    return 1;
+}
+
+// Function to give a file copied by a folder sync the source's mtime,
+// which is what the next sync compares
+void sync_record(struct TransferJob *job)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    struct stat source;
+    if (job->final_path[0] == '\0' || format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == -1 || stat(full_file_path, &source) == -1)
+        return;
+    struct timespec times[2] = {source.st_atim, source.st_mtim};
+    if (utimensat(AT_FDCWD, job->final_path, times, 0) == -1)
+        perror("Error setting modification time");
+}
+
+// Thread function running the folder walk of a sync started from the GUI
+void *sync_thread(void *arg)
+{
+    struct SyncRequest *request = (struct SyncRequest *)arg;
+    trace_thread_name("sync");
+    struct SyncStats stats = {0};
+    trace_stage_begin("scan folders", request->source_dir);
+    sync_directories(request->batch, request->source_dir, request->dest_dir, &stats);
+    trace_stage_end();
+    printf("Sync of %s into %s: %d file(s) in %d folder(s), %d new, %d changed, %d unchanged\n", request->source_dir,
+           request->dest_dir, stats.files, stats.folders, stats.added, stats.changed, stats.unchanged);
+    transfer_batch_close(request->batch);
+    free(request);
+    return NULL;
+}
+
+// Function to start a large file transfer as chunk jobs copied in parallel by the pool
+// The destination is preallocated and every chunk writes its own byte range, so the
+// chunks can finish in any order. Returns 0 once the chunks are queued (the file job
+// is finished by the last chunk), -1 if the copy could not be started
+int start_chunked_copy(struct TransferJob *job, long long size)
+{
+    struct ChunkedCopy *copy = calloc(1, sizeof(struct ChunkedCopy));
+    if (copy == NULL)
+    {
+        perror("Error allocating chunked copy");
+        return -1;
+    }
+
+    char full_file_path[MAX_PATH_LENGTH];
+    copy->src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY) : -1;
+    if (copy->src_fd == -1)
+    {
+        perror("Error opening file");
+        free(copy);
+        return -1;
+    }
+
+    // Chunks finished by an earlier attempt stay in the temporary file
+    int resumed_chunks = job->journal && job->journal->done_chunks && job->journal->chunk_size == chunk_size;
+    journal_prepare_chunks(job->journal, size, chunk_size);
+    if (remote_address)
+    {
+        // The daemon writes the chunks into a file of its own, whichever connection they come over
+        copy->dest_fd = -1;
+        copy->remote_id = atomic_fetch_add(&net_next_id, 1);
+    }
+    else
+    {
+        copy->dest_fd = open_temp_file(job, resumed_chunks ? size : job->resume_offset);
+        if (copy->dest_fd == -1)
+        {
+            close(copy->src_fd);
+            free(copy);
+            return -1;
+        }
+
+        // Reserve the space up front so parallel writers do not fragment the file
+        if (fallocate(copy->dest_fd, 0, 0, size) == -1 && ftruncate(copy->dest_fd, size) == -1)
+        {
+            perror("Error preallocating received file");
+            close(copy->src_fd);
+            close(copy->dest_fd);
+            free(copy);
+            return -1;
+        }
+    }
+
+    int num_chunks = (int)((size + chunk_size - 1) / chunk_size);
+    atomic_fetch_add(&chunked_files, 1);
+    pthread_mutex_init(&copy->lock, NULL);
+    copy->file_job = job;
+    copy->size = size;
+    copy->chunks_left = 1; // Held until every chunk is queued
+    clock_gettime(CLOCK_MONOTONIC, &copy->start_time);
+
+    // Queue the chunks ahead of other files so a started file completes first
+    for (int i = num_chunks - 1; i >= 0; i--)
+    {
+        long long offset = (long long)i * chunk_size;
+        long long length = size - offset < chunk_size ? size - offset : chunk_size;
+        if (journal_chunk_is_done(job->journal, offset, length))
+        {
+            if (offset >= job->resume_offset)
+                progress_add(job->progress, length, 0, 0);
+            continue;
+        }
+        pthread_mutex_lock(&copy->lock);
+        copy->chunks_left++;
+        pthread_mutex_unlock(&copy->lock);
+
+        struct TransferJob *chunk = calloc(1, sizeof(struct TransferJob));
+        if (chunk == NULL)
+        {
+            perror("Error allocating chunk job");
+            chunk_finished(copy, -1);
+            continue;
+        }
+        chunk->type = JOB_TYPE_CHUNK;
+        chunk->priority = job->priority;
+        chunk->copy = copy;
+        chunk->offset = offset;
+        chunk->length = length;
+        transfer_pool_submit_front(chunk);
+    }
+    chunk_finished(copy, 0);
+    return 0;
+}
+
+// Function called when one chunk of a chunked copy is done
+// The last chunk closes the files and finishes the original file job; over the
+// network it queues a commit job instead, whose reply finishes the file job
+void chunk_finished(struct ChunkedCopy *copy, int result)
+{
+    pthread_mutex_lock(&copy->lock);
+    if (result != 0)
+        copy->failed = 1;
+    int last = --copy->chunks_left == 0;
+    pthread_mutex_unlock(&copy->lock);
+    if (!last)
+        return;
+
+    if (copy->dest_fd == -1)
+    {
+        struct TransferJob *commit = calloc(1, sizeof(struct TransferJob));
+        if (commit != NULL)
+        {
+            commit->type = JOB_TYPE_COMMIT;
+            commit->priority = copy->file_job->priority;
+            commit->copy = copy;
+            transfer_pool_submit_front(commit);
+            return;
+        }
+        perror("Error allocating commit job");
+        close(copy->src_fd);
+        transfer_job_finished(copy->file_job, -1);
+        pthread_mutex_destroy(&copy->lock);
+        free(copy);
+        return;
+    }
+
+    double seconds = elapsed_seconds(&copy->start_time);
+    close(copy->src_fd);
+    if (close(copy->dest_fd) == -1)
+    {
+        perror("Error closing received file");
+        copy->failed = 1;
+    }
+    int file_result = journal_finish(copy->file_job, copy->failed ? -1 : 0);
+    if (file_result == 0)
+    {
+        log_file_completed(copy->file_job->file.filename, copy->size, seconds, "chunked");
+    }
+
+    transfer_job_finished(copy->file_job, file_result);
+    pthread_mutex_destroy(&copy->lock);
+    free(copy);
+}
+
+// Function to resolve "HOST:PORT", "[HOST]:PORT" or, for a listening socket, "PORT"
+// Returns 0 with the addresses in result, -1 if the address is invalid or unknown
+int net_resolve(const char *address, int passive, struct addrinfo **result)
+{
+    char host[MAX_PATH_LENGTH];
+    const char *colon = strrchr(address, ':');
+    const char *port = colon ? colon + 1 : address;
+    int host_length = colon ? (int)(colon - address) : 0;
+    if (host_length >= 2 && address[0] == '[' && address[host_length - 1] == ']')
+        snprintf(host, sizeof(host), "%.*s", host_length - 2, address + 1);
+    else
+        snprintf(host, sizeof(host), "%.*s", host_length, address);
+    if (*port == '\0' || (host[0] == '\0' && !passive))
+    {
+        fprintf(stderr, "Invalid address %s, expected HOST:PORT\n", address);
+        return -1;
+    }
+
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    int ret = getaddrinfo(host[0] ? host : NULL, port, &hints, result);
+    if (ret != 0)
+    {
+        fprintf(stderr, "Error resolving %s: %s\n", address, gai_strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+// Function to open a connection to the daemon at remote_address and start its reader thread
+// Returns the connection, or NULL on error
+struct NetConnection *net_connect()
+{
+    int fd = -1;
+    int saved_errno = ECONNREFUSED;
+    for (struct addrinfo *ai = remote_addrinfo; ai && fd == -1; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+        {
+            saved_errno = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd == -1)
+    {
+        fprintf(stderr, "Error connecting to %s: %s\n", remote_address, strerror(saved_errno));
+        errno = saved_errno;
+        return NULL;
+    }
+
+    // Small files are pipelined as small requests; do not let Nagle hold them back
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct NetConnection *connection = calloc(1, sizeof(struct NetConnection));
+    if (connection == NULL)
+    {
+        perror("Error allocating connection");
+        close(fd);
+        return NULL;
+    }
+    connection->fd = fd;
+    if (net_zerocopy)
+    {
+        connection->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+        if (!connection->zerocopy)
+            perror("MSG_ZEROCOPY is not available, using sendfile()");
+    }
+    pthread_mutex_init(&connection->lock, NULL);
+    pthread_cond_init(&connection->cond, NULL);
+    if (pthread_create(&connection->reader, NULL, net_reader_thread, connection) != 0)
+    {
+        fprintf(stderr, "Error creating connection reader thread\n");
+        pthread_mutex_destroy(&connection->lock);
+        pthread_cond_destroy(&connection->cond);
+        close(fd);
+        free(connection);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return connection;
+}
+
+// Function to close a connection once the replies to its requests are in
+void net_connection_close(struct NetConnection *connection)
+{
+    pthread_mutex_lock(&connection->lock);
+    while (connection->in_flight > 0 && !connection->broken)
+        pthread_cond_wait(&connection->cond, &connection->lock);
+    connection->broken = 1;
+    pthread_mutex_unlock(&connection->lock);
+
+    shutdown(connection->fd, SHUT_RDWR); // Wakes the reader thread
+    pthread_join(connection->reader, NULL);
+    if (connection->zerocopy_copied)
+        atomic_fetch_add(&net_zerocopy_copied, 1);
+    close(connection->fd);
+    pthread_mutex_destroy(&connection->lock);
+    pthread_cond_destroy(&connection->cond);
+    free(connection);
+}
+
+// Function to return the worker's connection to the daemon, opening a new one if there
+// is none yet or the last one broke. Returns NULL if the daemon cannot be reached
+struct NetConnection *net_connection_for(struct TransferWorker *worker)
+{
+    struct NetConnection *connection = worker->connection;
+    if (connection)
+    {
+        pthread_mutex_lock(&connection->lock);
+        int broken = connection->broken;
+        pthread_mutex_unlock(&connection->lock);
+        if (!broken)
+            return connection;
+        net_connection_close(connection);
+    }
+    worker->connection = net_connect();
+    return worker->connection;
+}
+
+// Reader thread of a connection: finishes the jobs in flight as their replies arrive.
+// Once the connection is lost the remaining ones fail
+void *net_reader_thread(void *arg)
+{
+    struct NetConnection *connection = (struct NetConnection *)arg;
+    trace_thread_name("net reader");
+    while (1)
+    {
+        struct NetReply reply;
+        ssize_t bytes_read = read_full(connection->fd, &reply, sizeof(reply));
+
+        pthread_mutex_lock(&connection->lock);
+        struct TransferJob *job = connection->head;
+        if (bytes_read != sizeof(reply) || job == NULL || ntohl(reply.magic) != NET_MAGIC ||
+            be64toh(reply.id) != job->remote_id)
+        {
+            if (!connection->broken && (bytes_read != 0 || job != NULL))
+                fprintf(stderr, "Lost the connection to %s%s\n", remote_address,
+                        bytes_read == sizeof(reply) ? " (unexpected reply)" : "");
+            connection->broken = 1;
+            break;
+        }
+        connection->head = job->next;
+        if (connection->head == NULL)
+            connection->tail = NULL;
+        connection->in_flight--;
+        pthread_cond_broadcast(&connection->cond);
+        job->next = NULL;
+        if (job == connection->sending)
+        {
+            // Answered while the worker still waits for its send to complete
+            connection->sending_replied = 1;
+            connection->sending_status = (int32_t)ntohl(reply.status);
+            pthread_mutex_unlock(&connection->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&connection->lock);
+        net_complete(job, (int32_t)ntohl(reply.status));
+    }
+
+    // Nothing more can be sent or answered on this connection; the job still being
+    // sent is left to its worker
+    struct TransferJob *failed = NULL;
+    struct TransferJob **failed_tail = &failed;
+    struct TransferJob *job = connection->head;
+    struct TransferJob *kept = NULL;
+    while (job)
+    {
+        struct TransferJob *next = job->next;
+        job->next = NULL;
+        if (job == connection->sending)
+        {
+            kept = job;
+        }
+        else
+        {
+            *failed_tail = job;
+            failed_tail = &job->next;
+        }
+        job = next;
+    }
+    connection->head = connection->tail = kept;
+    connection->in_flight = kept ? 1 : 0;
+    connection->closed = 1;
+    pthread_cond_broadcast(&connection->cond);
+    pthread_mutex_unlock(&connection->lock);
+    shutdown(connection->fd, SHUT_RDWR);
+    while (failed)
+    {
+        struct TransferJob *next = failed->next;
+        failed->next = NULL;
+        net_complete(failed, ECONNRESET);
+        failed = next;
+    }
+    return NULL;
+}
+
+// Function to finish a job sent to the daemon with the status of its reply
+void net_complete(struct TransferJob *job, int status)
+{
+    if (job->type == JOB_TYPE_CHUNK)
+    {
+        struct ChunkedCopy *copy = job->copy;
+        if (status != 0 && status != ECONNRESET)
+            fprintf(stderr, "Receiver failed chunk of file %s: %s\n", copy->file_job->file.filename, strerror(status));
+        free(job);
+        chunk_finished(copy, status == 0 ? 0 : -1);
+        return;
+    }
+
+    if (job->type == JOB_TYPE_COMMIT)
+    {
+        struct ChunkedCopy *copy = job->copy;
+        struct TransferJob *file_job = copy->file_job;
+        int result = status == 0 && !copy->failed ? 0 : -1;
+        if (status != 0 && status != ECONNRESET)
+            fprintf(stderr, "Receiver failed file %s: %s\n", file_job->file.filename, strerror(status));
+        if (result == 0)
+            log_file_completed(file_job->file.filename, copy->size, elapsed_seconds(&copy->start_time),
+                               net_zerocopy ? "chunked over TCP, MSG_ZEROCOPY" : "chunked over TCP, sendfile");
+        close(copy->src_fd);
+        pthread_mutex_destroy(&copy->lock);
+        free(copy);
+        free(job);
+        transfer_job_finished(file_job, result);
+        return;
+    }
+
+    if (status != 0 && status != ECONNRESET)
+        fprintf(stderr, "Receiver failed file %s: %s\n", job->file.filename, strerror(status));
+    job->seconds = (now_ns() - job->started_ns) / 1e9;
+    if (status == 0 && job->codec != CODEC_NONE)
+    {
+        char how[64];
+        snprintf(how, sizeof(how), "TCP, %s %.2f:1", codec_name(job->codec),
+                 job->wire_bytes ? (double)job->bytes_done / job->wire_bytes : 1.0);
+        log_file_completed(job->file.filename, job->bytes_done, job->seconds, how);
+        atomic_fetch_add(&compress_files, 1);
+        atomic_fetch_add(&compress_raw_bytes, job->bytes_done);
+        atomic_fetch_add(&compress_wire_bytes, job->wire_bytes);
+        atomic_fetch_add(&compress_pack_ns, job->pack_ns);
+    }
+    else if (status == 0)
+    {
+        log_file_completed(job->file.filename, job->bytes_done, job->seconds,
+                           net_zerocopy ? "TCP, MSG_ZEROCOPY" : "TCP, sendfile");
+    }
+    transfer_job_finished(job, status == 0 ? 0 : -1);
+}
+
+// Function to collect the MSG_ZEROCOPY completions the kernel queued on the socket's
+// error queue, waiting for at least one if wait is set
+// Returns 0, or -1 if the connection went away
+int net_zerocopy_reap(struct NetConnection *connection, int wait)
+{
+    while (1)
+    {
+        char control[128];
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(connection->fd, &msg, MSG_ERRQUEUE) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (!wait)
+                return 0;
+            struct pollfd pfd = {connection->fd, 0, 0};
+            if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+                return -1;
+            if (!(pfd.revents & POLLERR) && (pfd.revents & (POLLHUP | POLLNVAL)))
+                return -1;
+            continue;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0)
+                continue;
+            // Completions cover the sends numbered ee_info to ee_data
+            connection->zerocopy_done = err->ee_data + 1;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                connection->zerocopy_copied = 1;
+        }
+        wait = 0; // Take whatever else is queued without blocking
+    }
+}
+
+// Function to send length bytes of src_fd at offset with MSG_ZEROCOPY. The socket
+// references the pages of a mapping of the file instead of copying them, so the
+// mapping is kept until the kernel reports it is done with every send
+// Returns 0 on success, -1 on error
+int net_send_zerocopy(struct NetConnection *connection, int src_fd, long long offset, long long length,
+                      struct TransferProgress *progress)
+{
+    if (length == 0)
+        return 0;
+    long long map_offset = offset & ~(long long)(sysconf(_SC_PAGESIZE) - 1);
+    size_t map_length = length + (offset - map_offset);
+    unsigned char *map = mmap(NULL, map_length, PROT_READ, MAP_SHARED, src_fd, map_offset);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise(map, map_length, MADV_SEQUENTIAL);
+
+    const unsigned char *data = map + (offset - map_offset);
+    long long sent = 0;
+    int result = 0;
+    while (sent < length)
+    {
+        size_t block = length - sent < NET_SEND_BLOCK ? length - sent : NET_SEND_BLOCK;
+        long long trace_start = TRACE_START();
+        ssize_t bytes_sent = send(connection->fd, data + sent, block, MSG_ZEROCOPY);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "send", bytes_sent);
+        if (bytes_sent == -1 && errno == EINTR)
+            continue;
+        if (bytes_sent == -1 && errno == ENOBUFS && net_zerocopy_reap(connection, 1) == 0)
+            continue; // Too many pages pinned; some were released
+        if (bytes_sent == -1)
+        {
+            result = -1;
+            break;
+        }
+        connection->zerocopy_sent++;
+        sent += bytes_sent;
+        progress_add(progress, bytes_sent, 0, 0);
+        transfer_throttle(progress, bytes_sent);
+        net_zerocopy_reap(connection, 0);
+    }
+    long long trace_start = TRACE_START();
+    while (result == 0 && connection->zerocopy_done != connection->zerocopy_sent)
+        result = net_zerocopy_reap(connection, 1);
+    TRACE_END(trace_start, TRACE_WAIT, "wait for zerocopy", -1);
+    munmap(map, map_length);
+    return result;
+}
+
+// Function to send length bytes of src_fd at offset on the connection, with sendfile()
+// unless MSG_ZEROCOPY is on. Returns 0 on success, -1 on error
+int net_send_data(struct NetConnection *connection, int src_fd, long long offset, long long length,
+                  struct TransferProgress *progress)
+{
+    if (connection->zerocopy)
+        return net_send_zerocopy(connection, src_fd, offset, length, progress);
+
+    long long sent = 0;
+    while (sent < length)
+    {
+        size_t block = length - sent < NET_SEND_BLOCK ? length - sent : NET_SEND_BLOCK;
+        off_t position = offset + sent;
+        long long trace_start = TRACE_START();
+        ssize_t bytes_sent = sendfile(connection->fd, src_fd, &position, block);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "sendfile", bytes_sent);
+        if (bytes_sent == -1 && errno == EINTR)
+            continue;
+        if (bytes_sent == 0)
+            errno = EIO; // The file shrank under us
+        if (bytes_sent <= 0)
+            return -1;
+        sent += bytes_sent;
+        progress_add(progress, bytes_sent, 0, 0);
+        transfer_throttle(progress, bytes_sent);
+    }
+    return 0;
+}
+
+// Function to send one request for job on the worker's connection without waiting
+// for the reply; net_complete() finishes the job when it arrives, or when sending fails
+void net_send_request(struct TransferWorker *worker, struct TransferJob *job, int type, const char *filename, int src_fd,
+                      long long offset, long long length, long long file_size, long long mtime_ns)
+{
+    struct NetConnection *connection = net_connection_for(worker);
+    if (connection == NULL)
+    {
+        net_complete(job, ECONNRESET);
+        return;
+    }
+
+    // Bound the requests awaiting a reply, then queue this one for the reader
+    pthread_mutex_lock(&connection->lock);
+    if (connection->in_flight >= NET_MAX_IN_FLIGHT && !connection->broken)
+    {
+        long long trace_start = TRACE_START();
+        while (connection->in_flight >= NET_MAX_IN_FLIGHT && !connection->broken)
+            pthread_cond_wait(&connection->cond, &connection->lock);
+        TRACE_END(trace_start, TRACE_WAIT, "wait for replies", -1);
+    }
+    if (connection->broken)
+    {
+        pthread_mutex_unlock(&connection->lock);
+        net_complete(job, ECONNRESET);
+        return;
+    }
+    job->next = NULL;
+    if (connection->tail)
+        connection->tail->next = job;
+    else
+        connection->head = job;
+    connection->tail = job;
+    connection->in_flight++;
+    connection->sending = job;
+    pthread_mutex_unlock(&connection->lock);
+
+    unsigned char header[sizeof(struct NetRequest) + MAX_FILENAME_LENGTH];
+    struct NetRequest *request = (struct NetRequest *)header;
+    size_t name_length = strnlen(filename, MAX_FILENAME_LENGTH - 1);
+    request->magic = htonl(NET_MAGIC);
+    request->type = htonl(type);
+    request->id = htobe64(job->remote_id);
+    request->offset = htobe64(offset);
+    request->length = htobe64(length);
+    request->file_size = htobe64(file_size);
+    request->mtime_ns = htobe64(mtime_ns);
+    request->name_length = htonl(name_length);
+    request->codec = htonl(type == NET_REQUEST_FILE ? job->codec : CODEC_NONE);
+    memcpy(header + sizeof(struct NetRequest), filename, name_length);
+
+    // The header waits for the data that follows it (MSG_MORE), so both leave in the same segments
+    size_t header_length = sizeof(struct NetRequest) + name_length;
+    size_t done = 0;
+    int result = 0;
+    while (done < header_length && result == 0)
+    {
+        ssize_t bytes_sent = send(connection->fd, header + done, header_length - done, length > 0 ? MSG_MORE : 0);
+        COUNT_IO_SYSCALL();
+        if (bytes_sent == -1 && errno != EINTR)
+            result = -1;
+        else if (bytes_sent > 0)
+            done += bytes_sent;
+    }
+    if (result == 0 && length > 0 && type == NET_REQUEST_FILE && job->codec != CODEC_NONE)
+        result = compress_send(job, worker->compressor, src_fd, connection->fd, length, job->progress);
+    else if (result == 0 && length > 0)
+        result = net_send_data(connection, src_fd, offset, length, job->type == JOB_TYPE_CHUNK ? job->copy->file_job->progress
+                                                                                              : job->progress);
+    if (result == -1)
+        perror("Error sending to the receiver");
+
+    // Once sent the job belongs to the reader, unless it already answered it or is gone
+    pthread_mutex_lock(&connection->lock);
+    connection->sending = NULL;
+    int replied = connection->sending_replied;
+    int status = connection->sending_status;
+    connection->sending_replied = 0;
+    int orphaned = !replied && connection->closed;
+    if (orphaned)
+    {
+        connection->head = connection->tail = NULL;
+        connection->in_flight = 0;
+    }
+    if (result == -1)
+        connection->broken = 1;
+    pthread_mutex_unlock(&connection->lock);
+    if (result == -1)
+        shutdown(connection->fd, SHUT_RDWR); // The reader fails the job along with the rest in flight
+    if (replied)
+        net_complete(job, status);
+    else if (orphaned)
+        net_complete(job, ECONNRESET);
+}
+
+// Function to send a whole file to the daemon, pipelined behind the worker's earlier requests
+void net_send_file(struct TransferWorker *worker, struct TransferJob *job, const struct stat *source)
+{
+    char full_file_path[MAX_PATH_LENGTH];
+    int src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0 ? open(full_file_path, O_RDONLY | O_CLOEXEC) : -1;
+    if (src_fd == -1)
+    {
+        perror("Error opening file");
+        transfer_job_finished(job, -1);
+        return;
+    }
+    job->remote_id = atomic_fetch_add(&net_next_id, 1);
+    job->bytes_done = source->st_size;
+    job->started_ns = now_ns();
+    net_send_request(worker, job, NET_REQUEST_FILE, job->file.filename, src_fd, 0, source->st_size, source->st_size,
+                     source->st_mtim.tv_sec * 1000000000LL + source->st_mtim.tv_nsec);
+    close(src_fd);
+}
+
+// Function to send one chunk of a large file; the chunks of a file go out over
+// whichever workers pick them up, so over several connections at once
+void net_send_chunk(struct TransferWorker *worker, struct TransferJob *job)
+{
+    struct ChunkedCopy *copy = job->copy;
+    job->remote_id = copy->remote_id;
+    net_send_request(worker, job, NET_REQUEST_CHUNK, copy->file_job->file.filename, copy->src_fd, job->offset,
+                     job->length, copy->size, 0);
+}
+
+// Function to have the daemon name a large file once all of its chunks were acknowledged,
+// or drop what it has of the file if one of them failed
+void net_send_commit(struct TransferWorker *worker, struct TransferJob *job)
+{
+    struct ChunkedCopy *copy = job->copy;
+    struct stat st;
+    long long mtime_ns = fstat(copy->src_fd, &st) == 0 ? st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec : 0;
+    job->remote_id = copy->remote_id;
+    net_send_request(worker, job, copy->failed ? NET_REQUEST_ABORT : NET_REQUEST_COMMIT, copy->file_job->file.filename,
+                     -1, 0, 0, copy->size, mtime_ns);
+}
+
+// Function to look up the partial file of a sender's id; net_partial_lock must be held
+// Returns NULL if no chunk of it arrived yet or it was committed or aborted
+struct NetPartial *net_partial_find_locked(uint64_t id, const char *filename)
+{
+    for (struct NetPartial *partial = net_partials; partial; partial = partial->next)
+        if (partial->id == id && strcmp(partial->filename, filename) == 0)
+            return partial;
+    return NULL;
+}
+
+// Function to note that a connection is sending chunks of a file, so that the file is
+// removed if every such connection closes before it is committed
+// Returns 0 on success, -1 if out of memory
+int net_partial_attach(struct NetPartialList *partials, uint64_t id, const char *filename)
+{
+    pthread_mutex_lock(&net_partial_lock);
+    struct NetPartial *partial = net_partial_find_locked(id, filename);
+    if (partial == NULL)
+    {
+        partial = calloc(1, sizeof(struct NetPartial));
+        if (partial == NULL)
+        {
+            pthread_mutex_unlock(&net_partial_lock);
+            return -1;
+        }
+        partial->serial = ++net_partial_serial;
+        partial->id = id;
+        snprintf(partial->filename, sizeof(partial->filename), "%s", filename);
+        partial->next = net_partials;
+        net_partials = partial;
+    }
+    for (int i = 0; i < partials->count; i++)
+        if (partials->serials[i] == partial->serial)
+        {
+            pthread_mutex_unlock(&net_partial_lock);
+            return 0;
+        }
+
+    // Make room, first by forgetting the files that were committed since
+    if (partials->count == partials->capacity)
+    {
+        int kept = 0;
+        for (int i = 0; i < partials->count; i++)
+            for (struct NetPartial *other = net_partials; other; other = other->next)
+                if (other->serial == partials->serials[i])
+                {
+                    partials->serials[kept++] = partials->serials[i];
+                    break;
+                }
+        partials->count = kept;
+    }
+    if (partials->count == partials->capacity)
+    {
+        int capacity = partials->capacity ? partials->capacity * 2 : 16;
+        uint64_t *serials = realloc(partials->serials, capacity * sizeof(uint64_t));
+        if (serials == NULL)
+        {
+            pthread_mutex_unlock(&net_partial_lock);
+            return -1;
+        }
+        partials->serials = serials;
+        partials->capacity = capacity;
+    }
+    partials->serials[partials->count++] = partial->serial;
+    partial->connections++;
+    pthread_mutex_unlock(&net_partial_lock);
+    return 0;
+}
+
+// Function to forget a partial file once it was committed or aborted
+void net_partial_finish(uint64_t id, const char *filename)
+{
+    pthread_mutex_lock(&net_partial_lock);
+    for (struct NetPartial **link = &net_partials; *link; link = &(*link)->next)
+        if ((*link)->id == id && strcmp((*link)->filename, filename) == 0)
+        {
+            struct NetPartial *partial = *link;
+            *link = partial->next;
+            free(partial);
+            break;
+        }
+    pthread_mutex_unlock(&net_partial_lock);
+}
+
+// Function to detach a closing connection from the files it sent chunks of, removing
+// those that no open connection is still sending
+void net_partial_release_all(struct NetPartialList *partials)
+{
+    pthread_mutex_lock(&net_partial_lock);
+    for (int i = 0; i < partials->count; i++)
+        for (struct NetPartial **link = &net_partials; *link; link = &(*link)->next)
+            if ((*link)->serial == partials->serials[i])
+            {
+                struct NetPartial *partial = *link;
+                if (--partial->connections == 0)
+                {
+                    char temp_path[MAX_PATH_LENGTH];
+                    snprintf(temp_path, sizeof(temp_path), "%s/.%s.%016llx.part", cli_dest_dir, partial->filename,
+                             (unsigned long long)partial->id);
+                    if (unlink(temp_path) == 0 && !quiet_transfers)
+                        printf("Sender of file %s went away: partial file removed\n", partial->filename);
+                    *link = partial->next;
+                    free(partial);
+                }
+                break;
+            }
+    pthread_mutex_unlock(&net_partial_lock);
+    free(partials->serials);
+    partials->serials = NULL;
+    partials->count = partials->capacity = 0;
+}
+
+// Function to carry out one request on the daemon; its data is always read off the
+// connection, even when it cannot be stored, so that the next request is found
+// Returns 0 or the errno to reply with, -1 if the connection failed
+int net_serve_request(int fd, const struct NetRequest *request, const char *filename, unsigned char *buffer,
+                      struct NetPartialList *partials)
+{
+    // Names come from the network: only plain file names are accepted, and none starting
+    // with a dot, which could match another transfer's temporary file
+    int status = 0;
+    if (filename[0] == '\0' || filename[0] == '.' || strchr(filename, '/') || request->type < NET_REQUEST_FILE ||
+        request->type > NET_REQUEST_ABORT)
+        status = EINVAL;
+
+    // A chunk must lie within the file, and the file must be of a believable size
+    if (request->file_size > NET_MAX_FILE_SIZE ||
+        (request->type == NET_REQUEST_CHUNK &&
+         (request->offset > request->file_size || request->length > request->file_size - request->offset)))
+        status = EINVAL;
+    char temp_path[MAX_PATH_LENGTH];
+    snprintf(temp_path, sizeof(temp_path), "%s/.%s.%016llx.part", cli_dest_dir, filename,
+             (unsigned long long)request->id);
+
+    // Known before the first write, so that the file is removed if its senders go away
+    if (status == 0 && request->type == NET_REQUEST_CHUNK && net_partial_attach(partials, request->id, filename) == -1)
+        status = ENOMEM;
+
+    int out_fd = -1;
+    if (status == 0 && (request->type == NET_REQUEST_FILE || request->type == NET_REQUEST_CHUNK))
+    {
+        out_fd = open(temp_path, O_WRONLY | O_CREAT | O_CLOEXEC | (request->type == NET_REQUEST_FILE ? O_TRUNC : 0), 0666);
+        if (out_fd == -1)
+        {
+            status = errno;
+            perror("Error creating/opening received file");
+        }
+    }
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    long long offset = request->type == NET_REQUEST_CHUNK ? (long long)request->offset : 0;
+    long long received = 0;
+    long long unpack_ns = 0;
+    if (request->codec != CODEC_NONE)
+    {
+        // Blocks the sender compressed; a codec this build lacks cannot be unpacked,
+        // but the blocks are framed the same either way and are still drained
+        if (!codec_available(request->codec) && status == 0)
+            status = EPROTONOSUPPORT;
+        received = request->type == NET_REQUEST_FILE
+                       ? compress_receive(request->codec, fd, status == 0 ? out_fd : -1, request->length, &status, &unpack_ns)
+                       : -1;
+        if (received == -1)
+        {
+            if (out_fd != -1)
+                close(out_fd);
+            if (request->type == NET_REQUEST_FILE)
+                unlink(temp_path);
+            return -1;
+        }
+    }
+    while (received < (long long)request->length)
+    {
+        size_t block = request->length - received < NET_RECEIVE_BUFFER_SIZE ? request->length - received
+                                                                            : NET_RECEIVE_BUFFER_SIZE;
+        long long trace_start = TRACE_START();
+        ssize_t bytes_read = read(fd, buffer, block);
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_IO, "read", bytes_read);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0)
+        {
+            if (out_fd != -1)
+                close(out_fd);
+            if (request->type == NET_REQUEST_FILE)
+                unlink(temp_path);
+            return -1;
+        }
+        if (out_fd != -1 && status == 0 && pwrite_full(out_fd, buffer, bytes_read, offset + received) == -1)
+        {
+            status = errno;
+            perror("Error writing to file");
+        }
+        received += bytes_read;
+    }
+    if (out_fd != -1 && close(out_fd) == -1 && status == 0)
+    {
+        status = errno;
+        perror("Error closing received file");
+    }
+    if (status != 0 || request->type == NET_REQUEST_CHUNK)
+    {
+        if (status != 0 && request->type == NET_REQUEST_FILE)
+            unlink(temp_path);
+        return status;
+    }
+    if (request->type != NET_REQUEST_FILE)
+        net_partial_finish(request->id, filename);
+    if (request->type == NET_REQUEST_ABORT)
+    {
+        if (unlink(temp_path) == -1 && errno != ENOENT)
+            perror("Error removing partial file");
+        return 0;
+    }
+
+    // A complete file gets the source's mtime and the next free name
+    if (request->type == NET_REQUEST_COMMIT && truncate(temp_path, request->file_size) == -1)
+    {
+        status = errno;
+        perror("Error completing received file");
+        unlink(temp_path);
+        return status;
+    }
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = request->mtime_ns / 1000000000LL;
+    times[0].tv_nsec = times[1].tv_nsec = request->mtime_ns % 1000000000LL;
+    if (request->mtime_ns != 0)
+        utimensat(AT_FDCWD, temp_path, times, 0);
+    char final_file_path[MAX_PATH_LENGTH];
+    if (place_destination_file(cli_dest_dir, filename, temp_path, final_file_path) == -1)
+    {
+        status = errno;
+        perror("Error renaming received file");
+        unlink(temp_path);
+        return status;
+    }
+    if (request->type == NET_REQUEST_FILE && request->codec != CODEC_NONE)
+    {
+        char how[64];
+        snprintf(how, sizeof(how), "TCP, %s, %.3f s decompressing", codec_name(request->codec), unpack_ns / 1e9);
+        log_file_completed(filename, received, elapsed_seconds(&start_time), how);
+    }
+    else if (request->type == NET_REQUEST_FILE)
+        log_file_completed(filename, received, elapsed_seconds(&start_time), "TCP");
+    else if (!quiet_transfers)
+        printf("Receiver for file %s completed: %lld bytes in chunks\n", filename, (long long)request->file_size);
+    return 0;
+}
+
+// Daemon thread serving one sender connection: its requests are carried out and
+// answered in order
+void *net_serve_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    trace_thread_name("connection %d", fd);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    unsigned char *buffer = buffer_pool_get(NET_RECEIVE_BUFFER_SIZE);
+    if (buffer == NULL)
+        perror("Error allocating receive buffer");
+
+    struct NetPartialList partials = {NULL, 0, 0};
+    struct NetRequest request;
+    while (buffer && read_full(fd, &request, sizeof(request)) == sizeof(request))
+    {
+        request.magic = ntohl(request.magic);
+        request.type = ntohl(request.type);
+        request.id = be64toh(request.id);
+        request.offset = be64toh(request.offset);
+        request.length = be64toh(request.length);
+        request.file_size = be64toh(request.file_size);
+        request.mtime_ns = be64toh(request.mtime_ns);
+        request.name_length = ntohl(request.name_length);
+        request.codec = ntohl(request.codec);
+        char filename[MAX_FILENAME_LENGTH];
+        if (request.magic != NET_MAGIC || request.name_length >= MAX_FILENAME_LENGTH ||
+            request.length > NET_MAX_FILE_SIZE ||
+            read_full(fd, filename, request.name_length) != (ssize_t)request.name_length)
+        {
+            fprintf(stderr, "Dropping connection: invalid request\n");
+            break;
+        }
+        filename[request.name_length] = '\0';
+
+        trace_stage_begin(request.type == NET_REQUEST_FILE    ? "receive file"
+                          : request.type == NET_REQUEST_CHUNK ? "receive chunk"
+                          : request.type == NET_REQUEST_COMMIT ? "commit"
+                                                               : "abort",
+                          filename);
+        int status = net_serve_request(fd, &request, filename, buffer, &partials);
+        trace_stage_end();
+        if (status == -1)
+            break;
+        struct NetReply reply = {htonl(NET_MAGIC), (int32_t)htonl(status), htobe64(request.id)};
+        if (write_full(fd, &reply, sizeof(reply)) == -1)
+            break;
+    }
+    net_partial_release_all(&partials);
+    if (buffer)
+        buffer_pool_put(buffer, NET_RECEIVE_BUFFER_SIZE);
+    close(fd);
+    atomic_fetch_sub(&net_connection_count, 1);
+    return NULL;
+}
+
+// Function to run the receiving daemon: accept senders on serve_address and write the
+// files they send into cli_dest_dir, one thread per connection
+// Returns the process exit status; it only returns if the daemon cannot start
+int run_server()
+{
+    struct addrinfo *addresses;
+    if (cli_dest_dir == NULL)
+    {
+        fprintf(stderr, "--serve needs --to=DIR\n");
+        return EXIT_FAILURE;
+    }
+    if (net_resolve(serve_address, 1, &addresses) == -1)
+        return EXIT_FAILURE;
+
+    int listen_fd = -1;
+    int one = 1;
+    for (struct addrinfo *ai = addresses; ai && listen_fd == -1; ai = ai->ai_next)
+    {
+        listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (listen_fd == -1)
+            continue;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(listen_fd, ai->ai_addr, ai->ai_addrlen) == -1 || listen(listen_fd, NET_LISTEN_BACKLOG) == -1)
+        {
+            perror("Error listening");
+            close(listen_fd);
+            listen_fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (listen_fd == -1)
+        return EXIT_FAILURE;
+
+    // A sender that goes away mid-reply must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+    printf("Receiving into %s on %s\n", cli_dest_dir, serve_address);
+    fflush(stdout);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (1)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                perror("Error accepting connection");
+                sleep(1); // Out of descriptors, most likely; let connections finish
+            }
+            continue;
+        }
+        if (atomic_fetch_add(&net_connection_count, 1) >= NET_MAX_CONNECTIONS)
+        {
+            fprintf(stderr, "Refusing connection: already serving %d\n", NET_MAX_CONNECTIONS);
+            atomic_fetch_sub(&net_connection_count, 1);
+            close(fd);
+            continue;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, net_serve_thread, (void *)(intptr_t)fd) != 0)
+        {
+            fprintf(stderr, "Error creating connection thread\n");
+            atomic_fetch_sub(&net_connection_count, 1);
+            close(fd);
+        }
+    }
+}
+
+#ifdef HAVE_LIBURING
+// Function to start the io_uring engine thread
+// Returns 0 on success, -1 if io_uring is not available on this system
+int uring_engine_start()
+{
+    struct UringEngine *engine = &uring_engine;
+    int ret = io_uring_queue_init(URING_QUEUE_DEPTH, &engine->ring, 0);
+    if (ret < 0)
+    {
+        fprintf(stderr, "io_uring is not available: %s\n", strerror(-ret));
+        return -1;
+    }
+
+    engine->wake_fd = eventfd(0, EFD_CLOEXEC);
+    engine->buffers = NULL;
+    if (engine->wake_fd == -1 || posix_memalign((void **)&engine->buffers, 4096, (size_t)URING_NUM_BUFFERS * URING_BUFFER_SIZE) != 0)
+    {
+        perror("Error setting up io_uring engine");
+        if (engine->wake_fd != -1)
+            close(engine->wake_fd);
+        io_uring_queue_exit(&engine->ring);
+        return -1;
+    }
+
+    // Register the buffers once so the kernel does not map them on every request;
+    // this needs locked memory, so carry on with plain reads/writes if it is refused
+    struct iovec iovecs[URING_NUM_BUFFERS];
+    for (int i = 0; i < URING_NUM_BUFFERS; i++)
+    {
+        iovecs[i].iov_base = engine->buffers + (size_t)i * URING_BUFFER_SIZE;
+        iovecs[i].iov_len = URING_BUFFER_SIZE;
+        engine->ops[i].buf_index = i;
+        engine->free_ops[i] = &engine->ops[i];
+    }
+    engine->num_free_ops = URING_NUM_BUFFERS;
+    ret = io_uring_register_buffers(&engine->ring, iovecs, URING_NUM_BUFFERS);
+    engine->registered = ret == 0;
+    if (!engine->registered)
+    {
+        fprintf(stderr, "io_uring buffer registration failed (%s), using unregistered buffers\n", strerror(-ret));
+    }
+
+    pthread_mutex_init(&engine->lock, NULL);
+    engine->incoming = NULL;
+    engine->files = NULL;
+    engine->shutdown = 0;
+    if (pthread_create(&engine->thread, NULL, uring_engine_thread, engine) != 0)
+    {
+        perror("Error creating io_uring engine thread");
+        close(engine->wake_fd);
+        free(engine->buffers);
+        io_uring_queue_exit(&engine->ring);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to let the engine finish its files and stop it
+void uring_engine_stop()
+{
+    struct UringEngine *engine = &uring_engine;
+    pthread_mutex_lock(&engine->lock);
+    engine->shutdown = 1;
+    pthread_mutex_unlock(&engine->lock);
+    uring_engine_wake(engine);
+    pthread_join(engine->thread, NULL);
+    close(engine->wake_fd);
+    free(engine->buffers);
+    io_uring_queue_exit(&engine->ring);
+}
+
+// Function to hand a file job to the engine thread
+void uring_engine_submit(struct TransferJob *job)
+{
+    struct UringEngine *engine = &uring_engine;
+    pthread_mutex_lock(&engine->lock);
+    job->next = engine->incoming;
+    engine->incoming = job;
+    pthread_mutex_unlock(&engine->lock);
+    uring_engine_wake(engine);
+}
+
+// Function to interrupt the engine thread's wait, for new jobs or changed caps
+void uring_engine_wake(struct UringEngine *engine)
+{
+    uint64_t one = 1;
+    if (write(engine->wake_fd, &one, sizeof(one)) == -1)
+        perror("Error waking io_uring engine");
+}
+
+// Function to open the source and destination of a job and add it to the engine's active files
+void uring_engine_open_file(struct UringEngine *engine, struct TransferJob *job)
+{
+    struct UringFile *file = calloc(1, sizeof(struct UringFile));
+    if (file == NULL)
+    {
+        perror("Error allocating io_uring file");
+        transfer_job_finished(job, -1);
+        return;
+    }
+    file->job = job;
+
+    char full_file_path[MAX_PATH_LENGTH];
+    struct stat st;
+    file->src_fd = format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == 0
+                       ? open(full_file_path, O_RDONLY)
+                       : -1;
+    if (file->src_fd == -1 || fstat(file->src_fd, &st) == -1)
+    {
+        perror("Error opening file");
+        if (file->src_fd != -1)
+            close(file->src_fd);
+        free(file);
+        transfer_job_finished(job, journal_finish(job, -1));
+        return;
+    }
+    file->size = st.st_size;
+
+    // Continue after the bytes an earlier attempt committed
+    file->dest_fd = open_temp_file(job, job->resume_offset);
+    if (file->dest_fd == -1)
+    {
+        close(file->src_fd);
+        free(file);
+        transfer_job_finished(job, journal_finish(job, -1));
+        return;
+    }
+    file->next_offset = job->resume_offset;
+    posix_fadvise(file->src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    clock_gettime(CLOCK_MONOTONIC, &file->start_time);
+
+    file->next = engine->files;
+    engine->files = file;
+}
+
+// Function to close a file whose I/O has all completed and finish its job
+void uring_engine_close_file(struct UringEngine *engine, struct UringFile *file)
+{
+    struct UringFile **link = &engine->files;
+    while (*link != file)
+        link = &(*link)->next;
+    *link = file->next;
+
+    double seconds = elapsed_seconds(&file->start_time);
+    close(file->src_fd);
+    if (close(file->dest_fd) == -1)
+    {
+        perror("Error closing received file");
+        file->failed = 1;
+    }
+    int result = journal_finish(file->job, file->failed ? -1 : 0);
+    if (result == 0)
+    {
+        log_file_completed(file->job->file.filename, file->size, seconds, "io_uring");
+    }
+    transfer_job_finished(file->job, result);
+    free(file);
+}
+
+// Function to queue the read or write described by op, continuing after op->done bytes
+// Returns 0 on success, -1 if the submission queue is full
+int uring_engine_queue_op(struct UringEngine *engine, struct UringOp *op)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&engine->ring);
+    if (sqe == NULL)
+        return -1;
+
+    unsigned char *buf = engine->buffers + (size_t)op->buf_index * URING_BUFFER_SIZE + op->done;
+    unsigned int length = op->length - op->done;
+    long long offset = op->offset + op->done;
+    if (op->is_write)
+    {
+        if (engine->registered)
+            io_uring_prep_write_fixed(sqe, op->file->dest_fd, buf, length, offset, op->buf_index);
+        else
+            io_uring_prep_write(sqe, op->file->dest_fd, buf, length, offset);
+    }
+    else
+    {
+        if (engine->registered)
+            io_uring_prep_read_fixed(sqe, op->file->src_fd, buf, length, offset, op->buf_index);
+        else
+            io_uring_prep_read(sqe, op->file->src_fd, buf, length, offset);
+    }
+    io_uring_sqe_set_data(sqe, op);
+    return 0;
+}
+
+// Function to queue an fdatasync of the destination of file, after which the
+// journal may claim its first offset bytes; skipped if the queue is full
+void uring_engine_queue_sync(struct UringEngine *engine, struct UringFile *file, long long offset)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&engine->ring);
+    if (sqe == NULL)
+        return; // Retried after the next completion
+    file->sync_op.file = file;
+    file->sync_op.is_sync = 1;
+    file->sync_op.offset = offset;
+    file->sync_op.done = 0;
+    io_uring_prep_fsync(sqe, file->dest_fd, IORING_FSYNC_DATASYNC);
+    io_uring_sqe_set_data(sqe, &file->sync_op);
+    file->syncing = 1;
+    file->in_flight++;
+}
+
+// Function to hand out free buffers to active files round-robin, one read per file per pass,
+// so every selected file keeps I/O in flight. Files held back by a bandwidth cap are
+// skipped until their deadline; returns the earliest deadline still pending, or 0
+long long uring_engine_fill(struct UringEngine *engine)
+{
+    long long now = now_ns();
+    long long generation = atomic_load(&rate_limit_generation);
+    long long next_deadline = 0;
+    for (struct UringFile *file = engine->files; file != NULL; file = file->next)
+    {
+        if (file->throttle_until_ns == 0)
+            continue;
+        if (file->throttle_until_ns > now && file->throttle_generation == generation)
+        {
+            if (next_deadline == 0 || file->throttle_until_ns < next_deadline)
+                next_deadline = file->throttle_until_ns;
+            continue;
+        }
+        progress_add_cap_wait(file->job->progress, now - file->throttle_since_ns);
+        file->throttle_until_ns = 0;
+    }
+
+    int progress = 1;
+    while (progress && engine->num_free_ops > 0)
+    {
+        progress = 0;
+        for (struct UringFile *file = engine->files; file != NULL && engine->num_free_ops > 0; file = file->next)
+        {
+            if (file->failed || file->next_offset >= file->size || file->throttle_until_ns)
+                continue;
+
+            struct UringOp *op = engine->free_ops[engine->num_free_ops - 1];
+            op->file = file;
+            op->is_write = 0;
+            op->offset = file->next_offset;
+            op->length = file->size - file->next_offset < URING_BUFFER_SIZE ? (unsigned int)(file->size - file->next_offset) : URING_BUFFER_SIZE;
+            op->done = 0;
+            if (uring_engine_queue_op(engine, op) == -1)
+                return next_deadline;
+            engine->num_free_ops--;
+            file->next_offset += op->length;
+            file->in_flight++;
+            progress = 1;
+
+            // The block is charged to the caps as it is issued. Over a cap, the file
+            // gets no new reads until its deadline; sleeping on the engine thread
+            // would hold back every file it copies
+            long long wait = transfer_throttle_delay(file->job->progress, op->length);
+            if (wait > 0)
+            {
+                file->throttle_since_ns = now;
+                file->throttle_until_ns = now + wait;
+                file->throttle_generation = generation;
+                if (next_deadline == 0 || file->throttle_until_ns < next_deadline)
+                    next_deadline = file->throttle_until_ns;
+            }
+        }
+    }
+    return next_deadline;
+}
+
+// Function to process one completed request
+void uring_engine_complete(struct UringEngine *engine, struct UringOp *op, int res)
+{
+    struct UringFile *file = op->file;
+    if (op->is_sync)
+    {
+        // The data below the offset is on disk; a failed sync only costs the checkpoint
+        file->syncing = 0;
+        file->in_flight--;
+        if (res < 0)
+            fprintf(stderr, "Error syncing received file %s: %s\n", file->job->file.filename, strerror(-res));
+        else
+            journal_commit(file->job->journal, op->offset);
+        if (file->in_flight == 0 && (file->failed || file->next_offset >= file->size))
+            uring_engine_close_file(engine, file);
+        return;
+    }
+    if (res < 0 || (res == 0 && !op->is_write))
+    {
+        // An error, or the source got shorter than it was when we opened it
+        fprintf(stderr, "io_uring %s failed for file %s: %s\n", op->is_write ? "write" : "read",
+                file->job->file.filename, res < 0 ? strerror(-res) : "unexpected end of file");
+        file->failed = 1;
+    }
+    else
+    {
+        op->done += res;
+        if (op->done < op->length && !file->failed)
+        {
+            // Short read or write: resubmit the remainder with the same buffer
+            if (uring_engine_queue_op(engine, op) == 0)
+                return;
+            file->failed = 1;
+        }
+        else if (op->is_write)
+        {
+            progress_add(file->job->progress, op->length, 0, 0);
+        }
+        else if (!file->failed)
+        {
+            // The block is in memory; write it out at the same offset
+            op->is_write = 1;
+            op->done = 0;
+            if (uring_engine_queue_op(engine, op) == 0)
+                return;
+            file->failed = 1;
+        }
+    }
+
+    // The buffer is free again
+    op->file = NULL;
+    engine->free_ops[engine->num_free_ops++] = op;
+    file->in_flight--;
+
+    // Writes complete out of order; only the bytes below the lowest block still
+    // in flight can be checkpointed, once the ring has synced them
+    if (file->job->journal && !file->failed && !file->syncing)
+    {
+        long long written = file->next_offset;
+        for (int i = 0; i < URING_NUM_BUFFERS; i++)
+        {
+            if (engine->ops[i].file == file && engine->ops[i].offset < written)
+                written = engine->ops[i].offset;
+        }
+        if (written - file->job->journal->committed >= JOURNAL_CHECKPOINT_BYTES)
+            uring_engine_queue_sync(engine, file, written);
+    }
+    if (file->in_flight == 0 && (file->failed || file->next_offset >= file->size))
+        uring_engine_close_file(engine, file);
+}
+
+// Engine thread: owns the ring and drives every file handed to it
+void *uring_engine_thread(void *arg)
+{
+    struct UringEngine *engine = (struct UringEngine *)arg;
+    trace_thread_name("uring engine");
+    uint64_t wake_value;
+    int wake_armed = 0;
+    while (1)
+    {
+        // Pick up newly submitted jobs
+        pthread_mutex_lock(&engine->lock);
+        struct TransferJob *incoming = engine->incoming;
+        engine->incoming = NULL;
+        int shutdown = engine->shutdown;
+        pthread_mutex_unlock(&engine->lock);
+        while (incoming)
+        {
+            struct TransferJob *job = incoming;
+            incoming = job->next;
+            uring_engine_open_file(engine, job);
+        }
+
+        // Empty or already complete files have nothing to read and are done immediately
+        struct UringFile *file = engine->files;
+        while (file)
+        {
+            struct UringFile *next = file->next;
+            if (file->next_offset >= file->size && file->in_flight == 0)
+                uring_engine_close_file(engine, file);
+            file = next;
+        }
+        if (shutdown && engine->files == NULL)
+            break;
+
+        // Keep a read armed on the wakeup eventfd so new jobs interrupt the wait
+        if (!wake_armed)
+        {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&engine->ring);
+            if (sqe)
+            {
+                io_uring_prep_read(sqe, engine->wake_fd, &wake_value, sizeof(wake_value), (__u64)-1);
+                io_uring_sqe_set_data(sqe, NULL);
+                wake_armed = 1;
+            }
+        }
+        long long deadline = uring_engine_fill(engine);
+        io_uring_submit(&engine->ring);
+        COUNT_IO_SYSCALL();
+
+        // Reap at least one completion, then everything else that is ready; wake up
+        // by the next bandwidth cap deadline even if nothing completes
+        struct io_uring_cqe *cqe;
+        long long trace_start = TRACE_START();
+        int ret;
+        if (deadline)
+        {
+            long long wait = deadline - now_ns();
+            struct __kernel_timespec timeout = {wait > 0 ? wait / 1000000000LL : 0, wait > 0 ? wait % 1000000000LL : 0};
+            ret = io_uring_wait_cqe_timeout(&engine->ring, &cqe, &timeout);
+        }
+        else
+        {
+            ret = io_uring_wait_cqe(&engine->ring, &cqe);
+        }
+        COUNT_IO_SYSCALL();
+        TRACE_END(trace_start, TRACE_WAIT, "wait for completions", -1);
+        if (ret == -EINTR || ret == -ETIME)
+            continue;
+        if (ret < 0)
+        {
+            fprintf(stderr, "io_uring wait failed: %s\n", strerror(-ret));
+            break;
+        }
+        do
+        {
+            struct UringOp *op = (struct UringOp *)io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&engine->ring, cqe);
+            if (op == NULL)
+                wake_armed = 0;
+            else
+                uring_engine_complete(engine, op, res);
+        } while (io_uring_peek_cqe(&engine->ring, &cqe) == 0);
+    }
+    return NULL;
+}
+#endif
+
+// Sender thread owned by a worker; it is reused for every job the worker picks up
+void *sender_thread(void *arg)
+{
+    struct TransferWorker *worker = (struct TransferWorker *)arg;
+    trace_thread_name("sender %d", worker->id);
+    pthread_mutex_lock(&worker->lock);
+    while (1)
+    {
+        while (worker->send_job == NULL && !worker->shutdown)
+        {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+        }
+        if (worker->send_job == NULL)
+        {
+            break; // Shutdown requested
+        }
+        struct TransferJob *job = worker->send_job;
+        struct ShmRing *ring = worker->send_ring;
+        char fifo_name[MAX_PATH_LENGTH];
+        strcpy(fifo_name, worker->fifo_name);
+        pthread_mutex_unlock(&worker->lock);
+
+        trace_stage_begin("send", job->file.filename);
+        int result = ring ? send_file_shm(job, ring) : send_file(job, fifo_name);
+        trace_stage_end();
+
+        pthread_mutex_lock(&worker->lock);
+        worker->send_job = NULL;
+        worker->send_result = result;
+        worker->send_done = 1;
+        pthread_cond_broadcast(&worker->cond);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+// Worker thread: takes jobs off the pool queue and runs the receiver half of each transfer
+void *transfer_thread(void *arg)
+{
+    struct TransferWorker *worker = (struct TransferWorker *)arg;
+    trace_thread_name("worker %d", worker->id);
+    struct TransferJob *job;
+    while ((job = transfer_pool_next_job()) != NULL)
+    {
+        // Over the network the reply to a request finishes its job
+        if (job->type == JOB_TYPE_CHUNK && job->copy->dest_fd == -1)
+        {
+            net_send_chunk(worker, job);
+            continue;
+        }
+        if (job->type == JOB_TYPE_COMMIT)
+        {
+            net_send_commit(worker, job);
+            continue;
+        }
+        if (job->type == JOB_TYPE_CHUNK)
+        {
+            struct ChunkedCopy *copy = job->copy;
+            int result = copy_range(copy->src_fd, copy->dest_fd, job->offset, job->length, copy->file_job->progress,
+                                    copy->file_job->in_kernel);
+            if (result == 0)
+                journal_chunk_done(copy->file_job->journal, copy->dest_fd, job->offset, job->length);
+            free(job);
+            chunk_finished(copy, result);
+            continue;
+        }
+
+        // Find out where an interrupted earlier attempt left off
+        char full_file_path[MAX_PATH_LENGTH];
+        struct stat st;
+        progress_start(job->progress);
+        if (format_path(full_file_path, sizeof(full_file_path), "%s/%s", job->source_dir, job->file.filename) == -1)
+        {
+            fprintf(stderr, "Path too long, not copied: %s/%s\n", job->source_dir, job->file.filename);
+            transfer_job_finished(job, -1);
+            continue;
+        }
+        int have_source = stat(full_file_path, &st) == 0 && S_ISREG(st.st_mode);
+
+        // --remote: the daemon stores the file; small files are pipelined on the worker's
+        // connection and large ones split into chunks sent over every worker's.
+        // Compressed files are one stream of blocks, so they are never split
+        if (remote_address)
+        {
+            job->codec = have_source ? compress_choose(job, st.st_size) : CODEC_NONE;
+            if (job->codec != CODEC_NONE && worker->compressor == NULL && (worker->compressor = compressor_create()) == NULL)
+                job->codec = CODEC_NONE; // Send it as it is
+            if (!have_source)
+                transfer_job_finished(job, -1);
+            else if (st.st_size >= large_file_threshold && st.st_size > 0 && job->codec == CODEC_NONE)
+            {
+                if (start_chunked_copy(job, st.st_size) == -1)
+                    transfer_job_finished(job, -1);
+            }
+            else
+                net_send_file(worker, job, &st);
+            continue;
+        }
+
+        // Contents the destination already has are linked rather than copied again;
+        // a folder sync only compares the file with its own copy
+        if (have_source && (job->batch->sync ? sync_try(job, &st) : dedup_transfers && dedup_try(job, &st)))
+        {
+            transfer_job_finished(job, 0);
+            continue;
+        }
+
+        // --playable: videos are written in playing order and shown under their name early;
+        // --verify needs the sender/receiver pair, so it keeps them on that path
+        if (have_source && playable_transfers && !verify_transfers)
+        {
+            int result = playable_copy_file(job, &st);
+            if (result != 1)
+            {
+                transfer_job_finished(job, result);
+                continue;
+            }
+        }
+        if (journal_begin(job, have_source ? &st : NULL) == -1)
+        {
+            transfer_job_finished(job, -1);
+            continue;
+        }
+
+        // A folder sync within one filesystem lets the kernel copy the data
+        struct stat dest_dir_st;
+        job->in_kernel = have_source && job->batch->sync && !verify_transfers && stat(job->dest_dir, &dest_dir_st) == 0 &&
+                         dest_dir_st.st_dev == st.st_dev;
+        if (job->in_kernel && st.st_size < large_file_threshold)
+        {
+            int result = kernel_copy_file(job, st.st_size);
+            if (result != 1)
+            {
+                result = journal_finish(job, result);
+                if (result == 0)
+                    log_file_completed(job->file.filename, job->bytes_done, job->seconds, "copy_file_range");
+                transfer_job_finished(job, result);
+                continue;
+            }
+            job->in_kernel = 0; // Not supported here; copy it the usual way
+        }
+
+#ifdef HAVE_LIBURING
+        // The io_uring engine copies every file itself, several requests at a time
+        if (transfer_engine == TRANSFER_ENGINE_URING && !job->in_kernel)
+        {
+            uring_engine_submit(job);
+            continue;
+        }
+#endif
+
+        // Large files are split into byte ranges copied in parallel by the pool;
+        // --verify needs a sender and a receiver, so it keeps them on the FIFO path
+        if (have_source && st.st_size >= large_file_threshold && !verify_transfers)
+        {
+            if (start_chunked_copy(job, st.st_size) == -1)
+                transfer_job_finished(job, journal_finish(job, -1));
+            continue;
+        }
+
+        int result = transfer_file(worker, job);
+        transfer_job_finished(job, result);
+    }
+
+    // Release the paired sender thread
+    pthread_mutex_lock(&worker->lock);
+    worker->shutdown = 1;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->sender, NULL);
+    if (worker->ring)
+        shm_ring_destroy(worker->ring);
+    if (worker->compressor)
+        compressor_destroy(worker->compressor);
+    if (worker->connection)
+        net_connection_close(worker->connection);
+    return NULL;
+}
+
+// Function to start the worker pool with num_workers sender/receiver pairs
+void transfer_pool_start(int num_workers)
+{
+    // A receiver that gives up closes its end of the FIFO; report EPIPE instead of dying
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_mutex_init(&transfer_pool.lock, NULL);
+    pthread_cond_init(&transfer_pool.not_empty, NULL);
+    memset(transfer_pool.head, 0, sizeof(transfer_pool.head));
+    memset(transfer_pool.tail, 0, sizeof(transfer_pool.tail));
+    transfer_pool.bypassed = 0;
+    transfer_pool.shutdown = 0;
+    transfer_pool.workers = calloc(num_workers, sizeof(struct TransferWorker));
+    transfer_pool.num_workers = 0;
+    for (int i = 0; i < num_workers; i++)
+    {
+        struct TransferWorker *worker = &transfer_pool.workers[i];
+        worker->id = i;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->sender, NULL, sender_thread, worker) != 0)
+        {
+            perror("Error creating sender thread");
+            break;
+        }
+        if (pthread_create(&worker->receiver, NULL, transfer_thread, worker) != 0)
+        {
+            perror("Error creating worker thread");
+            worker->shutdown = 1;
+            pthread_cond_broadcast(&worker->cond);
+            pthread_join(worker->sender, NULL);
+            break;
+        }
+        transfer_pool.num_workers++;
+    }
+    if (transfer_pool.num_workers == 0)
+    {
+        fprintf(stderr, "Unable to start any transfer workers\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to let the workers drain the queue and then stop them
+void transfer_pool_stop()
+{
+    pthread_mutex_lock(&transfer_pool.lock);
+    transfer_pool.shutdown = 1;
+    pthread_cond_broadcast(&transfer_pool.not_empty);
+    pthread_mutex_unlock(&transfer_pool.lock);
+    for (int i = 0; i < transfer_pool.num_workers; i++)
+    {
+        pthread_join(transfer_pool.workers[i].receiver, NULL);
+    }
+    free(transfer_pool.workers);
+    transfer_pool.workers = NULL;
+    transfer_pool.num_workers = 0;
+}
+
+// Function to append a job to the queue of its priority class
+void transfer_pool_submit(struct TransferJob *job)
+{
+    int priority = job->priority;
+    job->next = NULL;
+    pthread_mutex_lock(&transfer_pool.lock);
+    if (transfer_pool.tail[priority])
+        transfer_pool.tail[priority]->next = job;
+    else
+        transfer_pool.head[priority] = job;
+    transfer_pool.tail[priority] = job;
+    pthread_cond_signal(&transfer_pool.not_empty);
+    pthread_mutex_unlock(&transfer_pool.lock);
+}
+
+// Function to put a job at the front of the queue of its priority class
+void transfer_pool_submit_front(struct TransferJob *job)
+{
+    int priority = job->priority;
+    pthread_mutex_lock(&transfer_pool.lock);
+    job->next = transfer_pool.head[priority];
+    transfer_pool.head[priority] = job;
+    if (transfer_pool.tail[priority] == NULL)
+        transfer_pool.tail[priority] = job;
+    pthread_cond_signal(&transfer_pool.not_empty);
+    pthread_mutex_unlock(&transfer_pool.lock);
+}
+
+// Function to pick the class to serve next; called with the pool lock held
+// Urgent jobs always go first and small files before bulk ones, except that bulk
+// jobs get one turn after PRIORITY_MAX_BYPASS small ones so they cannot starve
+// Returns -1 when every queue is empty
+int transfer_pool_pick_locked()
+{
+    if (transfer_pool.head[PRIORITY_URGENT])
+        return PRIORITY_URGENT;
+    if (transfer_pool.head[PRIORITY_SMALL] &&
+        (transfer_pool.head[PRIORITY_BULK] == NULL || transfer_pool.bypassed < PRIORITY_MAX_BYPASS))
+    {
+        if (transfer_pool.head[PRIORITY_BULK])
+            transfer_pool.bypassed++;
+        return PRIORITY_SMALL;
+    }
+    transfer_pool.bypassed = 0;
+    return transfer_pool.head[PRIORITY_BULK] ? PRIORITY_BULK : -1;
+}
+
+// Function to take the next job off the pool queues, blocking while they are empty
+// Returns NULL once the pool is shutting down and the queues have drained
+struct TransferJob *transfer_pool_next_job()
+{
+    // The worker is done with its previous job, whichever way it ended
+    trace_stage_end();
+    long long trace_start = TRACE_START();
+    pthread_mutex_lock(&transfer_pool.lock);
+    int priority;
+    while ((priority = transfer_pool_pick_locked()) == -1 && !transfer_pool.shutdown)
+    {
+        pthread_cond_wait(&transfer_pool.not_empty, &transfer_pool.lock);
+    }
+    struct TransferJob *job = NULL;
+    if (priority != -1)
+    {
+        job = transfer_pool.head[priority];
+        transfer_pool.head[priority] = job->next;
+        if (transfer_pool.head[priority] == NULL)
+            transfer_pool.tail[priority] = NULL;
+    }
+    pthread_mutex_unlock(&transfer_pool.lock);
+    TRACE_END(trace_start, TRACE_WAIT, "wait for job", -1);
+    if (job)
+        trace_stage_begin(job->type == JOB_TYPE_CHUNK ? "chunk" : job->type == JOB_TYPE_COMMIT ? "commit" : "file",
+                          job->type == JOB_TYPE_FILE ? job->file.filename : job->copy->file_job->file.filename);
+    return job;
+}
+
+// Function to create an empty batch
+// The batch stays open until transfer_batch_close() is called, so jobs finishing
+// early cannot complete it while files are still being added
+struct TransferBatch *transfer_batch_new(int notify_gui)
+{
+    struct TransferBatch *batch = calloc(1, sizeof(struct TransferBatch));
+    if (batch == NULL)
+    {
+        perror("Error allocating transfer batch");
+        return NULL;
+    }
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->done, NULL);
+    pthread_mutex_init(&batch->bucket.lock, NULL);
+    batch->pending = 1;
+    batch->notify_gui = notify_gui;
+    name_allocators_invalidate();
+    return batch;
+}
+
+// Function to create a job for file_info and queue it as part of batch
+void transfer_batch_add(struct TransferBatch *batch, const struct FileInfo *file_info, const char *source_dir, const char *dest_dir)
+{
+    struct TransferJob *job = calloc(1, sizeof(struct TransferJob));
+    if (job == NULL)
+    {
+        perror("Error allocating transfer job");
+        if (file_info->row)
+            g_idle_add(on_row_released_idle, file_info->row);
+        pthread_mutex_lock(&batch->lock);
+        batch->total++;
+        batch->failed++;
+        pthread_mutex_unlock(&batch->lock);
+        return;
+    }
+    job->file = *file_info;
+    snprintf(job->source_dir, sizeof(job->source_dir), "%s", source_dir);
+    snprintf(job->dest_dir, sizeof(job->dest_dir), "%s", dest_dir);
+    job->batch = batch;
+    clock_gettime(CLOCK_MONOTONIC, &job->queued_time);
+
+    job->progress = progress_register(job);
+    if (file_info->urgent)
+        job->priority = PRIORITY_URGENT;
+    else if (job->progress && job->progress->total_bytes >= small_file_threshold)
+        job->priority = PRIORITY_BULK;
+    else
+        job->priority = PRIORITY_SMALL;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->pending++;
+    batch->total++;
+    pthread_mutex_unlock(&batch->lock);
+    transfer_pool_submit(job);
+}
+
+// Function to mark the batch as fully queued
+void transfer_batch_close(struct TransferBatch *batch)
+{
+    transfer_batch_release(batch);
+}
+
+// Function to drop one pending reference from batch
+// The last reference either wakes transfer_batch_wait() or hands the batch to the GUI thread
+void transfer_batch_release(struct TransferBatch *batch)
+{
+    // Persist the hashes learned during the batch before anyone sees it finish. Seeing
+    // pending at 1 under the lock means the caller holds the only reference: nobody
+    // else can add to it or drop it while the lock is released for the save
+    pthread_mutex_lock(&batch->lock);
+    if (batch->pending == 1 && dedup_transfers)
+    {
+        pthread_mutex_unlock(&batch->lock);
+        content_index_save_all();
+        pthread_mutex_lock(&batch->lock);
+    }
+    int finished = --batch->pending == 0;
+    int notify_gui = batch->notify_gui;
+    if (finished && !notify_gui)
+        pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+
+    if (finished && notify_gui)
+        g_idle_add(on_batch_finished_idle, batch);
+}
+
+// Function called by a worker when a job is over; updates the batch and frees the job
+void transfer_job_finished(struct TransferJob *job, int result)
+{
+    struct TransferBatch *batch = job->batch;
+    if (result != 0)
+    {
+        fprintf(stderr, "Transfer of file %s failed\n", job->file.filename);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    if (result != 0)
+    {
+        // Remember which files failed for the completion dialog
+        size_t used = strlen(batch->failed_files);
+        if (batch->failed++ > 0 && used + 2 < sizeof(batch->failed_files))
+        {
+            strcat(batch->failed_files, ", ");
+            used += 2;
+        }
+        snprintf(batch->failed_files + used, sizeof(batch->failed_files) - used, "%s%s", job->file.filename,
+                 job->checksum_mismatch ? " (checksum mismatch)" : "");
+    }
+    if (batch->latencies)
+        batch->latencies[batch->num_latencies++] = elapsed_seconds(&job->queued_time);
+    pthread_mutex_unlock(&batch->lock);
+
+    if (result == 0 && dedup_transfers)
+        dedup_record(job);
+    if (result == 0 && batch->sync)
+        sync_record(job);
+
+    if (result == 0)
+    {
+        atomic_fetch_add(&files_completed, 1);
+        if (job->progress)
+            atomic_fetch_add(&bytes_completed, atomic_load(&job->progress->bytes_done));
+    }
+    else
+    {
+        atomic_fetch_add(&files_failed, 1);
+    }
+    if (job->progress)
+        atomic_store(&job->progress->state, result == 0 ? PROGRESS_DONE : PROGRESS_FAILED);
+
+    // The folder view may only be touched from the GTK main loop, which also
+    // retires the progress record and the row reference
+    struct FileResult *file_result = NULL;
+    if (batch->notify_gui && job->file.row)
+        file_result = malloc(sizeof(struct FileResult));
+    if (file_result)
+    {
+        file_result->row = job->file.row;
+        file_result->progress = job->progress;
+        file_result->success = result == 0;
+        file_result->checksum_mismatch = job->checksum_mismatch;
+        g_idle_add(on_file_finished_idle, file_result);
+    }
+    else
+    {
+        // Without a result the GUI thread is only asked to drop the row reference
+        if (job->file.row)
+            g_idle_add(on_row_released_idle, job->file.row);
+        if (job->progress)
+            progress_unregister(job->progress);
+    }
+
+    transfer_batch_release(batch);
+    free(job);
+}
+
+// Function to block until every job of a closed batch has finished
+// Returns 1 if all of them succeeded, 0 otherwise
+int transfer_batch_wait(struct TransferBatch *batch)
+{
+    pthread_mutex_lock(&batch->lock);
+    while (batch->pending > 0)
+    {
+        pthread_cond_wait(&batch->done, &batch->lock);
+    }
+    int success = batch->failed == 0;
+    pthread_mutex_unlock(&batch->lock);
+    return success;
+}
+
+// Function to release a finished batch
+void transfer_batch_free(struct TransferBatch *batch)
+{
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->done);
+    free(batch);
+}
+
+// Idle callback run on the GUI thread for every finished file
+gboolean on_file_finished_idle(gpointer data)
+{
+    struct FileResult *file_result = (struct FileResult *)data;
+
+    // Leave the row showing the outcome, then retire the progress record
+    struct TransferProgress *progress = file_result->progress;
+    char text[128];
+    if (progress && file_result->success)
+        snprintf(text, sizeof(text), "Done  (wait pipe %.1fs, disk %.1fs, cap %.1fs)",
+                 atomic_load(&progress->wait_pipe_ns) / 1e9, atomic_load(&progress->wait_disk_ns) / 1e9,
+                 atomic_load(&progress->wait_cap_ns) / 1e9);
+    else
+        snprintf(text, sizeof(text), "%s", file_result->success ? "Done" : file_result->checksum_mismatch ? "Checksum mismatch" : "Failed");
+    folder_row_set_progress(file_result->row, file_result->success ? 100 : -1, text);
+    if (progress)
+        progress_unregister(progress);
+
+    // Untick the file on successful file transfer
+    GtkTreePath *path = gtk_tree_row_reference_get_path(file_result->row);
+    if (path && file_result->success)
+    {
+        GtkTreeModel *model = gtk_tree_row_reference_get_model(file_result->row);
+        GtkTreeIter iter;
+        if (gtk_tree_model_get_iter(model, &iter, path))
+            gtk_list_store_set(GTK_LIST_STORE(model), &iter, FILE_COLUMN_SELECTED, FALSE, FILE_COLUMN_URGENT, FALSE, -1);
+    }
+    if (path)
+        gtk_tree_path_free(path);
+    gtk_tree_row_reference_free(file_result->row);
+    free(file_result);
+    return G_SOURCE_REMOVE;
+}
+
+// Idle callback run on the GUI thread to free the row reference of a file whose
+// result could not be reported, which releases its hold on the list store
+gboolean on_row_released_idle(gpointer data)
+{
+    gtk_tree_row_reference_free((GtkTreeRowReference *)data);
+    return G_SOURCE_REMOVE;
+}
+
+// Idle callback run on the GUI thread once every file of a batch has finished
+gboolean on_batch_finished_idle(gpointer data)
+{
+    struct TransferBatch *batch = (struct TransferBatch *)data;
+
+    // Show success or failure message without blocking the main loop
+    GtkWidget *dialog;
+    if (batch->failed == 0)
+    {
+        dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT,
+                                        GTK_MESSAGE_INFO, GTK_BUTTONS_OK,
+                                        "%d file(s) transferred successfully", batch->total);
+    }
+    else
+    {
+        dialog = gtk_message_dialog_new(GTK_WINDOW(window), GTK_DIALOG_DESTROY_WITH_PARENT,
+                                        GTK_MESSAGE_ERROR, GTK_BUTTONS_OK,
+                                        "File transfer failed for %d of %d file(s): %s",
+                                        batch->failed, batch->total, batch->failed_files);
+    }
+    g_signal_connect_swapped(dialog, "response", G_CALLBACK(gtk_widget_destroy), dialog);
+    gtk_widget_show_all(dialog);
+
+    transfer_batch_free(batch);
+    return G_SOURCE_REMOVE;
+}
+
+// Function to order directory entries by filename
+int compare_file_entries(const void *a, const void *b)
+{
+    return strcmp(((const struct FileEntry *)a)->filename, ((const struct FileEntry *)b)->filename);
+}
+
+// Function to binary search the index for filename
+// Returns its position, or the position it would be inserted at; *found tells which
+int directory_index_find(const struct DirectoryIndex *index, const char *filename, int *found)
+{
+    int low = 0, high = index->count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        int cmp = strcmp(index->entries[middle].filename, filename);
+        if (cmp == 0)
+        {
+            *found = 1;
+            return middle;
+        }
+        if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    *found = 0;
+    return low;
+}
+
+// Function to fill entry from the attributes of filename inside dir_fd
+// Returns 0 for a listed file, -1 if it is gone, hidden or not a regular file
+int directory_index_stat(int dir_fd, const char *filename, struct FileEntry *entry)
+{
+    struct stat st;
+    if (filename[0] == '.' || strlen(filename) >= sizeof(entry->filename))
+        return -1;
+    if (fstatat(dir_fd, filename, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+    strcpy(entry->filename, filename);
+    entry->size = st.st_size;
+    entry->mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+// Function to (re)build the index of a folder with one readdir() and fstatat() pass
+int directory_index_load(struct DirectoryIndex *index)
+{
+    index->count = 0;
+    DIR *dir = opendir(index->path);
+    if (dir == NULL)
+    {
+        perror("Error opening directory");
+        return -1;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (index->count == index->capacity)
+        {
+            int capacity = index->capacity ? index->capacity * 2 : 256;
+            struct FileEntry *entries = realloc(index->entries, capacity * sizeof(struct FileEntry));
+            if (entries == NULL)
+            {
+                perror("Error growing directory index");
+                break;
+            }
+            index->entries = entries;
+            index->capacity = capacity;
+        }
+        if (directory_index_stat(dirfd(dir), ent->d_name, &index->entries[index->count]) == 0)
+            index->count++;
+    }
+    closedir(dir);
+    qsort(index->entries, index->count, sizeof(struct FileEntry), compare_file_entries);
+    return 0;
+}
+
+// Function to bring one file of the index up to date after an inotify event,
+// mirroring the change into the folder view when that folder is on screen
+void directory_index_refresh(struct DirectoryIndex *index, const char *filename)
+{
+    struct FileEntry entry;
+    int dir_fd = open(index->path, O_RDONLY | O_DIRECTORY);
+    int listed = dir_fd >= 0 && directory_index_stat(dir_fd, filename, &entry) == 0;
+    if (dir_fd >= 0)
+        close(dir_fd);
+
+    int found;
+    int pos = directory_index_find(index, filename, &found);
+    GtkListStore *store = shown_index == index ? shown_store : NULL;
+    GtkTreeIter iter;
+
+    if (listed && found)
+    {
+        index->entries[pos] = entry;
+        if (store && gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, pos))
+            folder_store_set_entry(store, &iter, &entry);
+    }
+    else if (listed)
+    {
+        if (index->count == index->capacity)
+        {
+            int capacity = index->capacity ? index->capacity * 2 : 256;
+            struct FileEntry *entries = realloc(index->entries, capacity * sizeof(struct FileEntry));
+            if (entries == NULL)
+            {
+                perror("Error growing directory index");
+                return;
+            }
+            index->entries = entries;
+            index->capacity = capacity;
+        }
+        memmove(&index->entries[pos + 1], &index->entries[pos], (index->count - pos) * sizeof(struct FileEntry));
+        index->entries[pos] = entry;
+        index->count++;
+        if (store)
+        {
+            gtk_list_store_insert_with_values(store, &iter, pos, FILE_COLUMN_SELECTED, FALSE,
+                                              FILE_COLUMN_PROGRESS, 0, FILE_COLUMN_STATUS, "", -1);
+            folder_store_set_entry(store, &iter, &entry);
+        }
+    }
+    else if (found)
+    {
+        memmove(&index->entries[pos], &index->entries[pos + 1], (index->count - pos - 1) * sizeof(struct FileEntry));
+        index->count--;
+        if (store && gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, pos))
+            gtk_list_store_remove(store, &iter);
+    }
+}
+
+// Function to return the index of the folder at path, or NULL if it is not indexed
+struct DirectoryIndex *directory_index_for(const char *path)
+{
+    for (size_t i = 0; i < sizeof(folder_indexes) / sizeof(folder_indexes[0]); i++)
+    {
+        if (strcmp(folder_indexes[i].path, path) == 0)
+            return &folder_indexes[i];
+    }
+    return NULL;
+}
+
+// Function to index both folders and watch them for changes from the GTK main loop
+void directory_watch_start()
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+        perror("Error initializing inotify; folder views will not refresh");
+
+    for (size_t i = 0; i < sizeof(folder_indexes) / sizeof(folder_indexes[0]); i++)
+    {
+        // Watch before listing so that no change falls between the two
+        if (inotify_fd >= 0)
+        {
+            folder_indexes[i].watch = inotify_add_watch(inotify_fd, folder_indexes[i].path, DIRECTORY_WATCH_MASK);
+            if (folder_indexes[i].watch < 0)
+                perror("Error watching directory");
+        }
+        directory_index_load(&folder_indexes[i]);
+    }
+
+    if (inotify_fd >= 0)
+    {
+        GIOChannel *channel = g_io_channel_unix_new(inotify_fd);
+        g_io_add_watch(channel, G_IO_IN, on_inotify_event, NULL);
+        g_io_channel_unref(channel);
+    }
+}
+
+// Callback run on the GUI thread when inotify has events for the watched folders
+gboolean on_inotify_event(GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    char buffer[INOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were dropped; fall back to a full listing
+                for (size_t i = 0; i < sizeof(folder_indexes) / sizeof(folder_indexes[0]); i++)
+                    directory_index_load(&folder_indexes[i]);
+                if (shown_store)
+                    folder_store_fill(shown_store, shown_index);
+                continue;
+            }
+            for (size_t i = 0; i < sizeof(folder_indexes) / sizeof(folder_indexes[0]); i++)
+            {
+                if (folder_indexes[i].watch != event->wd)
+                    continue;
+                if (event->mask & IN_IGNORED)
+                    folder_indexes[i].watch = -1;
+                else if (event->len > 0)
+                    directory_index_refresh(&folder_indexes[i], event->name);
+            }
+        }
+    }
+    if (length < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        perror("Error reading inotify events");
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Function to format a byte count for the size column
+void format_size(long long bytes, char *text, size_t size)
+{
+    if (bytes >= 1024LL * 1024 * 1024)
+        snprintf(text, size, "%.1f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+    else if (bytes >= 1024 * 1024)
+        snprintf(text, size, "%.1f MB", bytes / (1024.0 * 1024.0));
+    else if (bytes >= 1024)
+        snprintf(text, size, "%.1f KB", bytes / 1024.0);
+    else
+        snprintf(text, size, "%lld B", bytes);
+}
+
+// Function to write the name and size of entry into a row of the folder view
+void folder_store_set_entry(GtkListStore *store, GtkTreeIter *iter, const struct FileEntry *entry)
+{
+    char size[32];
+    format_size(entry->size, size, sizeof(size));
+    gtk_list_store_set(store, iter, FILE_COLUMN_NAME, entry->filename, FILE_COLUMN_SIZE, size, -1);
+}
+
+// Function to fill a list store with one row per file of index, in index order
+void folder_store_fill(GtkListStore *store, const struct DirectoryIndex *index)
+{
+    GtkTreeIter iter;
+    gtk_list_store_clear(store);
+    for (int i = 0; i < index->count; i++)
+    {
+        char size[32];
+        format_size(index->entries[i].size, size, sizeof(size));
+        gtk_list_store_insert_with_values(store, &iter, -1,
+                                          FILE_COLUMN_SELECTED, FALSE,
+                                          FILE_COLUMN_NAME, index->entries[i].filename,
+                                          FILE_COLUMN_SIZE, size,
+                                          FILE_COLUMN_PROGRESS, 0,
+                                          FILE_COLUMN_STATUS, "", -1);
+    }
+}
+
+// Callback function to stop mirroring index changes once the folder view is gone
+void on_folder_view_destroyed(GtkWidget *widget, gpointer data)
+{
+    if (shown_store)
+        g_object_unref(shown_store);
+    shown_store = NULL;
+    shown_index = NULL;
+}
+
+// Callback function to handle button click for transferring files
+void on_button_clicked(GtkWidget *button, gpointer data)
+{
+    if (strcmp(gtk_widget_get_name(button), "Folder1") == 0)
+    {
+        SOURCE_DIR = "./Folder1";
+        DEST_DIR = "./Folder2";
+    }
+    else
+    {
+        SOURCE_DIR = "./Folder2";
+        DEST_DIR = "./Folder1";
+    }
+    if (shown_store == NULL)
+        return;
+
+    // Queue the ticked rows on the worker pool; completion is reported
+    // back to the main loop, so the GUI stays responsive while they run
+    GtkTreeModel *model = GTK_TREE_MODEL(shown_store);
+    GtkTreeIter iter;
+    struct TransferBatch *batch = NULL;
+    int numSelectedFiles = 0;
+    printf("Selected Files:\n");
+    for (gboolean valid = gtk_tree_model_get_iter_first(model, &iter); valid; valid = gtk_tree_model_iter_next(model, &iter))
+    {
+        gboolean selected, urgent;
+        gchar *filename;
+        gtk_tree_model_get(model, &iter, FILE_COLUMN_SELECTED, &selected, FILE_COLUMN_URGENT, &urgent,
+                           FILE_COLUMN_NAME, &filename, -1);
+        if (selected)
+        {
+            if (batch == NULL && (batch = transfer_batch_new(1)) == NULL)
+            {
+                g_free(filename);
+                return;
+            }
+            printf("%s\n", filename);
+
+            struct FileInfo file_info = {0};
+            file_info.index = numSelectedFiles++;
+            file_info.isSelected = 1;
+            file_info.urgent = urgent;
+            snprintf(file_info.filename, sizeof(file_info.filename), "%s", filename);
+            GtkTreePath *path = gtk_tree_model_get_path(model, &iter);
+            file_info.row = gtk_tree_row_reference_new(model, path);
+            gtk_tree_path_free(path);
+            gtk_list_store_set(shown_store, &iter, FILE_COLUMN_PROGRESS, 0, FILE_COLUMN_STATUS, "Queued", -1);
+            transfer_batch_add(batch, &file_info, SOURCE_DIR, DEST_DIR);
+        }
+        g_free(filename);
+    }
+    if (batch)
+        transfer_batch_close(batch);
+}
+
+// Callback function to mirror the shown folder into the other one: only new and
+// changed files are queued. The folder walk runs on its own thread and the
+// batch reports back like one started with "Add Selected Files"
+void on_sync_button_clicked(GtkWidget *button, gpointer data)
+{
+    struct SyncRequest *request = calloc(1, sizeof(struct SyncRequest));
+    if (request == NULL || (request->batch = transfer_batch_new(1)) == NULL)
+    {
+        free(request);
+        return;
+    }
+    int from_folder1 = strcmp(gtk_widget_get_name(button), "Folder1") == 0;
+    snprintf(request->source_dir, sizeof(request->source_dir), "%s", from_folder1 ? "./Folder1" : "./Folder2");
+    snprintf(request->dest_dir, sizeof(request->dest_dir), "%s", from_folder1 ? "./Folder2" : "./Folder1");
+    request->batch->sync = 1;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sync_thread, request) != 0)
+    {
+        perror("Error creating sync thread");
+        transfer_batch_free(request->batch);
+        free(request);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Callback function to handle button click to select folder
+void on_folder_button_clicked(GtkWidget *button, gpointer data)
+{
+    const char *folder = gtk_widget_get_name(button);
+    if (strcmp(folder, "Folder1") == 0)
+    {
+        SOURCE_DIR = "./Folder1";
+        DEST_DIR = "./Folder2";
+    }
+    else
+    {
+        SOURCE_DIR = "./Folder2";
+        DEST_DIR = "./Folder1";
+    }
+
+    // Clear main grid
+    GList *children, *iter;
+    children = gtk_container_get_children(GTK_CONTAINER(main_grid));
+    for (iter = children; iter != NULL; iter = g_list_next(iter))
+    {
+        gtk_widget_destroy(GTK_WIDGET(iter->data));
+    }
+    g_list_free(children);
+
+    // Build the list model from the index; no rescan of the folder is needed
+    struct DirectoryIndex *index = directory_index_for(SOURCE_DIR);
+    GtkListStore *store = gtk_list_store_new(FILE_NUM_COLUMNS, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT, G_TYPE_STRING,
+                                             G_TYPE_BOOLEAN);
+    folder_store_fill(store, index);
+    shown_index = index;
+    shown_store = store;
+
+    // Create a box for holding folder contents and the buttons
+    GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    gtk_grid_attach(GTK_GRID(main_grid), vbox, 0, 0, 2, 1);
+
+    // Display folder contents; fixed height rows let the view only lay out
+    // the rows that are visible, so large folders stay fast to scroll
+    GtkWidget *scrolled_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_vexpand(scrolled_window, TRUE);
+    gtk_box_pack_start(GTK_BOX(vbox), scrolled_window, TRUE, TRUE, 0);
+
+    GtkWidget *tree_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
+    g_signal_connect(tree_view, "destroy", G_CALLBACK(on_folder_view_destroyed), NULL);
+    gtk_container_add(GTK_CONTAINER(scrolled_window), tree_view);
+
+    GtkCellRenderer *renderer = gtk_cell_renderer_toggle_new();
+    g_signal_connect(renderer, "toggled", G_CALLBACK(on_file_toggled), store);
+    GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes("", renderer, "active", FILE_COLUMN_SELECTED, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 30);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+
+    renderer = gtk_cell_renderer_text_new();
+    column = gtk_tree_view_column_new_with_attributes("File", renderer, "text", FILE_COLUMN_NAME, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 250);
+    gtk_tree_view_column_set_expand(column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+
+    renderer = gtk_cell_renderer_text_new();
+    column = gtk_tree_view_column_new_with_attributes("Size", renderer, "text", FILE_COLUMN_SIZE, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 90);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+
+    // Progress column filled in by on_progress_timer while the file transfers
+    renderer = gtk_cell_renderer_progress_new();
+    column = gtk_tree_view_column_new_with_attributes("Progress", renderer, "value", FILE_COLUMN_PROGRESS,
+                                                      "text", FILE_COLUMN_STATUS, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 380);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+
+    // Urgent files are sent ahead of everything else queued
+    renderer = gtk_cell_renderer_toggle_new();
+    g_signal_connect(renderer, "toggled", G_CALLBACK(on_urgent_toggled), store);
+    column = gtk_tree_view_column_new_with_attributes("Urgent", renderer, "active", FILE_COLUMN_URGENT, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, 60);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(tree_view), column);
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(tree_view), TRUE);
+
+    // Bandwidth caps in MB/s, 0 for none; changes apply to transfers already running
+    GtkWidget *limit_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(limit_box), gtk_label_new("Limit per batch (MB/s):"), FALSE, FALSE, 0);
+    GtkWidget *batch_limit = gtk_spin_button_new_with_range(0, 100000, 10);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(batch_limit), atomic_load(&batch_rate_limit) / (1024.0 * 1024.0));
+    g_signal_connect(batch_limit, "value-changed", G_CALLBACK(on_rate_limit_changed), &batch_rate_limit);
+    gtk_box_pack_start(GTK_BOX(limit_box), batch_limit, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(limit_box), gtk_label_new("Total (MB/s):"), FALSE, FALSE, 0);
+    GtkWidget *total_limit = gtk_spin_button_new_with_range(0, 100000, 10);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(total_limit), atomic_load(&total_rate_limit) / (1024.0 * 1024.0));
+    g_signal_connect(total_limit, "value-changed", G_CALLBACK(on_rate_limit_changed), &total_rate_limit);
+    gtk_box_pack_start(GTK_BOX(limit_box), total_limit, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), limit_box, FALSE, FALSE, 0);
+
+    // Create a button to add selected files
+    GtkWidget *add_button = gtk_button_new_with_label("Add Selected Files");
+    gtk_widget_set_name(add_button, folder);
+    g_signal_connect(add_button, "clicked", G_CALLBACK(on_button_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(vbox), add_button, FALSE, FALSE, 0);
+
+    // Create a button to mirror the whole folder tree into the other folder
+    GtkWidget *sync_button = gtk_button_new_with_label("Sync Into Other Folder");
+    gtk_widget_set_name(sync_button, folder);
+    g_signal_connect(sync_button, "clicked", G_CALLBACK(on_sync_button_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(vbox), sync_button, FALSE, FALSE, 0);
+
+    // Create a back button to return to the main menu
+    GtkWidget *back_button = gtk_button_new_with_label("Back");
+    g_signal_connect(back_button, "clicked", G_CALLBACK(on_back_button_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(vbox), back_button, FALSE, FALSE, 0);
+
+    gtk_widget_show_all(main_grid);
+}
+
+void on_description_button_clicked(GtkWidget *button, gpointer data) {
+    // Create a new window for project description
+    GtkWidget *description_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(description_window), "Project Description");
+    gtk_window_set_default_size(GTK_WINDOW(description_window), 800, 600); // Set a larger default size for better readability
+
+    // Create a scrolled window to contain the text view
+    GtkWidget *scrolled_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_window),
+                                   GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add(GTK_CONTAINER(description_window), scrolled_window);
+
+    // Create a text view widget to display the project description
+    GtkWidget *text_view = gtk_text_view_new();
+    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(text_view), GTK_WRAP_WORD_CHAR);
+    gtk_container_add(GTK_CONTAINER(scrolled_window), text_view);
+
+    // Create a text buffer and set the text for the text view
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+    const char *description_text = "In this project, the system is designed to facilitate efficient file transfer between a sender and a receiver. The sender’s role involves interfacing with a graphical user interface (GUI) to select and process multiple video files. These files are segmented and dispatched through individual threads over shared pipes, ensuring that each file’s end is properly signaled to the receiver. Once a file is completely transferred, the corresponding pipe is closed. On the other side, the receiver is tasked with opening and assembling the incoming segments into new video files. It must detect the end-of-file (EOF) marker to conclude each transfer, after which it terminates the associated thread and closes the file and pipe. Throughout this process, the GUI serves as a dashboard, displaying successful transfers or reporting any errors encountered. This dual-process system streamlines the transfer of video content, ensuring that multiple files can be handled concurrently and efficiently.";
+    gtk_text_buffer_set_text(buffer, description_text, -1);
+
+    // Set the background color and styling using CSS
+    GtkCssProvider *provider = gtk_css_provider_new();
+    gtk_css_provider_load_from_data(provider,
+                                    "textview { background-color: #333333; color: #ffffff; font-family: 'Arial'; font-size: 28px; }", // Dark gray background color, white text, increased font size
+                                    -1,
+                                    NULL);
+
+    GtkStyleContext *context = gtk_widget_get_style_context(text_view);
+    gtk_style_context_add_provider(context, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+
+    // Show all widgets in the description window
+    gtk_widget_show_all(description_window);
+}
+
+
+
+
+void on_back_button_clicked(GtkWidget *button, gpointer data)
+{
+    // Clear main grid
+    GList *children, *iter;
+    children = gtk_container_get_children(GTK_CONTAINER(main_grid));
+    for (iter = children; iter != NULL; iter = g_list_next(iter))
+    {
+        gtk_widget_destroy(GTK_WIDGET(iter->data));
+    }
+    g_list_free(children);
+
+    // Recreate the main menu layout
+    // Create a heading label
+    // Create a heading label with custom CSS styling
+	GtkWidget *heading_label = gtk_label_new(NULL);
+	gtk_label_set_markup(GTK_LABEL(heading_label), "<span font_desc='30' foreground='#FFFFFF'>OS Project By Hira Sardar and Sarmad Sultan</span>");
+	gtk_grid_attach(GTK_GRID(main_grid), heading_label, 0, 0, 2, 1);
+
+    // Create buttons for Folder1 and Folder2
+    GtkWidget *button1 = gtk_button_new_with_label("Folder1");
+    gtk_widget_set_name(button1, "Folder1");
+    g_signal_connect(button1, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
+    gtk_grid_attach(GTK_GRID(main_grid), button1, 0, 1, 1, 1);
+
+    GtkWidget *button2 = gtk_button_new_with_label("Folder2");
+    gtk_widget_set_name(button2, "Folder2");
+    g_signal_connect(button2, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
+    gtk_grid_attach(GTK_GRID(main_grid), button2, 1, 1, 1, 1);
+    
+    GtkWidget *button3 = gtk_button_new_with_label("Description");
+    gtk_widget_set_name(button2, "Description");
+    g_signal_connect(button2, "clicked", G_CALLBACK(on_description_button_clicked), NULL);
+    gtk_grid_attach(GTK_GRID(main_grid), button3, 2, 1, 1, 1);
+    
+    // Load CSS provider and apply styles to the window
+    GtkCssProvider *provider = gtk_css_provider_new();
+    gtk_css_provider_load_from_data(provider,
+                                    "window { background-color: #800020; }", // Vine red background color
+                                    -1,
+                                    NULL);
+
+    // Apply the CSS provider to the window's style context
+    GtkStyleContext *context = gtk_widget_get_style_context(window);
+    gtk_style_context_add_provider(context, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+
+    gtk_widget_show_all(window);
+}
+
+// Function to start the selected transfer engine, falling back to the FIFO engine
+// when io_uring is not compiled in or not usable on this kernel
+void start_transfer_engine()
+{
+    if (transfer_engine != TRANSFER_ENGINE_URING)
+        return;
+    if (verify_transfers)
+    {
+        fprintf(stderr, "--verify checksums both ends of the FIFO engine; using it instead of io_uring\n");
+        transfer_engine = TRANSFER_ENGINE_FIFO;
+        return;
+    }
+#ifdef HAVE_LIBURING
+    if (uring_engine_start() == 0)
+    {
+        printf("Using the io_uring transfer engine\n");
+        return;
+    }
+#else
+    fprintf(stderr, "This build has no io_uring support (rebuild with -DHAVE_LIBURING -luring)\n");
+#endif
+    fprintf(stderr, "Falling back to the FIFO transfer engine\n");
+    transfer_engine = TRANSFER_ENGINE_FIFO;
+}
+
+// Function to stop the transfer engine once the worker pool has drained
+void stop_transfer_engine()
+{
+#ifdef HAVE_LIBURING
+    if (transfer_engine == TRANSFER_ENGINE_URING)
+        uring_engine_stop();
+#endif
+}
+
+// Function to print the command line usage
+void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]                                 (GUI)\n"
+            "       %s --cli --from=DIR --to=DIR [options] FILE...  (headless transfer)\n"
+            "       %s --cli --sync --from=DIR --to=DIR [options]   (mirror DIR into DIR)\n"
+            "       %s --cli --from=DIR --remote=HOST:PORT [options] FILE...  (send to a daemon)\n"
+            "       %s --serve=[HOST:]PORT --to=DIR                (receiving daemon)\n"
+            "       %s --bench [bench options] [options]          (benchmark)\n"
+            "Options:\n"
+            "       [--engine=fifo|uring] [--transport=fifo|shm]\n"
+            "       [--copy-mode=splice|buffered] [--workers=N] [--buffer-size=KB|auto]\n"
+            "       [--large-file-threshold=MB] [--chunk-size=MB] [--cache-mode=normal|stream|direct]\n"
+            "       [--metrics=FILE] [--metrics-interval=MS] [--verify] [--dedup]\n"
+            "       [--small-file-threshold=MB] [--limit-total=MB/s] [--limit-batch=MB/s]\n"
+            "       [--control=FILE] [--urgent=FILE] (--cli: send FILE before the rest)\n"
+            "       [--compress=off|auto|zstd|lz4] [--compress-level=N] [--compress-threads=N] (--remote only)\n"
+            "       [--zerocopy] (--remote: send with MSG_ZEROCOPY instead of sendfile)\n"
+            "       [--playable] (MP4/MPEG-TS files can be played while they arrive)\n"
+            "       [--trace=FILE] (record a Chrome/Perfetto trace; SIGUSR1 writes it, or starts one)\n"
+            "Bench options:\n"
+            "       [--bench-dir=DIR] [--bench-sizes=MB,...] [--bench-files=N]\n"
+            "       [--bench-buffers=KB,...] [--bench-workers=N,...] [--bench-output=FILE]\n"
+            "       [--bench-hot-set=MB]\n",
+            program, program, program, program, program, program);
+}
+
+// Function to return the default worker pool size: one worker per online CPU
+int default_worker_count()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Functions to name the active transfer configuration in logs and benchmark results
+const char *transfer_engine_name()
+{
+    if (remote_address)
+        return "tcp";
+    return transfer_engine == TRANSFER_ENGINE_URING ? "uring" : "fifo";
+}
+
+const char *transfer_transport_name()
+{
+    if (remote_address)
+        return "tcp";
+    return transfer_transport == TRANSFER_TRANSPORT_SHM ? "shm" : "fifo";
+}
+
+const char *transfer_mode_name()
+{
+    // Checksums need the data in user space, so --verify always copies through a buffer.
+    // The receiver of --cache-mode=direct does too, while its sender still splices
+    if (remote_address)
+        return net_zerocopy ? "zerocopy" : "sendfile";
+    if (transfer_mode != TRANSFER_MODE_SPLICE || verify_transfers)
+        return "buffered";
+    return cache_mode == CACHE_MODE_DIRECT ? "splice/buffered" : "splice";
+}
+
+const char *cache_mode_name()
+{
+    return cache_mode == CACHE_MODE_DIRECT ? "direct" : cache_mode == CACHE_MODE_STREAM ? "stream" : "normal";
+}
+
+// Function to transfer the files named on the command line without the GUI
+// Returns the process exit status
+int run_cli()
+{
+    if (cli_source_dir == NULL || (cli_dest_dir == NULL && remote_address == NULL) ||
+        (num_cli_files == 0) != (sync_mode != 0))
+    {
+        fprintf(stderr, "--cli needs --from=DIR, --to=DIR or --remote=HOST:PORT, and either at least one file or --sync\n");
+        return EXIT_FAILURE;
+    }
+    if (remote_address)
+    {
+        // The daemon only stores what it is sent; these need both folders on this host
+        if (sync_mode || verify_transfers || dedup_transfers)
+        {
+            fprintf(stderr, "--remote cannot be combined with --sync, --verify or --dedup\n");
+            return EXIT_FAILURE;
+        }
+        if (net_resolve(remote_address, 0, &remote_addrinfo) == -1)
+            return EXIT_FAILURE;
+        transfer_engine = TRANSFER_ENGINE_FIFO;
+
+        // Ids name the daemon's partial files, so two senders must not start from the same one
+        atomic_store(&net_next_id, ((uint64_t)getpid() << 40) ^ ((uint64_t)time(NULL) << 8));
+    }
+
+    // Add up the input so the summary can report throughput
+    long long total_bytes = 0;
+    for (int i = 0; i < num_cli_files; i++)
+    {
+        char full_file_path[MAX_PATH_LENGTH];
+        struct stat st;
+        snprintf(full_file_path, sizeof(full_file_path), "%s/%s", cli_source_dir, cli_files[i]);
+        if (stat(full_file_path, &st) == 0)
+            total_bytes += st.st_size;
+    }
+
+    transfer_pool_start(num_transfer_workers);
+    start_transfer_engine();
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    struct TransferBatch *batch = transfer_batch_new(0);
+    if (batch == NULL)
+    {
+        transfer_pool_stop();
+        stop_transfer_engine();
+        return EXIT_FAILURE;
+    }
+    struct SyncStats sync_stats = {0};
+    int sync_failed = 0;
+    if (sync_mode)
+    {
+        batch->sync = 1;
+        trace_stage_begin("scan folders", cli_source_dir);
+        sync_failed = sync_directories(batch, cli_source_dir, cli_dest_dir, &sync_stats) == -1;
+        trace_stage_end();
+        total_bytes = sync_stats.bytes;
+    }
+    for (int i = 0; i < num_cli_files; i++)
+    {
+        struct FileInfo file_info = {0};
+        file_info.index = i;
+        snprintf(file_info.filename, sizeof(file_info.filename), "%s", cli_files[i]);
+        file_info.urgent = cli_urgent[i];
+        transfer_batch_add(batch, &file_info, cli_source_dir, remote_address ? remote_address : cli_dest_dir);
+    }
+    transfer_batch_close(batch);
+    int success = transfer_batch_wait(batch);
+    double seconds = elapsed_seconds(&start_time);
+
+    printf("%d of %d file(s) transferred: %lld bytes in %.3f s (%.2f MB/s, engine %s, transport %s, copy mode %s)\n",
+           batch->total - batch->failed, batch->total, total_bytes, seconds,
+           seconds > 0 ? total_bytes / seconds / (1024.0 * 1024.0) : 0.0,
+           transfer_engine_name(), transfer_transport_name(), transfer_mode_name());
+    if (verify_transfers)
+        printf("Checksums took %.3f s of CPU time (%.1f%% of the transfer time)\n",
+               atomic_load(&checksum_ns) / 1e9, seconds > 0 ? atomic_load(&checksum_ns) / 1e9 / seconds * 100 : 0.0);
+    if (sync_mode)
+        printf("Sync: %d file(s) in %d folder(s) checked, %d new, %d changed (%lld of them with identical contents), "
+               "%d unchanged\n",
+               sync_stats.files, sync_stats.folders, sync_stats.added, sync_stats.changed, atomic_load(&sync_identical),
+               sync_stats.unchanged);
+    if (playable_transfers && atomic_load(&playable_files) > 0)
+        printf("Playable: %lld video file(s) could be opened after %.3f s on average, %lld with the MP4 index moved "
+               "to the front\n",
+               atomic_load(&playable_files), atomic_load(&playable_head_ns) / 1e9 / atomic_load(&playable_files),
+               atomic_load(&playable_moved_moov));
+    if (compress_codec != CODEC_NONE)
+    {
+        long long raw = atomic_load(&compress_raw_bytes), wire = atomic_load(&compress_wire_bytes);
+        double pack_seconds = atomic_load(&compress_pack_ns) / 1e9;
+        printf("Compression (%s): %lld of %d file(s), %lld bytes sent as %lld (%.2f:1), %.3f s of CPU time compressing "
+               "(%.1f MB/s per core)\n",
+               codec_name(compress_codec), atomic_load(&compress_files), batch->total, raw, wire,
+               wire > 0 ? (double)raw / wire : 1.0, pack_seconds,
+               pack_seconds > 0 ? raw / pack_seconds / (1024.0 * 1024.0) : 0.0);
+    }
+    if (!success)
+        fprintf(stderr, "Failed: %s\n", batch->failed_files);
+    transfer_batch_free(batch);
+
+    transfer_pool_stop();
+    stop_transfer_engine();
+    if (net_zerocopy && atomic_load(&net_zerocopy_copied))
+        printf("MSG_ZEROCOPY: the kernel copied the data anyway (loopback, or no NIC support)\n");
+    if (remote_addrinfo)
+        freeaddrinfo(remote_addrinfo);
+    return success && !sync_failed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Function to parse a comma separated list of positive numbers into values
+// Returns the number of values stored
+int parse_number_list(const char *list, long long *values, int max_values)
+{
+    int count = 0;
+    const char *p = list;
+    while (*p && count < max_values)
+    {
+        char *end;
+        long long value = strtoll(p, &end, 10);
+        if (end == p || value <= 0)
+            break;
+        values[count++] = value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+// Function to create (or reuse) a benchmark input file of size bytes filled with
+// incompressible pseudo-random data
+// Returns 0 on success, -1 on failure
+int create_bench_file(const char *path, long long size)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size == size)
+        return 0;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        perror("Error creating benchmark file");
+        return -1;
+    }
+    uint64_t *block = malloc(BENCH_FILL_BLOCK_SIZE);
+    if (block == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)size;
+    long long written = 0;
+    int result = 0;
+    while (written < size)
+    {
+        for (size_t i = 0; i < BENCH_FILL_BLOCK_SIZE / sizeof(uint64_t); i++)
+        {
+            // xorshift64
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            block[i] = state;
+        }
+        size_t want = size - written < BENCH_FILL_BLOCK_SIZE ? (size_t)(size - written) : BENCH_FILL_BLOCK_SIZE;
+        if (write(fd, block, want) != (ssize_t)want)
+        {
+            perror("Error writing benchmark file");
+            result = -1;
+            break;
+        }
+        written += want;
+    }
+    free(block);
+    if (close(fd) == -1)
+        result = -1;
+    return result;
+}
+
+// Function to delete every file in dirname, used to reset the benchmark destination
+void empty_directory(const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if (dir == NULL)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+            unlinkat(dirfd(dir), ent->d_name, 0);
+    }
+    closedir(dir);
+}
+
+// Function to compare two doubles for qsort()
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Function to read the amount of dirty page cache from /proc/meminfo
+// Returns it in KB, or -1 if it could not be read
+long long meminfo_dirty_kb()
+{
+    FILE *file = fopen("/proc/meminfo", "r");
+    if (file == NULL)
+        return -1;
+    char line[128];
+    long long dirty = -1;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "Dirty: %lld kB", &dirty) == 1)
+            break;
+    }
+    fclose(file);
+    return dirty;
+}
+
+// Probe thread of --bench-hot-set: reads a random block of the working set every
+// millisecond, timing each read, and tracks the peak of dirty memory
+void *bench_probe_thread(void *arg)
+{
+    struct BenchProbe *probe = (struct BenchProbe *)arg;
+    trace_thread_name("bench probe");
+    unsigned char *buffer = buffer_pool_get(BENCH_PROBE_BLOCK_SIZE);
+    unsigned int seed = 1;
+    long long blocks = probe->size / BENCH_PROBE_BLOCK_SIZE;
+    long long next_sample_ns = 0;
+    struct timespec interval = {0, 1000000};
+    while (buffer && blocks > 0 && !atomic_load(&probe->stop))
+    {
+        long long t0 = now_ns();
+        if (pread(probe->fd, buffer, BENCH_PROBE_BLOCK_SIZE, (rand_r(&seed) % blocks) * BENCH_PROBE_BLOCK_SIZE) > 0 &&
+            probe->num_latencies < BENCH_PROBE_MAX_SAMPLES)
+            probe->latencies[probe->num_latencies++] = (now_ns() - t0) / 1e6;
+        if (t0 >= next_sample_ns)
+        {
+            long long dirty = meminfo_dirty_kb();
+            if (dirty > probe->peak_dirty_kb)
+                probe->peak_dirty_kb = dirty;
+            next_sample_ns = t0 + 10000000;
+        }
+        nanosleep(&interval, NULL);
+    }
+    buffer_pool_put(buffer, BENCH_PROBE_BLOCK_SIZE);
+    return NULL;
+}
+
+// Function to find how much of a file is in the page cache
+// Returns the percentage of its pages that are resident, or -1 on error
+double file_resident_percent(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t pages = (st.st_size + page_size - 1) / page_size;
+    unsigned char *resident = malloc(pages);
+    double percent = -1;
+    if (map != MAP_FAILED && resident && mincore(map, st.st_size, resident) == 0)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < pages; i++)
+            count += resident[i] & 1;
+        percent = 100.0 * count / pages;
+    }
+    free(resident);
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+    return percent;
+}
+
+// Function to run the transfer benchmark and write one JSON object per run
+// Every combination of file size, buffer size and worker count is measured with
+// the engine, transport and copy mode given on the command line
+// Returns the process exit status
+int run_benchmark()
+{
+    long long sizes[BENCH_MAX_VALUES], buffers[BENCH_MAX_VALUES], workers[BENCH_MAX_VALUES];
+    int num_sizes = parse_number_list(bench_sizes, sizes, BENCH_MAX_VALUES);
+    int num_buffers = parse_number_list(bench_buffers, buffers, BENCH_MAX_VALUES);
+    int num_workers = parse_number_list(bench_workers, workers, BENCH_MAX_VALUES);
+    if (num_sizes == 0 || num_buffers == 0 || num_workers == 0)
+    {
+        fprintf(stderr, "Invalid --bench-sizes, --bench-buffers or --bench-workers list\n");
+        return EXIT_FAILURE;
+    }
+
+    // The sweep compares block sizes, which chunked copies do not use,
+    // so files are only chunked when --large-file-threshold asks for it
+    if (!large_file_threshold_set)
+        large_file_threshold = LLONG_MAX;
+
+    char source_dir[MAX_PATH_LENGTH], dest_dir[MAX_PATH_LENGTH];
+    snprintf(source_dir, sizeof(source_dir), "%s/src", bench_dir);
+    snprintf(dest_dir, sizeof(dest_dir), "%s/dst", bench_dir);
+    mkdir(bench_dir, 0777);
+    mkdir(source_dir, 0777);
+    mkdir(dest_dir, 0777);
+
+    // Generate the synthetic videos once; later runs reuse them
+    for (int s = 0; s < num_sizes; s++)
+    {
+        for (int i = 0; i < bench_files_per_size; i++)
+        {
+            char path[MAX_PATH_LENGTH];
+            if (format_path(path, sizeof(path), "%s/bench_%lldMB_%d.bin", source_dir, sizes[s], i) == -1)
+            {
+                perror("Error creating benchmark file");
+                return EXIT_FAILURE;
+            }
+            fprintf(stderr, "Preparing %s\n", path);
+            if (create_bench_file(path, sizes[s] * 1024 * 1024) == -1)
+                return EXIT_FAILURE;
+        }
+    }
+
+    FILE *output = stdout;
+    if (bench_output && (output = fopen(bench_output, "w")) == NULL)
+    {
+        perror("Error opening benchmark output");
+        return EXIT_FAILURE;
+    }
+
+    double *latencies = calloc(bench_files_per_size, sizeof(double));
+    if (latencies == NULL)
+        return EXIT_FAILURE;
+
+    // The working set of the concurrent probe, which the copies should leave in the page cache
+    char hot_set_path[MAX_PATH_LENGTH];
+    struct BenchProbe probe = {0};
+    probe.fd = -1;
+    snprintf(hot_set_path, sizeof(hot_set_path), "%s/hot_set.bin", bench_dir);
+    if (bench_hot_set_mb > 0)
+    {
+        probe.size = (long long)bench_hot_set_mb * 1024 * 1024;
+        if (create_bench_file(hot_set_path, probe.size) == -1 || (probe.fd = open(hot_set_path, O_RDONLY)) == -1 ||
+            (probe.latencies = malloc(BENCH_PROBE_MAX_SAMPLES * sizeof(double))) == NULL)
+            return EXIT_FAILURE;
+    }
+    int requested_engine = transfer_engine;
+    int status = EXIT_SUCCESS;
+    for (int s = 0; s < num_sizes; s++)
+    {
+        for (int b = 0; b < num_buffers; b++)
+        {
+            for (int w = 0; w < num_workers; w++)
+            {
+                empty_directory(dest_dir);
+                transfer_buffer_size = buffers[b] * 1024 < MAX_BUFFER_SIZE ? buffers[b] * 1024 : MAX_BUFFER_SIZE;
+                atomic_store(&adaptive_block_hint, 0); // Adaptive runs start from their buffer size
+                transfer_engine = requested_engine;
+                transfer_pool_start((int)workers[w]);
+                start_transfer_engine();
+
+                struct TransferBatch *batch = transfer_batch_new(0);
+                if (batch == NULL)
+                {
+                    transfer_pool_stop();
+                    stop_transfer_engine();
+                    return EXIT_FAILURE;
+                }
+                batch->latencies = latencies;
+
+                // Warm the working set up, then keep reading it while the files are copied
+                if (probe.fd != -1)
+                {
+                    unsigned char *block = buffer_pool_get(BENCH_FILL_BLOCK_SIZE);
+                    for (long long offset = 0; block && offset < probe.size; offset += BENCH_FILL_BLOCK_SIZE)
+                    {
+                        if (pread(probe.fd, block, BENCH_FILL_BLOCK_SIZE, offset) <= 0)
+                            break;
+                    }
+                    buffer_pool_put(block, BENCH_FILL_BLOCK_SIZE);
+                    probe.num_latencies = 0;
+                    probe.peak_dirty_kb = meminfo_dirty_kb();
+                    atomic_store(&probe.stop, 0);
+                    if (pthread_create(&probe.thread, NULL, bench_probe_thread, &probe) != 0)
+                    {
+                        transfer_batch_free(batch);
+                        transfer_pool_stop();
+                        stop_transfer_engine();
+                        return EXIT_FAILURE;
+                    }
+                }
+
+                struct rusage usage_before, usage_after;
+                long long syscalls_before = atomic_load(&io_syscall_count);
+                long long checksum_before = atomic_load(&checksum_ns);
+                long long chunked_before = atomic_load(&chunked_files);
+                getrusage(RUSAGE_SELF, &usage_before);
+                struct timespec start_time;
+                clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+                for (int i = 0; i < bench_files_per_size; i++)
+                {
+                    struct FileInfo file_info = {0};
+                    file_info.index = i;
+                    snprintf(file_info.filename, sizeof(file_info.filename), "bench_%lldMB_%d.bin", sizes[s], i);
+                    transfer_batch_add(batch, &file_info, source_dir, dest_dir);
+                }
+                transfer_batch_close(batch);
+                int success = transfer_batch_wait(batch);
+
+                double seconds = elapsed_seconds(&start_time);
+                getrusage(RUSAGE_SELF, &usage_after);
+                long long syscalls = atomic_load(&io_syscall_count) - syscalls_before;
+                transfer_pool_stop();
+                stop_transfer_engine();
+
+                double probe_p99 = 0.0, hot_set_resident = 0.0;
+                if (probe.fd != -1)
+                {
+                    atomic_store(&probe.stop, 1);
+                    pthread_join(probe.thread, NULL);
+                    qsort(probe.latencies, probe.num_latencies, sizeof(double), compare_doubles);
+                    if (probe.num_latencies)
+                        probe_p99 = probe.latencies[(int)((probe.num_latencies - 1) * 0.99 + 0.5)];
+                    hot_set_resident = file_resident_percent(hot_set_path);
+                }
+
+                qsort(batch->latencies, batch->num_latencies, sizeof(double), compare_doubles);
+                int n = batch->num_latencies;
+                double p50 = n ? batch->latencies[(n - 1) / 2] : 0.0;
+                double p99 = n ? batch->latencies[(int)((n - 1) * 0.99 + 0.5)] : 0.0;
+                long long bytes = sizes[s] * 1024 * 1024 * bench_files_per_size;
+                double user_seconds = (usage_after.ru_utime.tv_sec - usage_before.ru_utime.tv_sec) +
+                                      (usage_after.ru_utime.tv_usec - usage_before.ru_utime.tv_usec) / 1e6;
+                double system_seconds = (usage_after.ru_stime.tv_sec - usage_before.ru_stime.tv_sec) +
+                                        (usage_after.ru_stime.tv_usec - usage_before.ru_stime.tv_usec) / 1e6;
+
+                fprintf(output,
+                        "{\"engine\":\"%s\",\"transport\":\"%s\",\"copy_mode\":\"%s\",\"file_size\":%lld,"
+                        "\"files\":%d,\"buffer_size\":%zu,\"workers\":%lld,\"success\":%s,\"bytes\":%lld,"
+                        "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,"
+                        "\"cpu_user_s\":%.6f,\"cpu_system_s\":%.6f,\"io_syscalls\":%lld,"
+                        "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld,\"verify\":%s,\"checksum_s\":%.6f,\"adaptive_buffers\":%s,"
+                        "\"cache_mode\":\"%s\",\"hot_set_mb\":%d,\"probe_reads\":%d,\"probe_p99_ms\":%.3f,"
+                        "\"hot_set_resident_pct\":%.1f,\"peak_dirty_kb\":%lld,\"chunked_files\":%lld}\n",
+                        transfer_engine_name(), transfer_transport_name(), transfer_mode_name(), sizes[s] * 1024 * 1024,
+                        bench_files_per_size, transfer_buffer_size, workers[w], success ? "true" : "false", bytes,
+                        seconds, seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0.0, p50 * 1000, p99 * 1000,
+                        user_seconds, system_seconds, syscalls,
+                        usage_after.ru_nvcsw - usage_before.ru_nvcsw, usage_after.ru_nivcsw - usage_before.ru_nivcsw,
+                        verify_transfers ? "true" : "false", (atomic_load(&checksum_ns) - checksum_before) / 1e9,
+                        adaptive_buffers ? "true" : "false", cache_mode_name(), bench_hot_set_mb,
+                        probe.num_latencies, probe_p99, hot_set_resident, probe.peak_dirty_kb,
+                        atomic_load(&chunked_files) - chunked_before);
+                fflush(output);
+                transfer_batch_free(batch);
+                if (!success)
+                    status = EXIT_FAILURE;
+            }
+        }
+    }
+
+    empty_directory(dest_dir);
+    free(latencies);
+    free(probe.latencies);
+    if (probe.fd != -1)
+        close(probe.fd);
+    if (output != stdout)
+        fclose(output);
+    return status;
+}
+
+// Function to apply the command line options left over after gtk_init()
+void parse_options(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cli") == 0)
+        {
+            run_mode = RUN_MODE_CLI;
+        }
+        else if (strcmp(argv[i], "--bench") == 0)
+        {
+            run_mode = RUN_MODE_BENCH;
+        }
+        else if (strncmp(argv[i], "--serve=", 8) == 0)
+        {
+            run_mode = RUN_MODE_SERVE;
+            serve_address = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--remote=", 9) == 0)
+        {
+            remote_address = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--zerocopy") == 0)
+        {
+            net_zerocopy = 1;
+        }
+        else if (strcmp(argv[i], "--playable") == 0)
+        {
+            playable_transfers = 1;
+        }
+        else if (strncmp(argv[i], "--from=", 7) == 0)
+        {
+            cli_source_dir = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--to=", 5) == 0)
+        {
+            cli_dest_dir = argv[i] + 5;
+        }
+        else if (strncmp(argv[i], "--buffer-size=", 14) == 0 && atoll(argv[i] + 14) > 0)
+        {
+            long long size = atoll(argv[i] + 14) * 1024;
+            transfer_buffer_size = size < MAX_BUFFER_SIZE ? size : MAX_BUFFER_SIZE;
+        }
+        else if (strcmp(argv[i], "--buffer-size=auto") == 0)
+        {
+            adaptive_buffers = 1;
+            transfer_buffer_size = ADAPTIVE_BLOCK_START;
+        }
+        else if (strcmp(argv[i], "--cache-mode=normal") == 0)
+        {
+            cache_mode = CACHE_MODE_NORMAL;
+        }
+        else if (strcmp(argv[i], "--cache-mode=stream") == 0)
+        {
+            cache_mode = CACHE_MODE_STREAM;
+        }
+        else if (strcmp(argv[i], "--cache-mode=direct") == 0)
+        {
+            cache_mode = CACHE_MODE_DIRECT;
+        }
+        else if (strncmp(argv[i], "--metrics=", 10) == 0)
+        {
+            metrics_path = argv[i] + 10;
+        }
+        else if (strncmp(argv[i], "--metrics-interval=", 19) == 0 && atoi(argv[i] + 19) > 0)
+        {
+            metrics_interval_ms = atoi(argv[i] + 19);
+        }
+        else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8])
+        {
+            trace_path = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--bench-dir=", 12) == 0)
+        {
+            bench_dir = argv[i] + 12;
+        }
+        else if (strncmp(argv[i], "--bench-sizes=", 14) == 0)
+        {
+            bench_sizes = argv[i] + 14;
+        }
+        else if (strncmp(argv[i], "--bench-files=", 14) == 0 && atoi(argv[i] + 14) > 0)
+        {
+            bench_files_per_size = atoi(argv[i] + 14);
+        }
+        else if (strncmp(argv[i], "--bench-hot-set=", 16) == 0 && atoi(argv[i] + 16) > 0)
+        {
+            bench_hot_set_mb = atoi(argv[i] + 16);
+        }
+        else if (strncmp(argv[i], "--bench-buffers=", 16) == 0)
+        {
+            bench_buffers = argv[i] + 16;
+        }
+        else if (strncmp(argv[i], "--bench-workers=", 16) == 0)
+        {
+            bench_workers = argv[i] + 16;
+        }
+        else if (strncmp(argv[i], "--bench-output=", 15) == 0)
+        {
+            bench_output = argv[i] + 15;
+        }
+        else if (strncmp(argv[i], "--urgent=", 9) == 0)
+        {
+            if (num_cli_files < MAX_CLI_FILES)
+            {
+                cli_urgent[num_cli_files] = 1;
+                cli_files[num_cli_files++] = argv[i] + 9;
+            }
+        }
+        else if (argv[i][0] != '-')
+        {
+            // Files to transfer in --cli mode
+            if (num_cli_files < MAX_CLI_FILES)
+                cli_files[num_cli_files++] = argv[i];
+        }
+        else if (strcmp(argv[i], "--copy-mode=splice") == 0)
+        {
+            transfer_mode = TRANSFER_MODE_SPLICE;
+        }
+        else if (strcmp(argv[i], "--copy-mode=buffered") == 0)
+        {
+            transfer_mode = TRANSFER_MODE_BUFFERED;
+        }
+        else if (strncmp(argv[i], "--workers=", 10) == 0 && atoi(argv[i] + 10) > 0)
+        {
+            num_transfer_workers = atoi(argv[i] + 10);
+        }
+        else if (strcmp(argv[i], "--transport=fifo") == 0)
+        {
+            transfer_transport = TRANSFER_TRANSPORT_FIFO;
+        }
+        else if (strcmp(argv[i], "--transport=shm") == 0)
+        {
+            transfer_transport = TRANSFER_TRANSPORT_SHM;
+        }
+        else if (strcmp(argv[i], "--engine=fifo") == 0)
+        {
+            transfer_engine = TRANSFER_ENGINE_FIFO;
+        }
+        else if (strcmp(argv[i], "--engine=uring") == 0)
+        {
+            transfer_engine = TRANSFER_ENGINE_URING;
+        }
+        else if (strncmp(argv[i], "--large-file-threshold=", 23) == 0 && atoll(argv[i] + 23) > 0)
+        {
+            large_file_threshold = atoll(argv[i] + 23) * 1024 * 1024;
+            large_file_threshold_set = 1;
+        }
+        else if (strncmp(argv[i], "--chunk-size=", 13) == 0 && atoll(argv[i] + 13) > 0)
+        {
+            chunk_size = atoll(argv[i] + 13) * 1024 * 1024;
+        }
+        else if (strncmp(argv[i], "--small-file-threshold=", 23) == 0 && atoll(argv[i] + 23) >= 0)
+        {
+            small_file_threshold = atoll(argv[i] + 23) * 1024 * 1024;
+        }
+        else if (strncmp(argv[i], "--limit-total=", 14) == 0 && atof(argv[i] + 14) >= 0)
+        {
+            atomic_store(&total_rate_limit, (long long)(atof(argv[i] + 14) * 1024 * 1024));
+        }
+        else if (strncmp(argv[i], "--limit-batch=", 14) == 0 && atof(argv[i] + 14) >= 0)
+        {
+            atomic_store(&batch_rate_limit, (long long)(atof(argv[i] + 14) * 1024 * 1024));
+        }
+        else if (strncmp(argv[i], "--control=", 10) == 0)
+        {
+            control_path = argv[i] + 10;
+        }
+        else if (strncmp(argv[i], "--compress=", 11) == 0 && compress_select(argv[i] + 11) == 0)
+        {
+            // compress_select() applied it
+        }
+        else if (strncmp(argv[i], "--compress-level=", 17) == 0)
+        {
+            compress_level = atoi(argv[i] + 17);
+        }
+        else if (strncmp(argv[i], "--compress-threads=", 19) == 0 && atoi(argv[i] + 19) > 0)
+        {
+            compress_threads = atoi(argv[i] + 19);
+        }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            verify_transfers = 1;
+        }
+        else if (strcmp(argv[i], "--dedup") == 0)
+        {
+            dedup_transfers = 1;
+        }
+        else if (strcmp(argv[i], "--sync") == 0)
+        {
+            sync_mode = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Compressing and decompressing on the same host costs more CPU than it saves
+    if (compress_codec != CODEC_NONE && remote_address == NULL)
+    {
+        fprintf(stderr, "--compress only applies to --remote; local copies are sent as they are\n");
+        compress_codec = CODEC_NONE;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    trace_signals_start();
+    crc32c_init();
+
+    // The command line, daemon and benchmark modes run without GTK or a display
+    if (argc > 1 && (strcmp(argv[1], "--cli") == 0 || strcmp(argv[1], "--bench") == 0 || strncmp(argv[1], "--serve=", 8) == 0))
+    {
+        parse_options(argc, argv);
+        if (trace_path)
+            trace_enable();
+        if (remote_address && run_mode != RUN_MODE_CLI)
+        {
+            fprintf(stderr, "--remote only works with --cli\n");
+            return EXIT_FAILURE;
+        }
+        if (num_transfer_workers == 0)
+            num_transfer_workers = default_worker_count();
+        quiet_transfers = run_mode == RUN_MODE_BENCH;
+        if (metrics_path || control_path)
+            progress_monitor_start();
+        int status = run_mode == RUN_MODE_BENCH ? run_benchmark() : run_mode == RUN_MODE_SERVE ? run_server() : run_cli();
+        progress_monitor_stop_and_join();
+        trace_finish();
+        return status;
+    }
+
+    // Initialize GTK
+gtk_init(&argc, &argv);
+parse_options(argc, argv);
+if (run_mode != RUN_MODE_GUI || num_cli_files > 0 || remote_address)
+{
+    fprintf(stderr, "--cli, --serve and --bench must be the first argument\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+}
+if (trace_path)
+{
+    trace_enable();
+}
+
+// Start the transfer workers; by default one per online CPU
+if (num_transfer_workers == 0)
+{
+    num_transfer_workers = default_worker_count();
+}
+transfer_pool_start(num_transfer_workers);
+start_transfer_engine();
+
+// Index both folders once; inotify keeps the listings current from then on
+directory_watch_start();
+
+// Track transfer rates for the progress bars and the optional metrics file
+progress_monitor_start();
+g_timeout_add(PROGRESS_REFRESH_MS, on_progress_timer, NULL);
+
+// Create the main window
+window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+gtk_window_set_title(GTK_WINDOW(window), "File Transfer Program");
+gtk_window_set_default_size(GTK_WINDOW(window), 600, 500);
+g_signal_connect(window, "delete-event", G_CALLBACK(on_window_delete_event), NULL);
+
+// Create a main grid
+main_grid = gtk_grid_new();
+gtk_grid_set_column_homogeneous(GTK_GRID(main_grid), TRUE);
+gtk_grid_set_row_homogeneous(GTK_GRID(main_grid), TRUE);
+gtk_container_add(GTK_CONTAINER(window), main_grid);
+
+// Create a heading label
+GtkWidget *heading_label = gtk_label_new(NULL);
+gtk_label_set_markup(GTK_LABEL(heading_label), "<span font_desc='38' foreground='#FFFFFF'>End Semester Project By Hira Sardar and Sarmad Sultan!!</span>");
+gtk_grid_attach(GTK_GRID(main_grid), heading_label, 0, 0, 2, 1);
+
+// Create a choice label
+GtkWidget *choice_label = gtk_label_new(NULL);
+gtk_label_set_markup(GTK_LABEL(choice_label), "<span font_desc='30' foreground='#FFFFFF'>Choose the source folder to move files or click 'Description' to read details!!</span>");
+gtk_grid_attach(GTK_GRID(main_grid), choice_label, 0, 1, 2, 1);
+
+// Create buttons for Folder1 and Folder2
+GtkWidget *button1 = gtk_button_new_with_label("Folder1");
+gtk_widget_set_name(button1, "Folder1");
+g_signal_connect(button1, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
+gtk_grid_attach(GTK_GRID(main_grid), button1, 0, 2, 1, 1);
+
+GtkWidget *button2 = gtk_button_new_with_label("Folder2");
+gtk_widget_set_name(button2, "Folder2");
+g_signal_connect(button2, "clicked", G_CALLBACK(on_folder_button_clicked), NULL);
+gtk_grid_attach(GTK_GRID(main_grid), button2, 1, 2, 1, 1);
+
+GtkWidget *button3 = gtk_button_new_with_label("Description");
+gtk_widget_set_name(button3, "Description");
+g_signal_connect(button3, "clicked", G_CALLBACK(on_description_button_clicked), NULL);
+gtk_grid_attach(GTK_GRID(main_grid), button3, 2, 2, 1, 1);
+
+// Load CSS provider and apply styles to the window
+GtkCssProvider *provider = gtk_css_provider_new();
+gtk_css_provider_load_from_data(provider,
+                                "window { background-color: #800020; }", // Vine red background color
+                                -1,
+                                NULL);
+
+// Apply the CSS provider to the window's style context
+GtkStyleContext *context = gtk_widget_get_style_context(window);
+gtk_style_context_add_provider(context, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+
+// Show all widgets in the main window
+gtk_widget_show_all(window);
+
+// Start the GTK main loop
+gtk_main();
+
+// Let queued transfers finish before exiting
+transfer_pool_stop();
+stop_transfer_engine();
+progress_monitor_stop_and_join();
+trace_finish();
+
+return 0;
+
+}
+
@@ -0,0 +1,67 @@
+// Unit tests of --buffer-size=auto, included by unit_tests.c
+
+// Function to feed the sizer one measurement window in which the link moved
+// target_bytes in ADAPTIVE_BLOCK_TARGET_NS, and return the block size it picked
+size_t block_sizer_window(struct BlockSizer *sizer, long long target_bytes)
+{
+    long long window_bytes = target_bytes * (ADAPTIVE_WINDOW_NS / ADAPTIVE_BLOCK_TARGET_NS);
+    sizer->window_start_ns = now_ns() - ADAPTIVE_WINDOW_NS;
+    for (int i = 0; i < ADAPTIVE_WINDOW_BLOCKS; i++)
+        block_sizer_update(sizer, window_bytes / ADAPTIVE_WINDOW_BLOCKS);
+    return sizer->size;
+}
+
+// Test: each window doubles or halves the block towards what the link moves in
+// about 2 ms, within 16 KB..4 MB, and the next file starts from where the last ended
+void test_block_sizer()
+{
+    adaptive_buffers = 1;
+    transfer_buffer_size = ADAPTIVE_BLOCK_START;
+    atomic_store(&adaptive_block_hint, 0);
+    struct BlockSizer sizer;
+    block_sizer_start(&sizer, BUFFER_SIZE);
+    CHECK(sizer.size == ADAPTIVE_BLOCK_START);
+
+    // A window is only over after enough blocks and enough time
+    for (int i = 0; i < ADAPTIVE_WINDOW_BLOCKS - 1; i++)
+        block_sizer_update(&sizer, 1LL << 30);
+    CHECK(sizer.size == ADAPTIVE_BLOCK_START);
+    sizer.window_start_ns = now_ns();
+    block_sizer_update(&sizer, 1LL << 30);
+    CHECK(sizer.size == ADAPTIVE_BLOCK_START);
+    block_sizer_start(&sizer, BUFFER_SIZE);
+
+    // 1.5 MB per 2 ms: one doubling per window up to 1 MB, then it holds
+    size_t expected[] = {128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024, 1024 * 1024, 1024 * 1024};
+    for (int i = 0; i < 6; i++)
+        CHECK(block_sizer_window(&sizer, 1536 * 1024) == expected[i]);
+    // 24 KB per 2 ms: one halving per window down to 32 KB
+    for (int i = 0; i < 8; i++)
+        block_sizer_window(&sizer, 24 * 1024);
+    CHECK(sizer.size == 32 * 1024);
+    CHECK(block_sizer_window(&sizer, 24 * 1024) == 32 * 1024);
+
+    // Clamped at both ends
+    for (int i = 0; i < 4; i++)
+        CHECK(block_sizer_window(&sizer, 100) == ADAPTIVE_BLOCK_MIN);
+    for (int i = 0; i < 12; i++)
+        block_sizer_window(&sizer, 1LL << 30);
+    CHECK(sizer.size == ADAPTIVE_BLOCK_MAX);
+    CHECK(block_sizer_window(&sizer, 1LL << 30) == ADAPTIVE_BLOCK_MAX);
+
+    // The next file picks up the size the last one settled on
+    block_sizer_window(&sizer, 1536 * 1024);
+    CHECK(block_sizer_finish(&sizer) == 2 * 1024 * 1024);
+    struct BlockSizer next;
+    block_sizer_start(&next, BUFFER_SIZE);
+    CHECK(next.size == 2 * 1024 * 1024);
+    CHECK(block_sizer_window(&next, 1536 * 1024) == 2 * 1024 * 1024);
+
+    // Fixed sizes are left alone
+    adaptive_buffers = 0;
+    transfer_buffer_size = 0;
+    atomic_store(&adaptive_block_hint, 0);
+    block_sizer_start(&next, BUFFER_SIZE);
+    block_sizer_window(&next, 1LL << 30);
+    CHECK(block_sizer_finish(&next) == BUFFER_SIZE && atomic_load(&adaptive_block_hint) == 0);
+}
@@ -0,0 +1,164 @@
+#!/bin/sh
+# Copies a folder with --cli in each copy mode and compares the result with the source
+# Usage: cli_roundtrip.sh PROGRAM [FEATURE...]
+# With FEATUREs (uring, zstd, lz4), only the cases of those optional parts of the build are run
+set -e
+program=$(realpath "$1")
+shift
+features="$*"
+work=$(mktemp -d /tmp/file_transfer_cli.XXXXXX)
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/src"
+: > "$work/src/empty"
+printf 'hello\n' > "$work/src/small.txt"
+head -c 300000 /dev/urandom > "$work/src/medium.bin"
+head -c 20000000 /dev/urandom > "$work/src/big.mp4"
+files="empty small.txt medium.bin big.mp4"
+failed=0
+
+# Function to copy every file into a fresh folder with the given options and compare
+run() {
+    rm -rf "$work/dst"
+    mkdir "$work/dst"
+    if ! "$program" --cli --from="$work/src" --to="$work/dst" "$@" $files > "$work/log" 2>&1; then
+        echo "FAIL: --cli $* exited with an error"
+        cat "$work/log"
+        failed=1
+        return
+    fi
+    for f in $files; do
+        if ! cmp -s "$work/src/$f" "$work/dst/$f"; then
+            echo "FAIL: --cli $*: $f differs"
+            failed=1
+        fi
+    done
+    echo "ok: --cli $*"
+}
+
+# Function to start a daemon on a loopback port that receives into $work/rdst
+start_daemon() {
+    rm -rf "$work/rdst"
+    mkdir "$work/rdst"
+    port=$((20000 + $$ % 30000))
+    "$program" --serve=127.0.0.1:$port --to="$work/rdst" > "$work/serve.log" 2>&1 &
+    daemon=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        grep -q "Receiving into" "$work/serve.log" && break
+        sleep 0.2
+    done
+}
+
+# Function to stop the daemon started by start_daemon
+stop_daemon() {
+    kill $daemon
+    wait $daemon 2>/dev/null || true
+}
+
+# Optional parts of the build, for programs built with their libraries
+if [ -n "$features" ]; then
+    for feature in $features; do
+        case $feature in
+        uring)
+            run --engine=uring
+            if grep -q "io_uring is not available" "$work/log"; then
+                echo "skipped: --engine=uring: the kernel refuses io_uring"
+            elif ! grep -q "Using the io_uring transfer engine" "$work/log"; then
+                echo "FAIL: --engine=uring fell back to the FIFO engine"
+                cat "$work/log"
+                failed=1
+            fi
+            ;;
+        zstd | lz4)
+            # Raw captures are always compressed on their way to the daemon
+            yes "frame 0123456789" | head -c 3000000 > "$work/src/capture.raw"
+            start_daemon
+            if ! "$program" --cli --from="$work/src" --remote=127.0.0.1:$port --compress=$feature \
+                    capture.raw medium.bin > "$work/log" 2>&1; then
+                echo "FAIL: --compress=$feature exited with an error"
+                cat "$work/log" "$work/serve.log"
+                failed=1
+            else
+                case_failed=0
+                for f in capture.raw medium.bin; do
+                    cmp -s "$work/src/$f" "$work/rdst/$f" || { echo "FAIL: --compress=$feature: $f differs"; case_failed=1; }
+                done
+                if ! grep -q "$feature [0-9.]*:1" "$work/log"; then
+                    echo "FAIL: --compress=$feature did not compress capture.raw"
+                    cat "$work/log"
+                    case_failed=1
+                fi
+                if [ $case_failed = 0 ]; then
+                    echo "ok: --remote --compress=$feature"
+                else
+                    failed=1
+                fi
+            fi
+            stop_daemon
+            rm "$work/src/capture.raw"
+            ;;
+        *)
+            echo "FAIL: unknown feature $feature"
+            failed=1
+            ;;
+        esac
+    done
+    exit $failed
+fi
+
+run
+run --copy-mode=buffered
+run --transport=shm
+run --verify
+run --cache-mode=stream
+run --cache-mode=direct
+if ! grep -q "copy mode splice/buffered" "$work/log"; then
+    echo "FAIL: --cache-mode=direct does not report its receiver's buffered loop"
+    failed=1
+fi
+run --large-file-threshold=8 --chunk-size=4
+
+# A second copy of the same files gets numbered names
+"$program" --cli --from="$work/src" --to="$work/dst" small.txt > "$work/log" 2>&1
+if cmp -s "$work/src/small.txt" "$work/dst/small(1).txt"; then
+    echo "ok: duplicate name numbered"
+else
+    echo "FAIL: duplicate name not numbered"
+    failed=1
+fi
+
+# A folder sync copies everything once, then nothing
+rm -rf "$work/dst"
+mkdir "$work/dst"
+"$program" --cli --from="$work/src" --to="$work/dst" --sync > "$work/log" 2>&1
+"$program" --cli --from="$work/src" --to="$work/dst" --sync > "$work/log2" 2>&1
+for f in $files; do
+    cmp -s "$work/src/$f" "$work/dst/$f" || { echo "FAIL: --sync: $f differs"; failed=1; }
+done
+if ! grep -q " 0 new, 0 changed" "$work/log2"; then
+    echo "FAIL: second --sync copied files again"
+    cat "$work/log2"
+    failed=1
+else
+    echo "ok: --sync"
+fi
+
+# Over loopback to a daemon: one whole file and one sent in chunks
+start_daemon
+if ! "$program" --cli --from="$work/src" --remote=127.0.0.1:$port --large-file-threshold=8 --chunk-size=4 \
+        small.txt big.mp4 > "$work/log" 2>&1; then
+    echo "FAIL: --remote exited with an error"
+    cat "$work/log" "$work/serve.log"
+    failed=1
+else
+    for f in small.txt big.mp4; do
+        cmp -s "$work/src/$f" "$work/rdst/$f" || { echo "FAIL: --remote: $f differs"; failed=1; }
+    done
+    if ls -A "$work/rdst" | grep -q '^\.'; then
+        echo "FAIL: --remote left partial files behind"
+        failed=1
+    fi
+    echo "ok: --remote"
+fi
+stop_daemon
+
+exit $failed
@@ -0,0 +1,54 @@
+// Unit tests of the --dedup hash and content index, included by unit_tests.c
+
+// Test: XXH64 matches the reference implementation, and the content index finds
+// files by size, hash and contents, tells when no file has the size, and keeps
+// destination hashes across a save and load
+void test_content_index()
+{
+    CHECK(xxh64((const unsigned char *)"", 0, 0) == 0xEF46DB3751D8E999ULL);
+    CHECK(xxh64((const unsigned char *)"abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+    unsigned char data[1000];
+    for (int i = 0; i < 1000; i++)
+        data[i] = (unsigned char)(i * 7 + 3);
+    CHECK(xxh64(data, sizeof(data), 0) == 0x5F235FA033F1A3FBULL);
+
+    const char *dir = make_test_dir("content");
+    write_test_file(dir, "one.bin", data, sizeof(data));
+    write_test_file(dir, "two.bin", data + 1, sizeof(data) - 1);
+    char source_path[MAX_PATH_LENGTH];
+    char match[MAX_FILENAME_LENGTH];
+    snprintf(source_path, sizeof(source_path), "%s/one.bin", dir);
+    CHECK(content_find_match(dir, source_path, sizeof(data), xxh64(data, sizeof(data), 0), match) == 0);
+    CHECK(strcmp(match, "one.bin") == 0);
+    CHECK(content_find_match(dir, source_path, sizeof(data), 12345, match) == -1);
+    CHECK(content_size_known(dir, sizeof(data) - 1) == 1);
+    CHECK(content_size_known(dir, 77) == 0); // Nothing to hash the source for
+
+    // Equal hashes are confirmed byte for byte
+    char other_path[MAX_PATH_LENGTH];
+    data[500] ^= 1;
+    write_test_file(dir, "three.bin", data, sizeof(data));
+    data[500] ^= 1;
+    snprintf(other_path, sizeof(other_path), "%s/three.bin", dir);
+    CHECK(files_identical(source_path, source_path, sizeof(data)) == 1);
+    CHECK(files_identical(source_path, other_path, sizeof(data)) == 0);
+    CHECK(files_identical(source_path, other_path, sizeof(data) - 1) == 0);
+
+    // Only destination folders get an index file
+    const char *source_dir = make_test_dir("content_source");
+    uint64_t hash;
+    write_test_file(source_dir, "one.bin", data, sizeof(data));
+    CHECK(content_hash(source_dir, 0, "one.bin", sizeof(data), 0, &hash) == 0 && hash == xxh64(data, sizeof(data), 0));
+    content_index_save_all();
+    char index_path[MAX_PATH_LENGTH];
+    snprintf(index_path, sizeof(index_path), "%s/%s", source_dir, CONTENT_INDEX_NAME);
+    CHECK(access(index_path, F_OK) == -1);
+    snprintf(index_path, sizeof(index_path), "%s/%s", dir, CONTENT_INDEX_NAME);
+    CHECK(access(index_path, F_OK) == 0);
+
+    struct ContentIndex loaded = {0};
+    snprintf(loaded.dir, sizeof(loaded.dir), "%s", dir);
+    content_index_load(&loaded);
+    struct ContentEntry *entry = content_index_find_locked(&loaded, "one.bin");
+    CHECK(entry && entry->hashed && entry->size == sizeof(data) && entry->hash == xxh64(data, sizeof(data), 0));
+}
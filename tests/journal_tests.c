@@ -0,0 +1,45 @@
+// Unit tests of the checkpoint journal, included by unit_tests.c
+
+// Test: checkpoints survive a save and load, and finishing chunks out of order
+// only extends the committed prefix over chunks that are all done
+void test_journal()
+{
+    const char *dir = make_test_dir("journal");
+    write_test_file(dir, ".clip.part", "", 0);
+    char part_path[MAX_PATH_LENGTH];
+    snprintf(part_path, sizeof(part_path), "%s/.clip.part", dir);
+    int fd = open(part_path, O_WRONLY);
+
+    pthread_mutex_lock(&journal_lock);
+    struct TransferJournal *journal = journal_for_locked(dir);
+    struct JournalEntry *entry = calloc(1, sizeof(struct JournalEntry));
+    strcpy(entry->filename, "clip with spaces.mp4");
+    entry->source_size = 10 * 4096 + 5;
+    entry->source_mtime_ns = 1234567890123LL;
+    entry->journal = journal;
+    entry->next = journal->entries;
+    journal->entries = entry;
+    pthread_mutex_unlock(&journal_lock);
+
+    journal_prepare_chunks(entry, entry->source_size, 4096);
+    journal_chunk_done(entry, fd, 0, 4096);
+    journal_chunk_done(entry, fd, 2 * 4096, 4096);
+    journal_chunk_done(entry, fd, 10 * 4096, 5);
+    CHECK(entry->committed == 4096);
+    CHECK(journal_chunk_is_done(entry, 2 * 4096, 4096) && !journal_chunk_is_done(entry, 4096, 4096));
+    journal_chunk_done(entry, fd, 4096, 4096);
+    CHECK(entry->committed == 3 * 4096);
+    close(fd);
+
+    struct TransferJournal loaded = {0};
+    snprintf(loaded.dest_dir, sizeof(loaded.dest_dir), "%s", dir);
+    journal_load(&loaded);
+    struct JournalEntry *copy = loaded.entries;
+    CHECK(copy != NULL && copy->next == NULL);
+    if (copy == NULL)
+        return;
+    CHECK(strcmp(copy->filename, "clip with spaces.mp4") == 0);
+    CHECK(copy->committed == 3 * 4096 && copy->source_size == 10 * 4096 + 5);
+    CHECK(copy->source_mtime_ns == 1234567890123LL && copy->chunk_size == 4096);
+    CHECK(copy->done_chunks && copy->done_chunks[0] == 0x07 && copy->done_chunks[1] == 0x04);
+}
@@ -0,0 +1,52 @@
+// Unit tests of the destination name allocator, included by unit_tests.c
+
+// Test: duplicate names get the next free "name(N).ext", including past numbered
+// copies and files that appear behind the allocator's back, and freed names are
+// reused once a new batch has the folder rescanned
+void test_name_allocator()
+{
+    int base_length, stem_length;
+    CHECK(name_copy_number("clip(12).mp4", &base_length, &stem_length) == 12 && base_length == 8 && stem_length == 4);
+    CHECK(name_copy_number("clip(0).mp4", &base_length, &stem_length) == 0);
+    CHECK(name_copy_number("clip(1)x.mp4", &base_length, &stem_length) == 0);
+    CHECK(name_copy_number("clip", &base_length, &stem_length) == 0 && base_length == 4);
+
+    const char *dir = make_test_dir("names");
+    write_test_file(dir, "a.mp4", "a", 1);
+    write_test_file(dir, "a(1).mp4", "a", 1);
+    write_test_file(dir, "b", "b", 1);
+    const char *names[] = {"a.mp4", "b", "c.mp4", "c.mp4", "d.mp4"};
+    const char *expected[] = {"a(2).mp4", "b(1)", "c.mp4", "c(1).mp4", "d(1).mp4"};
+    for (int i = 0; i < 5; i++)
+    {
+        if (i == 4)
+            write_test_file(dir, "d.mp4", "d", 1); // Created by someone else
+        char temp_path[MAX_PATH_LENGTH], final_path[MAX_PATH_LENGTH], expected_path[MAX_PATH_LENGTH];
+        snprintf(temp_path, sizeof(temp_path), "%s/.part%d", dir, i);
+        write_test_file(dir, strrchr(temp_path, '/') + 1, "x", 1);
+        snprintf(expected_path, sizeof(expected_path), "%s/%s", dir, expected[i]);
+        CHECK(place_destination_file(dir, names[i], temp_path, final_path) == 0);
+        CHECK(strcmp(final_path, expected_path) == 0);
+        CHECK(test_file_equals(expected_path, "x", 1));
+    }
+
+    // Names removed by others are only handed out again after the next rescan
+    char path[MAX_PATH_LENGTH], temp_path[MAX_PATH_LENGTH], final_path[MAX_PATH_LENGTH];
+    const char *removed[] = {"c.mp4", "c(1).mp4", "c(2).mp4"};
+    snprintf(temp_path, sizeof(temp_path), "%s/.part5", dir);
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, removed[i]);
+        unlink(path);
+    }
+    write_test_file(dir, ".part5", "x", 1);
+    CHECK(place_destination_file(dir, "c.mp4", temp_path, final_path) == 0 && strstr(final_path, "/c(2).mp4"));
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, removed[i]);
+        unlink(path);
+    }
+    name_allocators_invalidate();
+    write_test_file(dir, ".part5", "x", 1);
+    CHECK(place_destination_file(dir, "c.mp4", temp_path, final_path) == 0 && strstr(final_path, "/c.mp4"));
+}
@@ -0,0 +1,89 @@
+// Unit tests of the transfer pool's priority classes and bandwidth caps, included by unit_tests.c
+
+// Thread of test_token_bucket(): writes ten seconds' worth at the total cap
+void *throttle_test_thread(void *arg)
+{
+    transfer_throttle(arg, 10 * atomic_load(&total_rate_limit));
+    return NULL;
+}
+
+// Test: a token bucket lets an idle transfer burst, then spaces grants at its rate,
+// and a cap change takes effect at once
+void test_token_bucket()
+{
+    struct TokenBucket bucket = {.lock = PTHREAD_MUTEX_INITIALIZER};
+    long long rate = 1024 * 1024;
+    // 64 KB after a long idle time fits in the burst allowance
+    CHECK(token_bucket_reserve(&bucket, rate, 64 * 1024) <= 0);
+    // Four more seconds' worth must wait close to four seconds, less the unused burst
+    long long wait = token_bucket_reserve(&bucket, rate, 4 * rate);
+    CHECK(wait > 3800000000LL && wait <= 4000000000LL);
+    // And the next grant queues behind it
+    CHECK(token_bucket_reserve(&bucket, rate, rate / 2) > wait);
+
+    // A cap change drops the backlog granted under the old cap and ends the wait
+    // of a throttled receiver, which is counted as cap time
+    rate_limit_set(&total_rate_limit, rate);
+    CHECK(token_bucket_reserve(&bucket, rate, 64 * 1024) <= 0);
+    struct TransferProgress progress = {0};
+    pthread_t thread;
+    long long start = now_ns();
+    pthread_create(&thread, NULL, throttle_test_thread, &progress);
+    usleep(100000);
+    rate_limit_set(&total_rate_limit, 0);
+    pthread_join(thread, NULL);
+    CHECK(now_ns() - start < 2000000000LL);
+    CHECK(atomic_load(&progress.wait_cap_ns) > 50000000LL && atomic_load(&progress.wait_pipe_ns) == 0);
+}
+
+// Function to queue a file job named name in the given priority class
+void submit_test_job(struct TransferJob *job, const char *name, int priority)
+{
+    job->type = JOB_TYPE_FILE;
+    job->priority = priority;
+    snprintf(job->file.filename, sizeof(job->file.filename), "%s", name);
+    transfer_pool_submit(job);
+}
+
+// Function to take count jobs off the pool and append their names to order
+void take_test_jobs(char *order, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        struct TransferJob *job = transfer_pool_next_job();
+        strcat(order, order[0] ? " " : "");
+        strcat(order, job ? job->file.filename : "none");
+    }
+}
+
+// Test: urgent jobs are served first, then small files before bulk ones, except
+// that a waiting bulk job gets its turn after PRIORITY_MAX_BYPASS small ones
+void test_priority_order()
+{
+    struct TransferJob *jobs = calloc(26, sizeof(struct TransferJob));
+    char name[16];
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(name, sizeof(name), "b%d", i);
+        submit_test_job(&jobs[i], name, PRIORITY_BULK);
+    }
+    for (int i = 0; i < 20; i++)
+    {
+        snprintf(name, sizeof(name), "s%d", i);
+        submit_test_job(&jobs[3 + i], name, PRIORITY_SMALL);
+    }
+    submit_test_job(&jobs[23], "u0", PRIORITY_URGENT);
+    submit_test_job(&jobs[24], "u1", PRIORITY_URGENT);
+
+    char order[256] = "";
+    take_test_jobs(order, 5);
+    // An urgent job queued meanwhile goes next and does not count as a small one
+    submit_test_job(&jobs[25], "u2", PRIORITY_URGENT);
+    take_test_jobs(order, 21);
+    CHECK(PRIORITY_MAX_BYPASS == 8);
+    CHECK(strcmp(order, "u0 u1 s0 s1 s2 u2 s3 s4 s5 s6 s7 b0 s8 s9 s10 s11 s12 s13 s14 s15 b1 s16 s17 s18 s19 b2") == 0);
+    pthread_mutex_lock(&transfer_pool.lock);
+    CHECK(transfer_pool_pick_locked() == -1);
+    pthread_mutex_unlock(&transfer_pool.lock);
+    free(jobs);
+}
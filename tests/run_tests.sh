@@ -0,0 +1,35 @@
+#!/bin/sh
+# Builds code.c against the GTK stub, then runs the unit tests and the --cli round trip,
+# also with the optional libraries that are installed
+set -e
+cd "$(dirname "$0")"
+mkdir -p build
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2 -g -Wall}
+$CC $CFLAGS -Istub -o build/file_transfer ../code.c stub/gtk_stub.c -lpthread
+$CC $CFLAGS -Istub -o build/unit_tests unit_tests.c stub/gtk_stub.c -lpthread
+./build/unit_tests
+sh ./cli_roundtrip.sh ./build/file_transfer
+
+# The io_uring engine, when liburing is installed
+if pkg-config --exists liburing; then
+    $CC $CFLAGS -Istub -DHAVE_LIBURING -o build/file_transfer_uring ../code.c stub/gtk_stub.c -lpthread \
+        $(pkg-config --cflags --libs liburing)
+    sh ./cli_roundtrip.sh ./build/file_transfer_uring uring
+fi
+
+# The compression codecs, when libzstd or liblz4 is installed
+codecs=""
+codec_flags=""
+if pkg-config --exists libzstd; then
+    codecs="zstd"
+    codec_flags="-DHAVE_ZSTD $(pkg-config --cflags --libs libzstd)"
+fi
+if pkg-config --exists liblz4; then
+    codecs="$codecs lz4"
+    codec_flags="$codec_flags -DHAVE_LZ4 $(pkg-config --cflags --libs liblz4)"
+fi
+if [ -n "$codecs" ]; then
+    $CC $CFLAGS -Istub -o build/file_transfer_codecs ../code.c stub/gtk_stub.c -lpthread $codec_flags
+    sh ./cli_roundtrip.sh ./build/file_transfer_codecs $codecs
+fi
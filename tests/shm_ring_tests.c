@@ -0,0 +1,67 @@
+// Unit tests of the shared memory ring transport, included by unit_tests.c
+
+struct RingTestProducer
+{
+    struct ShmRing *ring;
+    const unsigned char *data;
+    size_t length;
+};
+
+// Producer thread of test_shm_ring(): writes the data in uneven pieces, then closes the stream
+void *ring_test_producer(void *arg)
+{
+    struct RingTestProducer *producer = arg;
+    size_t done = 0, piece = 1;
+    while (done < producer->length)
+    {
+        size_t space = shm_ring_wait_space(producer->ring);
+        if (space == 0)
+            break;
+        size_t count = producer->length - done;
+        if (count > space)
+            count = space;
+        if (count > piece)
+            count = piece;
+        size_t index = atomic_load(&producer->ring->write_pos) & (producer->ring->capacity - 1);
+        memcpy(producer->ring->data + index, producer->data + done, count);
+        shm_ring_produce(producer->ring, count);
+        done += count;
+        piece = piece * 3 % 40000 + 1;
+    }
+    shm_ring_close(producer->ring, RING_EOF);
+    return NULL;
+}
+
+// Test: the shared memory ring delivers every byte in order across its wrap-around,
+// with the producer sleeping on a full ring and the consumer on an empty one
+void test_shm_ring()
+{
+    size_t length = 3 * 1024 * 1024 + 123;
+    unsigned char *data = malloc(length);
+    unsigned char *received = malloc(length);
+    fill_pattern(data, length, 2);
+    struct ShmRing *ring = shm_ring_create(64 * 1024);
+    CHECK(ring != NULL);
+    if (ring == NULL)
+        return;
+
+    struct RingTestProducer producer = {ring, data, length};
+    pthread_t thread;
+    pthread_create(&thread, NULL, ring_test_producer, &producer);
+    size_t total = 0;
+    size_t available;
+    while ((available = shm_ring_wait_data(ring)) > 0 && total + available <= length)
+    {
+        size_t index = atomic_load(&ring->read_pos) & (ring->capacity - 1);
+        memcpy(received + total, ring->data + index, available);
+        shm_ring_consume(ring, available);
+        total += available;
+    }
+    pthread_join(thread, NULL);
+    CHECK(total == length);
+    CHECK(memcmp(data, received, length) == 0);
+    CHECK(atomic_load(&ring->state) == RING_EOF);
+    shm_ring_destroy(ring);
+    free(data);
+    free(received);
+}
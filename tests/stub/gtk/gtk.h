@@ -0,0 +1,119 @@
+// Minimal stand-in for <gtk/gtk.h> so that the tests can build code.c without GTK
+// or a display. It declares only what code.c uses; gtk_stub.c defines them as no-ops
+#pragma once
+#include <stddef.h>
+typedef int gint; typedef unsigned int guint; typedef int gboolean; typedef void *gpointer; typedef char gchar;
+typedef double gdouble; typedef unsigned long gulong; typedef long long gint64; typedef const void *gconstpointer;
+#define TRUE 1
+#define FALSE 0
+typedef struct _GtkWidget GtkWidget; typedef struct _GdkEvent GdkEvent; typedef struct _GObject GObject;
+typedef struct _GList { void *data; struct _GList *next, *prev; } GList;
+typedef struct _GtkCssProvider GtkCssProvider; typedef struct _GtkStyleContext GtkStyleContext; typedef struct _GtkTextBuffer GtkTextBuffer;
+typedef struct _GtkWindow GtkWindow; typedef struct _GtkGrid GtkGrid; typedef struct _GtkContainer GtkContainer; typedef struct _GtkBox GtkBox;
+typedef struct _GtkLabel GtkLabel; typedef struct _GtkToggleButton GtkToggleButton; typedef struct _GtkDialog GtkDialog;
+typedef struct _GtkTextView GtkTextView; typedef struct _GtkScrolledWindow GtkScrolledWindow; typedef struct _GtkStyleProvider GtkStyleProvider;
+typedef struct _GtkProgressBar GtkProgressBar; typedef struct _GtkSpinButton GtkSpinButton; typedef struct _GtkAdjustment GtkAdjustment;
+typedef struct _GtkTreeView GtkTreeView; typedef struct _GtkListStore GtkListStore; typedef struct _GtkTreeModel GtkTreeModel;
+typedef struct { int stamp; void *u1, *u2, *u3; } GtkTreeIter; typedef struct _GtkTreePath GtkTreePath;
+typedef struct _GtkCellRenderer GtkCellRenderer; typedef struct _GtkCellRendererToggle GtkCellRendererToggle; typedef struct _GtkTreeViewColumn GtkTreeViewColumn;
+typedef struct _GtkEntry GtkEntry; typedef struct _GtkComboBoxText GtkComboBoxText; typedef struct _GtkComboBox GtkComboBox;
+typedef struct _GAsyncQueue GAsyncQueue; typedef struct _GError GError; typedef struct _GtkMessageDialog GtkMessageDialog;
+typedef struct _GHashTable GHashTable; typedef struct _GString GString;
+typedef gboolean (*GSourceFunc)(gpointer);
+typedef void (*GCallback)(void);
+typedef void (*GDestroyNotify)(gpointer);
+#define G_CALLBACK(f) ((GCallback)(f))
+#define G_OBJECT(x) ((GObject*)(x))
+#define GTK_WIDGET(x) ((GtkWidget*)(x))
+#define GTK_WINDOW(x) ((GtkWindow*)(x))
+#define GTK_GRID(x) ((GtkGrid*)(x))
+#define GTK_CONTAINER(x) ((GtkContainer*)(x))
+#define GTK_BOX(x) ((GtkBox*)(x))
+#define GTK_LABEL(x) ((GtkLabel*)(x))
+#define GTK_TOGGLE_BUTTON(x) ((GtkToggleButton*)(x))
+#define GTK_DIALOG(x) ((GtkDialog*)(x))
+#define GTK_TEXT_VIEW(x) ((GtkTextView*)(x))
+#define GTK_SCROLLED_WINDOW(x) ((GtkScrolledWindow*)(x))
+#define GTK_STYLE_PROVIDER(x) ((GtkStyleProvider*)(x))
+#define GTK_PROGRESS_BAR(x) ((GtkProgressBar*)(x))
+#define GTK_SPIN_BUTTON(x) ((GtkSpinButton*)(x))
+#define GTK_TREE_VIEW(x) ((GtkTreeView*)(x))
+#define GTK_TREE_MODEL(x) ((GtkTreeModel*)(x))
+#define GTK_LIST_STORE(x) ((GtkListStore*)(x))
+#define GTK_CELL_RENDERER_TOGGLE(x) ((GtkCellRendererToggle*)(x))
+#define GTK_MESSAGE_DIALOG(x) ((GtkMessageDialog*)(x))
+#define GTK_COMBO_BOX(x) ((GtkComboBox*)(x))
+#define GTK_COMBO_BOX_TEXT(x) ((GtkComboBoxText*)(x))
+#define G_SOURCE_REMOVE 0
+#define G_SOURCE_CONTINUE 1
+#define G_PRIORITY_DEFAULT_IDLE 200
+#define G_TYPE_BOOLEAN 20
+#define G_TYPE_STRING 64
+#define G_TYPE_INT 24
+#define G_TYPE_INT64 40
+#define G_TYPE_DOUBLE 60
+#define G_TYPE_POINTER 68
+#define GTK_STYLE_PROVIDER_PRIORITY_APPLICATION 600
+typedef enum { GTK_WINDOW_TOPLEVEL } GtkWindowType;
+typedef enum { GTK_ORIENTATION_HORIZONTAL, GTK_ORIENTATION_VERTICAL } GtkOrientation;
+typedef enum { GTK_DIALOG_DESTROY_WITH_PARENT = 2 } GtkDialogFlags;
+typedef enum { GTK_MESSAGE_INFO, GTK_MESSAGE_WARNING, GTK_MESSAGE_QUESTION, GTK_MESSAGE_ERROR } GtkMessageType;
+typedef enum { GTK_BUTTONS_NONE, GTK_BUTTONS_OK } GtkButtonsType;
+typedef enum { GTK_POLICY_ALWAYS, GTK_POLICY_AUTOMATIC } GtkPolicyType;
+typedef enum { GTK_WRAP_NONE, GTK_WRAP_WORD_CHAR = 3 } GtkWrapMode;
+void gtk_init(int *, char ***); gboolean gtk_init_check(int *, char ***); void gtk_main(void); void gtk_main_quit(void);
+GtkWidget *gtk_window_new(GtkWindowType); void gtk_window_set_title(GtkWindow *, const char *); void gtk_window_set_default_size(GtkWindow *, int, int);
+gulong g_signal_connect(gpointer, const char *, GCallback, gpointer);
+gulong g_signal_connect_swapped(gpointer, const char *, GCallback, gpointer);
+GtkWidget *gtk_grid_new(void); void gtk_grid_set_column_homogeneous(GtkGrid *, gboolean); void gtk_grid_set_row_homogeneous(GtkGrid *, gboolean);
+void gtk_grid_attach(GtkGrid *, GtkWidget *, int, int, int, int); void gtk_container_add(GtkContainer *, GtkWidget *);
+GList *gtk_container_get_children(GtkContainer *); void g_list_free(GList *);
+#define g_list_next(l) ((l) ? ((GList*)(l))->next : NULL)
+GtkWidget *gtk_label_new(const char *); void gtk_label_set_markup(GtkLabel *, const char *); void gtk_label_set_text(GtkLabel *, const char *);
+GtkWidget *gtk_button_new_with_label(const char *); void gtk_widget_set_name(GtkWidget *, const char *); const char *gtk_widget_get_name(GtkWidget *);
+GtkCssProvider *gtk_css_provider_new(void); gboolean gtk_css_provider_load_from_data(GtkCssProvider *, const char *, long, GError **);
+GtkStyleContext *gtk_widget_get_style_context(GtkWidget *); void gtk_style_context_add_provider(GtkStyleContext *, GtkStyleProvider *, guint);
+void gtk_widget_show_all(GtkWidget *); void gtk_widget_destroy(GtkWidget *);
+void *g_object_get_data(GObject *, const char *); void g_object_set_data(GObject *, const char *, gpointer);
+gpointer g_object_ref(gpointer); void g_object_unref(gpointer);
+gboolean gtk_toggle_button_get_active(GtkToggleButton *); void gtk_toggle_button_set_active(GtkToggleButton *, gboolean);
+GtkWidget *gtk_check_button_new_with_label(const char *); GtkWidget *gtk_box_new(GtkOrientation, int);
+void gtk_box_pack_start(GtkBox *, GtkWidget *, gboolean, gboolean, guint);
+GtkWidget *gtk_message_dialog_new(GtkWindow *, GtkDialogFlags, GtkMessageType, GtkButtonsType, const char *, ...);
+int gtk_dialog_run(GtkDialog *);
+GtkWidget *gtk_scrolled_window_new(void *, void *); void gtk_scrolled_window_set_policy(GtkScrolledWindow *, GtkPolicyType, GtkPolicyType);
+GtkWidget *gtk_text_view_new(void); void gtk_text_view_set_wrap_mode(GtkTextView *, GtkWrapMode); GtkTextBuffer *gtk_text_view_get_buffer(GtkTextView *);
+void gtk_text_buffer_set_text(GtkTextBuffer *, const char *, int);
+guint g_idle_add(GSourceFunc, gpointer); guint g_timeout_add(guint, GSourceFunc, gpointer); gboolean g_source_remove(guint);
+GtkWidget *gtk_progress_bar_new(void); void gtk_progress_bar_set_fraction(GtkProgressBar *, double); void gtk_progress_bar_set_text(GtkProgressBar *, const char *);
+void gtk_progress_bar_set_show_text(GtkProgressBar *, gboolean);
+gboolean gtk_widget_get_realized(GtkWidget *);
+void g_free(gpointer); gchar *g_strdup(const char *); gchar *g_strdup_printf(const char *, ...);
+void gtk_window_set_transient_for(GtkWindow *, GtkWindow *); void gtk_widget_show(GtkWidget *);
+GtkWidget *gtk_spin_button_new_with_range(double, double, double); double gtk_spin_button_get_value(GtkSpinButton *); void gtk_spin_button_set_value(GtkSpinButton *, double);
+GtkListStore *gtk_list_store_new(int, ...); void gtk_list_store_append(GtkListStore *, GtkTreeIter *); void gtk_list_store_set(GtkListStore *, GtkTreeIter *, ...);
+void gtk_list_store_remove(GtkListStore *, GtkTreeIter *); void gtk_list_store_clear(GtkListStore *);
+void gtk_list_store_insert_with_values(GtkListStore *, GtkTreeIter *, int, ...);
+GtkWidget *gtk_tree_view_new_with_model(GtkTreeModel *); void gtk_tree_view_set_fixed_height_mode(GtkTreeView *, gboolean);
+GtkTreeViewColumn *gtk_tree_view_column_new_with_attributes(const char *, GtkCellRenderer *, ...);
+void gtk_tree_view_column_set_sizing(GtkTreeViewColumn *, int); void gtk_tree_view_column_set_fixed_width(GtkTreeViewColumn *, int); void gtk_tree_view_column_set_expand(GtkTreeViewColumn *, gboolean);
+#define GTK_TREE_VIEW_COLUMN_FIXED 2
+int gtk_tree_view_append_column(GtkTreeView *, GtkTreeViewColumn *);
+GtkCellRenderer *gtk_cell_renderer_text_new(void); GtkCellRenderer *gtk_cell_renderer_toggle_new(void); GtkCellRenderer *gtk_cell_renderer_progress_new(void);
+GtkTreePath *gtk_tree_path_new_from_string(const char *); void gtk_tree_path_free(GtkTreePath *);
+gboolean gtk_tree_model_get_iter(GtkTreeModel *, GtkTreeIter *, GtkTreePath *); void gtk_tree_model_get(GtkTreeModel *, GtkTreeIter *, ...);
+gboolean gtk_tree_model_get_iter_first(GtkTreeModel *, GtkTreeIter *); gboolean gtk_tree_model_iter_next(GtkTreeModel *, GtkTreeIter *);
+gboolean gtk_tree_model_iter_nth_child(GtkTreeModel *, GtkTreeIter *, GtkTreeIter *, int);
+void gtk_widget_set_vexpand(GtkWidget *, gboolean); void gtk_widget_set_hexpand(GtkWidget *, gboolean);
+typedef struct _GIOChannel GIOChannel; typedef enum { G_IO_IN = 1, G_IO_ERR = 8, G_IO_HUP = 16 } GIOCondition;
+typedef gboolean (*GIOFunc)(GIOChannel *, GIOCondition, gpointer);
+GIOChannel *g_io_channel_unix_new(int); guint g_io_add_watch(GIOChannel *, GIOCondition, GIOFunc, gpointer); void g_io_channel_unref(GIOChannel *);
+GtkWidget *gtk_combo_box_text_new(void); void gtk_combo_box_text_append_text(GtkComboBoxText *, const char *); void gtk_combo_box_set_active(GtkComboBox *, int);
+gchar *gtk_combo_box_text_get_active_text(GtkComboBoxText *);
+typedef struct _GtkTreeRowReference GtkTreeRowReference;
+GtkTreeRowReference *gtk_tree_row_reference_new(GtkTreeModel *, GtkTreePath *); GtkTreePath *gtk_tree_row_reference_get_path(GtkTreeRowReference *);
+void gtk_tree_row_reference_free(GtkTreeRowReference *); GtkTreePath *gtk_tree_model_get_path(GtkTreeModel *, GtkTreeIter *);
+gboolean gtk_tree_model_get_iter_from_string(GtkTreeModel *, GtkTreeIter *, const gchar *); int gtk_tree_model_iter_n_children(GtkTreeModel *, GtkTreeIter *);
+void g_object_unref(gpointer); gpointer g_object_ref(gpointer); void g_free(gpointer);
+gchar *g_format_size(unsigned long long);
+GtkTreeModel *gtk_tree_row_reference_get_model(GtkTreeRowReference *);
@@ -0,0 +1,103 @@
+// No-op definitions of the GTK functions declared in gtk/gtk.h. The headless modes
+// the tests run never call them; they only have to link
+__attribute__((weak)) long g_format_size() { return 0; }
+__attribute__((weak)) long g_free() { return 0; }
+__attribute__((weak)) long g_idle_add() { return 0; }
+__attribute__((weak)) long g_io_add_watch() { return 0; }
+__attribute__((weak)) long g_io_channel_unix_new() { return 0; }
+__attribute__((weak)) long g_io_channel_unref() { return 0; }
+__attribute__((weak)) long g_list_free() { return 0; }
+__attribute__((weak)) long g_object_get_data() { return 0; }
+__attribute__((weak)) long g_object_ref() { return 0; }
+__attribute__((weak)) long g_object_set_data() { return 0; }
+__attribute__((weak)) long g_object_unref() { return 0; }
+__attribute__((weak)) long g_signal_connect() { return 0; }
+__attribute__((weak)) long g_signal_connect_swapped() { return 0; }
+__attribute__((weak)) long g_source_remove() { return 0; }
+__attribute__((weak)) long g_strdup() { return 0; }
+__attribute__((weak)) long g_strdup_printf() { return 0; }
+__attribute__((weak)) long g_timeout_add() { return 0; }
+__attribute__((weak)) long gtk_box_new() { return 0; }
+__attribute__((weak)) long gtk_box_pack_start() { return 0; }
+__attribute__((weak)) long gtk_button_new_with_label() { return 0; }
+__attribute__((weak)) long gtk_cell_renderer_progress_new() { return 0; }
+__attribute__((weak)) long gtk_cell_renderer_text_new() { return 0; }
+__attribute__((weak)) long gtk_cell_renderer_toggle_new() { return 0; }
+__attribute__((weak)) long gtk_check_button_new_with_label() { return 0; }
+__attribute__((weak)) long gtk_combo_box_set_active() { return 0; }
+__attribute__((weak)) long gtk_combo_box_text_append_text() { return 0; }
+__attribute__((weak)) long gtk_combo_box_text_get_active_text() { return 0; }
+__attribute__((weak)) long gtk_combo_box_text_new() { return 0; }
+__attribute__((weak)) long gtk_container_add() { return 0; }
+__attribute__((weak)) long gtk_container_get_children() { return 0; }
+__attribute__((weak)) long gtk_css_provider_load_from_data() { return 0; }
+__attribute__((weak)) long gtk_css_provider_new() { return 0; }
+__attribute__((weak)) long gtk_dialog_run() { return 0; }
+__attribute__((weak)) long gtk_grid_attach() { return 0; }
+__attribute__((weak)) long gtk_grid_new() { return 0; }
+__attribute__((weak)) long gtk_grid_set_column_homogeneous() { return 0; }
+__attribute__((weak)) long gtk_grid_set_row_homogeneous() { return 0; }
+__attribute__((weak)) long gtk_init() { return 0; }
+__attribute__((weak)) long gtk_init_check() { return 0; }
+__attribute__((weak)) long gtk_label_new() { return 0; }
+__attribute__((weak)) long gtk_label_set_markup() { return 0; }
+__attribute__((weak)) long gtk_label_set_text() { return 0; }
+__attribute__((weak)) long gtk_list_store_append() { return 0; }
+__attribute__((weak)) long gtk_list_store_clear() { return 0; }
+__attribute__((weak)) long gtk_list_store_insert_with_values() { return 0; }
+__attribute__((weak)) long gtk_list_store_new() { return 0; }
+__attribute__((weak)) long gtk_list_store_remove() { return 0; }
+__attribute__((weak)) long gtk_list_store_set() { return 0; }
+__attribute__((weak)) long gtk_main() { return 0; }
+__attribute__((weak)) long gtk_main_quit() { return 0; }
+__attribute__((weak)) long gtk_message_dialog_new() { return 0; }
+__attribute__((weak)) long gtk_progress_bar_new() { return 0; }
+__attribute__((weak)) long gtk_progress_bar_set_fraction() { return 0; }
+__attribute__((weak)) long gtk_progress_bar_set_show_text() { return 0; }
+__attribute__((weak)) long gtk_progress_bar_set_text() { return 0; }
+__attribute__((weak)) long gtk_scrolled_window_new() { return 0; }
+__attribute__((weak)) long gtk_scrolled_window_set_policy() { return 0; }
+__attribute__((weak)) long gtk_spin_button_get_value() { return 0; }
+__attribute__((weak)) long gtk_spin_button_new_with_range() { return 0; }
+__attribute__((weak)) long gtk_spin_button_set_value() { return 0; }
+__attribute__((weak)) long gtk_style_context_add_provider() { return 0; }
+__attribute__((weak)) long gtk_text_buffer_set_text() { return 0; }
+__attribute__((weak)) long gtk_text_view_get_buffer() { return 0; }
+__attribute__((weak)) long gtk_text_view_new() { return 0; }
+__attribute__((weak)) long gtk_text_view_set_wrap_mode() { return 0; }
+__attribute__((weak)) long gtk_toggle_button_get_active() { return 0; }
+__attribute__((weak)) long gtk_toggle_button_set_active() { return 0; }
+__attribute__((weak)) long gtk_tree_model_get() { return 0; }
+__attribute__((weak)) long gtk_tree_model_get_iter() { return 0; }
+__attribute__((weak)) long gtk_tree_model_get_iter_first() { return 0; }
+__attribute__((weak)) long gtk_tree_model_get_iter_from_string() { return 0; }
+__attribute__((weak)) long gtk_tree_model_get_path() { return 0; }
+__attribute__((weak)) long gtk_tree_model_iter_n_children() { return 0; }
+__attribute__((weak)) long gtk_tree_model_iter_next() { return 0; }
+__attribute__((weak)) long gtk_tree_model_iter_nth_child() { return 0; }
+__attribute__((weak)) long gtk_tree_path_free() { return 0; }
+__attribute__((weak)) long gtk_tree_path_new_from_string() { return 0; }
+__attribute__((weak)) long gtk_tree_row_reference_free() { return 0; }
+__attribute__((weak)) long gtk_tree_row_reference_get_model() { return 0; }
+__attribute__((weak)) long gtk_tree_row_reference_get_path() { return 0; }
+__attribute__((weak)) long gtk_tree_row_reference_new() { return 0; }
+__attribute__((weak)) long gtk_tree_view_append_column() { return 0; }
+__attribute__((weak)) long gtk_tree_view_column_new_with_attributes() { return 0; }
+__attribute__((weak)) long gtk_tree_view_column_set_expand() { return 0; }
+__attribute__((weak)) long gtk_tree_view_column_set_fixed_width() { return 0; }
+__attribute__((weak)) long gtk_tree_view_column_set_sizing() { return 0; }
+__attribute__((weak)) long gtk_tree_view_new_with_model() { return 0; }
+__attribute__((weak)) long gtk_tree_view_set_fixed_height_mode() { return 0; }
+__attribute__((weak)) long gtk_widget_destroy() { return 0; }
+__attribute__((weak)) long gtk_widget_get_name() { return 0; }
+__attribute__((weak)) long gtk_widget_get_realized() { return 0; }
+__attribute__((weak)) long gtk_widget_get_style_context() { return 0; }
+__attribute__((weak)) long gtk_widget_set_hexpand() { return 0; }
+__attribute__((weak)) long gtk_widget_set_name() { return 0; }
+__attribute__((weak)) long gtk_widget_set_vexpand() { return 0; }
+__attribute__((weak)) long gtk_widget_show() { return 0; }
+__attribute__((weak)) long gtk_widget_show_all() { return 0; }
+__attribute__((weak)) long gtk_window_new() { return 0; }
+__attribute__((weak)) long gtk_window_set_default_size() { return 0; }
+__attribute__((weak)) long gtk_window_set_title() { return 0; }
+__attribute__((weak)) long gtk_window_set_transient_for() { return 0; }
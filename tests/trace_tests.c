@@ -0,0 +1,48 @@
+// Unit tests of the --trace event trace, included by unit_tests.c
+
+// Thread of test_trace(): records more events than its ring holds
+void *trace_test_thread(void *arg)
+{
+    trace_thread_name("trace test");
+    for (int i = 0; i < TRACE_RING_EVENTS + 10; i++)
+        trace_event(TRACE_IO, "unit write", now_ns(), i, NULL);
+    return NULL;
+}
+
+// Test: the trace keeps the last TRACE_RING_EVENTS events of each thread and dumps
+// them with their thread names and file names as Chrome trace JSON
+void test_trace()
+{
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/trace.json", test_dir);
+    CHECK(TRACE_START() == 0); // Off until enabled
+    trace_path = path;
+    trace_enable();
+    long long start = TRACE_START();
+    CHECK(start > 0);
+    TRACE_END(start, TRACE_IO, "unit read", 4096);
+    trace_stage_begin("unit stage", "file \"quoted\".mp4");
+    trace_stage_end();
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, trace_test_thread, NULL);
+    pthread_join(thread, NULL);
+    CHECK(trace_dump(path) == 2 + TRACE_RING_EVENTS);
+
+    FILE *file = fopen(path, "r");
+    char *contents = calloc(1, 8 * 1024 * 1024);
+    size_t length = file ? fread(contents, 1, 8 * 1024 * 1024 - 1, file) : 0;
+    if (file)
+        fclose(file);
+    const char *header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    CHECK(strncmp(contents, header, strlen(header)) == 0);
+    CHECK(length > 4 && strcmp(contents + length - 4, "\n]}\n") == 0);
+    CHECK(strstr(contents, "\"name\":\"unit read\",\"cat\":\"io\",\"ph\":\"X\"") != NULL);
+    CHECK(strstr(contents, "\"args\":{\"bytes\":4096}") != NULL);
+    CHECK(strstr(contents, "\"file\":\"file \\\"quoted\\\".mp4\"") != NULL);
+    CHECK(strstr(contents, "\"args\":{\"name\":\"trace test\"}") != NULL);
+    // The oldest ten events of the thread were overwritten
+    CHECK(strstr(contents, "\"args\":{\"bytes\":9}") == NULL && strstr(contents, "\"args\":{\"bytes\":10}") != NULL);
+    free(contents);
+    atomic_store(&trace_enabled, 0);
+}
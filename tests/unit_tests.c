@@ -0,0 +1,287 @@
+// Unit tests of the building blocks of code.c, built against the GTK stub in stub/
+// code.c is included whole so that the tests can reach its functions and globals;
+// its main() is renamed out of the way. Tests of single features live in *_tests.c
+// files included below
+#define main file_transfer_main
+#include "../code.c"
+#undef main
+
+int checks = 0;
+int failures = 0;
+char *test_dir; // Scratch folder, removed at the end
+
+#define CHECK(condition)                                                                  \
+    do                                                                                    \
+    {                                                                                     \
+        checks++;                                                                         \
+        if (!(condition))                                                                 \
+        {                                                                                 \
+            failures++;                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        }                                                                                 \
+    } while (0)
+
+// Function to create a folder under the scratch folder and return its path
+const char *make_test_dir(const char *name)
+{
+    static char paths[16][MAX_PATH_LENGTH];
+    static int used = 0;
+    char *path = paths[used++ % 16];
+    snprintf(path, MAX_PATH_LENGTH, "%s/%s", test_dir, name);
+    mkdir(path, 0755);
+    return path;
+}
+
+// Function to write length bytes of data to dir/filename
+void write_test_file(const char *dir, const char *filename, const void *data, size_t length)
+{
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", dir, filename);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd != -1 && write_full(fd, data, length) == 0);
+    if (fd != -1)
+        close(fd);
+}
+
+// Function to tell whether dir/filename holds exactly length bytes of data
+int test_file_equals(const char *path, const void *data, size_t length)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    unsigned char *contents = malloc(length + 1);
+    ssize_t got = read_full(fd, contents, length + 1);
+    close(fd);
+    int equal = got == (ssize_t)length && memcmp(contents, data, length) == 0;
+    free(contents);
+    return equal;
+}
+
+// Function to fill length bytes with a pattern that differs from block to block
+void fill_pattern(unsigned char *data, size_t length, unsigned int seed)
+{
+    for (size_t i = 0; i < length; i++)
+        data[i] = (unsigned char)((i * 7 + seed) ^ (i >> 11));
+}
+
+// Test: a path that does not fit is an error, so two long names cannot end up
+// sharing one truncated temporary file
+void test_format_path()
+{
+    char path[16];
+    CHECK(format_path(path, sizeof(path), "%s/.%s.part", "dir", "a") == 0 && strcmp(path, "dir/.a.part") == 0);
+    errno = 0;
+    CHECK(format_path(path, sizeof(path), "%s/.%s.part", "dir", "long-name") == -1 && errno == ENAMETOOLONG);
+    CHECK(format_path(path, sizeof(path), "%s", "exactly 15 char") == 0);
+    CHECK(format_path(path, sizeof(path), "%s", "exactly 16 chars") == -1);
+}
+
+// Test: copy_fd() splices a pipe into a file, and falls back to the buffered loop
+// when splice() refuses the destination (O_APPEND files), reporting which one it used
+void test_copy_fd()
+{
+    static unsigned char data[48000];
+    fill_pattern(data, sizeof(data), 1);
+    const char *dir = make_test_dir("copy_fd");
+    for (int append = 0; append <= 1; append++)
+    {
+        int pipe_fds[2];
+        CHECK(pipe(pipe_fds) == 0);
+        CHECK(write_full(pipe_fds[1], data, sizeof(data)) == 0);
+        close(pipe_fds[1]);
+
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/out%d", dir, append);
+        int out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | (append ? O_APPEND : 0), 0644);
+        struct BlockSizer sizer;
+        block_sizer_start(&sizer, BUFFER_SIZE);
+        const char *mode = NULL;
+        long long copied = copy_fd(pipe_fds[0], out_fd, NULL, NULL, NULL, &sizer, NULL, &mode);
+        close(pipe_fds[0]);
+        close(out_fd);
+        CHECK(copied == (long long)sizeof(data));
+        CHECK(mode && strcmp(mode, append ? "buffered" : "splice") == 0);
+        // Without --buffer-size each loop uses its own block size
+        CHECK(sizer.size == (append ? BUFFER_SIZE : SPLICE_CHUNK_SIZE));
+        CHECK(test_file_equals(path, data, sizeof(data)));
+    }
+}
+
+#include "shm_ring_tests.c"
+
+#include "pool_tests.c"
+
+#include "name_allocator_tests.c"
+
+#include "journal_tests.c"
+
+// Test: CRC32C gives the standard check value, and the fastest kernel the CPU has
+// agrees with the table version at every length and alignment around its block sizes
+void test_crc32c()
+{
+    CHECK(~crc32c_update(~0U, (const unsigned char *)"123456789", 9) == 0xE3069283U);
+    CHECK(~crc32c_software(~0U, (const unsigned char *)"123456789", 9) == 0xE3069283U);
+    size_t length = 3 * CRC32C_LONG_BLOCK * 2 + 4096;
+    unsigned char *data = malloc(length + 8);
+    fill_pattern(data, length + 8, 3);
+    int mismatches = 0;
+    for (size_t size = 0; size <= length; size += size < 2048 ? 1 : 509)
+    {
+        for (int offset = 0; offset < 8; offset += 3)
+            mismatches += crc32c_update(0x12345678, data + offset, size) != crc32c_software(0x12345678, data + offset, size);
+    }
+    CHECK(mismatches == 0);
+    free(data);
+}
+
+#include "content_index_tests.c"
+
+#include "block_sizer_tests.c"
+
+// Test: mtimes match exactly on a fine-grained filesystem, and within the
+// filesystem's granularity on a coarse one such as FAT
+void test_mtime_granularity()
+{
+    const char *dir = make_test_dir("mtime");
+    write_test_file(dir, "source", "x", 1);
+    write_test_file(dir, "dest", "x", 1);
+    char source_path[MAX_PATH_LENGTH], dest_path[MAX_PATH_LENGTH];
+    snprintf(source_path, sizeof(source_path), "%s/source", dir);
+    snprintf(dest_path, sizeof(dest_path), "%s/dest", dir);
+    struct timespec source_times[2] = {{1700000000, 500000000}, {1700000000, 500000000}};
+    struct timespec dest_times[2] = {{1700000001, 0}, {1700000001, 0}};
+    utimensat(AT_FDCWD, source_path, source_times, 0);
+    utimensat(AT_FDCWD, dest_path, dest_times, 0);
+    struct stat source, dest;
+    CHECK(stat(source_path, &source) == 0 && stat(dest_path, &dest) == 0);
+    CHECK(mtimes_match(&source, &source, dir));
+
+    // The scratch folder keeps nanoseconds, or at worst whole seconds
+    long long granularity = mtime_granularity(dir);
+    CHECK(granularity >= 1 && granularity <= 1000000000LL);
+    CHECK(mtimes_match(&source, &dest, dir) == (granularity > 500000000LL));
+
+    // Pretend it is FAT, which stores mtimes in 2 s steps
+    for (int i = 0; i < mtime_granularity_count; i++)
+    {
+        if (mtime_granularity_dev[i] == source.st_dev)
+            mtime_granularity_ns[i] = 2000000000LL;
+    }
+    CHECK(mtimes_match(&source, &dest, dir));
+    dest.st_mtim.tv_sec += 2;
+    CHECK(!mtimes_match(&source, &dest, dir));
+    for (int i = 0; i < mtime_granularity_count; i++)
+    {
+        if (mtime_granularity_dev[i] == source.st_dev)
+            mtime_granularity_ns[i] = granularity;
+    }
+}
+
+// Function to append a box of the given type around the length bytes at body
+// Returns the new end of data
+size_t put_test_box(unsigned char *data, size_t end, const char *type, const void *body, size_t length)
+{
+    store_be32(data + end, (uint32_t)(8 + length));
+    memcpy(data + end + 4, type, 4);
+    memmove(data + end + 8, body, length);
+    return end + 8 + length;
+}
+
+// Test: mp4_find_boxes() finds an index written after the media, as cameras do, and
+// mp4_patch_offsets() moves the chunk offsets into the media by the index's size
+void test_mp4_offsets()
+{
+    // The sample table: two 32-bit offsets and one 64-bit offset into the media,
+    // and one 32-bit offset before it that must stay put
+    unsigned char stco[8 + 3 * 4] = {0};
+    store_be32(stco + 4, 3);
+    store_be32(stco + 8, 24);
+    store_be32(stco + 12, 60);
+    store_be32(stco + 16, 5);
+    unsigned char co64[8 + 8] = {0};
+    store_be32(co64 + 4, 1);
+    store_be64(co64 + 8, 40);
+    unsigned char boxes[256], box[256];
+    size_t length = put_test_box(boxes, 0, "stco", stco, sizeof(stco));
+    length = put_test_box(boxes, length, "co64", co64, sizeof(co64));
+    const char *parents[] = {"stbl", "minf", "mdia", "trak"};
+    for (int i = 0; i < 4; i++)
+    {
+        length = put_test_box(box, 0, parents[i], boxes, length);
+        memcpy(boxes, box, length);
+    }
+
+    // ftyp, then 100 bytes of media, then the index
+    unsigned char file[512];
+    unsigned char media[100];
+    fill_pattern(media, sizeof(media), 9);
+    size_t end = put_test_box(file, 0, "ftyp", "isom\0\0\0\0", 8);
+    end = put_test_box(file, end, "mdat", media, sizeof(media));
+    end = put_test_box(file, end, "moov", boxes, length);
+    const char *dir = make_test_dir("mp4");
+    write_test_file(dir, "camera.mp4", file, end);
+
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/camera.mp4", dir);
+    int fd = open(path, O_RDONLY);
+    long long moov_offset, moov_size, mdat_offset;
+    int unit;
+    CHECK(fd != -1 && video_probe(fd, end, &unit) == VIDEO_FORMAT_MP4);
+    CHECK(mp4_find_boxes(fd, end, &moov_offset, &moov_size, &mdat_offset) == 0);
+    CHECK(mdat_offset == 16 && moov_offset == 16 + 108 && moov_size == (long long)length + 8);
+    CHECK(moov_offset + moov_size == (long long)end);
+
+    // Moved in front of the media, every offset into it grows by the index's size
+    unsigned char moov[256];
+    CHECK(pread(fd, moov, moov_size, moov_offset) == moov_size);
+    CHECK(mp4_patch_offsets(moov, moov_size, mdat_offset, moov_offset, moov_size) == 0);
+    unsigned char *patched = moov + 8 * 5; // moov, trak, mdia, minf and stbl headers
+    CHECK(memcmp(patched + 4, "stco", 4) == 0);
+    CHECK(load_be32(patched + 16) == 24 + moov_size && load_be32(patched + 20) == 60 + moov_size);
+    CHECK(load_be32(patched + 24) == 5);
+    CHECK(memcmp(patched + 28 + 4, "co64", 4) == 0 && load_be64(patched + 28 + 16) == (uint64_t)(40 + moov_size));
+
+    // A 32-bit offset that would overflow is refused, and so is a truncated file
+    store_be32(stco + 8, UINT32_MAX - 4);
+    length = put_test_box(box, 0, "stco", stco, sizeof(stco));
+    CHECK(mp4_patch_offsets(box, length, 0, UINT32_MAX, 16) == -1);
+    CHECK(mp4_find_boxes(fd, end - 1, &moov_offset, &moov_size, &mdat_offset) == -1);
+    if (fd != -1)
+        close(fd);
+}
+
+#include "trace_tests.c"
+
+int main()
+{
+    trace_signals_start();
+    crc32c_init();
+    char template[] = "/tmp/file_transfer_tests.XXXXXX";
+    test_dir = mkdtemp(template);
+    if (test_dir == NULL)
+    {
+        perror("Error creating scratch folder");
+        return EXIT_FAILURE;
+    }
+
+    test_format_path();
+    test_copy_fd();
+    test_shm_ring();
+    test_token_bucket();
+    test_priority_order();
+    test_name_allocator();
+    test_journal();
+    test_crc32c();
+    test_content_index();
+    test_block_sizer();
+    test_mtime_granularity();
+    test_mp4_offsets();
+    test_trace();
+
+    char command[MAX_PATH_LENGTH + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", test_dir);
+    if (system(command) != 0)
+        fprintf(stderr, "Could not remove %s\n", test_dir);
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}